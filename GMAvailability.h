@@ -10,6 +10,7 @@
 #define GM_OSXFUSE_3_0 030000
 #define GM_OSXFUSE_3_5 030500
 #define GM_OSXFUSE_3_8 030800
+#define GM_OSXFUSE_3_9 030900
 
 #ifdef GM_VERSION_MIN_REQUIRED
 
@@ -39,6 +40,12 @@
         #define GM_AVAILABILITY_INTERNAL__3_8
     #endif
 
+    #if GM_VERSION_MIN_REQUIRED < GM_OSXFUSE_3_9
+        #define GM_AVAILABILITY_INTERNAL__3_9 GM_AVAILABILITY_WEAK
+    #else
+        #define GM_AVAILABILITY_INTERNAL__3_9
+    #endif
+
     #define GM_AVAILABLE(_version) GM_AVAILABILITY_INTERNAL__##_version
 
 #else /* !GM_VERSION_MIN_REQUIRED */
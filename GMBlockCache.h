@@ -0,0 +1,94 @@
+//
+//  GMBlockCache.h
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+
+#include <pthread.h>
+
+@class GMMemoryBudget;
+
+// Caches fixed-size blocks of file contents keyed by path and block index. The
+// blocks are spread over several independently locked GMCache shards, so
+// concurrent reads, even of the same file, rarely contend for a lock. Each
+// shard evicts its least recently used blocks once its share of the byte
+// budget is exceeded.
+//
+// The indexes of the blocks cached for each file are remembered as well, so
+// the blocks of a file can be removed without looking at those of other files.
+// Blocks evicted by the shards are only forgotten there; the indexes of files
+// with no blocks left are dropped from time to time.
+//
+// All methods are thread-safe.
+@interface GMBlockCache : NSObject {
+ @private
+  NSArray* shards_;  // GMCache
+  pthread_mutex_t mutex_;               // Protects the fields below.
+  NSMutableDictionary* blockIndexes_;   // Path -> NSMutableIndexSet
+  NSUInteger pruneCount_;  // Prune blockIndexes_ once it has this many paths.
+}
+
+- (id)initWithShardCount:(NSUInteger)shardCount
+               costLimit:(NSUInteger)costLimit
+                 timeout:(NSTimeInterval)timeout;
+
+// Returns the block or nil if it is not cached. Counts as a hit or miss.
+- (NSData *)blockForPath:(NSString *)path index:(UInt64)index;
+
+- (void)setBlock:(NSData *)block forPath:(NSString *)path index:(UInt64)index;
+
+// Removes all blocks of the file at path and, if recursive is YES, of all files
+// below path.
+- (void)removeBlocksForPath:(NSString *)path recursive:(BOOL)recursive;
+
+- (void)removeAllBlocks;
+
+// Removes the least recently used blocks of each shard until their total size
+// is at least size. Returns the total size of the removed blocks.
+- (NSUInteger)purgeCost:(NSUInteger)cost;
+
+// Sets the budget that is notified when blocks are added. Called by
+// GMMemoryBudget; the budget is not retained.
+- (void)setMemoryBudget:(GMMemoryBudget *)budget;
+
+// Totals over all shards.
+- (NSUInteger)count;
+- (NSUInteger)totalCost;
+- (UInt64)hits;
+- (UInt64)misses;
+
+@end
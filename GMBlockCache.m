@@ -0,0 +1,240 @@
+//
+//  GMBlockCache.m
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import "GMBlockCache.h"
+
+#import "GMCache.h"
+
+// Number of files whose block indexes are kept before the first time those of
+// files with no cached blocks are dropped.
+static const NSUInteger kGMBlockCacheMinPruneCount = 1024;
+
+// Blocks are stored under "<path>/<index>".
+static NSString* GMBlockCacheKey(NSString* path, UInt64 index) {
+  return [NSString stringWithFormat:@"%@/%llu", path, index];
+}
+
+@implementation GMBlockCache
+
+- (id)init {
+  return [self initWithShardCount:1 costLimit:0 timeout:0];
+}
+
+- (id)initWithShardCount:(NSUInteger)shardCount
+               costLimit:(NSUInteger)costLimit
+                 timeout:(NSTimeInterval)timeout {
+  self = [super init];
+  if (self) {
+    if (shardCount == 0) {
+      shardCount = 1;
+    }
+    NSMutableArray* shards = [NSMutableArray arrayWithCapacity:shardCount];
+    for (NSUInteger i = 0; i < shardCount; ++i) {
+      GMCache* shard = [[GMCache alloc] initWithCountLimit:0
+                                                 costLimit:costLimit / shardCount
+                                                   timeout:timeout];
+      [shards addObject:shard];
+      [shard release];
+    }
+    shards_ = [shards copy];
+    pthread_mutex_init(&mutex_, NULL);
+    blockIndexes_ = [[NSMutableDictionary alloc] init];
+    pruneCount_ = kGMBlockCacheMinPruneCount;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [shards_ release];
+  [blockIndexes_ release];
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+// Consecutive blocks of a file land in different shards.
+- (GMCache *)shardForPath:(NSString *)path index:(UInt64)index {
+  NSUInteger hash = [path hash] + (NSUInteger)index;
+  return [shards_ objectAtIndex:hash % [shards_ count]];
+}
+
+- (NSData *)blockForPath:(NSString *)path index:(UInt64)index {
+  GMCache* shard = [self shardForPath:path index:index];
+  return [shard objectForKey:GMBlockCacheKey(path, index)];
+}
+
+// Drops the block indexes of files that have no cached blocks left. mutex_
+// must be held.
+- (void)pruneBlockIndexes {
+  NSArray* paths = [blockIndexes_ allKeys];
+  for (int i = 0, count = [paths count]; i < count; i++) {
+    NSString* path = [paths objectAtIndex:i];
+    NSMutableIndexSet* indexes = [blockIndexes_ objectForKey:path];
+    NSUInteger index = [indexes firstIndex];
+    while (index != NSNotFound) {
+      GMCache* shard = [self shardForPath:path index:index];
+      if (![shard containsObjectForKey:GMBlockCacheKey(path, index)]) {
+        [indexes removeIndex:index];
+      }
+      index = [indexes indexGreaterThanIndex:index];
+    }
+    if ([indexes count] == 0) {
+      [blockIndexes_ removeObjectForKey:path];
+    }
+  }
+  pruneCount_ = MAX(kGMBlockCacheMinPruneCount, 2 * [blockIndexes_ count]);
+}
+
+- (void)setBlock:(NSData *)block forPath:(NSString *)path index:(UInt64)index {
+  GMCache* shard = [self shardForPath:path index:index];
+  [shard setObject:block forKey:GMBlockCacheKey(path, index) cost:[block length]];
+
+  // Indexed after the block has been added, so that the block is not missed
+  // by removeBlocksForPath:recursive: in the meantime.
+  pthread_mutex_lock(&mutex_);
+  NSMutableIndexSet* indexes = [blockIndexes_ objectForKey:path];
+  if (!indexes) {
+    indexes = [[NSMutableIndexSet alloc] init];
+    [blockIndexes_ setObject:indexes forKey:path];
+    [indexes release];
+  }
+  [indexes addIndex:(NSUInteger)index];
+  if ([blockIndexes_ count] >= pruneCount_) {
+    [self pruneBlockIndexes];
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)removeBlocksForPath:(NSString *)path recursive:(BOOL)recursive {
+  if (recursive && [path isEqualToString:@"/"]) {
+    [self removeAllBlocks];
+    return;
+  }
+
+  NSMutableDictionary* removed = [NSMutableDictionary dictionary];
+  pthread_mutex_lock(&mutex_);
+  NSIndexSet* indexes = [blockIndexes_ objectForKey:path];
+  if (indexes) {
+    [removed setObject:indexes forKey:path];
+    [blockIndexes_ removeObjectForKey:path];
+  }
+  if (recursive && [blockIndexes_ count] > 0) {
+    NSString* prefix = [path stringByAppendingString:@"/"];
+    NSArray* paths = [blockIndexes_ allKeys];
+    for (int i = 0, count = [paths count]; i < count; i++) {
+      NSString* descendantPath = [paths objectAtIndex:i];
+      if ([descendantPath hasPrefix:prefix]) {
+        [removed setObject:[blockIndexes_ objectForKey:descendantPath]
+                    forKey:descendantPath];
+        [blockIndexes_ removeObjectForKey:descendantPath];
+      }
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  NSArray* paths = [removed allKeys];
+  for (int i = 0, count = [paths count]; i < count; i++) {
+    NSString* removedPath = [paths objectAtIndex:i];
+    NSIndexSet* removedIndexes = [removed objectForKey:removedPath];
+    NSUInteger index = [removedIndexes firstIndex];
+    while (index != NSNotFound) {
+      GMCache* shard = [self shardForPath:removedPath index:index];
+      [shard removeObjectForKey:GMBlockCacheKey(removedPath, index)];
+      index = [removedIndexes indexGreaterThanIndex:index];
+    }
+  }
+}
+
+- (void)removeAllBlocks {
+  pthread_mutex_lock(&mutex_);
+  [blockIndexes_ removeAllObjects];
+  pruneCount_ = kGMBlockCacheMinPruneCount;
+  pthread_mutex_unlock(&mutex_);
+  for (int i = 0, count = [shards_ count]; i < count; i++) {
+    [[shards_ objectAtIndex:i] removeAllObjects];
+  }
+}
+
+- (NSUInteger)purgeCost:(NSUInteger)cost {
+  NSUInteger count = [shards_ count];
+  NSUInteger shardCost = (cost + count - 1) / count;
+  NSUInteger purged = 0;
+  for (NSUInteger i = 0; i < count; ++i) {
+    purged += [[shards_ objectAtIndex:i] purgeCost:shardCost];
+  }
+  return purged;
+}
+
+- (void)setMemoryBudget:(GMMemoryBudget *)budget {
+  for (int i = 0, count = [shards_ count]; i < count; i++) {
+    [[shards_ objectAtIndex:i] setMemoryBudget:budget];
+  }
+}
+
+- (NSUInteger)count {
+  NSUInteger count = 0;
+  for (int i = 0, shardCount = [shards_ count]; i < shardCount; i++) {
+    count += [[shards_ objectAtIndex:i] count];
+  }
+  return count;
+}
+
+- (NSUInteger)totalCost {
+  NSUInteger totalCost = 0;
+  for (int i = 0, count = [shards_ count]; i < count; i++) {
+    totalCost += [[shards_ objectAtIndex:i] totalCost];
+  }
+  return totalCost;
+}
+
+- (UInt64)hits {
+  UInt64 hits = 0;
+  for (int i = 0, count = [shards_ count]; i < count; i++) {
+    hits += [[shards_ objectAtIndex:i] hits];
+  }
+  return hits;
+}
+
+- (UInt64)misses {
+  UInt64 misses = 0;
+  for (int i = 0, count = [shards_ count]; i < count; i++) {
+    misses += [[shards_ objectAtIndex:i] misses];
+  }
+  return misses;
+}
+
+@end
@@ -0,0 +1,114 @@
+//
+//  GMCache.h
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+
+#include <pthread.h>
+
+@class GMCacheEntry;
+@class GMMemoryBudget;
+
+// A thread-safe key-value cache used by GMUserFileSystem to memoize the results
+// of delegate calls. Entries expire after the timeout given at initialization
+// and the least recently used entries are evicted once the count or cost limit
+// is exceeded. A limit or timeout of zero means "unlimited".
+@interface GMCache : NSObject {
+ @private
+  pthread_mutex_t mutex_;
+  NSMutableDictionary* entries_;  // Key -> GMCacheEntry
+  GMCacheEntry* head_;            // Most recently used entry; not retained.
+  GMCacheEntry* tail_;            // Least recently used entry; not retained.
+  NSUInteger countLimit_;
+  NSUInteger costLimit_;
+  NSUInteger totalCost_;
+  NSTimeInterval timeout_;
+  UInt64 hits_;
+  UInt64 misses_;
+  GMMemoryBudget* budget_;        // Not retained; may be nil.
+}
+
+- (id)initWithCountLimit:(NSUInteger)countLimit
+               costLimit:(NSUInteger)costLimit
+                 timeout:(NSTimeInterval)timeout;
+
+// Returns the object for key or nil if there is no such object or if it has
+// expired. Every call counts as either a hit or a miss.
+- (id)objectForKey:(id)key;
+
+// Returns YES if there is an unexpired object for key. Unlike objectForKey:,
+// this neither counts as a hit or miss nor marks the object as recently used.
+- (BOOL)containsObjectForKey:(id)key;
+
+// Returns the object for key or nil like objectForKey:, but neither counts as
+// a hit or miss nor marks the object as recently used.
+- (id)peekObjectForKey:(id)key;
+
+- (void)setObject:(id)object forKey:(id)key cost:(NSUInteger)cost;
+
+// Replaces the object for key with object if the current, unexpired object for
+// key is identical to expectedObject. The entry keeps its expiration and LRU
+// position. Returns NO if there is no such entry, e.g. because it has been
+// replaced or removed concurrently.
+- (BOOL)replaceObject:(id)expectedObject
+           withObject:(id)object
+               forKey:(id)key
+                 cost:(NSUInteger)cost;
+
+- (void)removeObjectForKey:(id)key;
+
+// Removes the object for path as well as the objects for all paths below it.
+// Only valid for caches that use path strings as keys.
+- (void)removeObjectsForPathAndDescendants:(NSString *)path;
+
+- (void)removeAllObjects;
+
+// Removes the least recently used objects until their total cost is at least
+// cost, or the cache is empty. Returns the total cost of the removed objects.
+- (NSUInteger)purgeCost:(NSUInteger)cost;
+
+// Sets the budget that is notified when objects are added. Called by
+// GMMemoryBudget; the budget is not retained.
+- (void)setMemoryBudget:(GMMemoryBudget *)budget;
+
+- (NSTimeInterval)timeout;
+- (NSUInteger)count;
+- (NSUInteger)totalCost;
+- (UInt64)hits;
+- (UInt64)misses;
+
+@end
@@ -0,0 +1,346 @@
+//
+//  GMCache.m
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import "GMCache.h"
+
+#import "GMMemoryBudget.h"
+
+static NSTimeInterval GMCacheCurrentTime(void) {
+  return [NSDate timeIntervalSinceReferenceDate];
+}
+
+@interface GMCacheEntry : NSObject {
+ @public
+  id key_;                     // Retained
+  id object_;                  // Retained
+  NSUInteger cost_;
+  NSTimeInterval expiration_;  // Zero means the entry does not expire.
+  GMCacheEntry* prev_;         // Not retained
+  GMCacheEntry* next_;         // Not retained
+}
+- (id)initWithKey:(id)key
+           object:(id)object
+             cost:(NSUInteger)cost
+       expiration:(NSTimeInterval)expiration;
+@end
+
+@implementation GMCacheEntry
+
+- (id)initWithKey:(id)key
+           object:(id)object
+             cost:(NSUInteger)cost
+       expiration:(NSTimeInterval)expiration {
+  self = [super init];
+  if (self) {
+    key_ = [key copy];
+    object_ = [object retain];
+    cost_ = cost;
+    expiration_ = expiration;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [key_ release];
+  [object_ release];
+  [super dealloc];
+}
+
+@end
+
+@implementation GMCache
+
+- (id)init {
+  return [self initWithCountLimit:0 costLimit:0 timeout:0];
+}
+
+- (id)initWithCountLimit:(NSUInteger)countLimit
+               costLimit:(NSUInteger)costLimit
+                 timeout:(NSTimeInterval)timeout {
+  self = [super init];
+  if (self) {
+    pthread_mutex_init(&mutex_, NULL);
+    entries_ = [[NSMutableDictionary alloc] init];
+    countLimit_ = countLimit;
+    costLimit_ = costLimit;
+    timeout_ = timeout;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [entries_ release];
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+#pragma mark Internal (mutex_ must be held)
+
+- (void)unlinkEntry:(GMCacheEntry *)entry {
+  if (entry->prev_) {
+    entry->prev_->next_ = entry->next_;
+  } else {
+    head_ = entry->next_;
+  }
+  if (entry->next_) {
+    entry->next_->prev_ = entry->prev_;
+  } else {
+    tail_ = entry->prev_;
+  }
+  entry->prev_ = nil;
+  entry->next_ = nil;
+}
+
+- (void)linkEntryAtHead:(GMCacheEntry *)entry {
+  entry->prev_ = nil;
+  entry->next_ = head_;
+  if (head_) {
+    head_->prev_ = entry;
+  }
+  head_ = entry;
+  if (!tail_) {
+    tail_ = entry;
+  }
+}
+
+- (void)removeEntry:(GMCacheEntry *)entry {
+  [entry retain];
+  [self unlinkEntry:entry];
+  totalCost_ -= entry->cost_;
+  [entries_ removeObjectForKey:entry->key_];
+  [entry release];
+}
+
+- (void)evictEntriesIfNeeded {
+  while (tail_ &&
+         ((countLimit_ > 0 && [entries_ count] > countLimit_) ||
+          (costLimit_ > 0 && totalCost_ > costLimit_))) {
+    [self removeEntry:tail_];
+  }
+}
+
+#pragma mark Public
+
+- (id)objectForKey:(id)key {
+  id object = nil;
+  pthread_mutex_lock(&mutex_);
+  GMCacheEntry* entry = [entries_ objectForKey:key];
+  if (entry) {
+    if (entry->expiration_ != 0 && entry->expiration_ <= GMCacheCurrentTime()) {
+      [self removeEntry:entry];
+    } else {
+      object = [[entry->object_ retain] autorelease];
+      if (entry != head_) {
+        [self unlinkEntry:entry];
+        [self linkEntryAtHead:entry];
+      }
+    }
+  }
+  if (object) {
+    ++hits_;
+  } else {
+    ++misses_;
+  }
+  pthread_mutex_unlock(&mutex_);
+  return object;
+}
+
+- (BOOL)containsObjectForKey:(id)key {
+  pthread_mutex_lock(&mutex_);
+  GMCacheEntry* entry = [entries_ objectForKey:key];
+  BOOL contains = entry != nil &&
+    (entry->expiration_ == 0 || entry->expiration_ > GMCacheCurrentTime());
+  pthread_mutex_unlock(&mutex_);
+  return contains;
+}
+
+- (id)peekObjectForKey:(id)key {
+  id object = nil;
+  pthread_mutex_lock(&mutex_);
+  GMCacheEntry* entry = [entries_ objectForKey:key];
+  if (entry &&
+      (entry->expiration_ == 0 || entry->expiration_ > GMCacheCurrentTime())) {
+    object = [[entry->object_ retain] autorelease];
+  }
+  pthread_mutex_unlock(&mutex_);
+  return object;
+}
+
+- (void)setObject:(id)object forKey:(id)key cost:(NSUInteger)cost {
+  if (object == nil || key == nil) {
+    return;
+  }
+  NSTimeInterval expiration = 0;
+  if (timeout_ > 0) {
+    expiration = GMCacheCurrentTime() + timeout_;
+  }
+  GMCacheEntry* entry = [[GMCacheEntry alloc] initWithKey:key
+                                                   object:object
+                                                     cost:cost
+                                               expiration:expiration];
+  pthread_mutex_lock(&mutex_);
+  GMCacheEntry* existing = [entries_ objectForKey:key];
+  if (existing) {
+    [self removeEntry:existing];
+  }
+  [entries_ setObject:entry forKey:entry->key_];
+  [self linkEntryAtHead:entry];
+  totalCost_ += cost;
+  [self evictEntriesIfNeeded];
+  pthread_mutex_unlock(&mutex_);
+  [entry release];
+  [budget_ noteGrowth:cost];
+}
+
+- (BOOL)replaceObject:(id)expectedObject
+           withObject:(id)object
+               forKey:(id)key
+                 cost:(NSUInteger)cost {
+  if (object == nil || key == nil) {
+    return NO;
+  }
+  BOOL replaced = NO;
+  pthread_mutex_lock(&mutex_);
+  GMCacheEntry* entry = [entries_ objectForKey:key];
+  if (entry && entry->object_ == expectedObject &&
+      (entry->expiration_ == 0 || entry->expiration_ > GMCacheCurrentTime())) {
+    [entry->object_ autorelease];
+    entry->object_ = [object retain];
+    totalCost_ = totalCost_ - entry->cost_ + cost;
+    entry->cost_ = cost;
+    [self evictEntriesIfNeeded];
+    replaced = YES;
+  }
+  pthread_mutex_unlock(&mutex_);
+  if (replaced) {
+    [budget_ noteGrowth:cost];
+  }
+  return replaced;
+}
+
+- (void)removeObjectForKey:(id)key {
+  if (key == nil) {
+    return;
+  }
+  pthread_mutex_lock(&mutex_);
+  GMCacheEntry* entry = [entries_ objectForKey:key];
+  if (entry) {
+    [self removeEntry:entry];
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)removeObjectsForPathAndDescendants:(NSString *)path {
+  if (path == nil) {
+    return;
+  }
+  if ([path isEqualToString:@"/"]) {
+    [self removeAllObjects];
+    return;
+  }
+  NSString* prefix = [path stringByAppendingString:@"/"];
+  pthread_mutex_lock(&mutex_);
+  GMCacheEntry* entry = head_;
+  while (entry) {
+    GMCacheEntry* next = entry->next_;
+    NSString* key = entry->key_;
+    if ([key isEqualToString:path] || [key hasPrefix:prefix]) {
+      [self removeEntry:entry];
+    }
+    entry = next;
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)removeAllObjects {
+  pthread_mutex_lock(&mutex_);
+  [entries_ removeAllObjects];
+  head_ = nil;
+  tail_ = nil;
+  totalCost_ = 0;
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (NSUInteger)purgeCost:(NSUInteger)cost {
+  NSUInteger purged = 0;
+  pthread_mutex_lock(&mutex_);
+  while (tail_ && purged < cost) {
+    purged += tail_->cost_;
+    [self removeEntry:tail_];
+  }
+  pthread_mutex_unlock(&mutex_);
+  return purged;
+}
+
+- (void)setMemoryBudget:(GMMemoryBudget *)budget {
+  budget_ = budget;
+}
+
+- (NSTimeInterval)timeout {
+  return timeout_;
+}
+
+- (NSUInteger)count {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger count = [entries_ count];
+  pthread_mutex_unlock(&mutex_);
+  return count;
+}
+
+- (NSUInteger)totalCost {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger totalCost = totalCost_;
+  pthread_mutex_unlock(&mutex_);
+  return totalCost;
+}
+
+- (UInt64)hits {
+  pthread_mutex_lock(&mutex_);
+  UInt64 hits = hits_;
+  pthread_mutex_unlock(&mutex_);
+  return hits;
+}
+
+- (UInt64)misses {
+  pthread_mutex_lock(&mutex_);
+  UInt64 misses = misses_;
+  pthread_mutex_unlock(&mutex_);
+  return misses;
+}
+
+@end
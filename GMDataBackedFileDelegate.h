@@ -37,6 +37,8 @@
 
 #define GM_EXPORT __attribute__((visibility("default")))
 
+@class GMPageStore;
+
 GM_EXPORT @interface GMDataBackedFileDelegate : NSObject {
  @private
   NSData* data_;
@@ -52,14 +54,36 @@ GM_EXPORT @interface GMDataBackedFileDelegate : NSObject {
                size:(size_t)size 
              offset:(off_t)offset 
               error:(NSError **)error;
+
+// Returns up to size bytes starting at offset. The returned data references the
+// backing data without copying it where possible.
+- (NSData *)readDataWithSize:(size_t)size
+                      offset:(off_t)offset
+                       error:(NSError **)error;
 @end
 
-GM_EXPORT @interface GMMutableDataBackedFileDelegate : GMDataBackedFileDelegate
+// A file delegate created with init or fileDelegate keeps its contents in
+// sparse pages: writes far past the end do not allocate the bytes in between,
+// which read as zeros, and growing the file never copies existing contents.
+// If a memory limit is set, or the pages no longer fit into the memory budget
+// of the mount, the contents of a paged file delegate move to an unlinked
+// temporary file. One created with a mutable data object writes into that
+// object instead and is never moved to disk.
+GM_EXPORT @interface GMMutableDataBackedFileDelegate : GMDataBackedFileDelegate {
+ @private
+  GMPageStore* pageStore_;  // Used instead of the data if not nil.
+}
 
++ (GMMutableDataBackedFileDelegate *)fileDelegate;
 + (GMMutableDataBackedFileDelegate *)fileDelegateWithData:(NSMutableData *)data;
 
+- (id)init;
 - (id)initWithMutableData:(NSMutableData *)data;
 
+// Returns the contents. For a paged file delegate this is a copy, which
+// requires as much memory as the whole file.
+- (NSData *)data;
+
 - (int)writeFromBuffer:(const char *)buffer 
                   size:(size_t)size 
                 offset:(off_t)offset
@@ -68,6 +92,62 @@ GM_EXPORT @interface GMMutableDataBackedFileDelegate : GMDataBackedFileDelegate
 - (BOOL)truncateToOffset:(off_t)offset 
                    error:(NSError **)error;
 
+// Sets the maximum number of bytes of memory a paged file delegate may use
+// before its contents move to disk. Zero means "unlimited".
+- (void)setMemoryLimit:(NSUInteger)limit;
+- (NSUInteger)memoryLimit;
+
+// Returns the number of bytes written to disk after exceeding the memory limit.
+- (UInt64)spilledSize;
+
+// Memory is only allocated on write, so there is nothing to reserve.
+- (BOOL)preallocateWithOptions:(int)options
+                        offset:(off_t)offset
+                        length:(off_t)length
+                         error:(NSError **)error;
+
+@end
+
+// A file delegate whose contents are those of an open file descriptor, e.g. a
+// file on a local file system that the mounted file system mirrors. The
+// framework reads from and writes to the file descriptor directly, without
+// calling the delegate. The delegate is still told when the file is released.
+GM_EXPORT @interface GMFileDescriptorBackedFileDelegate : NSObject {
+ @private
+  int fd_;
+  BOOL closeOnDealloc_;
+}
+
++ (GMFileDescriptorBackedFileDelegate *)fileDelegateWithFileDescriptor:(int)fd
+                                                        closeOnDealloc:(BOOL)closeOnDealloc;
+
+// If closeOnDealloc is YES, the file descriptor is closed when the file
+// delegate is deallocated, i.e. after the file has been released.
+- (id)initWithFileDescriptor:(int)fd closeOnDealloc:(BOOL)closeOnDealloc;
+
+- (int)fileDescriptor;
+
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error;
+
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error;
+
+- (BOOL)truncateToOffset:(off_t)offset
+                   error:(NSError **)error;
+
+- (BOOL)preallocateWithOptions:(int)options
+                        offset:(off_t)offset
+                        length:(off_t)length
+                         error:(NSError **)error;
+
+// Flushes the contents of the file descriptor to its storage device.
+- (BOOL)synchronizeWithError:(NSError **)error;
+
 @end
 
 #undef GM_EXPORT
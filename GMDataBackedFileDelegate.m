@@ -34,6 +34,54 @@
 //  POSSIBILITY OF SUCH DAMAGE.
 
 #import "GMDataBackedFileDelegate.h"
+#import "GMDataBackedFileDelegate_Private.h"
+
+#import "GMPageStore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/vnode.h>
+
+static NSError* GMFileDelegateError(int code) {
+  return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+}
+
+// A range of the bytes of an immutable data object that keeps the data object
+// alive for as long as it is.
+@interface GMDataSlice : NSData {
+ @private
+  NSData* data_;  // Retained
+  NSRange range_;
+}
+- (id)initWithData:(NSData *)data range:(NSRange)range;
+@end
+
+@implementation GMDataSlice
+
+- (id)initWithData:(NSData *)data range:(NSRange)range {
+  self = [super init];
+  if (self) {
+    data_ = [data retain];
+    range_ = range;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [data_ release];
+  [super dealloc];
+}
+
+- (NSUInteger)length {
+  return range_.length;
+}
+
+- (const void *)bytes {
+  return (const char *)[data_ bytes] + range_.location;
+}
+
+@end
 
 @implementation GMDataBackedFileDelegate
 
@@ -74,23 +122,82 @@
   return size;
 }
 
+- (NSData *)readDataWithSize:(size_t)size
+                      offset:(off_t)offset
+                       error:(NSError **)error {
+  size_t len = [data_ length];
+  if (offset >= len) {
+    return [NSData data];  // No data to read.
+  }
+  if (offset + size > len) {
+    size = len - offset;
+  }
+  NSRange range = NSMakeRange(offset, size);
+  if ([data_ isKindOfClass:[NSMutableData class]]) {
+    // The bytes of mutable data may be reallocated at any time.
+    return [data_ subdataWithRange:range];
+  }
+  return [[[GMDataSlice alloc] initWithData:data_ range:range] autorelease];
+}
+
 @end
 
 @implementation GMMutableDataBackedFileDelegate
 
++ (GMMutableDataBackedFileDelegate *)fileDelegate {
+  return [[[self alloc] init] autorelease];
+}
+
 + (GMMutableDataBackedFileDelegate *)fileDelegateWithData:(NSMutableData *)data {
   return [[[self alloc] initWithMutableData:data] autorelease];
 }
 
+- (id)init {
+  self = [super initWithData:nil];
+  if (self) {
+    pageStore_ = [[GMPageStore alloc] init];
+  }
+  return self;
+}
+
 - (id)initWithMutableData:(NSMutableData *)data {
   self = [super initWithData:data];
   return self;
 }
 
+- (void)dealloc {
+  [pageStore_ release];
+  [super dealloc];
+}
+
+- (NSData *)data {
+  if (pageStore_) {
+    return [pageStore_ data];
+  }
+  return [super data];
+}
+
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error {
+  if (pageStore_) {
+    return [pageStore_ readToBuffer:buffer size:size offset:offset error:error];
+  }
+  return [super readToBuffer:buffer size:size offset:offset error:error];
+}
+
 - (int)writeFromBuffer:(const char *)buffer 
                   size:(size_t)size 
                 offset:(off_t)offset
                  error:(NSError **)error {
+  if (pageStore_) {
+    if (![pageStore_ writeFromBuffer:buffer size:size offset:offset error:error]) {
+      return -1;
+    }
+    return size;
+  }
+
   // Take the lazy way out.  We just extend the NSData to be as large as needed
   // and then replace whatever bytes they want to write.
   NSMutableData* data = (NSMutableData*)[self data];
@@ -103,11 +210,169 @@
   return size;
 }
 
+- (NSData *)readDataWithSize:(size_t)size
+                      offset:(off_t)offset
+                       error:(NSError **)error {
+  if (pageStore_) {
+    NSMutableData* data = [NSMutableData dataWithLength:size];
+    ssize_t length = [pageStore_ readToBuffer:[data mutableBytes]
+                                         size:size
+                                       offset:offset
+                                        error:error];
+    if (length < 0) {
+      return nil;
+    }
+    [data setLength:length];
+    return data;
+  }
+
+  // Writes may reallocate the bytes of the mutable data at any time, so a
+  // slice that references them is not safe to hand out.
+  NSData* data = [super data];
+  size_t len = [data length];
+  if (offset >= len) {
+    return [NSData data];  // No data to read.
+  }
+  if (offset + size > len) {
+    size = len - offset;
+  }
+  return [data subdataWithRange:NSMakeRange(offset, size)];
+}
+
 - (BOOL)truncateToOffset:(off_t)offset 
                    error:(NSError **)error {
+  if (pageStore_) {
+    return [pageStore_ truncateToLength:offset error:error];
+  }
   NSMutableData* data = (NSMutableData*)[self data];
   [data setLength:offset];
   return YES;
 }
 
-@end
\ No newline at end of file
+- (void)setMemoryLimit:(NSUInteger)limit {
+  [pageStore_ setMemoryLimit:limit];
+}
+
+- (NSUInteger)memoryLimit {
+  return [pageStore_ memoryLimit];
+}
+
+- (UInt64)spilledSize {
+  return [pageStore_ spilledSize];
+}
+
+- (void)setPageStoreBudget:(GMPageStoreBudget *)budget {
+  [pageStore_ setBudget:budget];
+}
+
+- (BOOL)preallocateWithOptions:(int)options
+                        offset:(off_t)offset
+                        length:(off_t)length
+                         error:(NSError **)error {
+  return YES;
+}
+
+@end
+
+@implementation GMFileDescriptorBackedFileDelegate
+
++ (GMFileDescriptorBackedFileDelegate *)fileDelegateWithFileDescriptor:(int)fd
+                                                        closeOnDealloc:(BOOL)closeOnDealloc {
+  return [[[self alloc] initWithFileDescriptor:fd
+                                closeOnDealloc:closeOnDealloc] autorelease];
+}
+
+- (id)initWithFileDescriptor:(int)fd closeOnDealloc:(BOOL)closeOnDealloc {
+  self = [super init];
+  if (self) {
+    fd_ = fd;
+    closeOnDealloc_ = closeOnDealloc;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  if (closeOnDealloc_ && fd_ >= 0) {
+    close(fd_);
+  }
+  [super dealloc];
+}
+
+- (int)fileDescriptor {
+  return fd_;
+}
+
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error {
+  ssize_t ret = pread(fd_, buffer, size, offset);
+  if (ret < 0) {
+    *error = GMFileDelegateError(errno);
+    return -1;
+  }
+  return (int)ret;
+}
+
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error {
+  ssize_t ret = pwrite(fd_, buffer, size, offset);
+  if (ret < 0) {
+    *error = GMFileDelegateError(errno);
+    return -1;
+  }
+  return (int)ret;
+}
+
+- (BOOL)truncateToOffset:(off_t)offset
+                   error:(NSError **)error {
+  if (ftruncate(fd_, offset) < 0) {
+    *error = GMFileDelegateError(errno);
+    return NO;
+  }
+  return YES;
+}
+
+- (BOOL)preallocateWithOptions:(int)options
+                        offset:(off_t)offset
+                        length:(off_t)length
+                         error:(NSError **)error {
+#ifdef F_PREALLOCATE
+  fstore_t fstore;
+  fstore.fst_flags = 0;
+  if (options & ALLOCATECONTIG) {
+    fstore.fst_flags |= F_ALLOCATECONTIG;
+  }
+  if (options & ALLOCATEALL) {
+    fstore.fst_flags |= F_ALLOCATEALL;
+  }
+  fstore.fst_posmode = (options & ALLOCATEFROMVOL) ? F_VOLPOSMODE : F_PEOFPOSMODE;
+  fstore.fst_offset = offset;
+  fstore.fst_length = length;
+  fstore.fst_bytesalloc = 0;
+  if (fcntl(fd_, F_PREALLOCATE, &fstore) < 0) {
+    *error = GMFileDelegateError(errno);
+    return NO;
+  }
+  return YES;
+#else
+  int ret = posix_fallocate(fd_, offset, length);
+  if (ret != 0) {
+    *error = GMFileDelegateError(ret);
+    return NO;
+  }
+  return YES;
+#endif
+}
+
+- (BOOL)synchronizeWithError:(NSError **)error {
+  if (fsync(fd_) < 0) {
+    *error = GMFileDelegateError(errno);
+    return NO;
+  }
+  return YES;
+}
+
+@end
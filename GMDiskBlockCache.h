@@ -0,0 +1,98 @@
+//
+//  GMDiskBlockCache.h
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+
+#include <pthread.h>
+
+@class GMDiskBlockCacheEntry;
+
+// Caches blocks of file contents in files below a directory, so the blocks
+// survive remounts. Blocks are keyed by path, version and block index. A block
+// is only returned for the version it has been stored for, so blocks do not go
+// stale as long as the version changes whenever the contents do. Each block
+// file holds the key and a checksum of the block, and a block whose file does
+// not match either is dropped instead of being returned. The least recently
+// used blocks are removed once the blocks exceed the size limit.
+//
+// The index of the cached blocks is kept in memory and written to the
+// directory by synchronize. The index is removed from the directory while the
+// cache is in use, so if synchronize is not called before the process exits,
+// the blocks are discarded the next time the directory is used.
+//
+// All methods are thread-safe.
+@interface GMDiskBlockCache : NSObject {
+ @private
+  pthread_mutex_t mutex_;
+  NSString* directory_;
+  UInt64 sizeLimit_;
+  UInt64 totalSize_;
+  NSMutableDictionary* entries_;  // Key hash -> GMDiskBlockCacheEntry
+  GMDiskBlockCacheEntry* head_;   // Most recently used entry; not retained.
+  GMDiskBlockCacheEntry* tail_;   // Least recently used entry; not retained.
+  UInt64 hits_;
+  UInt64 misses_;
+}
+
+// Uses the blocks cached in directory by a previous instance, if its index has
+// been written. The directory is created if it does not exist. A size limit of
+// zero means "unlimited".
+- (id)initWithDirectory:(NSString *)directory sizeLimit:(UInt64)sizeLimit;
+
+// Returns the block or nil if it is not cached. Counts as a hit or miss.
+- (NSData *)blockForPath:(NSString *)path
+                 version:(NSString *)version
+                   index:(UInt64)index;
+
+- (void)setBlock:(NSData *)block
+         forPath:(NSString *)path
+         version:(NSString *)version
+           index:(UInt64)index;
+
+- (void)removeAllBlocks;
+
+// Writes the index to the directory. Returns NO if writing the index failed.
+- (BOOL)synchronize;
+
+- (NSString *)directory;
+- (NSUInteger)count;
+- (NSUInteger)totalCost;  // The number of bytes cached.
+- (UInt64)hits;
+- (UInt64)misses;
+
+@end
@@ -0,0 +1,450 @@
+//
+//  GMDiskBlockCache.m
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import "GMDiskBlockCache.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define GM_DISK_BLOCK_CACHE_MAGIC 0x474d4442  // 'GMDB'
+#define GM_DISK_BLOCK_CACHE_INDEX_MAGIC 0x474d4449  // 'GMDI'
+#define GM_DISK_BLOCK_CACHE_INDEX_VERSION 1
+
+// Precedes the key and the data of a block in its file.
+typedef struct {
+  UInt32 magic;
+  UInt32 keyLength;
+  UInt64 checksum;  // Of the data.
+} GMDiskBlockHeader;
+
+typedef struct {
+  UInt32 magic;
+  UInt32 version;
+  UInt64 count;
+} GMDiskBlockIndexHeader;
+
+// The index lists the blocks from the least to the most recently used one.
+typedef struct {
+  UInt64 hash;
+  UInt64 size;  // Of the block file.
+} GMDiskBlockIndexEntry;
+
+// 64-bit FNV-1a. Used both to name block files and as checksum.
+static UInt64 GMDiskBlockHash(const void* bytes, size_t length, UInt64 hash) {
+  const UInt8* p = bytes;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+static const UInt64 kGMDiskBlockHashSeed = 0xcbf29ce484222325ULL;
+
+static NSData* GMDiskBlockKey(NSString* path, NSString* version, UInt64 index) {
+  // The components are separated by NUL, which none of them can contain.
+  NSString* key = [NSString stringWithFormat:@"%@%C%@%C%llu",
+                   path, (unichar)0, version, (unichar)0, index];
+  return [key dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+@interface GMDiskBlockCacheEntry : NSObject {
+ @public
+  UInt64 hash_;
+  UInt64 size_;
+  GMDiskBlockCacheEntry* prev_;  // Not retained
+  GMDiskBlockCacheEntry* next_;  // Not retained
+}
+@end
+
+@implementation GMDiskBlockCacheEntry
+@end
+
+@implementation GMDiskBlockCache
+
+- (id)initWithDirectory:(NSString *)directory sizeLimit:(UInt64)sizeLimit {
+  self = [super init];
+  if (self) {
+    pthread_mutex_init(&mutex_, NULL);
+    directory_ = [directory copy];
+    sizeLimit_ = sizeLimit;
+    entries_ = [[NSMutableDictionary alloc] init];
+
+    NSFileManager* fileManager = [NSFileManager defaultManager];
+    [fileManager createDirectoryAtPath:directory_
+           withIntermediateDirectories:YES
+                            attributes:nil
+                                 error:NULL];
+    if (![self readIndex]) {
+      // Without an index it is unknown which block files exist.
+      [fileManager removeItemAtPath:[self blocksDirectory] error:NULL];
+    } else {
+      [self removeTemporaryFiles];
+    }
+    // The index is written again by synchronize. Until then, the blocks may
+    // change without the index on disk reflecting it.
+    unlink([[self indexPath] fileSystemRepresentation]);
+    [self evictEntriesIfNeeded];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [entries_ release];
+  [directory_ release];
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+#pragma mark Files
+
+- (NSString *)indexPath {
+  return [directory_ stringByAppendingPathComponent:@"index"];
+}
+
+- (NSString *)blocksDirectory {
+  return [directory_ stringByAppendingPathComponent:@"blocks"];
+}
+
+// Block files are spread over 256 subdirectories.
+- (NSString *)pathForBlockWithHash:(UInt64)hash {
+  return [NSString stringWithFormat:@"%@/%02x/%016llx", [self blocksDirectory],
+          (unsigned int)(hash & 0xff), hash];
+}
+
+// Removes the temporary files left behind by block writes that have been
+// interrupted, e.g. by a crash.
+- (void)removeTemporaryFiles {
+  NSFileManager* fileManager = [NSFileManager defaultManager];
+  NSString* blocksDirectory = [self blocksDirectory];
+  NSArray* subdirectories =
+    [fileManager contentsOfDirectoryAtPath:blocksDirectory error:NULL];
+  for (int i = 0, count = [subdirectories count]; i < count; i++) {
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+    NSString* subdirectory = [blocksDirectory stringByAppendingPathComponent:
+                              [subdirectories objectAtIndex:i]];
+    NSArray* names = [fileManager contentsOfDirectoryAtPath:subdirectory
+                                                      error:NULL];
+    for (int j = 0, namesCount = [names count]; j < namesCount; j++) {
+      NSString* name = [names objectAtIndex:j];
+      if ([name hasPrefix:@".tmp."]) {
+        unlink([[subdirectory stringByAppendingPathComponent:name]
+                fileSystemRepresentation]);
+      }
+    }
+    [pool release];
+  }
+}
+
+- (BOOL)readIndex {
+  NSData* index = [NSData dataWithContentsOfFile:[self indexPath]];
+  if ([index length] < sizeof(GMDiskBlockIndexHeader)) {
+    return NO;
+  }
+  const GMDiskBlockIndexHeader* header = [index bytes];
+  if (header->magic != GM_DISK_BLOCK_CACHE_INDEX_MAGIC ||
+      header->version != GM_DISK_BLOCK_CACHE_INDEX_VERSION ||
+      [index length] != sizeof(GMDiskBlockIndexHeader) +
+                        header->count * sizeof(GMDiskBlockIndexEntry)) {
+    return NO;
+  }
+  const GMDiskBlockIndexEntry* indexEntries =
+    (const GMDiskBlockIndexEntry *)(header + 1);
+  for (UInt64 i = 0; i < header->count; ++i) {
+    NSNumber* key = [NSNumber numberWithUnsignedLongLong:indexEntries[i].hash];
+    if ([entries_ objectForKey:key]) {
+      continue;
+    }
+    GMDiskBlockCacheEntry* entry = [[GMDiskBlockCacheEntry alloc] init];
+    entry->hash_ = indexEntries[i].hash;
+    entry->size_ = indexEntries[i].size;
+    [entries_ setObject:entry forKey:key];
+    [self linkEntryAtHead:entry];
+    totalSize_ += entry->size_;
+    [entry release];
+  }
+  return YES;
+}
+
+// Writes all of buffer to fd.
+static BOOL GMDiskBlockWrite(int fd, const void* buffer, size_t size) {
+  size_t written = 0;
+  while (written < size) {
+    ssize_t res = write(fd, (const char *)buffer + written, size - written);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return NO;
+    }
+    written += res;
+  }
+  return YES;
+}
+
+// Writes the file to a temporary file next to path and renames it into place,
+// so a file is either complete or missing.
+static BOOL GMDiskBlockWriteFile(NSString* path, NSData* header, NSData* key,
+                                 NSData* data) {
+  NSString* template =
+    [[path stringByDeletingLastPathComponent]
+     stringByAppendingPathComponent:@".tmp.XXXXXX"];
+  char tmpPath[PATH_MAX];
+  if (![template getFileSystemRepresentation:tmpPath maxLength:sizeof(tmpPath)]) {
+    return NO;
+  }
+  int fd = mkstemp(tmpPath);
+  if (fd < 0 && errno == ENOENT) {
+    [[NSFileManager defaultManager]
+     createDirectoryAtPath:[path stringByDeletingLastPathComponent]
+     withIntermediateDirectories:YES
+     attributes:nil
+     error:NULL];
+    fd = mkstemp(tmpPath);
+  }
+  if (fd < 0) {
+    return NO;
+  }
+  BOOL ok = GMDiskBlockWrite(fd, [header bytes], [header length]) &&
+            GMDiskBlockWrite(fd, [key bytes], [key length]) &&
+            GMDiskBlockWrite(fd, [data bytes], [data length]);
+  close(fd);
+  if (ok) {
+    ok = (rename(tmpPath, [path fileSystemRepresentation]) == 0);
+  }
+  if (!ok) {
+    unlink(tmpPath);
+  }
+  return ok;
+}
+
+#pragma mark Internal (mutex_ must be held)
+
+- (void)unlinkEntry:(GMDiskBlockCacheEntry *)entry {
+  if (entry->prev_) {
+    entry->prev_->next_ = entry->next_;
+  } else {
+    head_ = entry->next_;
+  }
+  if (entry->next_) {
+    entry->next_->prev_ = entry->prev_;
+  } else {
+    tail_ = entry->prev_;
+  }
+  entry->prev_ = nil;
+  entry->next_ = nil;
+}
+
+- (void)linkEntryAtHead:(GMDiskBlockCacheEntry *)entry {
+  entry->prev_ = nil;
+  entry->next_ = head_;
+  if (head_) {
+    head_->prev_ = entry;
+  }
+  head_ = entry;
+  if (!tail_) {
+    tail_ = entry;
+  }
+}
+
+// Removes the entry, but not its block file.
+- (void)removeEntry:(GMDiskBlockCacheEntry *)entry {
+  [self unlinkEntry:entry];
+  totalSize_ -= entry->size_;
+  [entries_ removeObjectForKey:[NSNumber numberWithUnsignedLongLong:entry->hash_]];
+}
+
+- (void)evictEntriesIfNeeded {
+  while (tail_ && sizeLimit_ > 0 && totalSize_ > sizeLimit_) {
+    UInt64 hash = tail_->hash_;
+    [self removeEntry:tail_];
+    unlink([[self pathForBlockWithHash:hash] fileSystemRepresentation]);
+  }
+}
+
+#pragma mark Public
+
+- (NSData *)blockForPath:(NSString *)path
+                 version:(NSString *)version
+                   index:(UInt64)index {
+  NSData* key = GMDiskBlockKey(path, version, index);
+  UInt64 hash = GMDiskBlockHash([key bytes], [key length], kGMDiskBlockHashSeed);
+  NSNumber* hashKey = [NSNumber numberWithUnsignedLongLong:hash];
+
+  pthread_mutex_lock(&mutex_);
+  GMDiskBlockCacheEntry* entry = [entries_ objectForKey:hashKey];
+  if (entry) {
+    [[entry retain] autorelease];  // May be removed while the file is read.
+    [self unlinkEntry:entry];
+    [self linkEntryAtHead:entry];
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  NSData* block = nil;
+  if (entry) {
+    NSData* file = [NSData dataWithContentsOfFile:[self pathForBlockWithHash:hash]];
+    const GMDiskBlockHeader* header = [file bytes];
+    size_t dataOffset = sizeof(GMDiskBlockHeader) + [key length];
+    if ([file length] >= dataOffset &&
+        header->magic == GM_DISK_BLOCK_CACHE_MAGIC &&
+        header->keyLength == [key length] &&
+        memcmp(header + 1, [key bytes], [key length]) == 0) {
+      NSData* data =
+        [file subdataWithRange:NSMakeRange(dataOffset, [file length] - dataOffset)];
+      if (GMDiskBlockHash([data bytes], [data length], kGMDiskBlockHashSeed) ==
+          header->checksum) {
+        block = data;
+      }
+    }
+  }
+
+  pthread_mutex_lock(&mutex_);
+  if (block) {
+    ++hits_;
+  } else {
+    ++misses_;
+    if (entry && [entries_ objectForKey:hashKey] == entry) {
+      // The block file is missing, damaged or belongs to another key.
+      [self removeEntry:entry];
+      unlink([[self pathForBlockWithHash:hash] fileSystemRepresentation]);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return block;
+}
+
+- (void)setBlock:(NSData *)block
+         forPath:(NSString *)path
+         version:(NSString *)version
+           index:(UInt64)index {
+  NSData* key = GMDiskBlockKey(path, version, index);
+  UInt64 hash = GMDiskBlockHash([key bytes], [key length], kGMDiskBlockHashSeed);
+  NSNumber* hashKey = [NSNumber numberWithUnsignedLongLong:hash];
+
+  GMDiskBlockHeader header;
+  header.magic = GM_DISK_BLOCK_CACHE_MAGIC;
+  header.keyLength = (UInt32)[key length];
+  header.checksum = GMDiskBlockHash([block bytes], [block length], kGMDiskBlockHashSeed);
+  NSData* headerData = [NSData dataWithBytes:&header length:sizeof(header)];
+  if (!GMDiskBlockWriteFile([self pathForBlockWithHash:hash], headerData, key, block)) {
+    return;  // Not cached; e.g. the disk is full.
+  }
+
+  pthread_mutex_lock(&mutex_);
+  GMDiskBlockCacheEntry* entry = [entries_ objectForKey:hashKey];
+  if (entry) {
+    [self removeEntry:entry];
+  }
+  entry = [[GMDiskBlockCacheEntry alloc] init];
+  entry->hash_ = hash;
+  entry->size_ = sizeof(header) + [key length] + [block length];
+  [entries_ setObject:entry forKey:hashKey];
+  [self linkEntryAtHead:entry];
+  totalSize_ += entry->size_;
+  [entry release];
+  [self evictEntriesIfNeeded];
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)removeAllBlocks {
+  pthread_mutex_lock(&mutex_);
+  [entries_ removeAllObjects];
+  head_ = nil;
+  tail_ = nil;
+  totalSize_ = 0;
+  [[NSFileManager defaultManager] removeItemAtPath:[self blocksDirectory]
+                                             error:NULL];
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (BOOL)synchronize {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger count = [entries_ count];
+  NSMutableData* index =
+    [NSMutableData dataWithLength:sizeof(GMDiskBlockIndexHeader) +
+                                  count * sizeof(GMDiskBlockIndexEntry)];
+  GMDiskBlockIndexHeader* header = [index mutableBytes];
+  header->magic = GM_DISK_BLOCK_CACHE_INDEX_MAGIC;
+  header->version = GM_DISK_BLOCK_CACHE_INDEX_VERSION;
+  header->count = count;
+  GMDiskBlockIndexEntry* indexEntries = (GMDiskBlockIndexEntry *)(header + 1);
+  NSUInteger i = 0;
+  for (GMDiskBlockCacheEntry* entry = tail_; entry; entry = entry->prev_) {
+    indexEntries[i].hash = entry->hash_;
+    indexEntries[i].size = entry->size_;
+    ++i;
+  }
+  BOOL ok = [index writeToFile:[self indexPath] atomically:YES];
+  pthread_mutex_unlock(&mutex_);
+  return ok;
+}
+
+- (NSString *)directory {
+  return directory_;
+}
+
+- (NSUInteger)count {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger count = [entries_ count];
+  pthread_mutex_unlock(&mutex_);
+  return count;
+}
+
+- (NSUInteger)totalCost {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger totalCost = (NSUInteger)totalSize_;
+  pthread_mutex_unlock(&mutex_);
+  return totalCost;
+}
+
+- (UInt64)hits {
+  pthread_mutex_lock(&mutex_);
+  UInt64 hits = hits_;
+  pthread_mutex_unlock(&mutex_);
+  return hits;
+}
+
+- (UInt64)misses {
+  pthread_mutex_lock(&mutex_);
+  UInt64 misses = misses_;
+  pthread_mutex_unlock(&mutex_);
+  return misses;
+}
+
+@end
@@ -0,0 +1,148 @@
+//
+//  GMInodeTable.h
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+
+#include <pthread.h>
+
+// The node ID of the root directory. Matches FUSE_ROOT_ID.
+#define GM_ROOT_NODE_ID 1
+
+@class GMInode;
+@class GMMemoryBudget;
+
+// Maps paths to node IDs, which double as the inode numbers of the items, and
+// back. Every known node remembers its parent, its name and its full path, so
+// requests that identify an item by node ID, or by parent node ID and name, can
+// be resolved without building the path from scratch. Node IDs are never
+// reused while the file system is mounted, and they follow their items when
+// they are moved.
+//
+// The low-level FUSE interface registers nodes by looking them up and removes
+// them once the kernel forgets them. The high-level interface registers the
+// paths of the items it reports attributes for. The kernel does not reference
+// these nodes, so once there are more than the count limit, or the memory
+// budget asks for it, the least recently used ones without children are
+// evicted; their items get new node IDs when they are registered again. Nodes
+// of open items are pinned, so they keep their node IDs.
+//
+// Nodes are indexed by node ID and by path in open-addressed hash tables that
+// are spread over several independently locked shards, so resolving a node ID
+// or a path does not contend with other lookups. Changes to the tree of nodes
+// are serialized by a single lock. The string of a known path is shared by all
+// requests for it.
+//
+// All methods are thread-safe.
+@interface GMInodeTable : NSObject {
+ @private
+  pthread_mutex_t mutex_;         // Serializes changes to the tree of nodes.
+  void* shards_;                  // GMInodeTableShard[kGMInodeTableShardCount]
+  UInt64 nextNodeID_;
+  NSUInteger count_;
+  NSUInteger countLimit_;         // Zero means "unlimited".
+  GMInode* clockHand_;            // The next node to consider for eviction.
+  NSUInteger totalCost_;          // Approximate bytes held by the nodes.
+  GMMemoryBudget* budget_;        // Not retained; may be nil.
+}
+
+// Nodes that are neither referenced by the kernel nor pinned are evicted once
+// there are more than countLimit nodes. A limit of zero means "unlimited".
+- (id)initWithCountLimit:(NSUInteger)countLimit;
+
+// Returns the path of the node or nil if the node is not known.
+- (NSString *)pathForNodeID:(UInt64)nodeID;
+
+// Returns the path of the item with the given name in the directory with the
+// given node ID, or nil if the directory is not known. Does not register a
+// node for the item.
+- (NSString *)pathForName:(NSString *)name parentNodeID:(UInt64)parentID;
+
+// Returns the node ID of the item with the given name in the directory with the
+// given node ID, registering a new node if necessary, and increments the
+// node's lookup count. Returns 0 if the directory is not known.
+- (UInt64)lookupName:(NSString *)name parentNodeID:(UInt64)parentID;
+
+// Decrements the lookup count of the node by count. Once the lookup count drops
+// to zero, the node is removed from the table. Returns YES if the node has
+// been removed.
+- (BOOL)forgetNodeID:(UInt64)nodeID count:(UInt64)count;
+
+// Detaches the item with the given name from the directory with the given node
+// ID, e.g. after it has been removed. The node stays valid until forgotten.
+- (void)removeName:(NSString *)name parentNodeID:(UInt64)parentID;
+
+// Moves the item with the given name to a new directory and name and updates
+// the paths of all known nodes below it.
+- (void)moveName:(NSString *)name
+    parentNodeID:(UInt64)parentID
+          toName:(NSString *)newName
+    parentNodeID:(UInt64)newParentID;
+
+// Returns the node ID for path or 0 if the path is not known. If parentID is
+// not NULL, it is set to the node ID of the parent directory.
+- (UInt64)nodeIDForPath:(NSString *)path parentNodeID:(UInt64 *)parentID;
+
+// Returns the path for the given file system representation, which is the
+// string of the node if the path is known and a new string otherwise.
+- (NSString *)pathWithFileSystemRepresentation:(const char *)path;
+
+// Returns the node ID for path, registering nodes for it and its ancestors if
+// necessary. The lookup counts of the nodes are not changed.
+- (UInt64)registerPath:(NSString *)path;
+
+// Registers path like registerPath: and keeps its node from being evicted, e.g.
+// while the item is open, until unpinNodeID: is called. Pinning counts as a
+// lookup. Returns the node ID or 0 if the node could not be pinned.
+- (UInt64)pinPath:(NSString *)path;
+- (void)unpinNodeID:(UInt64)nodeID;
+
+// Path based counterparts of removeName:parentNodeID: and
+// moveName:parentNodeID:toName:parentNodeID:. Nodes that are not referenced by
+// the kernel are removed from the table along with the item.
+- (void)removePath:(NSString *)path;
+- (void)movePath:(NSString *)path toPath:(NSString *)newPath;
+
+// Returns the number of known nodes.
+- (NSUInteger)count;
+
+// GMMemoryBudgetConsumer. Purging evicts nodes like the count limit does.
+- (NSUInteger)totalCost;
+- (NSUInteger)purgeCost:(NSUInteger)cost;
+- (void)setMemoryBudget:(GMMemoryBudget *)budget;
+
+@end
@@ -0,0 +1,803 @@
+//
+//  GMInodeTable.m
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import "GMInodeTable.h"
+
+#import "GMMemoryBudget.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Number of independently locked shards of the node indexes. A power of two.
+#define kGMInodeTableShardCount 16
+
+// Approximate bytes held by a node besides its path, which is held twice: as
+// a string and as its file system representation.
+static const NSUInteger kGMInodeCost = 128;
+
+// Initial number of slots of a node index. A power of two.
+static const NSUInteger kGMInodeIndexMinCapacity = 16;
+
+@interface GMInode : NSObject {
+ @public
+  UInt64 nodeID_;
+  UInt64 parentID_;               // Zero if the node has been detached.
+  NSString* name_;                // Retained
+  NSString* path_;                // Retained
+  char* fileSystemPath_;          // UTF-8 representation of path_.
+  size_t fileSystemPathLength_;
+  UInt64 pathHash_;
+  BOOL isIndexed_;                // Can be found by path?
+  UInt64 lookupCount_;
+  NSMutableDictionary* children_;  // Name -> GMInode; created lazily.
+  BOOL isReferenced_;             // Used since the clock hand passed it?
+  GMInode* clockPrev_;            // Not retained; nil for the root.
+  GMInode* clockNext_;            // Not retained; nil for the root.
+}
+- (id)initWithNodeID:(UInt64)nodeID
+            parentID:(UInt64)parentID
+                name:(NSString *)name
+                path:(NSString *)path;
+- (void)setPath:(NSString *)path;
+- (NSUInteger)cost;
+@end
+
+// FNV-1a. Never returns zero, which marks empty slots.
+static UInt64 GMInodePathHash(const char* path, size_t length) {
+  UInt64 hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash ? hash : 1;
+}
+
+@implementation GMInode
+
+- (id)initWithNodeID:(UInt64)nodeID
+            parentID:(UInt64)parentID
+                name:(NSString *)name
+                path:(NSString *)path {
+  self = [super init];
+  if (self) {
+    nodeID_ = nodeID;
+    parentID_ = parentID;
+    name_ = [name copy];
+    [self setPath:path];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [name_ release];
+  [path_ release];
+  free(fileSystemPath_);
+  [children_ release];
+  [super dealloc];
+}
+
+- (void)setPath:(NSString *)path {
+  [path_ release];
+  path_ = [path copy];
+  free(fileSystemPath_);
+  const char* fileSystemPath = [path_ UTF8String];
+  fileSystemPathLength_ = strlen(fileSystemPath);
+  fileSystemPath_ = malloc(fileSystemPathLength_ + 1);
+  memcpy(fileSystemPath_, fileSystemPath, fileSystemPathLength_ + 1);
+  pathHash_ = GMInodePathHash(fileSystemPath_, fileSystemPathLength_);
+}
+
+- (NSUInteger)cost {
+  return kGMInodeCost + 2 * fileSystemPathLength_;
+}
+
+@end
+
+static NSString* GMInodeChildPath(NSString* parentPath, NSString* name) {
+  if ([parentPath isEqualToString:@"/"]) {
+    return [parentPath stringByAppendingString:name];
+  }
+  return [NSString stringWithFormat:@"%@/%@", parentPath, name];
+}
+
+#pragma mark Node Indexes
+
+// An open-addressed hash table with linear probing. The slots only hold the
+// keys and the nodes, so probing stays within a few cache lines and only
+// touches the node of a matching key. Keys of the index by path are path
+// hashes and need not be unique.
+typedef struct {
+  UInt64 key;      // Zero marks an empty slot.
+  GMInode* node;   // Not retained
+} GMInodeSlot;
+
+typedef struct {
+  GMInodeSlot* slots;
+  NSUInteger capacity;  // A power of two, or zero.
+  NSUInteger count;
+} GMInodeIndex;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  GMInodeIndex nodesByID;    // Holds a reference to the nodes.
+  GMInodeIndex nodesByPath;  // Attached nodes only.
+} GMInodeTableShard;
+
+// Spreads sequential node IDs and weak hashes over the shards and slots.
+static inline UInt64 GMInodeMix(UInt64 key) {
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return key;
+}
+
+static inline GMInodeTableShard* GMInodeShardForKey(void* shards, UInt64 key) {
+  NSUInteger index = GMInodeMix(key) & (kGMInodeTableShardCount - 1);
+  return &((GMInodeTableShard *)shards)[index];
+}
+
+// The shard bits are left out, as all keys of a shard share them.
+static inline NSUInteger GMInodeSlotIndex(UInt64 key, NSUInteger capacity) {
+  return (GMInodeMix(key) >> 4) & (capacity - 1);
+}
+
+static void GMInodeIndexInsert(GMInodeIndex* index, UInt64 key, GMInode* node);
+
+static void GMInodeIndexGrow(GMInodeIndex* index) {
+  GMInodeSlot* slots = index->slots;
+  NSUInteger capacity = index->capacity;
+  index->capacity = capacity ? capacity * 2 : kGMInodeIndexMinCapacity;
+  index->slots = calloc(index->capacity, sizeof(GMInodeSlot));
+  index->count = 0;
+  for (NSUInteger i = 0; i < capacity; ++i) {
+    if (slots[i].key != 0) {
+      GMInodeIndexInsert(index, slots[i].key, slots[i].node);
+    }
+  }
+  free(slots);
+}
+
+static void GMInodeIndexInsert(GMInodeIndex* index, UInt64 key, GMInode* node) {
+  // Keep the load factor below 3/4 so probe sequences stay short.
+  if ((index->count + 1) * 4 > index->capacity * 3) {
+    GMInodeIndexGrow(index);
+  }
+  NSUInteger mask = index->capacity - 1;
+  NSUInteger i = GMInodeSlotIndex(key, index->capacity);
+  while (index->slots[i].key != 0) {
+    i = (i + 1) & mask;
+  }
+  index->slots[i].key = key;
+  index->slots[i].node = node;
+  ++index->count;
+}
+
+static void GMInodeIndexRemove(GMInodeIndex* index, UInt64 key, GMInode* node) {
+  if (index->capacity == 0) {
+    return;
+  }
+  NSUInteger mask = index->capacity - 1;
+  NSUInteger i = GMInodeSlotIndex(key, index->capacity);
+  while (index->slots[i].key != 0 &&
+         !(index->slots[i].key == key && index->slots[i].node == node)) {
+    i = (i + 1) & mask;
+  }
+  if (index->slots[i].key == 0) {
+    return;
+  }
+  // Move the following entries of the probe sequence back into the hole, so
+  // lookups do not need tombstones.
+  NSUInteger j = i;
+  for (;;) {
+    j = (j + 1) & mask;
+    if (index->slots[j].key == 0) {
+      break;
+    }
+    NSUInteger home = GMInodeSlotIndex(index->slots[j].key, index->capacity);
+    BOOL staysInPlace = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+    if (!staysInPlace) {
+      index->slots[i] = index->slots[j];
+      i = j;
+    }
+  }
+  index->slots[i].key = 0;
+  index->slots[i].node = nil;
+  --index->count;
+}
+
+static GMInode* GMInodeIndexNodeForID(GMInodeIndex* index, UInt64 nodeID) {
+  if (index->capacity == 0) {
+    return nil;
+  }
+  NSUInteger mask = index->capacity - 1;
+  for (NSUInteger i = GMInodeSlotIndex(nodeID, index->capacity);
+       index->slots[i].key != 0; i = (i + 1) & mask) {
+    if (index->slots[i].key == nodeID) {
+      return index->slots[i].node;
+    }
+  }
+  return nil;
+}
+
+static GMInode* GMInodeIndexNodeForPath(GMInodeIndex* index, UInt64 hash,
+                                        const char* path, size_t length) {
+  if (index->capacity == 0) {
+    return nil;
+  }
+  NSUInteger mask = index->capacity - 1;
+  for (NSUInteger i = GMInodeSlotIndex(hash, index->capacity);
+       index->slots[i].key != 0; i = (i + 1) & mask) {
+    if (index->slots[i].key == hash) {
+      GMInode* node = index->slots[i].node;
+      if (node->fileSystemPathLength_ == length &&
+          memcmp(node->fileSystemPath_, path, length) == 0) {
+        return node;
+      }
+    }
+  }
+  return nil;
+}
+
+@implementation GMInodeTable
+
+- (id)init {
+  return [self initWithCountLimit:0];
+}
+
+- (id)initWithCountLimit:(NSUInteger)countLimit {
+  self = [super init];
+  if (self) {
+    pthread_mutex_init(&mutex_, NULL);
+    countLimit_ = countLimit;
+    GMInodeTableShard* shards =
+      calloc(kGMInodeTableShardCount, sizeof(GMInodeTableShard));
+    for (int i = 0; i < kGMInodeTableShardCount; ++i) {
+      pthread_mutex_init(&shards[i].mutex, NULL);
+    }
+    shards_ = shards;
+    nextNodeID_ = GM_ROOT_NODE_ID + 1;
+
+    GMInode* root = [[GMInode alloc] initWithNodeID:GM_ROOT_NODE_ID
+                                           parentID:0
+                                               name:@""
+                                               path:@"/"];
+    [self addNode:root];
+    [root release];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  GMInodeTableShard* shards = shards_;
+  for (int i = 0; i < kGMInodeTableShardCount; ++i) {
+    GMInodeIndex* nodesByID = &shards[i].nodesByID;
+    for (NSUInteger j = 0; j < nodesByID->capacity; ++j) {
+      [nodesByID->slots[j].node release];
+    }
+    free(nodesByID->slots);
+    free(shards[i].nodesByPath.slots);
+    pthread_mutex_destroy(&shards[i].mutex);
+  }
+  free(shards);
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+#pragma mark Internal (mutex_ must be held)
+
+// The shards are only modified with mutex_ held, so they can be read without
+// locking them here. Lookups without mutex_ lock the shard instead.
+
+- (GMInode *)nodeForID:(UInt64)nodeID {
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, nodeID);
+  return GMInodeIndexNodeForID(&shard->nodesByID, nodeID);
+}
+
+- (GMInode *)nodeForPath:(NSString *)path {
+  const char* fileSystemPath = [path UTF8String];
+  size_t length = strlen(fileSystemPath);
+  UInt64 hash = GMInodePathHash(fileSystemPath, length);
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, hash);
+  return GMInodeIndexNodeForPath(&shard->nodesByPath, hash, fileSystemPath,
+                                 length);
+}
+
+- (void)indexPathOfNode:(GMInode *)node {
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, node->pathHash_);
+  pthread_mutex_lock(&shard->mutex);
+  GMInodeIndexInsert(&shard->nodesByPath, node->pathHash_, node);
+  node->isIndexed_ = YES;
+  pthread_mutex_unlock(&shard->mutex);
+}
+
+- (void)unindexPathOfNode:(GMInode *)node {
+  if (!node->isIndexed_) {
+    return;
+  }
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, node->pathHash_);
+  pthread_mutex_lock(&shard->mutex);
+  GMInodeIndexRemove(&shard->nodesByPath, node->pathHash_, node);
+  node->isIndexed_ = NO;
+  pthread_mutex_unlock(&shard->mutex);
+}
+
+// The nodes other than the root form a ring that the clock hand moves around
+// to find nodes to evict. New nodes are inserted behind the hand, so they are
+// considered last.
+- (void)insertNodeIntoClock:(GMInode *)node {
+  if (!clockHand_) {
+    node->clockPrev_ = node;
+    node->clockNext_ = node;
+    clockHand_ = node;
+    return;
+  }
+  GMInode* prev = clockHand_->clockPrev_;
+  node->clockPrev_ = prev;
+  node->clockNext_ = clockHand_;
+  prev->clockNext_ = node;
+  clockHand_->clockPrev_ = node;
+}
+
+- (void)removeNodeFromClock:(GMInode *)node {
+  if (!node->clockNext_) {
+    return;
+  }
+  if (node->clockNext_ == node) {
+    clockHand_ = nil;
+  } else {
+    node->clockPrev_->clockNext_ = node->clockNext_;
+    node->clockNext_->clockPrev_ = node->clockPrev_;
+    if (clockHand_ == node) {
+      clockHand_ = node->clockNext_;
+    }
+  }
+  node->clockPrev_ = nil;
+  node->clockNext_ = nil;
+}
+
+// Adds node to the indexes and returns its cost. The node is neither attached
+// to its parent nor is the memory budget told about the growth.
+- (NSUInteger)addNode:(GMInode *)node {
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, node->nodeID_);
+  pthread_mutex_lock(&shard->mutex);
+  GMInodeIndexInsert(&shard->nodesByID, node->nodeID_, [node retain]);
+  pthread_mutex_unlock(&shard->mutex);
+  [self indexPathOfNode:node];
+  if (node->nodeID_ != GM_ROOT_NODE_ID) {
+    node->isReferenced_ = YES;
+    [self insertNodeIntoClock:node];
+  }
+  NSUInteger cost = [node cost];
+  totalCost_ += cost;
+  ++count_;
+  return cost;
+}
+
+- (void)attachNode:(GMInode *)node toParent:(GMInode *)parent {
+  node->parentID_ = parent->nodeID_;
+  if (!parent->children_) {
+    parent->children_ = [[NSMutableDictionary alloc] init];
+  }
+  [parent->children_ setObject:node forKey:node->name_];
+}
+
+// Returns the node for the item with the given name in parent, registering a
+// new node if necessary. Adds the cost of a new node to *growth.
+- (GMInode *)childNamed:(NSString *)name
+               ofParent:(GMInode *)parent
+                 growth:(NSUInteger *)growth {
+  GMInode* node = [parent->children_ objectForKey:name];
+  if (node) {
+    return node;
+  }
+  NSString* path = GMInodeChildPath(parent->path_, name);
+  node = [self nodeForPath:path];
+  if (node) {
+    // The parent has been forgotten and registered again since the node was
+    // registered.
+    GMInode* oldParent = [self nodeForID:node->parentID_];
+    if (oldParent && [oldParent->children_ objectForKey:node->name_] == node) {
+      [oldParent->children_ removeObjectForKey:node->name_];
+    }
+    [self attachNode:node toParent:parent];
+    return node;
+  }
+  node = [[GMInode alloc] initWithNodeID:nextNodeID_++
+                                parentID:parent->nodeID_
+                                    name:name
+                                    path:path];
+  *growth += [self addNode:node];
+  [self attachNode:node toParent:parent];
+  [node release];
+  return node;
+}
+
+// Removes node from the indexes, along with the last reference to it.
+- (void)dropNode:(GMInode *)node {
+  [self removeNodeFromClock:node];
+  [self unindexPathOfNode:node];
+  totalCost_ -= [node cost];
+  --count_;
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, node->nodeID_);
+  pthread_mutex_lock(&shard->mutex);
+  GMInodeIndexRemove(&shard->nodesByID, node->nodeID_, node);
+  pthread_mutex_unlock(&shard->mutex);
+  [node release];
+}
+
+// The nodes below a detached node can no longer be found by path. Those that
+// are not referenced by the kernel are dropped.
+- (void)detachDescendantsOfNode:(GMInode *)node {
+  NSArray* children = [node->children_ allValues];
+  [node->children_ removeAllObjects];
+  for (int i = 0, count = [children count]; i < count; i++) {
+    GMInode* child = [children objectAtIndex:i];
+    [self detachDescendantsOfNode:child];
+    child->parentID_ = 0;
+    [self unindexPathOfNode:child];
+    if (child->lookupCount_ == 0) {
+      [self dropNode:child];
+    }
+  }
+}
+
+- (void)detachNode:(GMInode *)node {
+  [[node retain] autorelease];
+  GMInode* parent = [self nodeForID:node->parentID_];
+  if (parent && [parent->children_ objectForKey:node->name_] == node) {
+    [parent->children_ removeObjectForKey:node->name_];
+  }
+  node->parentID_ = 0;
+  [self unindexPathOfNode:node];
+  [self detachDescendantsOfNode:node];
+  if (node->lookupCount_ == 0) {
+    [self dropNode:node];
+  }
+}
+
+// Sets the path of node, keeping the indexes and readers of the path in step.
+- (void)setPath:(NSString *)path ofNode:(GMInode *)node {
+  BOOL isIndexed = node->isIndexed_;
+  [self unindexPathOfNode:node];
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, node->nodeID_);
+  totalCost_ -= [node cost];
+  pthread_mutex_lock(&shard->mutex);
+  [node setPath:path];
+  pthread_mutex_unlock(&shard->mutex);
+  totalCost_ += [node cost];
+  if (isIndexed) {
+    [self indexPathOfNode:node];
+  }
+}
+
+- (void)updatePathOfNode:(GMInode *)node parentPath:(NSString *)parentPath {
+  [self setPath:GMInodeChildPath(parentPath, node->name_) ofNode:node];
+  for (GMInode* child in [node->children_ objectEnumerator]) {
+    [self updatePathOfNode:child parentPath:node->path_];
+  }
+}
+
+- (void)moveNode:(GMInode *)node
+        toParent:(GMInode *)newParent
+            name:(NSString *)newName {
+  GMInode* replaced = newParent ? [newParent->children_ objectForKey:newName] : nil;
+  [[node retain] autorelease];
+  if (replaced && replaced != node) {
+    [self detachNode:replaced];
+  }
+  if (node) {
+    GMInode* parent = [self nodeForID:node->parentID_];
+    if (parent && [parent->children_ objectForKey:node->name_] == node) {
+      [parent->children_ removeObjectForKey:node->name_];
+    }
+    if (newParent) {
+      [node->name_ release];
+      node->name_ = [newName copy];
+      [self attachNode:node toParent:newParent];
+      [self updatePathOfNode:node parentPath:newParent->path_];
+    } else {
+      [self detachNode:node];
+    }
+  }
+}
+
+// Evicts nodes that are neither referenced by the kernel nor have children, in
+// the order of the clock hand, until no more than count nodes are left and at
+// least cost bytes have been freed. Nodes that have been used since the hand
+// last passed them are passed once more. Returns the number of bytes freed.
+- (NSUInteger)evictNodesToCount:(NSUInteger)count cost:(NSUInteger)cost {
+  NSUInteger freed = 0;
+  // Two rounds suffice to pass all nodes used since the last round and then
+  // to evict them.
+  NSUInteger steps = 2 * count_;
+  while ((count_ > count || freed < cost) && clockHand_ && steps > 0) {
+    --steps;
+    GMInode* node = clockHand_;
+    clockHand_ = node->clockNext_;
+    if (node->lookupCount_ > 0 || [node->children_ count] > 0) {
+      continue;
+    }
+    if (node->isReferenced_) {
+      node->isReferenced_ = NO;
+      continue;
+    }
+    freed += [node cost];
+    [self detachNode:node];
+  }
+  return freed;
+}
+
+#pragma mark Public
+
+- (NSString *)pathForNodeID:(UInt64)nodeID {
+  NSString* path = nil;
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, nodeID);
+  pthread_mutex_lock(&shard->mutex);
+  GMInode* node = GMInodeIndexNodeForID(&shard->nodesByID, nodeID);
+  if (node) {
+    path = [[node->path_ retain] autorelease];
+  }
+  pthread_mutex_unlock(&shard->mutex);
+  return path;
+}
+
+- (NSString *)pathForName:(NSString *)name parentNodeID:(UInt64)parentID {
+  NSString* path = nil;
+  pthread_mutex_lock(&mutex_);
+  GMInode* parent = [self nodeForID:parentID];
+  if (parent) {
+    GMInode* node = [parent->children_ objectForKey:name];
+    if (node) {
+      path = [[node->path_ retain] autorelease];
+    } else {
+      path = GMInodeChildPath(parent->path_, name);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return path;
+}
+
+- (UInt64)lookupName:(NSString *)name parentNodeID:(UInt64)parentID {
+  UInt64 nodeID = 0;
+  NSUInteger growth = 0;
+  pthread_mutex_lock(&mutex_);
+  GMInode* parent = [self nodeForID:parentID];
+  if (parent) {
+    GMInode* node = [self childNamed:name ofParent:parent growth:&growth];
+    ++node->lookupCount_;
+    nodeID = node->nodeID_;
+  }
+  pthread_mutex_unlock(&mutex_);
+  if (growth > 0) {
+    [budget_ noteGrowth:growth];
+  }
+  return nodeID;
+}
+
+- (BOOL)forgetNodeID:(UInt64)nodeID count:(UInt64)count {
+  if (nodeID == GM_ROOT_NODE_ID) {
+    return NO;
+  }
+  BOOL removed = NO;
+  pthread_mutex_lock(&mutex_);
+  GMInode* node = [self nodeForID:nodeID];
+  if (node) {
+    node->lookupCount_ = (count < node->lookupCount_) ? node->lookupCount_ - count : 0;
+    if (node->lookupCount_ == 0) {
+      GMInode* parent = [self nodeForID:node->parentID_];
+      if (parent && [parent->children_ objectForKey:node->name_] == node) {
+        [parent->children_ removeObjectForKey:node->name_];
+      }
+      [self dropNode:node];
+      removed = YES;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return removed;
+}
+
+- (void)removeName:(NSString *)name parentNodeID:(UInt64)parentID {
+  pthread_mutex_lock(&mutex_);
+  GMInode* parent = [self nodeForID:parentID];
+  GMInode* node = parent ? [parent->children_ objectForKey:name] : nil;
+  if (node) {
+    [self detachNode:node];
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)moveName:(NSString *)name
+    parentNodeID:(UInt64)parentID
+          toName:(NSString *)newName
+    parentNodeID:(UInt64)newParentID {
+  pthread_mutex_lock(&mutex_);
+  GMInode* parent = [self nodeForID:parentID];
+  GMInode* newParent = [self nodeForID:newParentID];
+  GMInode* node = parent ? [parent->children_ objectForKey:name] : nil;
+  [self moveNode:node toParent:newParent name:newName];
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (UInt64)nodeIDForPath:(NSString *)path parentNodeID:(UInt64 *)parentID {
+  UInt64 nodeID = 0;
+  pthread_mutex_lock(&mutex_);
+  GMInode* node = [self nodeForPath:path];
+  if (node) {
+    nodeID = node->nodeID_;
+    if (parentID) {
+      *parentID = node->parentID_;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return nodeID;
+}
+
+- (NSString *)pathWithFileSystemRepresentation:(const char *)path {
+  size_t length = strlen(path);
+  UInt64 hash = GMInodePathHash(path, length);
+  NSString* interned = nil;
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, hash);
+  pthread_mutex_lock(&shard->mutex);
+  GMInode* node = GMInodeIndexNodeForPath(&shard->nodesByPath, hash, path, length);
+  if (node) {
+    interned = [[node->path_ retain] autorelease];
+  }
+  pthread_mutex_unlock(&shard->mutex);
+  return interned ? interned : [NSString stringWithUTF8String:path];
+}
+
+- (UInt64)registerPath:(NSString *)path {
+  const char* fileSystemPath = [path UTF8String];
+  size_t length = strlen(fileSystemPath);
+  UInt64 hash = GMInodePathHash(fileSystemPath, length);
+  UInt64 nodeID = 0;
+  GMInodeTableShard* shard = GMInodeShardForKey(shards_, hash);
+  pthread_mutex_lock(&shard->mutex);
+  GMInode* node = GMInodeIndexNodeForPath(&shard->nodesByPath, hash,
+                                          fileSystemPath, length);
+  if (node) {
+    nodeID = node->nodeID_;
+    // Set without mutex_; a lost update only costs the node a second chance.
+    node->isReferenced_ = YES;
+  }
+  pthread_mutex_unlock(&shard->mutex);
+  if (nodeID != 0) {
+    return nodeID;
+  }
+
+  NSUInteger growth = 0;
+  pthread_mutex_lock(&mutex_);
+  node = [self nodeForID:GM_ROOT_NODE_ID];
+  NSArray* components = [path componentsSeparatedByString:@"/"];
+  for (int i = 0, count = [components count]; i < count; i++) {
+    NSString* component = [components objectAtIndex:i];
+    if ([component length] > 0) {
+      node = [self childNamed:component ofParent:node growth:&growth];
+    }
+  }
+  nodeID = node->nodeID_;
+  if (countLimit_ > 0 && count_ > countLimit_) {
+    // Leave some room, so that not every new node evicts another one.
+    [self evictNodesToCount:countLimit_ - countLimit_ / 8 cost:0];
+  }
+  pthread_mutex_unlock(&mutex_);
+  if (growth > 0) {
+    [budget_ noteGrowth:growth];
+  }
+  return nodeID;
+}
+
+- (UInt64)pinPath:(NSString *)path {
+  UInt64 nodeID = [self registerPath:path];
+  pthread_mutex_lock(&mutex_);
+  GMInode* node = [self nodeForID:nodeID];
+  if (node) {
+    ++node->lookupCount_;
+  } else {
+    nodeID = 0;  // Evicted or removed in the meantime.
+  }
+  pthread_mutex_unlock(&mutex_);
+  return nodeID;
+}
+
+- (void)unpinNodeID:(UInt64)nodeID {
+  pthread_mutex_lock(&mutex_);
+  GMInode* node = [self nodeForID:nodeID];
+  if (node && node->lookupCount_ > 0 && --node->lookupCount_ == 0 &&
+      node->parentID_ == 0 && nodeID != GM_ROOT_NODE_ID) {
+    [self dropNode:node];  // Removed while pinned.
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)removePath:(NSString *)path {
+  pthread_mutex_lock(&mutex_);
+  GMInode* node = [self nodeForPath:path];
+  if (node && node->nodeID_ != GM_ROOT_NODE_ID) {
+    [self detachNode:node];
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)movePath:(NSString *)path toPath:(NSString *)newPath {
+  pthread_mutex_lock(&mutex_);
+  GMInode* node = [self nodeForPath:path];
+  if (node && node->nodeID_ != GM_ROOT_NODE_ID) {
+    GMInode* newParent =
+      [self nodeForPath:[newPath stringByDeletingLastPathComponent]];
+    [self moveNode:node toParent:newParent name:[newPath lastPathComponent]];
+  } else {
+    // Whatever was known at newPath has been replaced.
+    GMInode* replaced = [self nodeForPath:newPath];
+    if (replaced && replaced->nodeID_ != GM_ROOT_NODE_ID) {
+      [self detachNode:replaced];
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (NSUInteger)count {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger count = count_;
+  pthread_mutex_unlock(&mutex_);
+  return count;
+}
+
+#pragma mark GMMemoryBudgetConsumer
+
+- (NSUInteger)totalCost {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger totalCost = totalCost_;
+  pthread_mutex_unlock(&mutex_);
+  return totalCost;
+}
+
+- (NSUInteger)purgeCost:(NSUInteger)cost {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger freed = [self evictNodesToCount:count_ cost:cost];
+  pthread_mutex_unlock(&mutex_);
+  return freed;
+}
+
+- (void)setMemoryBudget:(GMMemoryBudget *)budget {
+  budget_ = budget;
+}
+
+@end
@@ -0,0 +1,121 @@
+//
+//  GMMemoryBudget.h
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+
+#include <dispatch/dispatch.h>
+#include <pthread.h>
+
+// The memory of all caches and buffers of a mount. Each consumer is added with
+// a name and a weight. Once the consumers hold more than the limit, those that
+// hold more than their share of it are asked to purge the difference, where
+// the share of a consumer is proportional to its weight. Consumers with a
+// weight of zero are only accounted; the others get to share what they leave.
+// On memory pressure, the consumers are purged to half of their size, or
+// completely if the pressure is critical, regardless of the limit.
+//
+// Consumers do not report their size continuously. They call noteGrowth: when
+// they grow, and the budget only asks them for their sizes once the growth may
+// have exceeded the limit. To avoid asking on every growth after that, purging
+// leaves some room below the limit, and the consumers are not asked again until
+// they may have grown by that room. If the consumers with a weight of zero hold
+// more than the limit themselves, the others still keep that room rather than
+// being emptied on every growth.
+//
+// All methods are thread-safe.
+@interface GMMemoryBudget : NSObject {
+ @private
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;            // Signaled when a purge has finished.
+  NSUInteger limit_;
+  NSMutableArray* consumers_;      // GMMemoryBudgetConsumer
+  NSUInteger estimatedSize_;       // An upper bound of the size since last asked.
+  NSUInteger nextPurgeSize_;       // The estimate growth purges wait for.
+  BOOL isPurging_;
+  UInt64 purgedSize_;
+  dispatch_queue_t queue_;         // Memory pressure events, or NULL.
+  dispatch_source_t source_;
+}
+
+// A limit of zero means "unlimited"; consumers are then only purged on memory
+// pressure.
+- (id)initWithLimit:(NSUInteger)limit;
+
+// Adds a consumer. It is retained until removeAllConsumers is called and must
+// implement the methods of GMMemoryBudgetConsumer; purgeCost: is only called
+// if weight is not zero. A consumer that implements setMemoryBudget: is given
+// the budget, to report its growth, until it is removed.
+- (void)addConsumer:(id)consumer name:(NSString *)name weight:(NSUInteger)weight;
+
+// Removes all consumers, after waiting for a purge in progress to finish.
+- (void)removeAllConsumers;
+
+// Called by consumers after they have grown by size bytes. Purges the
+// consumers, on the calling thread, if they may exceed the limit.
+- (void)noteGrowth:(NSUInteger)size;
+
+// Purges the consumers until they hold no more than size bytes, if possible.
+- (void)purgeToSize:(NSUInteger)size;
+
+- (NSUInteger)limit;
+
+// Returns the number of bytes held by all consumers.
+- (NSUInteger)size;
+
+// Returns the number of bytes held by each consumer, by name.
+- (NSDictionary *)sizesByConsumerName;
+
+// Returns the number of bytes purged so far.
+- (UInt64)purgedSize;
+
+@end
+
+// Methods implemented by the consumers of a GMMemoryBudget.
+@interface NSObject (GMMemoryBudgetConsumer)
+
+// Returns the number of bytes held by the consumer.
+- (NSUInteger)totalCost;
+
+// Frees at least cost bytes if possible, the least valuable ones first.
+// Returns the number of bytes freed.
+- (NSUInteger)purgeCost:(NSUInteger)cost;
+
+// Optional. Sets the budget to call noteGrowth: on, or nil.
+- (void)setMemoryBudget:(GMMemoryBudget *)budget;
+
+@end
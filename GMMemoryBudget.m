@@ -0,0 +1,309 @@
+//
+//  GMMemoryBudget.m
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import "GMMemoryBudget.h"
+
+#include <math.h>
+
+@interface GMMemoryBudgetConsumer : NSObject {
+ @public
+  id consumer_;      // Retained
+  NSString* name_;   // Retained
+  NSUInteger weight_;
+  NSUInteger size_;  // As of the last time the consumer was asked.
+}
+@end
+
+@implementation GMMemoryBudgetConsumer
+
+- (void)dealloc {
+  [consumer_ release];
+  [name_ release];
+  [super dealloc];
+}
+
+@end
+
+@interface GMMemoryBudget (Private)
+- (void)handleMemoryPressure;
+@end
+
+#ifdef DISPATCH_MEMORYPRESSURE_WARN
+static void GMMemoryBudgetMemoryPressureHandler(void* context) {
+  [(GMMemoryBudget *)context handleMemoryPressure];
+}
+
+static void GMMemoryBudgetNoop(void* context) {
+}
+#endif
+
+@implementation GMMemoryBudget
+
+- (id)init {
+  return [self initWithLimit:0];
+}
+
+- (id)initWithLimit:(NSUInteger)limit {
+  self = [super init];
+  if (self) {
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&cond_, NULL);
+    limit_ = limit;
+    consumers_ = [[NSMutableArray alloc] init];
+#ifdef DISPATCH_MEMORYPRESSURE_WARN
+    queue_ = dispatch_queue_create("GMMemoryBudget", NULL);
+    source_ = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0,
+                                     DISPATCH_MEMORYPRESSURE_WARN |
+                                     DISPATCH_MEMORYPRESSURE_CRITICAL,
+                                     queue_);
+    if (source_) {
+      // The handler does not retain the budget; dealloc waits for it instead.
+      dispatch_set_context(source_, self);
+      dispatch_source_set_event_handler_f(source_,
+                                          GMMemoryBudgetMemoryPressureHandler);
+      dispatch_resume(source_);
+    }
+#endif
+  }
+  return self;
+}
+
+- (void)dealloc {
+#ifdef DISPATCH_MEMORYPRESSURE_WARN
+  if (source_) {
+    dispatch_source_cancel(source_);
+    dispatch_release(source_);
+  }
+  if (queue_) {
+    dispatch_sync_f(queue_, NULL, GMMemoryBudgetNoop);
+    dispatch_release(queue_);
+  }
+#endif
+  [consumers_ release];
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+#pragma mark Internal
+
+// Asks the consumers for their sizes and purges those above their share of
+// size. The consumers that can be purged share at least reserve bytes, even if
+// the others hold size or more. mutex_ must be held and isPurging_ set; the
+// consumers are called with mutex_ unlocked.
+- (void)purgeConsumersToSize:(NSUInteger)size reserve:(NSUInteger)reserve {
+  NSArray* consumers = [[consumers_ copy] autorelease];
+  pthread_mutex_unlock(&mutex_);
+
+  NSUInteger total = 0;
+  NSUInteger fixedSize = 0;  // Held by consumers that cannot be purged.
+  NSUInteger totalWeight = 0;
+  for (int i = 0, count = [consumers count]; i < count; i++) {
+    GMMemoryBudgetConsumer* consumer = [consumers objectAtIndex:i];
+    consumer->size_ = [consumer->consumer_ totalCost];
+    total += consumer->size_;
+    if (consumer->weight_ == 0) {
+      fixedSize += consumer->size_;
+    } else {
+      totalWeight += consumer->weight_;
+    }
+  }
+
+  NSUInteger freed = 0;
+  NSUInteger available = (size > fixedSize) ? size - fixedSize : 0;
+  available = MAX(available, reserve);
+  if (total - fixedSize > available && totalWeight > 0) {
+    // Consumers below their share do not need to give anything up, so the
+    // excess is spread over those above it, in proportion to how much above
+    // their share they are.
+    NSUInteger excess = total - fixedSize - available;
+    double totalOverage = 0;
+    for (int i = 0, count = [consumers count]; i < count; i++) {
+      GMMemoryBudgetConsumer* consumer = [consumers objectAtIndex:i];
+      if (consumer->weight_ > 0) {
+        double share = (double)available * consumer->weight_ / totalWeight;
+        if (consumer->size_ > share) {
+          totalOverage += consumer->size_ - share;
+        }
+      }
+    }
+    for (int i = 0, count = [consumers count]; i < count && totalOverage > 0; i++) {
+      GMMemoryBudgetConsumer* consumer = [consumers objectAtIndex:i];
+      if (consumer->weight_ == 0) {
+        continue;
+      }
+      double share = (double)available * consumer->weight_ / totalWeight;
+      if (consumer->size_ <= share) {
+        continue;
+      }
+      NSUInteger cost =
+        (NSUInteger)ceil(excess * ((consumer->size_ - share) / totalOverage));
+      if (cost > 0) {
+        freed += [consumer->consumer_ purgeCost:cost];
+      }
+    }
+  }
+
+  pthread_mutex_lock(&mutex_);
+  estimatedSize_ = (freed < total) ? total - freed : 0;
+  nextPurgeSize_ = estimatedSize_ + limit_ / 8;
+  purgedSize_ += freed;
+}
+
+- (void)handleMemoryPressure {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+#ifdef DISPATCH_MEMORYPRESSURE_WARN
+  unsigned long pressure = dispatch_source_get_data(source_);
+  if (pressure & DISPATCH_MEMORYPRESSURE_CRITICAL) {
+    [self purgeToSize:0];
+  } else if (pressure & DISPATCH_MEMORYPRESSURE_WARN) {
+    [self purgeToSize:[self size] / 2];
+  }
+#endif
+  [pool release];
+}
+
+#pragma mark Public
+
+- (void)addConsumer:(id)consumer name:(NSString *)name weight:(NSUInteger)weight {
+  GMMemoryBudgetConsumer* entry = [[GMMemoryBudgetConsumer alloc] init];
+  entry->consumer_ = [consumer retain];
+  entry->name_ = [name copy];
+  entry->weight_ = weight;
+  if ([consumer respondsToSelector:@selector(setMemoryBudget:)]) {
+    [consumer setMemoryBudget:self];
+  }
+  NSUInteger size = [consumer totalCost];
+  pthread_mutex_lock(&mutex_);
+  [consumers_ addObject:entry];
+  estimatedSize_ += size;
+  pthread_mutex_unlock(&mutex_);
+  [entry release];
+}
+
+- (void)removeAllConsumers {
+  pthread_mutex_lock(&mutex_);
+  while (isPurging_) {
+    pthread_cond_wait(&cond_, &mutex_);
+  }
+  NSArray* consumers = [consumers_ copy];
+  [consumers_ removeAllObjects];
+  estimatedSize_ = 0;
+  nextPurgeSize_ = 0;
+  pthread_mutex_unlock(&mutex_);
+  for (int i = 0, count = [consumers count]; i < count; i++) {
+    id consumer = ((GMMemoryBudgetConsumer *)[consumers objectAtIndex:i])->consumer_;
+    if ([consumer respondsToSelector:@selector(setMemoryBudget:)]) {
+      [consumer setMemoryBudget:nil];
+    }
+  }
+  [consumers release];
+}
+
+- (void)noteGrowth:(NSUInteger)size {
+  if (limit_ == 0) {
+    return;
+  }
+  pthread_mutex_lock(&mutex_);
+  estimatedSize_ += size;
+  // Purging again before the consumers have grown by the room the last purge
+  // left would not free more than that growth, e.g. if the consumers with a
+  // weight of zero hold more than the limit.
+  if (estimatedSize_ > MAX(limit_, nextPurgeSize_) && !isPurging_) {
+    // Another purge in progress will see the growth when it asks for sizes.
+    isPurging_ = YES;
+    [self purgeConsumersToSize:limit_ - limit_ / 8 reserve:limit_ / 8];
+    isPurging_ = NO;
+    pthread_cond_broadcast(&cond_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)purgeToSize:(NSUInteger)size {
+  pthread_mutex_lock(&mutex_);
+  while (isPurging_) {
+    pthread_cond_wait(&cond_, &mutex_);
+  }
+  isPurging_ = YES;
+  [self purgeConsumersToSize:size reserve:0];
+  isPurging_ = NO;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (NSUInteger)limit {
+  return limit_;
+}
+
+- (NSUInteger)size {
+  NSDictionary* sizes = [self sizesByConsumerName];
+  NSArray* values = [sizes allValues];
+  NSUInteger size = 0;
+  for (int i = 0, count = [values count]; i < count; i++) {
+    size += [[values objectAtIndex:i] unsignedIntegerValue];
+  }
+  return size;
+}
+
+- (NSDictionary *)sizesByConsumerName {
+  pthread_mutex_lock(&mutex_);
+  NSArray* consumers = [[consumers_ copy] autorelease];
+  pthread_mutex_unlock(&mutex_);
+
+  NSMutableDictionary* sizes = [NSMutableDictionary dictionary];
+  for (int i = 0, count = [consumers count]; i < count; i++) {
+    GMMemoryBudgetConsumer* consumer = [consumers objectAtIndex:i];
+    NSUInteger size = [consumer->consumer_ totalCost];
+    NSNumber* previous = [sizes objectForKey:consumer->name_];
+    if (previous) {
+      size += [previous unsignedIntegerValue];
+    }
+    [sizes setObject:[NSNumber numberWithUnsignedInteger:size]
+              forKey:consumer->name_];
+  }
+  return sizes;
+}
+
+- (UInt64)purgedSize {
+  pthread_mutex_lock(&mutex_);
+  UInt64 purgedSize = purgedSize_;
+  pthread_mutex_unlock(&mutex_);
+  return purgedSize;
+}
+
+@end
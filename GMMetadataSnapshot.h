@@ -0,0 +1,122 @@
+//
+//  GMMetadataSnapshot.h
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+@class GMMemoryBudget;
+
+// Keeps the metadata of a file system across mounts: item attributes,
+// directory listings and symbolic link destinations by path.
+//
+// The snapshot consists of two parts. The entries loaded from the snapshot
+// file are mapped into memory and looked up by binary search. Each of them is
+// returned once, to fill the caches of the file system, and then expires along
+// with the cached copy. The entries set during the mount, and the loaded ones
+// that have been returned, are only recorded, not returned again. They are
+// written to the snapshot file along with the loaded entries that have not
+// been removed by synchronize.
+//
+// The recorded entries are held in memory until then. As a consumer of a
+// GMMemoryBudget they may be purged; purged entries are not written to the
+// snapshot file and are fetched from the delegate on the next mount.
+//
+// Every snapshot file carries the generation of the file system its entries
+// are valid for. Loaded entries of another generation are dropped by
+// updateGeneration:changedPaths: unless the changed paths are known.
+//
+// All methods are thread-safe.
+@interface GMMetadataSnapshot : NSObject {
+ @private
+  pthread_mutex_t mutex_;
+  NSString* path_;
+  NSString* generation_;
+  NSData* data_;                  // Mapped snapshot file, or nil.
+  UInt64 count_;                  // Number of entries in data_.
+  const char* offsets_;           // Entry offsets in data_, sorted by path.
+  UInt8* takenEntries_;           // Bit per loaded entry moved to records_.
+  NSMutableSet* removedPaths_;    // Loaded entries that must not be returned.
+  NSMutableSet* removedTrees_;    // Same for the entries below these paths.
+  NSMutableDictionary* records_;  // Path -> GMMetadataSnapshotRecord
+  NSUInteger totalCost_;          // Approximate bytes held by records_.
+  GMMemoryBudget* budget_;        // Not retained; may be nil.
+}
+
+// Loads the snapshot file at path if it exists and is intact. The snapshot is
+// written back to path by synchronize.
+- (id)initWithContentsOfFile:(NSString *)path;
+
+// The generation of the loaded entries, or nil if none have been loaded.
+- (NSString *)generation;
+
+// Makes generation the generation of the snapshot. If it differs from the
+// generation of the loaded entries, the entries for changedPaths and the
+// items below them, and the listings of the directories containing them, are
+// removed. If changedPaths is nil, all loaded entries are removed.
+- (void)updateGeneration:(NSString *)generation changedPaths:(NSArray *)changedPaths;
+
+// Loaded entries. Return NO or nil if there is no such entry, or if it has
+// been returned before.
+- (BOOL)getStat:(struct stat *)stbuf forPath:(NSString *)path;
+- (NSArray *)contentsOfDirectoryAtPath:(NSString *)path;
+- (NSString *)destinationOfSymbolicLinkAtPath:(NSString *)path;
+
+// Recorded entries.
+- (void)setStat:(const struct stat *)stbuf forPath:(NSString *)path;
+- (void)setContents:(NSArray *)contents ofDirectoryAtPath:(NSString *)path;
+- (void)setDestination:(NSString *)destination
+  ofSymbolicLinkAtPath:(NSString *)path;
+
+// Removes the loaded and recorded entries for path, and for all paths below it
+// if recursive is YES.
+- (void)removeEntriesForPath:(NSString *)path recursive:(BOOL)recursive;
+
+// Writes the snapshot file. Returns NO if writing it failed.
+- (BOOL)synchronize;
+
+// Returns the number of recorded entries.
+- (NSUInteger)count;
+
+// GMMemoryBudgetConsumer. Purging removes recorded entries.
+- (NSUInteger)totalCost;
+- (NSUInteger)purgeCost:(NSUInteger)cost;
+- (void)setMemoryBudget:(GMMemoryBudget *)budget;
+
+@end
@@ -0,0 +1,785 @@
+//
+//  GMMetadataSnapshot.m
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import "GMMetadataSnapshot.h"
+
+#import "GMMemoryBudget.h"
+
+#include <stdlib.h>
+
+#define GM_METADATA_SNAPSHOT_MAGIC 0x474d4d53  // 'GMMS'
+#define GM_METADATA_SNAPSHOT_VERSION 1
+
+// The file starts with the header, followed by the generation padded to a
+// multiple of 8 bytes, the offsets of the entries (UInt64 each, sorted by
+// path) and the entries. An entry consists of:
+//   UInt32 pathLength, UInt32 flags, path
+//   if kEntryHasStat:        struct stat
+//   if kEntryHasContents:    UInt32 count, count times (UInt32 length, name)
+//   if kEntryHasDestination: UInt32 length, destination
+// Strings are UTF-8 without terminating NUL. All numbers are in host byte
+// order; the snapshot is not meant to move between machines.
+typedef struct {
+  UInt32 magic;
+  UInt32 version;
+  UInt64 count;
+  UInt32 generationLength;
+  UInt32 statSize;  // sizeof(struct stat) of the writer.
+} GMMetadataSnapshotHeader;
+
+// Approximate bytes held by a record besides its sections, and by a name in a
+// directory listing.
+static const NSUInteger kRecordCost = 64;
+static const NSUInteger kRecordNameCost = 64;
+
+// Number of entries synchronize writes per autorelease pool.
+static const NSUInteger kSynchronizePoolInterval = 1024;
+
+enum {
+  kEntryHasStat = 1 << 0,
+  kEntryHasContents = 1 << 1,
+  kEntryHasDestination = 1 << 2,
+};
+
+// Reads from a bounded region of the mapped file. Entries are not aligned, so
+// all reads copy.
+typedef struct {
+  const char* pos;
+  const char* end;
+} GMSnapshotCursor;
+
+static BOOL GMSnapshotRead(GMSnapshotCursor* cursor, void* buffer, size_t size) {
+  if ((size_t)(cursor->end - cursor->pos) < size) {
+    return NO;
+  }
+  memcpy(buffer, cursor->pos, size);
+  cursor->pos += size;
+  return YES;
+}
+
+static NSString* GMSnapshotReadString(GMSnapshotCursor* cursor) {
+  UInt32 length;
+  if (!GMSnapshotRead(cursor, &length, sizeof(length)) ||
+      (size_t)(cursor->end - cursor->pos) < length) {
+    return nil;
+  }
+  NSString* string = [[[NSString alloc] initWithBytes:cursor->pos
+                                               length:length
+                                             encoding:NSUTF8StringEncoding] autorelease];
+  cursor->pos += length;
+  return string;
+}
+
+static BOOL GMSnapshotSkipString(GMSnapshotCursor* cursor) {
+  UInt32 length;
+  if (!GMSnapshotRead(cursor, &length, sizeof(length)) ||
+      (size_t)(cursor->end - cursor->pos) < length) {
+    return NO;
+  }
+  cursor->pos += length;
+  return YES;
+}
+
+// Advances cursor past the sections of an entry without decoding them.
+static BOOL GMSnapshotSkipEntry(GMSnapshotCursor* cursor, UInt32 flags) {
+  if (flags & kEntryHasStat) {
+    if ((size_t)(cursor->end - cursor->pos) < sizeof(struct stat)) {
+      return NO;
+    }
+    cursor->pos += sizeof(struct stat);
+  }
+  if (flags & kEntryHasContents) {
+    UInt32 count;
+    if (!GMSnapshotRead(cursor, &count, sizeof(count))) {
+      return NO;
+    }
+    for (UInt32 i = 0; i < count; ++i) {
+      if (!GMSnapshotSkipString(cursor)) {
+        return NO;
+      }
+    }
+  }
+  if ((flags & kEntryHasDestination) && !GMSnapshotSkipString(cursor)) {
+    return NO;
+  }
+  return YES;
+}
+
+static void GMSnapshotAppendString(NSMutableData* data, NSString* string) {
+  const char* bytes = [string UTF8String];
+  UInt32 length = (UInt32)strlen(bytes);
+  [data appendBytes:&length length:sizeof(length)];
+  [data appendBytes:bytes length:length];
+}
+
+// Orders paths like the entries of the snapshot file: by their UTF-8 bytes.
+static int GMSnapshotComparePathBytes(const char* path1, size_t length1,
+                                      const char* path2, size_t length2) {
+  int result = memcmp(path1, path2, MIN(length1, length2));
+  if (result == 0 && length1 != length2) {
+    result = (length1 < length2) ? -1 : 1;
+  }
+  return result;
+}
+
+@interface GMMetadataSnapshotRecord : NSObject {
+ @public
+  NSData* stat_;           // Retained; struct stat or nil.
+  NSArray* contents_;      // Retained
+  NSString* destination_;  // Retained
+  UInt32 loaded_;          // Sections taken from the loaded entry, not returned yet.
+  NSUInteger cost_;        // Accounted in totalCost_ of the snapshot.
+}
+@end
+
+@implementation GMMetadataSnapshotRecord
+
+- (void)dealloc {
+  [stat_ release];
+  [contents_ release];
+  [destination_ release];
+  [super dealloc];
+}
+
+@end
+
+static void GMSnapshotAppendEntry(NSMutableData* entries, const char* path,
+                                  UInt32 pathLength,
+                                  GMMetadataSnapshotRecord* record) {
+  UInt32 flags = (record->stat_ ? kEntryHasStat : 0) |
+                 (record->contents_ ? kEntryHasContents : 0) |
+                 (record->destination_ ? kEntryHasDestination : 0);
+  [entries appendBytes:&pathLength length:sizeof(pathLength)];
+  [entries appendBytes:&flags length:sizeof(flags)];
+  [entries appendBytes:path length:pathLength];
+  if (record->stat_) {
+    [entries appendData:record->stat_];
+  }
+  if (record->contents_) {
+    UInt32 count = (UInt32)[record->contents_ count];
+    [entries appendBytes:&count length:sizeof(count)];
+    for (UInt32 i = 0; i < count; ++i) {
+      GMSnapshotAppendString(entries, [record->contents_ objectAtIndex:i]);
+    }
+  }
+  if (record->destination_) {
+    GMSnapshotAppendString(entries, record->destination_);
+  }
+}
+
+// A recorded entry, sorted by synchronize.
+typedef struct {
+  char* path;  // UTF-8; malloc'ed.
+  UInt32 pathLength;
+  GMMetadataSnapshotRecord* record;  // Not retained
+} GMSnapshotRecordedEntry;
+
+static int GMSnapshotCompareRecordedEntries(const void* entry1, const void* entry2) {
+  const GMSnapshotRecordedEntry* recorded1 = entry1;
+  const GMSnapshotRecordedEntry* recorded2 = entry2;
+  return GMSnapshotComparePathBytes(recorded1->path, recorded1->pathLength,
+                                    recorded2->path, recorded2->pathLength);
+}
+
+@implementation GMMetadataSnapshot
+
+- (id)initWithContentsOfFile:(NSString *)path {
+  self = [super init];
+  if (self) {
+    pthread_mutex_init(&mutex_, NULL);
+    path_ = [path copy];
+    removedPaths_ = [[NSMutableSet alloc] init];
+    removedTrees_ = [[NSMutableSet alloc] init];
+    records_ = [[NSMutableDictionary alloc] init];
+    [self load];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  free(takenEntries_);
+  [records_ release];
+  [removedTrees_ release];
+  [removedPaths_ release];
+  [data_ release];
+  [generation_ release];
+  [path_ release];
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+- (void)load {
+  NSData* data = [NSData dataWithContentsOfFile:path_
+                                        options:NSDataReadingMappedAlways
+                                          error:NULL];
+  GMSnapshotCursor cursor = { [data bytes], (const char *)[data bytes] + [data length] };
+  GMMetadataSnapshotHeader header;
+  if (!GMSnapshotRead(&cursor, &header, sizeof(header)) ||
+      header.magic != GM_METADATA_SNAPSHOT_MAGIC ||
+      header.version != GM_METADATA_SNAPSHOT_VERSION ||
+      header.statSize != sizeof(struct stat)) {
+    return;
+  }
+  size_t generationSize = (header.generationLength + 7) & ~7;
+  if ((size_t)(cursor.end - cursor.pos) < generationSize ||
+      (UInt64)(cursor.end - cursor.pos - generationSize) / sizeof(UInt64) < header.count) {
+    return;
+  }
+  NSString* generation =
+    [[NSString alloc] initWithBytes:cursor.pos
+                             length:header.generationLength
+                           encoding:NSUTF8StringEncoding];
+  if (!generation) {
+    return;
+  }
+  generation_ = generation;
+  data_ = [data retain];
+  count_ = header.count;
+  offsets_ = cursor.pos + generationSize;
+  takenEntries_ = calloc((size_t)((count_ + 7) / 8), 1);
+}
+
+#pragma mark Internal (mutex_ must be held)
+
+// Returns a cursor positioned after the path of the entry at index, or NO if
+// the entry is damaged.
+- (BOOL)getCursor:(GMSnapshotCursor *)cursor
+            flags:(UInt32 *)flags
+             path:(const char **)path
+       pathLength:(UInt32 *)pathLength
+          atIndex:(UInt64)index {
+  UInt64 offset;
+  memcpy(&offset, offsets_ + index * sizeof(UInt64), sizeof(offset));
+  if (offset > [data_ length]) {
+    return NO;
+  }
+  cursor->pos = (const char *)[data_ bytes] + offset;
+  cursor->end = (const char *)[data_ bytes] + [data_ length];
+  if (!GMSnapshotRead(cursor, pathLength, sizeof(*pathLength)) ||
+      !GMSnapshotRead(cursor, flags, sizeof(*flags)) ||
+      (size_t)(cursor->end - cursor->pos) < *pathLength) {
+    return NO;
+  }
+  *path = cursor->pos;
+  cursor->pos += *pathLength;
+  return YES;
+}
+
+- (BOOL)isRemovedPath:(NSString *)path {
+  if ([removedPaths_ containsObject:path]) {
+    return YES;
+  }
+  if ([removedTrees_ count] > 0) {
+    while (YES) {
+      if ([removedTrees_ containsObject:path]) {
+        return YES;
+      }
+      if ([path isEqualToString:@"/"] || [path length] == 0) {
+        return NO;
+      }
+      path = [path stringByDeletingLastPathComponent];
+    }
+  }
+  return NO;
+}
+
+- (BOOL)isRemovedPathBytes:(const char *)bytes length:(UInt32)length {
+  if ([removedPaths_ count] == 0 && [removedTrees_ count] == 0) {
+    return NO;
+  }
+  NSString* path = [[[NSString alloc] initWithBytes:bytes
+                                             length:length
+                                           encoding:NSUTF8StringEncoding] autorelease];
+  return !path || [self isRemovedPath:path];
+}
+
+- (BOOL)isTakenEntryAtIndex:(UInt64)index {
+  return (takenEntries_[index / 8] & (1 << (index % 8))) != 0;
+}
+
+// Looks up the loaded entry for path that has not been taken yet and positions
+// cursor after its path.
+- (BOOL)getCursor:(GMSnapshotCursor *)cursor
+            flags:(UInt32 *)flags
+            index:(UInt64 *)index
+          forPath:(NSString *)path {
+  if (!data_ || [self isRemovedPath:path]) {
+    return NO;
+  }
+  const char* bytes = [path UTF8String];
+  size_t length = strlen(bytes);
+  UInt64 low = 0;
+  UInt64 high = count_;
+  while (low < high) {
+    UInt64 mid = low + (high - low) / 2;
+    const char* entryPath;
+    UInt32 entryPathLength;
+    if (![self getCursor:cursor
+                   flags:flags
+                    path:&entryPath
+              pathLength:&entryPathLength
+                 atIndex:mid]) {
+      return NO;
+    }
+    int result = GMSnapshotComparePathBytes(entryPath, entryPathLength,
+                                            bytes, length);
+    if (result == 0) {
+      *index = mid;
+      return ![self isTakenEntryAtIndex:mid];
+    }
+    if (result < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return NO;
+}
+
+// Decodes the sections of the entry following the path.
+- (GMMetadataSnapshotRecord *)recordWithCursor:(GMSnapshotCursor *)cursor
+                                         flags:(UInt32)flags {
+  GMMetadataSnapshotRecord* record = [[[GMMetadataSnapshotRecord alloc] init] autorelease];
+  if (flags & kEntryHasStat) {
+    struct stat stbuf;
+    if (!GMSnapshotRead(cursor, &stbuf, sizeof(stbuf))) {
+      return nil;
+    }
+    record->stat_ = [[NSData alloc] initWithBytes:&stbuf length:sizeof(stbuf)];
+  }
+  if (flags & kEntryHasContents) {
+    UInt32 count;
+    if (!GMSnapshotRead(cursor, &count, sizeof(count)) ||
+        (size_t)(cursor->end - cursor->pos) / sizeof(UInt32) < count) {
+      return nil;
+    }
+    NSMutableArray* contents = [NSMutableArray arrayWithCapacity:count];
+    for (UInt32 i = 0; i < count; ++i) {
+      NSString* name = GMSnapshotReadString(cursor);
+      if (!name) {
+        return nil;
+      }
+      [contents addObject:name];
+    }
+    record->contents_ = [contents copy];
+  }
+  if (flags & kEntryHasDestination) {
+    NSString* destination = GMSnapshotReadString(cursor);
+    if (!destination) {
+      return nil;
+    }
+    record->destination_ = [destination retain];
+  }
+  return record;
+}
+
+// Returns the record for path if the section of the loaded entry for path has
+// not been returned yet. The loaded entry is moved to the recorded ones on the
+// first lookup, so it is written back by synchronize, and each of its sections
+// is only returned once. After that, the section is looked up in the caches of
+// the file system, and expires with them.
+- (GMMetadataSnapshotRecord *)takeSection:(UInt32)section
+                                  forPath:(NSString *)path
+                                   growth:(NSUInteger *)growth {
+  GMMetadataSnapshotRecord* record = [records_ objectForKey:path];
+  GMSnapshotCursor cursor;
+  UInt32 flags;
+  UInt64 index;
+  if ([self getCursor:&cursor flags:&flags index:&index forPath:path]) {
+    takenEntries_[index / 8] |= (1 << (index % 8));
+    GMMetadataSnapshotRecord* loaded = [self recordWithCursor:&cursor flags:flags];
+    if (loaded && !record) {
+      loaded->loaded_ = flags;
+      [records_ setObject:loaded forKey:path];
+      record = loaded;
+    } else if (loaded) {
+      // Sections recorded during the mount are more recent.
+      if (!record->stat_ && loaded->stat_) {
+        record->stat_ = [loaded->stat_ retain];
+        record->loaded_ |= kEntryHasStat;
+      }
+      if (!record->contents_ && loaded->contents_) {
+        record->contents_ = [loaded->contents_ retain];
+        record->loaded_ |= kEntryHasContents;
+      }
+      if (!record->destination_ && loaded->destination_) {
+        record->destination_ = [loaded->destination_ retain];
+        record->loaded_ |= kEntryHasDestination;
+      }
+    }
+    *growth = [self updateCostOfRecord:record forPath:path];
+  }
+  if (!record || !(record->loaded_ & section)) {
+    return nil;
+  }
+  record->loaded_ &= ~section;
+  return record;
+}
+
+- (GMMetadataSnapshotRecord *)recordedRecordForPath:(NSString *)path {
+  GMMetadataSnapshotRecord* record = [records_ objectForKey:path];
+  if (!record) {
+    record = [[GMMetadataSnapshotRecord alloc] init];
+    [records_ setObject:record forKey:path];
+    [record release];
+  }
+  return record;
+}
+
+// Accounts for the sections of the record for path. Returns the growth.
+- (NSUInteger)updateCostOfRecord:(GMMetadataSnapshotRecord *)record
+                         forPath:(NSString *)path {
+  NSUInteger cost = kRecordCost + [path length] + [record->stat_ length] +
+                    [record->contents_ count] * kRecordNameCost +
+                    [record->destination_ length];
+  NSUInteger growth = (cost > record->cost_) ? cost - record->cost_ : 0;
+  totalCost_ = totalCost_ - record->cost_ + cost;
+  record->cost_ = cost;
+  return growth;
+}
+
+- (void)removeRecordForPath:(NSString *)path {
+  GMMetadataSnapshotRecord* record = [records_ objectForKey:path];
+  if (record) {
+    totalCost_ -= record->cost_;
+    [records_ removeObjectForKey:path];
+  }
+}
+
+- (void)removeAllLoadedEntries {
+  [data_ release];
+  data_ = nil;
+  count_ = 0;
+  offsets_ = NULL;
+  free(takenEntries_);
+  takenEntries_ = NULL;
+  [removedPaths_ removeAllObjects];
+  [removedTrees_ removeAllObjects];
+}
+
+#pragma mark Public
+
+- (NSString *)generation {
+  pthread_mutex_lock(&mutex_);
+  NSString* generation = data_ ? [[generation_ retain] autorelease] : nil;
+  pthread_mutex_unlock(&mutex_);
+  return generation;
+}
+
+- (void)updateGeneration:(NSString *)generation
+            changedPaths:(NSArray *)changedPaths {
+  pthread_mutex_lock(&mutex_);
+  if (![generation isEqualToString:generation_]) {
+    if (changedPaths) {
+      for (int i = 0, count = [changedPaths count]; i < count; i++) {
+        NSString* path = [changedPaths objectAtIndex:i];
+        [removedTrees_ addObject:path];
+        if (![path isEqualToString:@"/"]) {
+          [removedPaths_ addObject:[path stringByDeletingLastPathComponent]];
+        }
+      }
+    } else {
+      [self removeAllLoadedEntries];
+    }
+    [generation_ autorelease];
+    generation_ = [generation copy];
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (BOOL)getStat:(struct stat *)stbuf forPath:(NSString *)path {
+  NSUInteger growth = 0;
+  pthread_mutex_lock(&mutex_);
+  GMMetadataSnapshotRecord* record = [self takeSection:kEntryHasStat
+                                               forPath:path
+                                                growth:&growth];
+  if (record) {
+    [record->stat_ getBytes:stbuf length:sizeof(struct stat)];
+  }
+  pthread_mutex_unlock(&mutex_);
+  [budget_ noteGrowth:growth];
+  return (record != nil);
+}
+
+- (NSArray *)contentsOfDirectoryAtPath:(NSString *)path {
+  NSUInteger growth = 0;
+  pthread_mutex_lock(&mutex_);
+  GMMetadataSnapshotRecord* record = [self takeSection:kEntryHasContents
+                                               forPath:path
+                                                growth:&growth];
+  NSArray* contents = record ? [[record->contents_ retain] autorelease] : nil;
+  pthread_mutex_unlock(&mutex_);
+  [budget_ noteGrowth:growth];
+  return contents;
+}
+
+- (NSString *)destinationOfSymbolicLinkAtPath:(NSString *)path {
+  NSUInteger growth = 0;
+  pthread_mutex_lock(&mutex_);
+  GMMetadataSnapshotRecord* record = [self takeSection:kEntryHasDestination
+                                               forPath:path
+                                                growth:&growth];
+  NSString* destination = record ? [[record->destination_ retain] autorelease] : nil;
+  pthread_mutex_unlock(&mutex_);
+  [budget_ noteGrowth:growth];
+  return destination;
+}
+
+- (void)setStat:(const struct stat *)stbuf forPath:(NSString *)path {
+  NSData* data = [[NSData alloc] initWithBytes:stbuf length:sizeof(struct stat)];
+  pthread_mutex_lock(&mutex_);
+  GMMetadataSnapshotRecord* record = [self recordedRecordForPath:path];
+  [record->stat_ release];
+  record->stat_ = data;
+  record->loaded_ &= ~kEntryHasStat;
+  NSUInteger growth = [self updateCostOfRecord:record forPath:path];
+  pthread_mutex_unlock(&mutex_);
+  [budget_ noteGrowth:growth];
+}
+
+- (void)setContents:(NSArray *)contents ofDirectoryAtPath:(NSString *)path {
+  contents = [contents copy];
+  pthread_mutex_lock(&mutex_);
+  GMMetadataSnapshotRecord* record = [self recordedRecordForPath:path];
+  [record->contents_ release];
+  record->contents_ = contents;
+  record->loaded_ &= ~kEntryHasContents;
+  NSUInteger growth = [self updateCostOfRecord:record forPath:path];
+  pthread_mutex_unlock(&mutex_);
+  [budget_ noteGrowth:growth];
+}
+
+- (void)setDestination:(NSString *)destination
+  ofSymbolicLinkAtPath:(NSString *)path {
+  destination = [destination copy];
+  pthread_mutex_lock(&mutex_);
+  GMMetadataSnapshotRecord* record = [self recordedRecordForPath:path];
+  [record->destination_ release];
+  record->destination_ = destination;
+  record->loaded_ &= ~kEntryHasDestination;
+  NSUInteger growth = [self updateCostOfRecord:record forPath:path];
+  pthread_mutex_unlock(&mutex_);
+  [budget_ noteGrowth:growth];
+}
+
+- (void)removeEntriesForPath:(NSString *)path recursive:(BOOL)recursive {
+  pthread_mutex_lock(&mutex_);
+  if (data_) {
+    [(recursive ? removedTrees_ : removedPaths_) addObject:path];
+  }
+  [self removeRecordForPath:path];
+  if (recursive && [records_ count] > 0) {
+    NSString* prefix =
+      [path isEqualToString:@"/"] ? path : [path stringByAppendingString:@"/"];
+    NSArray* paths = [records_ allKeys];
+    for (int i = 0, count = [paths count]; i < count; i++) {
+      NSString* recordPath = [paths objectAtIndex:i];
+      if ([recordPath hasPrefix:prefix]) {
+        [self removeRecordForPath:recordPath];
+      }
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (BOOL)synchronize {
+  pthread_mutex_lock(&mutex_);
+  if (!generation_) {
+    pthread_mutex_unlock(&mutex_);
+    return NO;  // Nothing to say what the entries are valid for.
+  }
+
+  // Sort the recorded entries like the loaded ones, by their UTF-8 paths.
+  NSArray* recordedPaths = [records_ allKeys];
+  NSUInteger recordedCount = [recordedPaths count];
+  GMSnapshotRecordedEntry* recorded =
+    malloc(MAX(recordedCount, 1) * sizeof(GMSnapshotRecordedEntry));
+  for (NSUInteger k = 0; k < recordedCount; ++k) {
+    NSString* path = [recordedPaths objectAtIndex:k];
+    NSUInteger maxLength =
+      [path maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding] + 1;
+    recorded[k].path = malloc(maxLength);
+    [path getCString:recorded[k].path
+           maxLength:maxLength
+            encoding:NSUTF8StringEncoding];
+    recorded[k].pathLength = (UInt32)strlen(recorded[k].path);
+    recorded[k].record = [records_ objectForKey:path];
+  }
+  qsort(recorded, recordedCount, sizeof(GMSnapshotRecordedEntry),
+        GMSnapshotCompareRecordedEntries);
+
+  // Merge the recorded entries into the loaded ones that are still valid, in
+  // one pass over both. Loaded entries without a recorded one are copied as
+  // they are.
+  NSMutableData* entries = [NSMutableData data];
+  NSMutableData* offsets = [NSMutableData data];
+  UInt64 i = 0;
+  NSUInteger j = 0;
+  NSUInteger steps = 0;
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  while (YES) {
+    if (++steps % kSynchronizePoolInterval == 0) {
+      [pool release];
+      pool = [[NSAutoreleasePool alloc] init];
+    }
+    GMSnapshotCursor cursor;
+    UInt32 flags;
+    const char* pathBytes = NULL;
+    UInt32 pathLength = 0;
+    for (; i < count_; ++i) {
+      if (![self isTakenEntryAtIndex:i] &&
+          [self getCursor:&cursor
+                    flags:&flags
+                     path:&pathBytes
+               pathLength:&pathLength
+                  atIndex:i]) {
+        break;
+      }
+    }
+    GMSnapshotRecordedEntry* next = (j < recordedCount) ? &recorded[j] : NULL;
+    if (i == count_ && !next) {
+      break;
+    }
+    int order = (i == count_) ? 1 : !next ? -1 :
+      GMSnapshotComparePathBytes(pathBytes, pathLength,
+                                 next->path, next->pathLength);
+    UInt64 offset = [entries length];
+    if (order < 0) {
+      const char* entryStart = pathBytes - 2 * sizeof(UInt32);
+      if (GMSnapshotSkipEntry(&cursor, flags) &&
+          ![self isRemovedPathBytes:pathBytes length:pathLength]) {
+        [offsets appendBytes:&offset length:sizeof(offset)];
+        [entries appendBytes:entryStart length:cursor.pos - entryStart];
+      }
+      ++i;
+      continue;
+    }
+    GMMetadataSnapshotRecord* record = next->record;
+    if (order == 0) {
+      GMMetadataSnapshotRecord* loaded =
+        [self isRemovedPathBytes:pathBytes length:pathLength]
+          ? nil : [self recordWithCursor:&cursor flags:flags];
+      if (loaded) {
+        // Sections recorded during the mount are more recent.
+        if (record->stat_) {
+          [loaded->stat_ release];
+          loaded->stat_ = [record->stat_ retain];
+        }
+        if (record->contents_) {
+          [loaded->contents_ release];
+          loaded->contents_ = [record->contents_ retain];
+        }
+        if (record->destination_) {
+          [loaded->destination_ release];
+          loaded->destination_ = [record->destination_ retain];
+        }
+        record = loaded;
+      }
+      ++i;
+    }
+    [offsets appendBytes:&offset length:sizeof(offset)];
+    GMSnapshotAppendEntry(entries, next->path, next->pathLength, record);
+    ++j;
+  }
+  [pool release];
+  for (NSUInteger k = 0; k < recordedCount; ++k) {
+    free(recorded[k].path);
+  }
+  free(recorded);
+
+  // Entry offsets are relative to the start of the file.
+  const char* generationBytes = [generation_ UTF8String];
+  GMMetadataSnapshotHeader header;
+  header.magic = GM_METADATA_SNAPSHOT_MAGIC;
+  header.version = GM_METADATA_SNAPSHOT_VERSION;
+  header.count = [offsets length] / sizeof(UInt64);
+  header.generationLength = (UInt32)strlen(generationBytes);
+  header.statSize = sizeof(struct stat);
+  size_t generationSize = (header.generationLength + 7) & ~7;
+  UInt64 base = sizeof(header) + generationSize + [offsets length];
+  UInt64* offsetValues = [offsets mutableBytes];
+  for (UInt64 k = 0; k < header.count; ++k) {
+    offsetValues[k] += base;
+  }
+
+  NSMutableData* file = [NSMutableData dataWithCapacity:base + [entries length]];
+  [file appendBytes:&header length:sizeof(header)];
+  [file appendBytes:generationBytes length:header.generationLength];
+  [file increaseLengthBy:generationSize - header.generationLength];
+  [file appendData:offsets];
+  [file appendData:entries];
+  pthread_mutex_unlock(&mutex_);
+
+  // The mapped file is replaced, not modified, so data_ stays valid.
+  return [file writeToFile:path_ atomically:YES];
+}
+
+- (NSUInteger)count {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger count = [records_ count];
+  pthread_mutex_unlock(&mutex_);
+  return count;
+}
+
+#pragma mark GMMemoryBudgetConsumer
+
+- (NSUInteger)totalCost {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger totalCost = totalCost_;
+  pthread_mutex_unlock(&mutex_);
+  return totalCost;
+}
+
+- (NSUInteger)purgeCost:(NSUInteger)cost {
+  NSUInteger freed = 0;
+  pthread_mutex_lock(&mutex_);
+  NSArray* paths = [records_ allKeys];
+  for (int i = 0, count = [paths count]; i < count && freed < cost; i++) {
+    NSString* path = [paths objectAtIndex:i];
+    freed += ((GMMetadataSnapshotRecord *)[records_ objectForKey:path])->cost_;
+    [self removeRecordForPath:path];
+  }
+  pthread_mutex_unlock(&mutex_);
+  return freed;
+}
+
+- (void)setMemoryBudget:(GMMemoryBudget *)budget {
+  budget_ = budget;
+}
+
+@end
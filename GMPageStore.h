@@ -0,0 +1,139 @@
+//
+//  GMPageStore.h
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+
+#include <pthread.h>
+
+// Default size in bytes of the pages of a GMPageStore.
+#define GM_PAGE_STORE_DEFAULT_PAGE_SIZE (64 * 1024)
+
+// Memory shared by several page stores, e.g. all files of a mount. A page
+// store whose next page does not fit into its budget spills to disk.
+//
+// All methods are thread-safe.
+@interface GMPageStoreBudget : NSObject {
+ @private
+  pthread_mutex_t mutex_;
+  NSUInteger limit_;
+  NSUInteger size_;
+  UInt64 spilledSize_;
+}
+
+// A limit of zero means "unlimited".
+- (id)initWithLimit:(NSUInteger)limit;
+
+// Returns NO, without reserving anything, if size bytes do not fit.
+- (BOOL)reserveSize:(NSUInteger)size;
+// Reserves size bytes even if they exceed the limit.
+- (void)addSize:(NSUInteger)size;
+- (void)releaseSize:(NSUInteger)size;
+- (void)addSpilledSize:(UInt64)size;
+
+- (NSUInteger)limit;
+
+// Returns the number of bytes currently reserved.
+- (NSUInteger)size;
+
+// Returns the number of bytes written to disk by spilled page stores.
+- (UInt64)spilledSize;
+
+@end
+
+// Sparse, growable byte storage made of fixed-size pages. Pages are allocated
+// on first write; ranges that have never been written are holes that read as
+// zeros and take no memory. Growing the store never moves existing bytes, and
+// truncating it only touches the pages that are dropped.
+//
+// Once the pages exceed the memory limit of the store or no longer fit into its
+// budget, the contents move to an unlinked temporary file and all further I/O
+// uses pread(2) and pwrite(2) on it.
+//
+// All methods are thread-safe.
+@interface GMPageStore : NSObject {
+ @private
+  pthread_mutex_t mutex_;
+  NSMutableDictionary* pages_;  // NSNumber page index -> NSMutableData
+  NSUInteger pageSize_;
+  off_t length_;
+  NSUInteger memoryLimit_;      // Zero means "unlimited".
+  GMPageStoreBudget* budget_;   // Retained; may be nil.
+  int fd_;                      // The temporary file once spilled, else -1.
+  UInt64 spilledSize_;
+}
+
+- (id)initWithPageSize:(NSUInteger)pageSize;
+
+// Returns the number of bytes read, which is less than size at the end of the
+// store, or -1 on error.
+- (ssize_t)readToBuffer:(char *)buffer
+                   size:(size_t)size
+                 offset:(off_t)offset
+                  error:(NSError **)error;
+
+// Writes size bytes at offset, extending the store if needed.
+- (BOOL)writeFromBuffer:(const char *)buffer
+                   size:(size_t)size
+                 offset:(off_t)offset
+                  error:(NSError **)error;
+
+// Sets the length of the store. Growing the store appends a hole.
+- (BOOL)truncateToLength:(off_t)length error:(NSError **)error;
+
+- (off_t)length;
+
+// Sets the maximum number of bytes of memory used by pages.
+- (void)setMemoryLimit:(NSUInteger)limit;
+- (NSUInteger)memoryLimit;
+
+// Sets the budget that the pages are accounted to.
+- (void)setBudget:(GMPageStoreBudget *)budget;
+
+// Returns the number of bytes of memory used by allocated pages.
+- (NSUInteger)allocatedSize;
+
+// Returns YES if the contents have moved to disk.
+- (BOOL)isSpilled;
+
+// Returns the number of bytes written to disk.
+- (UInt64)spilledSize;
+
+// Returns a copy of the contents, or nil on error. Holes are filled with zeros.
+- (NSData *)data;
+
+@end
@@ -0,0 +1,419 @@
+//
+//  GMPageStore.m
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import "GMPageStore.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static NSError* GMPageStoreError(int code) {
+  return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+}
+
+@implementation GMPageStoreBudget
+
+- (id)init {
+  return [self initWithLimit:0];
+}
+
+- (id)initWithLimit:(NSUInteger)limit {
+  self = [super init];
+  if (self) {
+    pthread_mutex_init(&mutex_, NULL);
+    limit_ = limit;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+- (BOOL)reserveSize:(NSUInteger)size {
+  pthread_mutex_lock(&mutex_);
+  BOOL reserved = (limit_ == 0 || size_ + size <= limit_);
+  if (reserved) {
+    size_ += size;
+  }
+  pthread_mutex_unlock(&mutex_);
+  return reserved;
+}
+
+- (void)addSize:(NSUInteger)size {
+  pthread_mutex_lock(&mutex_);
+  size_ += size;
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)releaseSize:(NSUInteger)size {
+  pthread_mutex_lock(&mutex_);
+  size_ = (size < size_) ? size_ - size : 0;
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)addSpilledSize:(UInt64)size {
+  pthread_mutex_lock(&mutex_);
+  spilledSize_ += size;
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (NSUInteger)limit {
+  return limit_;
+}
+
+- (NSUInteger)size {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger size = size_;
+  pthread_mutex_unlock(&mutex_);
+  return size;
+}
+
+- (UInt64)spilledSize {
+  pthread_mutex_lock(&mutex_);
+  UInt64 spilledSize = spilledSize_;
+  pthread_mutex_unlock(&mutex_);
+  return spilledSize;
+}
+
+@end
+
+@implementation GMPageStore
+
+- (id)init {
+  return [self initWithPageSize:GM_PAGE_STORE_DEFAULT_PAGE_SIZE];
+}
+
+- (id)initWithPageSize:(NSUInteger)pageSize {
+  self = [super init];
+  if (self) {
+    pthread_mutex_init(&mutex_, NULL);
+    pages_ = [[NSMutableDictionary alloc] init];
+    pageSize_ = (pageSize > 0) ? pageSize : GM_PAGE_STORE_DEFAULT_PAGE_SIZE;
+    fd_ = -1;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [budget_ releaseSize:[pages_ count] * pageSize_];
+  [budget_ release];
+  [pages_ release];
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+#pragma mark Internal (mutex_ must be held)
+
+- (NSMutableData *)pageAtIndex:(UInt64)index {
+  return [pages_ objectForKey:[NSNumber numberWithUnsignedLongLong:index]];
+}
+
+- (ssize_t)copyToBuffer:(char *)buffer
+                   size:(size_t)size
+                 offset:(off_t)offset
+                  error:(NSError **)error {
+  if (offset >= length_) {
+    return 0;
+  }
+  if (offset + size > length_) {
+    size = length_ - offset;
+  }
+  size_t copied = 0;
+  while (copied < size) {
+    off_t position = offset + copied;
+    if (fd_ >= 0) {
+      ssize_t res = pread(fd_, buffer + copied, size - copied, position);
+      if (res < 0 && errno == EINTR) {
+        continue;
+      }
+      if (res < 0) {
+        *error = GMPageStoreError(errno);
+        return -1;
+      }
+      if (res == 0) {
+        break;  // The temporary file always has the length of the store.
+      }
+      copied += res;
+      continue;
+    }
+    UInt64 index = position / pageSize_;
+    NSUInteger pageOffset = position % pageSize_;
+    size_t length = MIN(size - copied, pageSize_ - pageOffset);
+    NSMutableData* page = [self pageAtIndex:index];
+    if (page) {
+      memcpy(buffer + copied, (const char *)[page bytes] + pageOffset, length);
+    } else {
+      memset(buffer + copied, 0, length);  // Hole
+    }
+    copied += length;
+  }
+  return copied;
+}
+
+- (BOOL)pwriteBuffer:(const char *)buffer
+                size:(size_t)size
+              offset:(off_t)offset
+               error:(NSError **)error {
+  size_t written = 0;
+  while (written < size) {
+    ssize_t res = pwrite(fd_, buffer + written, size - written, offset + written);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res < 0) {
+      *error = GMPageStoreError(errno);
+      return NO;
+    }
+    written += res;
+  }
+  spilledSize_ += size;
+  [budget_ addSpilledSize:size];
+  return YES;
+}
+
+// Moves all pages to an unlinked temporary file. Holes stay holes.
+- (BOOL)spillWithError:(NSError **)error {
+  NSString* template =
+    [NSTemporaryDirectory() stringByAppendingPathComponent:@"GMPageStore.XXXXXX"];
+  char* path = strdup([template fileSystemRepresentation]);
+  if (!path) {
+    *error = GMPageStoreError(ENOMEM);
+    return NO;
+  }
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    *error = GMPageStoreError(errno);
+    free(path);
+    return NO;
+  }
+  unlink(path);
+  free(path);
+
+  fd_ = fd;
+  NSArray* indexes = [pages_ allKeys];
+  for (int i = 0, count = [indexes count]; i < count; i++) {
+    NSNumber* index = [indexes objectAtIndex:i];
+    NSMutableData* page = [pages_ objectForKey:index];
+    if (![self pwriteBuffer:[page bytes]
+                       size:pageSize_
+                     offset:[index unsignedLongLongValue] * pageSize_
+                      error:error]) {
+      close(fd_);
+      fd_ = -1;
+      return NO;
+    }
+  }
+  if (ftruncate(fd_, length_) != 0) {
+    *error = GMPageStoreError(errno);
+    close(fd_);
+    fd_ = -1;
+    return NO;
+  }
+  [budget_ releaseSize:[pages_ count] * pageSize_];
+  [pages_ removeAllObjects];
+  return YES;
+}
+
+// Returns YES if another page may be allocated, reserving it in the budget.
+- (BOOL)reservePage {
+  if (memoryLimit_ > 0 && ([pages_ count] + 1) * pageSize_ > memoryLimit_) {
+    return NO;
+  }
+  return budget_ ? [budget_ reserveSize:pageSize_] : YES;
+}
+
+#pragma mark Public
+
+- (ssize_t)readToBuffer:(char *)buffer
+                   size:(size_t)size
+                 offset:(off_t)offset
+                  error:(NSError **)error {
+  pthread_mutex_lock(&mutex_);
+  ssize_t copied = [self copyToBuffer:buffer size:size offset:offset error:error];
+  pthread_mutex_unlock(&mutex_);
+  return copied;
+}
+
+- (BOOL)writeFromBuffer:(const char *)buffer
+                   size:(size_t)size
+                 offset:(off_t)offset
+                  error:(NSError **)error {
+  BOOL ok = YES;
+  pthread_mutex_lock(&mutex_);
+  size_t copied = 0;
+  while (copied < size) {
+    off_t position = offset + copied;
+    if (fd_ >= 0) {
+      ok = [self pwriteBuffer:buffer + copied
+                         size:size - copied
+                       offset:position
+                        error:error];
+      break;
+    }
+    UInt64 index = position / pageSize_;
+    NSUInteger pageOffset = position % pageSize_;
+    size_t length = MIN(size - copied, pageSize_ - pageOffset);
+    NSMutableData* page = [self pageAtIndex:index];
+    if (!page) {
+      if (![self reservePage]) {
+        ok = [self spillWithError:error];
+        if (!ok) {
+          break;
+        }
+        continue;  // Write the rest to disk.
+      }
+      page = [[NSMutableData alloc] initWithLength:pageSize_];
+      [pages_ setObject:page forKey:[NSNumber numberWithUnsignedLongLong:index]];
+      [page release];
+    }
+    memcpy((char *)[page mutableBytes] + pageOffset, buffer + copied, length);
+    copied += length;
+  }
+  if (ok && offset + (off_t)size > length_) {
+    length_ = offset + size;
+  }
+  pthread_mutex_unlock(&mutex_);
+  return ok;
+}
+
+- (BOOL)truncateToLength:(off_t)length error:(NSError **)error {
+  BOOL ok = YES;
+  pthread_mutex_lock(&mutex_);
+  if (fd_ >= 0) {
+    if (ftruncate(fd_, length) != 0) {
+      *error = GMPageStoreError(errno);
+      ok = NO;
+    }
+  } else if (length < length_) {
+    // Drop the pages past the end and zero the tail of the new last page, so
+    // growing the store again exposes zeros.
+    UInt64 firstDroppedIndex = (length + pageSize_ - 1) / pageSize_;
+    NSArray* indexes = [pages_ allKeys];
+    for (int i = 0, count = [indexes count]; i < count; i++) {
+      NSNumber* index = [indexes objectAtIndex:i];
+      if ([index unsignedLongLongValue] >= firstDroppedIndex) {
+        [pages_ removeObjectForKey:index];
+        [budget_ releaseSize:pageSize_];
+      }
+    }
+    NSUInteger tailOffset = length % pageSize_;
+    NSMutableData* page = (tailOffset > 0) ? [self pageAtIndex:length / pageSize_] : nil;
+    if (page) {
+      memset((char *)[page mutableBytes] + tailOffset, 0, pageSize_ - tailOffset);
+    }
+  }
+  if (ok) {
+    length_ = length;
+  }
+  pthread_mutex_unlock(&mutex_);
+  return ok;
+}
+
+- (off_t)length {
+  pthread_mutex_lock(&mutex_);
+  off_t length = length_;
+  pthread_mutex_unlock(&mutex_);
+  return length;
+}
+
+- (void)setMemoryLimit:(NSUInteger)limit {
+  pthread_mutex_lock(&mutex_);
+  memoryLimit_ = limit;
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (NSUInteger)memoryLimit {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger limit = memoryLimit_;
+  pthread_mutex_unlock(&mutex_);
+  return limit;
+}
+
+- (void)setBudget:(GMPageStoreBudget *)budget {
+  pthread_mutex_lock(&mutex_);
+  if (budget != budget_) {
+    // Move the pages that have already been allocated over to the new budget,
+    // even if they exceed it; the next page will trigger spilling.
+    NSUInteger size = [pages_ count] * pageSize_;
+    [budget_ releaseSize:size];
+    [budget_ autorelease];
+    budget_ = [budget retain];
+    [budget_ addSize:size];
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (NSUInteger)allocatedSize {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger size = [pages_ count] * pageSize_;
+  pthread_mutex_unlock(&mutex_);
+  return size;
+}
+
+- (BOOL)isSpilled {
+  pthread_mutex_lock(&mutex_);
+  BOOL spilled = (fd_ >= 0);
+  pthread_mutex_unlock(&mutex_);
+  return spilled;
+}
+
+- (UInt64)spilledSize {
+  pthread_mutex_lock(&mutex_);
+  UInt64 size = spilledSize_;
+  pthread_mutex_unlock(&mutex_);
+  return size;
+}
+
+- (NSData *)data {
+  NSError* error = nil;
+  pthread_mutex_lock(&mutex_);
+  NSMutableData* data = [NSMutableData dataWithLength:length_];
+  ssize_t copied = [self copyToBuffer:[data mutableBytes]
+                                 size:length_
+                               offset:0
+                                error:&error];
+  pthread_mutex_unlock(&mutex_);
+  return (copied < 0) ? nil : data;
+}
+
+@end
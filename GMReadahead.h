@@ -0,0 +1,101 @@
+//
+//  GMReadahead.h
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+
+#include <pthread.h>
+
+@class GMPageStoreBudget;
+
+typedef enum {
+  GMReadaheadModeNormal,      // Reads ahead once sequential reads are detected.
+  GMReadaheadModeSequential,  // Reads ahead at the full window from the start.
+  GMReadaheadModeWholeFile,   // Like sequential, but starts reading at open.
+} GMReadaheadMode;
+
+// Reads ahead of a sequential reader of an open file. Once reads follow each
+// other, the next chunks of the file are read in the background and later
+// reads are answered from them. The number of bytes read ahead doubles with
+// every read answered that way, up to the maximum window. A read elsewhere in
+// the file drops the buffered chunks and starts over.
+//
+// The source must implement readToBuffer:size:offset:error:, which is called on
+// the threads of the operation queue. It is not retained; call close before it
+// goes away.
+//
+// All methods are thread-safe.
+@interface GMReadahead : NSObject {
+ @private
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;        // Signaled when a chunk has been read.
+  id source_;                  // Not retained
+  NSOperationQueue* queue_;
+  GMPageStoreBudget* budget_;  // Memory of the chunks; may be nil.
+  GMReadaheadMode mode_;
+  NSUInteger chunkSize_;
+  NSUInteger maxWindow_;
+  NSUInteger window_;          // Zero while reads are not sequential.
+  off_t nextOffset_;           // The offset following the last read.
+  off_t endOfFile_;            // -1 if not known yet.
+  NSMutableArray* chunks_;     // Contiguous and ordered by offset.
+  NSUInteger pendingCount_;    // Chunks that are still being read.
+  BOOL isClosed_;
+}
+
+- (id)initWithSource:(id)source
+               queue:(NSOperationQueue *)queue
+              budget:(GMPageStoreBudget *)budget
+                mode:(GMReadaheadMode)mode
+           chunkSize:(NSUInteger)chunkSize
+           maxWindow:(NSUInteger)maxWindow;
+
+// Reads from the buffered chunks if possible and from the source otherwise.
+// Returns the number of bytes read or -1 on error.
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error;
+
+// Drops the buffered chunks, e.g. because the file has been modified.
+- (void)invalidate;
+
+// Drops the buffered chunks and waits until no chunk is being read anymore.
+// The source is not used after close returns.
+- (void)close;
+
+@end
@@ -0,0 +1,302 @@
+//
+//  GMReadahead.m
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import "GMReadahead.h"
+
+#import "GMPageStore.h"
+
+@interface GMReadaheadChunk : NSObject {
+ @public
+  off_t offset_;
+  NSUInteger size_;      // The number of bytes requested.
+  NSData* data_;         // Retained; nil until read or if reading failed.
+  BOOL isComplete_;
+  BOOL isDropped_;       // No longer in chunks_.
+}
+@end
+
+@implementation GMReadaheadChunk
+
+- (void)dealloc {
+  [data_ release];
+  [super dealloc];
+}
+
+@end
+
+@implementation GMReadahead
+
+- (id)initWithSource:(id)source
+               queue:(NSOperationQueue *)queue
+              budget:(GMPageStoreBudget *)budget
+                mode:(GMReadaheadMode)mode
+           chunkSize:(NSUInteger)chunkSize
+           maxWindow:(NSUInteger)maxWindow {
+  self = [super init];
+  if (self) {
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&cond_, NULL);
+    source_ = source;
+    queue_ = [queue retain];
+    budget_ = [budget retain];
+    mode_ = mode;
+    chunkSize_ = chunkSize;
+    maxWindow_ = MAX(maxWindow, chunkSize);
+    window_ = (mode_ == GMReadaheadModeNormal) ? 0 : maxWindow_;
+    endOfFile_ = -1;
+    chunks_ = [[NSMutableArray alloc] init];
+
+    if (mode_ == GMReadaheadModeWholeFile) {
+      pthread_mutex_lock(&mutex_);
+      [self scheduleChunks];
+      pthread_mutex_unlock(&mutex_);
+    }
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [self dropChunksFromIndex:0];
+  [chunks_ release];
+  [budget_ release];
+  [queue_ release];
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+#pragma mark Internal (mutex_ must be held)
+
+- (void)dropChunk:(GMReadaheadChunk *)chunk {
+  chunk->isDropped_ = YES;
+  if (chunk->isComplete_) {
+    [budget_ releaseSize:chunk->size_];
+  }  // Otherwise the budget is released once reading the chunk has finished.
+  [chunks_ removeObjectIdenticalTo:chunk];
+}
+
+- (void)dropChunksFromIndex:(NSUInteger)index {
+  while ([chunks_ count] > index) {
+    [self dropChunk:[chunks_ lastObject]];
+  }
+}
+
+- (GMReadaheadChunk *)chunkContainingOffset:(off_t)offset {
+  for (int i = 0, count = [chunks_ count]; i < count; i++) {
+    GMReadaheadChunk* chunk = [chunks_ objectAtIndex:i];
+    if (chunk->offset_ <= offset && offset < chunk->offset_ + (off_t)chunk->size_) {
+      return chunk;
+    }
+  }
+  return nil;
+}
+
+- (void)scheduleChunks {
+  if (isClosed_ || window_ == 0) {
+    return;
+  }
+  off_t start = nextOffset_;
+  GMReadaheadChunk* last = [chunks_ lastObject];
+  if (last) {
+    start = MAX(start, last->offset_ + (off_t)last->size_);
+  }
+  while (start < nextOffset_ + (off_t)window_ &&
+         (endOfFile_ < 0 || start < endOfFile_)) {
+    if (budget_ && ![budget_ reserveSize:chunkSize_]) {
+      break;  // Try again on the next read.
+    }
+    GMReadaheadChunk* chunk = [[GMReadaheadChunk alloc] init];
+    chunk->offset_ = start;
+    chunk->size_ = chunkSize_;
+    [chunks_ addObject:chunk];
+    ++pendingCount_;
+    NSInvocationOperation* operation =
+      [[NSInvocationOperation alloc] initWithTarget:self
+                                           selector:@selector(readChunk:)
+                                             object:chunk];
+    [queue_ addOperation:operation];
+    [operation release];
+    [chunk release];
+    start += chunkSize_;
+  }
+}
+
+#pragma mark Background
+
+- (void)readChunk:(GMReadaheadChunk *)chunk {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+
+  pthread_mutex_lock(&mutex_);
+  BOOL isDropped = chunk->isDropped_;
+  pthread_mutex_unlock(&mutex_);
+
+  NSMutableData* data = nil;
+  if (!isDropped) {
+    data = [NSMutableData dataWithLength:chunk->size_];
+    NSError* error = nil;
+    int ret = -1;
+    @try {
+      ret = [source_ readToBuffer:[data mutableBytes]
+                             size:chunk->size_
+                           offset:chunk->offset_
+                            error:&error];
+    }
+    @catch (id exception) { }
+    if (ret >= 0) {
+      [data setLength:ret];
+    } else {
+      data = nil;  // The read is retried, and the error reported, by the reader.
+    }
+  }
+
+  pthread_mutex_lock(&mutex_);
+  chunk->data_ = [data retain];
+  chunk->isComplete_ = YES;
+  if (chunk->isDropped_) {
+    [budget_ releaseSize:chunk->size_];
+  } else if (!data) {
+    [self dropChunk:chunk];
+  } else if ([data length] < chunk->size_) {
+    // Reached the end of the file; chunks beyond it would read nothing.
+    off_t end = chunk->offset_ + [data length];
+    if (endOfFile_ < 0 || end < endOfFile_) {
+      endOfFile_ = end;
+    }
+    NSUInteger index = [chunks_ indexOfObjectIdenticalTo:chunk];
+    if (index != NSNotFound) {
+      [self dropChunksFromIndex:index + 1];
+    }
+  }
+  --pendingCount_;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mutex_);
+
+  [pool release];
+}
+
+#pragma mark Public
+
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error {
+  size_t copied = 0;
+  BOOL isAtEnd = NO;
+
+  pthread_mutex_lock(&mutex_);
+  BOOL isSequential =
+    (offset == nextOffset_) || [self chunkContainingOffset:offset] != nil;
+  if (!isSequential && mode_ != GMReadaheadModeWholeFile) {
+    [self dropChunksFromIndex:0];
+    if (mode_ == GMReadaheadModeNormal) {
+      window_ = 0;
+    }
+  }
+
+  while (copied < size) {
+    off_t position = offset + copied;
+    GMReadaheadChunk* chunk = [self chunkContainingOffset:position];
+    if (!chunk) {
+      break;
+    }
+    [[chunk retain] autorelease];  // May be dropped while waiting.
+    while (!chunk->isComplete_ && !chunk->isDropped_) {
+      pthread_cond_wait(&cond_, &mutex_);
+    }
+    if (chunk->isDropped_) {
+      break;
+    }
+    off_t chunkEnd = chunk->offset_ + [chunk->data_ length];
+    if (position >= chunkEnd) {
+      isAtEnd = YES;
+      break;
+    }
+    size_t length = MIN(size - copied, (size_t)(chunkEnd - position));
+    memcpy(buffer + copied,
+           (const char *)[chunk->data_ bytes] + (position - chunk->offset_),
+           length);
+    copied += length;
+  }
+
+  // Chunks behind the reader will not be needed again.
+  while ([chunks_ count] > 0) {
+    GMReadaheadChunk* chunk = [chunks_ objectAtIndex:0];
+    if (chunk->offset_ + (off_t)chunk->size_ > offset) {
+      break;
+    }
+    [self dropChunk:chunk];
+  }
+
+  nextOffset_ = offset + size;
+  if (isSequential && mode_ == GMReadaheadModeNormal) {
+    window_ = MIN(MAX(window_ * 2, chunkSize_ * 2), maxWindow_);
+  }
+  [self scheduleChunks];
+  pthread_mutex_unlock(&mutex_);
+
+  if (copied == size || isAtEnd) {
+    return (int)copied;
+  }
+  int ret = [source_ readToBuffer:buffer + copied
+                             size:size - copied
+                           offset:offset + copied
+                            error:error];
+  if (ret < 0) {
+    return -1;
+  }
+  return (int)(copied + ret);
+}
+
+- (void)invalidate {
+  pthread_mutex_lock(&mutex_);
+  [self dropChunksFromIndex:0];
+  endOfFile_ = -1;
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (void)close {
+  pthread_mutex_lock(&mutex_);
+  isClosed_ = YES;
+  [self dropChunksFromIndex:0];
+  while (pendingCount_ > 0) {
+    pthread_cond_wait(&cond_, &mutex_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+@end
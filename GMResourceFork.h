@@ -39,7 +39,7 @@
 /*!
  * @header GMResourceFork
  *
- * A utility class to construct raw resource fork data.
+ * Utility classes to construct and read raw resource fork data.
  * 
  * In OS 10.4, the ResourceFork for a file may be present in an AppleDouble (._) 
  * file that is associated with the file. In 10.5+, the ResourceFork is present 
@@ -53,6 +53,7 @@
 #define GM_EXPORT __attribute__((visibility("default")))
 
 @class GMResource;
+@class GMResourceForkReader;
 
 /*!
  * @class
@@ -63,11 +64,25 @@
 GM_EXPORT @interface GMResourceFork : NSObject {
  @private
   NSMutableDictionary* resourcesByType_;
+  NSData* layoutHeader_;     // Computed by length; nil until then.
+  NSArray* layoutResources_; // GMResource in the order of their data.
+  NSData* layoutMap_;        // The resource map following the data.
+  NSUInteger layoutLength_;
 }
 
 /*! @abstract Returns an autoreleased GMResourceFork */
 + (GMResourceFork *)resourceFork GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Returns an autoreleased GMResourceFork with the resources of an
+ * existing resource fork.
+ * @discussion The data of the resources is not copied until the resource fork
+ * is constructed, so a large resource fork can be edited by removing and
+ * adding single resources.
+ * @param reader The reader of the existing resource fork.
+ */
++ (GMResourceFork *)resourceForkWithReader:(GMResourceForkReader *)reader GM_AVAILABLE(3_9);
+
 /*! 
  * @abstract Adds a resource to the resource fork by specifying components.
  * @discussion See CarbonCore/Finder.h for some common resource identifiers.
@@ -88,12 +103,133 @@ GM_EXPORT @interface GMResourceFork : NSObject {
  */
 - (void)addResource:(GMResource *)resource GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Adds all resources of an existing resource fork.
+ * @param reader The reader of the existing resource fork.
+ */
+- (void)addResourcesFromReader:(GMResourceForkReader *)reader GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Removes the resources with the given type and ID.
+ * @discussion To replace a resource, remove it and add the new one.
+ * @param resType The four-char code for the resource, e.g. 'icns'
+ * @param resID The ID of the resource, e.g. 256 for webloc 'url' contents
+ */
+- (void)removeResourceWithType:(ResType)resType
+                         resID:(ResID)resID GM_AVAILABLE(3_9);
+
 /*! 
  * @abstract Constucts the raw data for the resource fork.
  * @result NSData for the resource fork containing all added resources.
  */
 - (NSData *)data GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Returns the length of the raw data for the resource fork.
+ * @discussion The layout of the resource fork is computed once and kept until
+ * another resource is added. Once computed, length and getBytes:range: can be
+ * called from several threads as long as no resources are added.
+ * @result The length in bytes of the data returned by data.
+ */
+- (NSUInteger)length GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Copies a range of the raw data for the resource fork.
+ * @discussion Only the bytes within range are copied; the resource fork is
+ * not constructed as a whole. Raises NSRangeException if range exceeds length.
+ * @param buffer The buffer to copy to; it must hold range.length bytes.
+ * @param range The range of the raw data to copy.
+ */
+- (void)getBytes:(void *)buffer range:(NSRange)range GM_AVAILABLE(3_9);
+
+@end
+
+/*!
+ * @class
+ * @discussion This class can be used to read the resources of raw resource fork
+ * data, e.g. to serve it from resourceAttributesAtPath:error: or to edit it
+ * with GMResourceFork.
+ *
+ * The resource map is parsed once into an index, so that resources are looked
+ * up by type and ID or by type and name in constant time. The raw data is
+ * neither copied nor parsed again: the data of the returned resources refers
+ * to the raw data, which is retained as long as any of it is.
+ *
+ * A reader is immutable and can be used from several threads.
+ */
+GM_EXPORT @interface GMResourceForkReader : NSObject {
+ @private
+  NSData* data_;                      // The raw resource fork, not copied.
+  NSUInteger count_;
+  void* entries_;                     // Index entries in the order of the map.
+  NSMutableDictionary* indexByID_;    // Type and ID -> entry number
+  NSMutableDictionary* indexByName_;  // Type -> name -> entry number
+}
+
+/*!
+ * @abstract Returns an autoreleased reader of raw resource fork data.
+ * @param data The raw resource fork data (retained, not copied)
+ * @result The reader, or nil if data is not a valid resource fork.
+ */
++ (GMResourceForkReader *)resourceForkReaderWithData:(NSData *)data GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns an autoreleased reader of a resource fork file.
+ * @discussion The file is mapped into memory rather than read; it must not be
+ * truncated while the reader or the data of its resources are in use.
+ * @param path The path to a file containing raw resource fork data, e.g. the
+ * ..namedfork/rsrc of a file.
+ * @result The reader, or nil if the file cannot be mapped or is not a valid
+ * resource fork.
+ */
++ (GMResourceForkReader *)resourceForkReaderWithContentsOfFile:(NSString *)path GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Initializes a reader of raw resource fork data.
+ * @discussion To read a buffer without copying it, pass an NSData created with
+ * dataWithBytesNoCopy:length:freeWhenDone: and keep the buffer alive as long
+ * as the reader and the data of its resources are in use.
+ * @param data The raw resource fork data (retained, not copied)
+ * @result The reader, or nil if data is not a valid resource fork.
+ */
+- (id)initWithData:(NSData *)data GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Initializes a reader of a resource fork file.
+ * @discussion See resourceForkReaderWithContentsOfFile:.
+ * @param path The path to a file containing raw resource fork data.
+ * @result The reader, or nil if the file cannot be mapped or is not a valid
+ * resource fork.
+ */
+- (id)initWithContentsOfFile:(NSString *)path GM_AVAILABLE(3_9);
+
+/*! @abstract The raw resource fork data */
+- (NSData *)data GM_AVAILABLE(3_9);
+
+/*! @abstract The number of resources */
+- (NSUInteger)count GM_AVAILABLE(3_9);
+
+/*! @abstract All resources in the order of the resource map */
+- (NSArray *)resources GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Looks up a resource by type and ID.
+ * @param resType The four-char code for the resource, e.g. 'icns'
+ * @param resID The ID of the resource, e.g. 256 for webloc 'url' contents
+ * @result The resource, or nil if there is no such resource.
+ */
+- (GMResource *)resourceWithType:(ResType)resType
+                           resID:(ResID)resID GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Looks up a resource by type and name.
+ * @param resType The four-char code for the resource, e.g. 'icns'
+ * @param name The name of the resource
+ * @result The resource, or nil if there is no such resource.
+ */
+- (GMResource *)resourceWithType:(ResType)resType
+                            name:(NSString *)name GM_AVAILABLE(3_9);
+
 @end
 
 /*!
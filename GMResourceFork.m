@@ -153,12 +153,23 @@ typedef struct {
 
 @end
 
+@interface GMResourceFork (Private)
+- (void)layOut;
+- (void)clearLayout;
+@end
+
 @implementation GMResourceFork
 
 + (GMResourceFork *)resourceFork {
   return [[[GMResourceFork alloc] init] autorelease];
 }
 
++ (GMResourceFork *)resourceForkWithReader:(GMResourceForkReader *)reader {
+  GMResourceFork* fork = [GMResourceFork resourceFork];
+  [fork addResourcesFromReader:reader];
+  return fork;
+}
+
 - (id)init {
   self = [super init];
   if (self) {
@@ -168,6 +179,7 @@ typedef struct {
 }
 
 - (void)dealloc {
+  [self clearLayout];
   [resourcesByType_ release];
   [super dealloc];
 }
@@ -193,15 +205,64 @@ typedef struct {
     [resourcesByType_ setObject:resources forKey:key];
   }
   [resources addObject:resource];
+  [self clearLayout];
 }
 
+- (void)addResourcesFromReader:(GMResourceForkReader *)reader {
+  NSArray* resources = [reader resources];
+  for (int i = 0, count = [resources count]; i < count; i++) {
+    [self addResource:[resources objectAtIndex:i]];
+  }
+}
 
-// Constructs the raw data for the resource fork containing all added resources.
-- (NSData *)data {
-  NSMutableData* resourceData = [NSMutableData data];
+- (void)removeResourceWithType:(ResType)resType resID:(ResID)resID {
+  NSNumber* key = [NSNumber numberWithLong:resType];
+  NSMutableArray* resources = [resourcesByType_ objectForKey:key];
+  for (int i = [resources count] - 1; i >= 0; --i) {
+    if ([[resources objectAtIndex:i] resID] == resID) {
+      [resources removeObjectAtIndex:i];
+    }
+  }
+  if (resources != nil && [resources count] == 0) {
+    [resourcesByType_ removeObjectForKey:key];
+  }
+  [self clearLayout];
+}
+
+
+// It looks like macOS prefers the resource data to start at offset 256 bytes.
+static const UInt32 kResourceDataOffset =
+  sizeof(ResourceForkHeader) > 256 ? sizeof(ResourceForkHeader) : 256;
+
+// Copies the part of the region of length bytes at offset that lies within
+// range to buffer, which holds the bytes of range. Copies zeros if bytes is
+// NULL. Returns the offset following the region.
+static NSUInteger GMCopyRegion(char* buffer, NSRange range, NSUInteger offset,
+                               const void* bytes, NSUInteger length) {
+  NSUInteger start = MAX(offset, range.location);
+  NSUInteger end = MIN(offset + length, NSMaxRange(range));
+  if (start < end) {
+    if (bytes) {
+      memcpy(buffer + (start - range.location),
+             (const char *)bytes + (start - offset), end - start);
+    } else {
+      memset(buffer + (start - range.location), 0, end - start);
+    }
+  }
+  return offset + length;
+}
+
+// Computes the layout of the resource fork: the order of the resource data and
+// the header and map surrounding it. The resource data itself is not copied.
+- (void)layOut {
+  if (layoutMap_ != nil) {
+    return;
+  }
+  NSMutableArray* resourcesInOrder = [NSMutableArray array];
   NSMutableData* typeListData = [NSMutableData data];
   NSMutableData* referenceListData = [NSMutableData data];
   NSMutableData* nameListData = [NSMutableData data];
+  UInt32 dataLen = 0;
 
   NSArray* keys = [resourcesByType_ allKeys];
   int refListStartOffset = sizeof(ResourceTypeListHeader) + 
@@ -229,7 +290,7 @@ typedef struct {
       // -- Append the ResourceReferenceListItem to referenceListData --
       ResourceReferenceListItem referenceItem;
       memset(&referenceItem, 0, sizeof(referenceItem));
-      UInt32 dataOffset = [resourceData length];
+      UInt32 dataOffset = dataLen;
       referenceItem.resid = htons([resource resID]);
       referenceItem.nameListOffset = 
         htons((name == nil) ? (SInt16)(-1) : [nameListData length]);
@@ -250,12 +311,9 @@ typedef struct {
         [nameListData appendBytes:[name UTF8String] length:nameLen];
       }
 
-      // -- Append the ResourceDataItem and resource data to resourceData --
-      ResourceDataItem dataItem;
-      memset(&dataItem, 0, sizeof(dataItem));
-      dataItem.dataLength = htonl([[resource data] length]);
-      [resourceData appendBytes:&dataItem length:sizeof(dataItem)];
-      [resourceData appendData:[resource data]];
+      // -- Account for the ResourceDataItem and resource data --
+      [resourcesInOrder addObject:resource];
+      dataLen += sizeof(ResourceDataItem) + [[resource data] length];
     }
   }
 
@@ -266,9 +324,7 @@ typedef struct {
   ResourceTypeListHeader typeListHeader;
   memset(&typeListHeader, 0, sizeof(typeListHeader));
   
-  // It looks like macOS prefers the resource data to start at offset 256 bytes.
-  UInt32 dataOffset = sizeof(forkHeader) > 256 ? sizeof(forkHeader) : 256;
-  UInt32 dataLen = [resourceData length];
+  UInt32 dataOffset = kResourceDataOffset;
   UInt32 mapOffset = dataOffset + dataLen;
   UInt32 mapLen = sizeof(ResourceMapHeader) +
                   sizeof(ResourceTypeListHeader) +
@@ -290,17 +346,380 @@ typedef struct {
   
   typeListHeader.numTypesMinusOne = htons([resourcesByType_ count] - 1);
 
-  NSMutableData* data = [NSMutableData data];  
-  [data appendBytes:&forkHeader length:sizeof(forkHeader)];
-  [data setLength:dataOffset];
-  [data appendData:resourceData];
-  [data appendBytes:&mapHeader length:sizeof(mapHeader)];
-  [data appendBytes:&typeListHeader length:sizeof(typeListHeader)];
-  [data appendData:typeListData];
-  [data appendData:referenceListData];
-  [data appendData:nameListData];
-  
-  return data;
+  NSMutableData* map = [NSMutableData dataWithCapacity:mapLen];
+  [map appendBytes:&mapHeader length:sizeof(mapHeader)];
+  [map appendBytes:&typeListHeader length:sizeof(typeListHeader)];
+  [map appendData:typeListData];
+  [map appendData:referenceListData];
+  [map appendData:nameListData];
+
+  layoutHeader_ = [[NSData alloc] initWithBytes:&forkHeader
+                                         length:sizeof(forkHeader)];
+  layoutResources_ = [resourcesInOrder copy];
+  layoutMap_ = [map copy];
+  layoutLength_ = mapOffset + mapLen;
+}
+
+- (void)clearLayout {
+  [layoutHeader_ release];
+  layoutHeader_ = nil;
+  [layoutResources_ release];
+  layoutResources_ = nil;
+  [layoutMap_ release];
+  layoutMap_ = nil;
+  layoutLength_ = 0;
+}
+
+- (NSUInteger)length {
+  [self layOut];
+  return layoutLength_;
+}
+
+// Copies the bytes of the resource fork within range, region by region.
+- (void)getBytes:(void *)buffer range:(NSRange)range {
+  [self layOut];
+  if (NSMaxRange(range) > layoutLength_ || NSMaxRange(range) < range.location) {
+    [NSException raise:NSRangeException
+                format:@"Range %@ exceeds resource fork length %lu",
+                       NSStringFromRange(range), (unsigned long)layoutLength_];
+  }
+  char* bytes = (char *)buffer;
+  NSUInteger offset = 0;
+  offset = GMCopyRegion(bytes, range, offset,
+                        [layoutHeader_ bytes], [layoutHeader_ length]);
+  offset = GMCopyRegion(bytes, range, offset, NULL, kResourceDataOffset - offset);
+  for (int i = 0, count = [layoutResources_ count]; 
+       i < count && offset < NSMaxRange(range); i++) {
+    NSData* data = [[layoutResources_ objectAtIndex:i] data];
+    ResourceDataItem dataItem;
+    memset(&dataItem, 0, sizeof(dataItem));
+    dataItem.dataLength = htonl([data length]);
+    offset = GMCopyRegion(bytes, range, offset, &dataItem, sizeof(dataItem));
+    if (offset + [data length] <= range.location) {
+      offset += [data length];  // Skip without touching the resource data.
+    } else {
+      offset = GMCopyRegion(bytes, range, offset, [data bytes], [data length]);
+    }
+  }
+  GMCopyRegion(bytes, range, offset, [layoutMap_ bytes], [layoutMap_ length]);
+}
+
+// Constructs the raw data for the resource fork containing all added resources.
+- (NSData *)data {
+  NSUInteger length = [self length];
+  void* bytes = malloc(length);
+  if (bytes == NULL) {
+    return nil;
+  }
+  [self getBytes:bytes range:NSMakeRange(0, length)];
+  return [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:YES];
+}
+
+@end
+
+// Resource data within the raw data of a GMResourceForkReader. Retains the raw
+// data rather than copying its part of it.
+@interface GMResourceForkSlice : NSData {
+  NSData* data_;
+  const void* bytes_;
+  NSUInteger length_;
+}
+- (id)initWithData:(NSData *)data range:(NSRange)range;
+@end
+
+@implementation GMResourceForkSlice
+
+- (id)initWithData:(NSData *)data range:(NSRange)range {
+  self = [super init];
+  if (self) {
+    data_ = [data retain];
+    bytes_ = (const char *)[data bytes] + range.location;
+    length_ = range.length;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [data_ release];
+  [super dealloc];
+}
+
+- (const void *)bytes {
+  return bytes_;
+}
+
+- (NSUInteger)length {
+  return length_;
+}
+
+@end
+
+// An entry of the index of a GMResourceForkReader. Offsets are from the
+// beginning of the raw data.
+typedef struct {
+  ResType type;
+  ResID resID;
+  UInt32 nameOffset;  // Offset of the ResourceNameListItem, or UINT32_MAX.
+  UInt32 dataOffset;  // Offset of the data following the ResourceDataItem.
+  UInt32 dataLength;
+} GMResourceForkEntry;
+
+static NSNumber* indexKeyForTypeAndID(ResType type, ResID resID) {
+  return [NSNumber numberWithUnsignedLongLong:
+          ((UInt64)type << 16) | (UInt16)resID];
+}
+
+// Returns YES if the length bytes at offset lie within size bytes.
+static BOOL rangeIsWithinSize(UInt64 offset, UInt64 length, UInt64 size) {
+  return offset <= size && length <= size - offset;
+}
+
+@interface GMResourceForkReader (Private)
+- (BOOL)parse;
+- (NSString *)nameOfEntry:(const GMResourceForkEntry *)entry;
+- (GMResource *)resourceForEntry:(NSUInteger)i;
+@end
+
+@implementation GMResourceForkReader
+
++ (GMResourceForkReader *)resourceForkReaderWithData:(NSData *)data {
+  return [[[GMResourceForkReader alloc] initWithData:data] autorelease];
+}
+
++ (GMResourceForkReader *)resourceForkReaderWithContentsOfFile:(NSString *)path {
+  return [[[GMResourceForkReader alloc] initWithContentsOfFile:path] autorelease];
+}
+
+- (id)init {
+  return [self initWithData:nil];
+}
+
+- (id)initWithData:(NSData *)data {
+  self = [super init];
+  if (self) {
+    if (data == nil) {
+      [self release];
+      return nil;
+    }
+    data_ = [data retain];
+    indexByID_ = [[NSMutableDictionary alloc] init];
+    indexByName_ = [[NSMutableDictionary alloc] init];
+    if (![self parse]) {
+      [self release];
+      return nil;
+    }
+  }
+  return self;
+}
+
+- (id)initWithContentsOfFile:(NSString *)path {
+  NSData* data = [NSData dataWithContentsOfFile:path
+                                        options:NSDataReadingMappedAlways
+                                          error:NULL];
+  return [self initWithData:data];
+}
+
+- (void)dealloc {
+  free(entries_);
+  [data_ release];
+  [indexByID_ release];
+  [indexByName_ release];
+  [super dealloc];
+}
+
+// Parses the resource map into the index, validating every offset against the
+// raw data so that lookups need not check them again.
+- (BOOL)parse {
+  const UInt8* bytes = [data_ bytes];
+  UInt64 size = [data_ length];
+
+  ResourceForkHeader forkHeader;
+  if (size < sizeof(forkHeader)) {
+    return NO;
+  }
+  memcpy(&forkHeader, bytes, sizeof(forkHeader));
+  UInt32 dataOffset = ntohl(forkHeader.resourceDataOffset);
+  UInt32 dataLen = ntohl(forkHeader.resourceDataLength);
+  UInt32 mapOffset = ntohl(forkHeader.resourceMapOffset);
+  UInt32 mapLen = ntohl(forkHeader.resourceMapLength);
+  if (!rangeIsWithinSize(dataOffset, dataLen, size) ||
+      !rangeIsWithinSize(mapOffset, mapLen, size)) {
+    return NO;
+  }
+  const UInt8* map = bytes + mapOffset;
+
+  ResourceMapHeader mapHeader;
+  ResourceTypeListHeader typeListHeader;
+  if (mapLen < sizeof(mapHeader)) {
+    return NO;
+  }
+  memcpy(&mapHeader, map, sizeof(mapHeader));
+  UInt32 typeListOffset = ntohs(mapHeader.typeListOffset);
+  UInt32 nameListOffset = ntohs(mapHeader.nameListOffset);
+  if (!rangeIsWithinSize(typeListOffset, sizeof(typeListHeader), mapLen) ||
+      nameListOffset > mapLen) {
+    return NO;
+  }
+  const UInt8* typeList = map + typeListOffset;
+  memcpy(&typeListHeader, typeList, sizeof(typeListHeader));
+  // An empty resource fork has 0xFFFF types minus one.
+  UInt16 typeCount = ntohs(typeListHeader.numTypesMinusOne) + 1;
+  if (!rangeIsWithinSize(typeListOffset + sizeof(typeListHeader),
+                         (UInt64)typeCount * sizeof(ResourceTypeListItem),
+                         mapLen)) {
+    return NO;
+  }
+
+  NSUInteger count = 0;
+  for (int i = 0; i < typeCount; ++i) {
+    ResourceTypeListItem typeItem;
+    memcpy(&typeItem,
+           typeList + sizeof(typeListHeader) + i * sizeof(typeItem),
+           sizeof(typeItem));
+    count += ntohs(typeItem.numMinusOne) + 1;
+  }
+  entries_ = calloc(count > 0 ? count : 1, sizeof(GMResourceForkEntry));
+  if (entries_ == NULL) {
+    return NO;
+  }
+  GMResourceForkEntry* entries = entries_;
+
+  // For each resource type.
+  for (int i = 0; i < typeCount; ++i) {
+    ResourceTypeListItem typeItem;
+    memcpy(&typeItem,
+           typeList + sizeof(typeListHeader) + i * sizeof(typeItem),
+           sizeof(typeItem));
+    ResType type = ntohl(typeItem.type);
+    UInt32 refCount = ntohs(typeItem.numMinusOne) + 1;
+    UInt32 refListOffset = typeListOffset + ntohs(typeItem.referenceListOffset);
+    if (!rangeIsWithinSize(refListOffset,
+                           (UInt64)refCount * sizeof(ResourceReferenceListItem),
+                           mapLen)) {
+      return NO;
+    }
+
+    // For each resource of that type.
+    for (UInt32 j = 0; j < refCount; ++j) {
+      ResourceReferenceListItem referenceItem;
+      memcpy(&referenceItem, map + refListOffset + j * sizeof(referenceItem),
+             sizeof(referenceItem));
+      GMResourceForkEntry* entry = &entries[count_];
+      entry->type = type;
+      entry->resID = (SInt16)ntohs(referenceItem.resid);
+
+      UInt32 itemOffset = (referenceItem.resourceDataOffset1 << 16) |
+                          (referenceItem.resourceDataOffset2 << 8) |
+                          referenceItem.resourceDataOffset3;
+      ResourceDataItem dataItem;
+      if (!rangeIsWithinSize(itemOffset, sizeof(dataItem), dataLen)) {
+        return NO;
+      }
+      memcpy(&dataItem, bytes + dataOffset + itemOffset, sizeof(dataItem));
+      entry->dataOffset = dataOffset + itemOffset + sizeof(dataItem);
+      entry->dataLength = ntohl(dataItem.dataLength);
+      if (!rangeIsWithinSize(itemOffset + sizeof(dataItem), entry->dataLength,
+                             dataLen)) {
+        return NO;
+      }
+
+      UInt16 nameOffset = ntohs(referenceItem.nameListOffset);
+      if (nameOffset == 0xFFFF) {
+        entry->nameOffset = UINT32_MAX;
+      } else {
+        UInt32 offset = nameListOffset + nameOffset;
+        if (!rangeIsWithinSize(offset, sizeof(ResourceNameListItem), mapLen) ||
+            !rangeIsWithinSize(offset + sizeof(ResourceNameListItem),
+                               map[offset], mapLen)) {
+          return NO;
+        }
+        entry->nameOffset = mapOffset + offset;
+      }
+
+      // The first of several resources with the same key wins, as in the
+      // Resource Manager.
+      NSNumber* number = [NSNumber numberWithUnsignedInteger:count_];
+      NSNumber* key = indexKeyForTypeAndID(type, entry->resID);
+      if ([indexByID_ objectForKey:key] == nil) {
+        [indexByID_ setObject:number forKey:key];
+      }
+      NSString* name = [self nameOfEntry:entry];
+      if (name != nil) {
+        NSNumber* typeKey = [NSNumber numberWithLong:type];
+        NSMutableDictionary* names = [indexByName_ objectForKey:typeKey];
+        if (names == nil) {
+          names = [NSMutableDictionary dictionary];
+          [indexByName_ setObject:names forKey:typeKey];
+        }
+        if ([names objectForKey:name] == nil) {
+          [names setObject:number forKey:name];
+        }
+      }
+      ++count_;
+    }
+  }
+  return YES;
+}
+
+// Names written by GMResourceFork are UTF-8, those written by the Resource
+// Manager are usually MacRoman.
+- (NSString *)nameOfEntry:(const GMResourceForkEntry *)entry {
+  if (entry->nameOffset == UINT32_MAX) {
+    return nil;
+  }
+  const UInt8* nameItem = (const UInt8 *)[data_ bytes] + entry->nameOffset;
+  const UInt8* name = nameItem + sizeof(ResourceNameListItem);
+  NSUInteger nameLen = ((const ResourceNameListItem *)nameItem)->nameLength;
+  NSString* string = [[NSString alloc] initWithBytes:name
+                                              length:nameLen
+                                            encoding:NSUTF8StringEncoding];
+  if (string == nil) {
+    string = [[NSString alloc] initWithBytes:name
+                                      length:nameLen
+                                    encoding:NSMacOSRomanStringEncoding];
+  }
+  return [string autorelease];
+}
+
+- (GMResource *)resourceForEntry:(NSUInteger)i {
+  const GMResourceForkEntry* entry = (GMResourceForkEntry *)entries_ + i;
+  NSData* data =
+    [[GMResourceForkSlice alloc] initWithData:data_
+                                        range:NSMakeRange(entry->dataOffset,
+                                                          entry->dataLength)];
+  GMResource* resource = [GMResource resourceWithType:entry->type
+                                                resID:entry->resID
+                                                 name:[self nameOfEntry:entry]
+                                                 data:data];
+  [data release];
+  return resource;
+}
+
+- (NSData *)data {
+  return data_;
+}
+
+- (NSUInteger)count {
+  return count_;
+}
+
+- (NSArray *)resources {
+  NSMutableArray* resources = [NSMutableArray arrayWithCapacity:count_];
+  for (NSUInteger i = 0; i < count_; ++i) {
+    [resources addObject:[self resourceForEntry:i]];
+  }
+  return resources;
+}
+
+- (GMResource *)resourceWithType:(ResType)resType resID:(ResID)resID {
+  NSNumber* number = [indexByID_ objectForKey:indexKeyForTypeAndID(resType, resID)];
+  return number ? [self resourceForEntry:[number unsignedIntegerValue]] : nil;
+}
+
+- (GMResource *)resourceWithType:(ResType)resType name:(NSString *)name {
+  NSDictionary* names = [indexByName_ objectForKey:[NSNumber numberWithLong:resType]];
+  NSNumber* number = [names objectForKey:name];
+  return number ? [self resourceForEntry:[number unsignedIntegerValue]] : nil;
 }
 
 @end
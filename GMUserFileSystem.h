@@ -128,6 +128,11 @@ GM_EXPORT @interface GMUserFileSystem : NSObject {
  * @discussion Mounts the file system at mountPath with the given set of options.
  * The set of available options can be found on the options wiki page.
  * For example, to turn on debug output add \@"debug" to the options NSArray.
+ * Add \@"lowlevel" to use the inode-based low-level FUSE interface instead of
+ * the path-based one. Items are then identified by node IDs and their paths are
+ * only resolved once, and delegates may implement the methods of
+ * GMUserFileSystemNodeOperations. Preallocation, exchange data, extended times
+ * and volume renaming are not available with the low-level interface.
  * If the mount succeeds, then a kGMUserFileSystemDidMount notification is posted
  * to the default noification center. If the mount fails, then a 
  * kGMUserFileSystemMountFailed notification will be posted instead.
@@ -177,6 +182,34 @@ GM_EXPORT @interface GMUserFileSystem : NSObject {
 - (BOOL)invalidateItemAtPath:(NSString *)path
                        error:(NSError **)error GM_AVAILABLE(3_8);
 
+/*!
+ * @abstract Returns statistics of the file system's internal caches.
+ * @discussion The returned dictionary maps cache identifiers, e.g.
+ * kGMUserFileSystemItemAttributesCacheKey, to dictionaries that contain the
+ * following keys (you must ignore unknown keys):<ul>
+ *   <li>kGMUserFileSystemStatisticsHitsKey
+ *   <li>kGMUserFileSystemStatisticsMissesKey
+ *   <li>kGMUserFileSystemStatisticsCountKey
+ *   <li>kGMUserFileSystemStatisticsSizeKey</ul>
+ * Caches that have not been enabled are not included. The entry for
+ * kGMUserFileSystemFileDataKey contains kGMUserFileSystemStatisticsSizeKey and
+ * kGMUserFileSystemStatisticsSpilledSizeKey instead. The entry for
+ * kGMUserFileSystemMemoryBudgetKey contains kGMUserFileSystemStatisticsSizeKey,
+ * kGMUserFileSystemStatisticsLimitKey, kGMUserFileSystemStatisticsPurgedSizeKey
+ * and kGMUserFileSystemStatisticsConsumersKey.
+ * @result A dictionary of cache statistics.
+ */
+- (NSDictionary *)statistics GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns the path of the item with the given node ID.
+ * @discussion Only valid if the file system has been mounted with the
+ * \@"lowlevel" option. See GMUserFileSystemNodeOperations.
+ * @param nodeID The node ID of the item.
+ * @result The path of the item or nil if the node ID is not known.
+ */
+- (NSString *)pathForNodeID:(UInt64)nodeID GM_AVAILABLE(3_9);
+
 @end
 
 #pragma mark Operation Context
@@ -233,6 +266,212 @@ extern NSString* const kGMUserFileSystemDidMount GM_AVAILABLE(2_0);
 /*! @abstract Notification sent after the filesystem is successfully unmounted. */
 extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
 
+#pragma mark Statistics
+
+/*! @group Statistics */
+
+/*! @abstract Statistics of the cache for item attributes (stat). */
+extern NSString* const kGMUserFileSystemItemAttributesCacheKey GM_AVAILABLE(3_9);
+
+/*! @abstract Statistics of the cache for file system attributes (statfs). */
+extern NSString* const kGMUserFileSystemFileSystemAttributesCacheKey GM_AVAILABLE(3_9);
+
+/*! @abstract Statistics of the cache for items that do not exist (ENOENT). */
+extern NSString* const kGMUserFileSystemNegativeLookupCacheKey GM_AVAILABLE(3_9);
+
+/*! @abstract Statistics of the cache for directory listings (readdir). */
+extern NSString* const kGMUserFileSystemDirectoryContentsCacheKey GM_AVAILABLE(3_9);
+
+/*! @abstract Statistics of the cache for file contents (contentsAtPath:). */
+extern NSString* const kGMUserFileSystemFileContentsCacheKey GM_AVAILABLE(3_9);
+
+/*! @abstract Statistics of the cache for extended attributes. */
+extern NSString* const kGMUserFileSystemExtendedAttributesCacheKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Statistics of the cache for FinderInfo and resource forks built from
+ * finderAttributesAtPath:error: and resourceAttributesAtPath:error:.
+ */
+extern NSString* const kGMUserFileSystemResourcesCacheKey GM_AVAILABLE(3_9);
+
+/*! @abstract Statistics of the cache for file blocks (blockAtPath:index:error:). */
+extern NSString* const kGMUserFileSystemFileBlockCacheKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Statistics of the memory used by paged GMMutableDataBackedFileDelegate
+ * objects (see kGMUserFileSystemVolumeFileDataMemoryLimitKey).
+ */
+extern NSString* const kGMUserFileSystemFileDataKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Statistics of the memory used by file contents read ahead (see
+ * kGMUserFileSystemVolumeReadaheadSizeKey).
+ */
+extern NSString* const kGMUserFileSystemReadaheadKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Statistics of the cache for file contents on disk (see
+ * kGMUserFileSystemVolumeDiskCacheDirectoryKey).
+ */
+extern NSString* const kGMUserFileSystemDiskBlockCacheKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Statistics of the memory used by buffered writes (see
+ * kGMUserFileSystemVolumeWriteBackSizeKey).
+ */
+extern NSString* const kGMUserFileSystemWriteBackKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Statistics of the memory used by all caches and buffers (see
+ * kGMUserFileSystemVolumeMemoryLimitKey).
+ */
+extern NSString* const kGMUserFileSystemMemoryBudgetKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Statistics of the table of inode numbers and paths known to the
+ * file system.
+ */
+extern NSString* const kGMUserFileSystemInodeTableKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Statistics of the metadata recorded for the metadata snapshot (see
+ * kGMUserFileSystemVolumeMetadataSnapshotPathKey).
+ */
+extern NSString* const kGMUserFileSystemMetadataSnapshotKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Number of cache hits.
+ * @discussion The value is an NSNumber with uint64 value.
+ */
+extern NSString* const kGMUserFileSystemStatisticsHitsKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Number of cache misses.
+ * @discussion The value is an NSNumber with uint64 value.
+ */
+extern NSString* const kGMUserFileSystemStatisticsMissesKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Number of cached entries.
+ * @discussion The value is an NSNumber with uint64 value.
+ */
+extern NSString* const kGMUserFileSystemStatisticsCountKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Approximate size of the cached entries in bytes.
+ * @discussion The value is an NSNumber with uint64 value.
+ */
+extern NSString* const kGMUserFileSystemStatisticsSizeKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Number of bytes written to disk after exceeding a memory limit.
+ * @discussion The value is an NSNumber with uint64 value.
+ */
+extern NSString* const kGMUserFileSystemStatisticsSpilledSizeKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Memory limit in bytes, or zero if there is none.
+ * @discussion The value is an NSNumber with uint64 value.
+ */
+extern NSString* const kGMUserFileSystemStatisticsLimitKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Number of bytes removed from caches to stay within the memory limit
+ * or on memory pressure.
+ * @discussion The value is an NSNumber with uint64 value.
+ */
+extern NSString* const kGMUserFileSystemStatisticsPurgedSizeKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Approximate memory used by each cache or buffer.
+ * @discussion The value is an NSDictionary that maps the identifiers of the
+ * caches and buffers, e.g. kGMUserFileSystemItemAttributesCacheKey, to NSNumbers
+ * with the number of bytes used.
+ */
+extern NSString* const kGMUserFileSystemStatisticsConsumersKey GM_AVAILABLE(3_9);
+
+#pragma mark Item Attributes
+
+/*! @group Item Attributes */
+
+/*!
+ * @abstract Flags of the fields of GMItemAttributes that are set.
+ * @constant kGMItemAttributeType type
+ * @constant kGMItemAttributePermissions permissions
+ * @constant kGMItemAttributeOwner uid
+ * @constant kGMItemAttributeGroup gid
+ * @constant kGMItemAttributeLinkCount linkCount
+ * @constant kGMItemAttributeFlags flags
+ * @constant kGMItemAttributeInode inode
+ * @constant kGMItemAttributeSize size
+ * @constant kGMItemAttributeSizeInBlocks sizeInBlocks
+ * @constant kGMItemAttributeOptimalIOSize optimalIOSize
+ * @constant kGMItemAttributeAccessTime accessTime
+ * @constant kGMItemAttributeModificationTime modificationTime
+ * @constant kGMItemAttributeChangeTime changeTime
+ * @constant kGMItemAttributeCreationTime creationTime
+ * @constant kGMItemAttributeBackupTime backupTime
+ */
+enum {
+  kGMItemAttributeType             = 1 << 0,
+  kGMItemAttributePermissions      = 1 << 1,
+  kGMItemAttributeOwner            = 1 << 2,
+  kGMItemAttributeGroup            = 1 << 3,
+  kGMItemAttributeLinkCount        = 1 << 4,
+  kGMItemAttributeFlags            = 1 << 5,
+  kGMItemAttributeInode            = 1 << 6,
+  kGMItemAttributeSize             = 1 << 7,
+  kGMItemAttributeSizeInBlocks     = 1 << 8,
+  kGMItemAttributeOptimalIOSize    = 1 << 9,
+  kGMItemAttributeAccessTime       = 1 << 10,
+  kGMItemAttributeModificationTime = 1 << 11,
+  kGMItemAttributeChangeTime       = 1 << 12,
+  kGMItemAttributeCreationTime     = 1 << 13,
+  kGMItemAttributeBackupTime       = 1 << 14
+};
+
+/*!
+ * @abstract Item attributes as a plain structure.
+ * @discussion The counterpart of the attribute dictionaries of
+ * attributesOfItemAtPath:userData:error: and setAttributes:ofItemAtPath:userData:error:
+ * that needs no objects to be created and keeps times in nanoseconds. Only the
+ * fields whose flags are set in valid are meaningful; the flags correspond to
+ * the dictionary keys as follows:<ul>
+ *   <li>type: NSFileType, one of S_IFDIR, S_IFREG or S_IFLNK
+ *   <li>permissions: NSFilePosixPermissions
+ *   <li>uid: NSFileOwnerAccountID
+ *   <li>gid: NSFileGroupOwnerAccountID
+ *   <li>linkCount: NSFileReferenceCount
+ *   <li>flags: kGMUserFileSystemFileFlagsKey
+ *   <li>inode: NSFileSystemFileNumber
+ *   <li>size: NSFileSize
+ *   <li>sizeInBlocks: kGMUserFileSystemFileSizeInBlocksKey
+ *   <li>optimalIOSize: kGMUserFileSystemFileOptimalIOSizeKey
+ *   <li>accessTime: kGMUserFileSystemFileAccessDateKey
+ *   <li>modificationTime: NSFileModificationDate
+ *   <li>changeTime: kGMUserFileSystemFileChangeDateKey
+ *   <li>creationTime: NSFileCreationDate
+ *   <li>backupTime: kGMUserFileSystemFileBackupDateKey</ul>
+ */
+typedef struct {
+  UInt32 valid;  // kGMItemAttribute flags of the fields that are set.
+  mode_t type;
+  mode_t permissions;
+  uid_t uid;
+  gid_t gid;
+  UInt32 linkCount;
+  UInt32 flags;
+  UInt64 inode;
+  off_t size;
+  UInt64 sizeInBlocks;
+  UInt32 optimalIOSize;
+  struct timespec accessTime;
+  struct timespec modificationTime;
+  struct timespec changeTime;
+  struct timespec creationTime;
+  struct timespec backupTime;
+} GMItemAttributes;
+
 #pragma mark -
 
 #pragma mark GMUserFileSystem Delegate Protocols
@@ -254,6 +493,30 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
 /*! @abstract Called just before an unmount of the file system will occur. */
 - (void)willUnmount GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Returns the current generation of the file system's metadata.
+ * @discussion Called once at mount time if the file system keeps a metadata
+ * snapshot (see kGMUserFileSystemVolumeMetadataSnapshotPathKey). The generation
+ * must change whenever items have been changed since the last mount, e.g. a
+ * journal sequence number or a server-side change token.
+ * @result The generation, or nil not to use a metadata snapshot.
+ */
+- (NSString *)metadataGeneration GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns the items changed since a generation.
+ * @discussion Called at mount time if the metadata snapshot was saved for
+ * another generation than the current one. The saved metadata of the returned
+ * items, of the items below them and of the directories containing them is
+ * fetched again; the rest of the snapshot remains in use.
+ * @param generation A generation previously returned by metadataGeneration.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result The paths of the changed, created and removed items, or nil if they
+ * are not known. In that case the whole snapshot is discarded.
+ */
+- (NSArray *)pathsOfItemsChangedSinceMetadataGeneration:(NSString *)generation
+                                                  error:(NSError **)error GM_AVAILABLE(3_9);
+
 @end
 
 /*! 
@@ -290,6 +553,76 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
  */
 - (NSArray *)contentsOfDirectoryAtPath:(NSString *)path error:(NSError **)error GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Returns directory contents and their attributes at the specified path.
+ * @discussion Returns a dictionary that maps the names of the files and
+ * sub-directories in the specified directory to dictionaries of their
+ * attributes. The attribute dictionaries support the same keys as
+ * attributesOfItemAtPath:userData:error:. If implemented, this is called
+ * instead of contentsOfDirectoryAtPath:error: and the attributes are passed to
+ * FUSE along with the names. If the item attributes cache is enabled (see
+ * kGMUserFileSystemVolumeItemAttributesCacheTimeoutKey), it is seeded with the
+ * attributes, so examining the items right after listing the directory does not
+ * result in additional delegate calls.
+ * @seealso man readdir(3)
+ * @param path The path to a directory.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result A dictionary of attribute dictionaries keyed by name or nil on error.
+ */
+- (NSDictionary *)contentsAndAttributesOfDirectoryAtPath:(NSString *)path
+                                                   error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Opens the directory at the specified path for enumeration.
+ * @discussion Only called if the delegate implements
+ * contentsOfDirectoryAtPath:userData:cookie:nextCookie:error:. The userData
+ * is passed to the following calls for this directory handle and released
+ * after releaseDirectoryAtPath:userData: has been called.
+ * @seealso man opendir(3)
+ * @param path The path to a directory.
+ * @param userData Out parameter that can be filled in with arbitrary user data.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result YES if the directory was opened successfully.
+ */
+- (BOOL)openDirectoryAtPath:(NSString *)path
+                   userData:(id *)userData
+                      error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns the next batch of directory contents at the specified path.
+ * @discussion Implement this instead of contentsOfDirectoryAtPath:error: to
+ * enumerate large directories in batches of names. The first batch is
+ * requested with a cookie of 0. Set nextCookie to the value that identifies
+ * the batch following the returned one; its meaning is up to the delegate.
+ * Return an empty array once there are no more names. Batches are requested
+ * while the kernel reads the directory, so only one batch is held in memory
+ * per directory handle and the listing can start before all names are known.
+ * If a directory handle is rewound, enumeration restarts with a cookie of 0.
+ * @seealso man readdir(3)
+ * @param path The path to a directory.
+ * @param userData The userData corresponding to this open directory or nil.
+ * @param cookie The cookie identifying the requested batch.
+ * @param nextCookie Out parameter to be filled with the cookie of the next batch.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result An array of NSString, an empty array at the end, or nil on error.
+ */
+- (NSArray *)contentsOfDirectoryAtPath:(NSString *)path
+                              userData:(id)userData
+                                cookie:(UInt64)cookie
+                            nextCookie:(UInt64 *)nextCookie
+                                 error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Releases the directory at the specified path.
+ * @discussion Called when a directory handle opened with
+ * openDirectoryAtPath:userData:error: is closed.
+ * @seealso man closedir(3)
+ * @param path The path to a directory.
+ * @param userData The userData corresponding to this open directory or nil.
+ */
+- (void)releaseDirectoryAtPath:(NSString *)path
+                      userData:(id)userData GM_AVAILABLE(3_9);
+
 #pragma mark Getting and Setting Attributes
 
 /*!
@@ -314,6 +647,13 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
  *   <li>kGMUserFileSystemFileFlagsKey
  *   <li>kGMUserFileSystemFileSizeInBlocksKey</ul>
  *
+ * If NSFileSystemFileNumber is omitted, the item is given an inode number that
+ * stays the same while the item is open. Renamed items keep their inode
+ * numbers. To bound the memory used, items that are not open may be given new
+ * numbers once they have not been used for a while. These numbers have the
+ * highest bit set, so they do not collide with the NSFileSystemFileNumber
+ * values of other items as long as those are below 2^63.
+ *
  * If this is the fstat variant and userData was supplied in openFileAtPath: or 
  * createFileAtPath: then it will be passed back in this call.
  *
@@ -327,6 +667,52 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
                                 userData:(id)userData
                                    error:(NSError **)error GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Gets attributes at the specified path without creating objects.
+ * @discussion Used instead of attributesOfItemAtPath:userData:error: to stat
+ * items if implemented. When called, attributes holds the defaults for the
+ * item: its type, permissions and link count. Set the fields you know,
+ * including the type, and their flags in the valid field of attributes; the
+ * rules of attributesOfItemAtPath:userData:error: apply to them as to the keys
+ * they correspond to. Attributes that are only known in the form of a
+ * dictionary, e.g. from attributesOfItemsAtPaths:error:, are still passed as
+ * one.
+ *
+ * If this is the fstat variant and userData was supplied in openFileAtPath: or
+ * createFileAtPath: then it will be passed back in this call.
+ *
+ * @seealso man stat(2), fstat(2)
+ * @param attributes The attributes to fill in.
+ * @param path The path to the item.
+ * @param userData The userData corresponding to this open file or nil.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result YES if the item exists and attributes have been filled in.
+ */
+- (BOOL)getItemAttributes:(GMItemAttributes *)attributes
+             ofItemAtPath:(NSString *)path
+                 userData:(id)userData
+                    error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns attributes of the items at the specified paths.
+ * @discussion Returns a dictionary that maps paths to dictionaries of item
+ * attributes, using the same keys as attributesOfItemAtPath:userData:error:.
+ * Paths of items that do not exist may be left out. This is used to prefetch
+ * the attributes of items that are likely to be examined soon, e.g. the items
+ * of a directory that has just been listed, with a single call. The results
+ * are stored in the item attributes cache, so this is only called if the cache
+ * is enabled (see kGMUserFileSystemVolumeItemAttributesCacheTimeoutKey).
+ * Items that are not part of the result are looked up individually using
+ * attributesOfItemAtPath:userData:error: when needed. If the delegate is
+ * thread-safe, the items of large directories are prefetched in batches on a
+ * background thread, where currentContext is not available.
+ * @param paths An array of paths.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result A dictionary of attribute dictionaries keyed by path or nil on error.
+ */
+- (NSDictionary *)attributesOfItemsAtPaths:(NSArray *)paths
+                                     error:(NSError **)error GM_AVAILABLE(3_9);
+
 /*!
  * @abstract Returns file system attributes.
  * @discussion
@@ -338,8 +724,24 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
  *   <li>NSFileSystemFreeNodes
  *   <li>kGMUserFileSystemVolumeSupportsExtendedDatesKey
  *   <li>kGMUserFileSystemVolumeMaxFilenameLengthKey
- *   <li>kGMUserFileSystemVolumeFileSystemBlockSizeKey</ul>
- *   <li>kGMUserFileSystemVolumeSupportsCaseSensitiveNamesKey</ul>
+ *   <li>kGMUserFileSystemVolumeFileSystemBlockSizeKey
+ *   <li>kGMUserFileSystemVolumeSupportsCaseSensitiveNamesKey
+ *   <li>kGMUserFileSystemVolumeItemAttributesCacheTimeoutKey
+ *   <li>kGMUserFileSystemVolumeFileSystemAttributesCacheTimeoutKey
+ *   <li>kGMUserFileSystemVolumeNegativeLookupCacheTimeoutKey
+ *   <li>kGMUserFileSystemVolumeDirectoryContentsCacheTimeoutKey
+ *   <li>kGMUserFileSystemVolumeFileContentsCacheTimeoutKey
+ *   <li>kGMUserFileSystemVolumeExtendedAttributesCacheTimeoutKey
+ *   <li>kGMUserFileSystemVolumeFileContentsBlockSizeKey
+ *   <li>kGMUserFileSystemVolumeFileDataMemoryLimitKey
+ *   <li>kGMUserFileSystemVolumeFileDataHandleMemoryLimitKey
+ *   <li>kGMUserFileSystemVolumeReadaheadSizeKey
+ *   <li>kGMUserFileSystemVolumeReadaheadMemoryLimitKey
+ *   <li>kGMUserFileSystemVolumeWriteBackSizeKey
+ *   <li>kGMUserFileSystemVolumeDiskCacheDirectoryKey
+ *   <li>kGMUserFileSystemVolumeDiskCacheSizeKey
+ *   <li>kGMUserFileSystemVolumeMetadataSnapshotPathKey
+ *   <li>kGMUserFileSystemVolumeMemoryLimitKey</ul>
  *
  * @seealso man statvfs(3)
  * @param path A path on the file system (it is safe to ignore this).
@@ -381,6 +783,29 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
              userData:(id)userData
                 error:(NSError **)error GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Set attributes at the specified path without creating objects.
+ * @discussion Used instead of setAttributes:ofItemAtPath:userData:error: if
+ * implemented. The fields to set are flagged in the valid field of attributes;
+ * type, linkCount, inode, sizeInBlocks and optimalIOSize are never set. See
+ * setAttributes:ofItemAtPath:userData:error: for details.
+ *
+ * If this is the f-variant and userData was supplied in openFileAtPath: or
+ * createFileAtPath: then it will be passed back in this call.
+ *
+ * @seealso man truncate(2), chown(2), chmod(2), utimes(2), chflags(2),
+ *              ftruncate(2), fchown(2), fchmod(2), futimes(2), fchflags(2)
+ * @param attributes The attributes to set.
+ * @param path The path to the item.
+ * @param userData The userData corresponding to this open file or nil.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result YES if the attributes are successfully set.
+ */
+- (BOOL)setItemAttributes:(const GMItemAttributes *)attributes
+             ofItemAtPath:(NSString *)path
+                 userData:(id)userData
+                    error:(NSError **)error GM_AVAILABLE(3_9);
+
 #pragma mark File Contents
 
 /*!
@@ -388,12 +813,44 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
  * @discussion Returns the full contents at the given path. Implementation of
  * this delegate method is recommended only by very simple file systems that are 
  * not concerned with performance. If contentsAtPath is implemented then you can 
- * skip open/release/read.
+ * skip open/release/read. See kGMUserFileSystemVolumeFileContentsCacheTimeoutKey
+ * to avoid calling this repeatedly for the same file.
  * @param path The path to the file.
  * @result The contents of the file or nil if a file does not exist at path.
  */
 - (NSData *)contentsAtPath:(NSString *)path GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Returns the size of the file at the specified path.
+ * @discussion Implement this together with blockAtPath:index:error: to provide
+ * file contents in fixed-size blocks instead of implementing contentsAtPath: or
+ * open/release/read. The framework reads files at any offset by requesting the
+ * blocks that cover the range and keeps recently used blocks in a memory-bounded
+ * cache, so files never need to be held in memory as a whole. This is also used
+ * to compute NSFileSize if attributesOfItemAtPath:userData:error: leaves it out.
+ * @param path The path to the file.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result The size of the file in bytes or -1 on error.
+ */
+- (off_t)sizeOfItemAtPath:(NSString *)path
+                    error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns a block of the file at the specified path.
+ * @discussion Returns the bytes of the file from index * blockSize up to
+ * (index + 1) * blockSize, where blockSize is given by
+ * kGMUserFileSystemVolumeFileContentsBlockSizeKey. Only the last block of a
+ * file may be shorter. See sizeOfItemAtPath:error:. Blocks are cached until the
+ * file is modified through the file system or invalidateItemAtPath: is called.
+ * @param path The path to the file.
+ * @param index The index of the block.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result The block or nil on error.
+ */
+- (NSData *)blockAtPath:(NSString *)path
+                  index:(UInt64)index
+                  error:(NSError **)error GM_AVAILABLE(3_9);
+
 /*!
  * @abstract Opens the file at the given path for read/write.
  * @discussion This will only be called for existing files. If the file needs
@@ -444,6 +901,83 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
                offset:(off_t)offset
                 error:(NSError **)error GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Returns data of the open file at the specified path.
+ * @discussion Alternative to readFileAtPath:userData:buffer:size:offset:error:
+ * for delegates that already hold the file contents in memory. Returns up to
+ * size bytes of the file starting at offset. A data object that references the
+ * delegate's storage, e.g. one created with dataWithBytesNoCopy:length:
+ * freeWhenDone:, avoids copying the data; the storage must stay valid until the
+ * returned object is deallocated. When the file system is mounted using the
+ * low-level interface, the bytes are passed to the kernel without an
+ * intermediate copy. If userData was provided in the corresponding
+ * openFileAtPath: or createFileAtPath: call then it will be passed in.
+ * @seealso man pread(2)
+ * @param path The path to the file.
+ * @param userData The userData corresponding to this open file or nil.
+ * @param size The maximum number of bytes to return.
+ * @param offset The offset in the file from which to read data.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result The data read (empty at the end of the file) or nil on error.
+ */
+- (NSData *)readDataFromFileAtPath:(NSString *)path
+                          userData:(id)userData
+                              size:(size_t)size
+                            offset:(off_t)offset
+                             error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns a file descriptor backing the open file at the specified path.
+ * @discussion If the contents of the open file are those of a file descriptor
+ * at the same offsets, e.g. because the file system mirrors another file
+ * system, the framework reads from and writes to the file descriptor directly
+ * instead of calling readFileAtPath:userData:buffer:size:offset:error: and
+ * writeFileAtPath:userData:buffer:size:offset:error:. This spares the copy
+ * through a user space buffer where the kernel supports splicing. The file
+ * descriptor must stay open until releaseFileAtPath:userData: is called. If
+ * userData was provided in the corresponding openFileAtPath: or
+ * createFileAtPath: call then it will be passed in. Returning a
+ * GMFileDescriptorBackedFileDelegate as userData has the same effect and also
+ * covers truncation, preallocation and fsync without calling the delegate.
+ * @param path The path to the file.
+ * @param userData The userData corresponding to this open file or nil.
+ * @result A file descriptor or -1 if the file is not backed by one.
+ */
+- (int)fileDescriptorForFileAtPath:(NSString *)path
+                          userData:(id)userData GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns how the open file at the specified path is going to be read.
+ * @discussion Tunes reading ahead (see kGMUserFileSystemVolumeReadaheadSizeKey)
+ * for a file that has just been opened. A file read sequentially is read ahead
+ * from the first read on, a whole file is read ahead right after it has been
+ * opened and a file read randomly is not read ahead at all. If this method is
+ * not implemented, files are read ahead once sequential reads are detected.
+ * @param path The path to the file.
+ * @param userData The userData corresponding to this open file or nil.
+ * @result One of the kGMUserFileSystemFileAccessPattern constants.
+ */
+- (NSString *)accessPatternOfFileAtPath:(NSString *)path
+                               userData:(id)userData GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns the version of the contents of the open file at the
+ * specified path.
+ * @discussion Enables caching the contents of a file that has just been opened
+ * on disk (see kGMUserFileSystemVolumeDiskCacheDirectoryKey). The version, e.g.
+ * an etag or modification counter of the backing store, must change whenever
+ * the contents of the file change; blocks cached for other versions are never
+ * returned. Reads of the open file that can be answered from the cache do not
+ * call readFileAtPath:userData:buffer:size:offset:error:. Once the file is
+ * modified through the file system or invalidateItemAtPath: is called, the
+ * open file is no longer read from the cache.
+ * @param path The path to the file.
+ * @param userData The userData corresponding to this open file or nil.
+ * @result The version or nil if the contents of the file should not be cached.
+ */
+- (NSString *)contentVersionOfFileAtPath:(NSString *)path
+                                userData:(id)userData GM_AVAILABLE(3_9);
+
 /*!
  * @abstract Writes data to the open file at the specified path.
  * @discussion Writes data to the file starting at offset from the provided
@@ -492,6 +1026,43 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
                        length:(off_t)length
                         error:(NSError **)error GM_AVAILABLE(3_0);
 
+/*!
+ * @abstract Called when an open file is closed by one of its users.
+ * @discussion Called on every close(2) of a file descriptor referencing the
+ * open file. The writes buffered for the file (see
+ * kGMUserFileSystemVolumeWriteBackSizeKey) have been passed to
+ * writeFileAtPath:userData:buffer:size:offset:error: before this is called. If
+ * userData was provided in the corresponding openFileAtPath: or
+ * createFileAtPath: call then it will be passed in.
+ * @seealso man close(2)
+ * @param path The path to the file.
+ * @param userData The userData corresponding to this open file or nil.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result YES if the file was flushed successfully.
+ */
+- (BOOL)flushFileAtPath:(NSString *)path
+               userData:(id)userData
+                  error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Commits the contents of the open file to stable storage.
+ * @discussion The writes buffered for the file have been passed to
+ * writeFileAtPath:userData:buffer:size:offset:error: before this is called. If
+ * userData was provided in the corresponding openFileAtPath: or
+ * createFileAtPath: call then it will be passed in.
+ * @seealso man fsync(2), man fdatasync(2)
+ * @param path The path to the file.
+ * @param userData The userData corresponding to this open file or nil.
+ * @param dataOnly YES if only the contents, but not the metadata, of the file
+ *        need to be committed.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result YES if the file was synchronized successfully.
+ */
+- (BOOL)synchronizeFileAtPath:(NSString *)path
+                     userData:(id)userData
+                     dataOnly:(BOOL)dataOnly
+                        error:(NSError **)error GM_AVAILABLE(3_9);
+
 /*!
  * @abstract Atomically exchanges data between files.
  * @discussion  Called to atomically exchange file data between path1 and path2.
@@ -649,6 +1220,25 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
                             position:(off_t)position
                                error:(NSError **)error GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Returns the names and contents of all extended attributes at the
+ * specified path.
+ * @discussion Optional. If implemented, it is called instead of
+ * extendedAttributesOfItemAtPath:error: and
+ * valueOfExtendedAttribute:ofItemAtPath:position:error: whenever extended
+ * attributes are cached (see
+ * kGMUserFileSystemVolumeExtendedAttributesCacheTimeoutKey) or those are not
+ * implemented, so listing the attributes of an item and reading all of them
+ * takes a single call. If there are no extended attributes at this path, then
+ * return an empty dictionary. Return nil only on error.
+ * @param path The path to the specified file.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result An NSDictionary that maps attribute names to NSData values or nil on
+ * error.
+ */
+- (NSDictionary *)valuesOfExtendedAttributesOfItemAtPath:(NSString *)path
+                                                   error:(NSError **)error GM_AVAILABLE(3_9);
+
 /*!
  * @abstract Writes the contents of the extended attribute at the specified path.
  * @seealso man setxattr(2)
@@ -723,6 +1313,10 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
  * The following keys are currently supported (unknown keys are ignored):<ul>
  *   <li>kGMUserFileSystemCustomIconDataKey [Raw .icns file NSData]
  *   <li>kGMUserFileSystemWeblocURLkey [NSURL, only valid for .webloc files]</ul>
+ *
+ * The resource fork built from the attributes is kept and only built again if
+ * the attributes change. Returning the same NSData object for the icon, rather
+ * than a copy of it, each time lets the resource fork be reused.
  * @seealso man getxattr(2)
  * @param path The path to the item.
  * @param error Should be filled with a POSIX error in case of failure.
@@ -733,6 +1327,68 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
 
 @end
 
+/*!
+ * @category
+ * @discussion These methods are only used if the file system has been mounted
+ * with the \@"lowlevel" option. They identify items by the node IDs that
+ * GMUserFileSystem assigns when the kernel looks up an item, which allows file
+ * systems that do not store items by path to avoid path lookups for the most
+ * frequent operations. All other operations are still called with paths. Use
+ * GMUserFileSystem's pathForNodeID: to map a node ID to its current path.
+ *
+ * A node ID stays valid until forgetNodeID: is called for it, even if the item
+ * is renamed. The node ID of the root directory is always 1.
+ */
+@interface NSObject (GMUserFileSystemNodeOperations)
+
+/*!
+ * @abstract Returns attributes of the item with the given name in a directory.
+ * @discussion Called when the kernel looks up an item. Use this instead of
+ * attributesOfItemAtPath:userData:error: to look up items by their parent
+ * directory. The same keys as for attributesOfItemAtPath:userData:error: are
+ * supported.
+ * @param name The name of the item.
+ * @param parentNodeID The node ID of the directory containing the item.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result The attributes of the item or nil on error.
+ */
+- (NSDictionary *)attributesOfItemNamed:(NSString *)name
+                  inDirectoryWithNodeID:(UInt64)parentNodeID
+                                  error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns attributes of the item with the given node ID.
+ * @discussion Use this instead of attributesOfItemAtPath:userData:error: to
+ * get the attributes of items that have already been looked up.
+ * @param nodeID The node ID of the item.
+ * @param userData The userData corresponding to this open file or nil.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result The attributes of the item or nil on error.
+ */
+- (NSDictionary *)attributesOfItemWithNodeID:(UInt64)nodeID
+                                    userData:(id)userData
+                                       error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Returns directory contents of the directory with the given node ID.
+ * @discussion Use this instead of contentsOfDirectoryAtPath:error:.
+ * @param nodeID The node ID of the directory.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result An array of NSString or nil on error.
+ */
+- (NSArray *)contentsOfDirectoryWithNodeID:(UInt64)nodeID
+                                     error:(NSError **)error GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Called when the kernel no longer references a node ID.
+ * @discussion The node ID will not be used again. Any state associated with
+ * it can be discarded.
+ * @param nodeID The node ID that has been forgotten.
+ */
+- (void)forgetNodeID:(UInt64)nodeID GM_AVAILABLE(3_9);
+
+@end
+
 #pragma mark Additional Item Attribute Keys
 
 /*! @group Additional Item Attribute Keys */
@@ -825,6 +1481,227 @@ extern NSString* const kGMUserFileSystemVolumeMaxFilenameLengthKey GM_AVAILABLE(
  */
 extern NSString* const kGMUserFileSystemVolumeFileSystemBlockSizeKey GM_AVAILABLE(3_0);
 
+/*!
+ * @abstract Specifies how long item attributes may be cached.
+ * @discussion The value should be an NSNumber that is the number of seconds
+ * the framework may answer stat requests from its own cache instead of calling
+ * attributesOfItemAtPath:userData:error:. Cached attributes are discarded when
+ * the item is modified through the file system or when invalidateItemAtPath:
+ * is called. If omitted or zero, item attributes are not cached. The value is
+ * read once, when the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeItemAttributesCacheTimeoutKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how long file system attributes may be cached.
+ * @discussion The value should be an NSNumber that is the number of seconds
+ * the framework may answer statfs requests from its own cache instead of calling
+ * attributesOfFileSystemForPath:error:. If omitted or zero, file system
+ * attributes are not cached. The value is read once, when the file system is
+ * mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeFileSystemAttributesCacheTimeoutKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how long the absence of an item may be cached.
+ * @discussion The value should be an NSNumber that is the number of seconds
+ * the framework may remember that no item exists at a path, e.g. for "._*",
+ * ".DS_Store" or "Icon\r" probes, and answer stat requests for that path with
+ * ENOENT without calling the delegate. An entry is discarded as soon as an
+ * item is created, renamed or linked to that path through the file system, or
+ * when invalidateItemAtPath: is called for the path. The number of remembered
+ * paths is bounded. If omitted or zero, missing items are not cached. The value
+ * is read once, when the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeNegativeLookupCacheTimeoutKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how long directory listings may be cached.
+ * @discussion The value should be an NSNumber that is the number of seconds
+ * the framework may answer readdir requests from its own cache instead of
+ * calling contentsOfDirectoryAtPath:error:. Cached listings are updated when
+ * items are created, removed, renamed or linked through the file system and
+ * discarded when invalidateItemAtPath: is called for the directory or for an
+ * item in it. The number of cached directories and names is bounded. If
+ * omitted or zero, directory listings are not cached. The value is read once,
+ * when the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeDirectoryContentsCacheTimeoutKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how long file contents may be cached.
+ * @discussion The value should be an NSNumber that is the number of seconds
+ * the framework may reuse the result of contentsAtPath: instead of calling it
+ * again. Computing the size of a file for a stat request and all concurrently
+ * open handles of the file then share a single copy of its contents. Cached
+ * contents are discarded when the item is modified through the file system or
+ * when invalidateItemAtPath: is called. The total size of cached contents is
+ * bounded. If omitted or zero, file contents are not cached. The value is read
+ * once, when the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeFileContentsCacheTimeoutKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how long extended attributes may be cached.
+ * @discussion The value should be an NSNumber that is the number of seconds
+ * the framework may reuse the names and values of the extended attributes of an
+ * item, and the absence of an attribute, instead of asking the delegate again.
+ * Callers of getxattr(2) usually ask for the size of a value before reading it;
+ * both are answered by a single delegate call. Cached attributes of an item are
+ * discarded when an attribute is set or removed through the file system, when
+ * the item is modified, or when invalidateItemAtPath: is called. The number of
+ * cached items and the total size of cached values are bounded. If omitted or
+ * zero, extended attributes are not cached. The value is read once, when the
+ * file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeExtendedAttributesCacheTimeoutKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies the size of the blocks returned by blockAtPath:index:error:.
+ * @discussion The value should be an NSNumber that is the block size in bytes.
+ * If omitted 131072 bytes is assumed. The value is read once, when the file
+ * system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeFileContentsBlockSizeKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how much memory in-memory files may use in total.
+ * @discussion The value should be an NSNumber that is the number of bytes all
+ * paged GMMutableDataBackedFileDelegate objects returned as userData by
+ * openFileAtPath: or createFileAtPath: may use together. A file delegate that
+ * needs more memory moves its contents to an unlinked temporary file. Reads
+ * and writes then use the file. If omitted or zero, the memory is not limited.
+ * The value is read once, when the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeFileDataMemoryLimitKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how much memory a single in-memory file may use.
+ * @discussion The value should be an NSNumber that is the default memory limit
+ * of paged GMMutableDataBackedFileDelegate objects returned as userData (see
+ * kGMUserFileSystemVolumeFileDataMemoryLimitKey). It does not override a limit
+ * set using setMemoryLimit:. If omitted or zero, the memory is not limited. The
+ * value is read once, when the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeFileDataHandleMemoryLimitKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how far open files may be read ahead.
+ * @discussion The value should be an NSNumber that is the maximum number of
+ * bytes of an open file the framework may read ahead of a sequential reader.
+ * Reads ahead call readFileAtPath:userData:buffer:size:offset:error: on
+ * background threads, where currentContext is not available, and later reads
+ * are answered from the data read ahead. Files whose userData reads itself or
+ * that are backed by a file descriptor are not read ahead. Data read ahead is
+ * discarded when the file is modified through the file system or when
+ * invalidateItemAtPath: is called. See also
+ * accessPatternOfFileAtPath:userData:. If omitted or zero, or if the delegate
+ * is not thread-safe, files are not read ahead. The value is read once, when
+ * the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeReadaheadSizeKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how much memory data read ahead may use in total.
+ * @discussion The value should be an NSNumber that is the number of bytes the
+ * data read ahead of all open files may use together. Files are not read
+ * further ahead while the limit is reached. If omitted, 64 MB are used; zero
+ * means the memory is not limited. The value is read once, when the file
+ * system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeReadaheadMemoryLimitKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how many bytes of writes may be buffered per open file.
+ * @discussion The value should be an NSNumber that is the number of bytes of
+ * small writes to an open file the framework may buffer. Adjacent and
+ * overlapping writes are merged and passed to
+ * writeFileAtPath:userData:buffer:size:offset:error: in large extents once the
+ * limit is reached, once the oldest buffered write is more than a second old,
+ * and when the file is flushed, synchronized or released, or its attributes
+ * are read or changed. A write that fails while buffered writes are passed on
+ * is reported by the next flush or fsync(2) of the file. Files whose userData
+ * writes itself or that are backed by a file descriptor are not buffered. If
+ * omitted or zero, writes are not buffered. The value is read once, when the
+ * file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeWriteBackSizeKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies a directory to cache file contents in.
+ * @discussion The value should be an NSString that is the path of a directory
+ * the framework may use exclusively. Blocks of the contents of open files for
+ * which contentVersionOfFileAtPath:userData: returns a version are cached in
+ * the directory and read from it instead of calling
+ * readFileAtPath:userData:buffer:size:offset:error:. The cache survives
+ * remounts if the file system is unmounted cleanly; otherwise it starts out
+ * empty. Files whose userData reads itself or that are backed by a file
+ * descriptor are not cached. If omitted, file contents are not cached on disk.
+ * The value is read once, when the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeDiskCacheDirectoryKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how much disk space cached file contents may use.
+ * @discussion The value should be an NSNumber that is the number of bytes the
+ * cache directory (see kGMUserFileSystemVolumeDiskCacheDirectoryKey) may hold.
+ * The least recently used blocks are removed once the limit is exceeded. If
+ * omitted, 1 GB is used; zero means the size is not limited. The value is read
+ * once, when the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeDiskCacheSizeKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies a file to keep metadata in across mounts.
+ * @discussion The value should be an NSString that is the path of a file the
+ * framework may use exclusively. When the file system is unmounted, the item
+ * attributes, directory listings and symbolic link destinations returned by
+ * the delegate are saved to the file along with the delegate's
+ * metadataGeneration. On the next mount they are answered from the file once,
+ * without calling the delegate, and then cached like metadata returned by the
+ * delegate: they expire after the item attributes or directory contents cache
+ * timeout, and symbolic link destinations are fetched again on the next
+ * lookup. If the generation has changed in the meantime, only the items
+ * returned by pathsOfItemsChangedSinceMetadataGeneration:error: are fetched
+ * again; if that fails, the saved metadata is discarded. Changes made behind
+ * the file system's back while it is mounted must be reported using
+ * invalidateItemAtPath:error:. Ignored if the delegate does not implement
+ * metadataGeneration. The value is read once, when the file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeMetadataSnapshotPathKey GM_AVAILABLE(3_9);
+
+/*!
+ * @abstract Specifies how much memory the caches and buffers may use together.
+ * @discussion The value should be an NSNumber that is a number of bytes. The
+ * in-memory caches, the pages of paged file delegates, read ahead file contents
+ * and buffered writes are accounted to a single budget. Once they exceed the
+ * limit, the caches holding more than their share are trimmed, least recently
+ * used entries first. Attributes get a larger share than file contents. Pages
+ * and buffered writes are not trimmed, but leave less room for the caches; use
+ * kGMUserFileSystemVolumeFileDataMemoryLimitKey and
+ * kGMUserFileSystemVolumeWriteBackSizeKey to bound them. Regardless of the
+ * limit, the caches are trimmed when the system is under memory pressure. If
+ * omitted or zero, there is no common limit. The value is read once, when the
+ * file system is mounted.
+ */
+extern NSString* const kGMUserFileSystemVolumeMemoryLimitKey GM_AVAILABLE(3_9);
+
+#pragma mark File Access Patterns
+
+/*! @group File Access Patterns */
+
+/*! @abstract The file is read ahead once sequential reads are detected. */
+extern NSString* const kGMUserFileSystemFileAccessPatternNormal GM_AVAILABLE(3_9);
+
+/*! @abstract The file is read sequentially. */
+extern NSString* const kGMUserFileSystemFileAccessPatternSequential GM_AVAILABLE(3_9);
+
+/*! @abstract The file is read randomly and is not read ahead. */
+extern NSString* const kGMUserFileSystemFileAccessPatternRandom GM_AVAILABLE(3_9);
+
+/*! @abstract The whole file is going to be read. */
+extern NSString* const kGMUserFileSystemFileAccessPatternWholeFile GM_AVAILABLE(3_9);
+
 #pragma mark Additional Finder and Resource Fork Keys
 
 /*! @group Additional Finder and Resource Fork Keys */
@@ -56,13 +56,25 @@
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/sysctl.h>
+#include <sys/time.h>
 #include <sys/utsname.h>
 #include <sys/vnode.h>
 
 #import <Foundation/Foundation.h>
+#import <objc/runtime.h>
+#import "GMBlockCache.h"
+#import "GMDiskBlockCache.h"
+#import "GMMetadataSnapshot.h"
+#import "GMMemoryBudget.h"
+#import "GMCache.h"
+#import "GMInodeTable.h"
 #import "GMFinderInfo.h"
 #import "GMResourceFork.h"
 #import "GMDataBackedFileDelegate.h"
+#import "GMDataBackedFileDelegate_Private.h"
+#import "GMPageStore.h"
+#import "GMReadahead.h"
+#import "GMWriteBack.h"
 
 #import "GMDTrace.h"
 
@@ -85,6 +97,31 @@ GM_EXPORT NSString* const kGMUserFileSystemMountFailed = @"kGMUserFileSystemMoun
 GM_EXPORT NSString* const kGMUserFileSystemDidMount = @"kGMUserFileSystemDidMount";
 GM_EXPORT NSString* const kGMUserFileSystemDidUnmount = @"kGMUserFileSystemDidUnmount";
 
+// Statistics
+GM_EXPORT NSString* const kGMUserFileSystemItemAttributesCacheKey = @"kGMUserFileSystemItemAttributesCacheKey";
+GM_EXPORT NSString* const kGMUserFileSystemFileSystemAttributesCacheKey = @"kGMUserFileSystemFileSystemAttributesCacheKey";
+GM_EXPORT NSString* const kGMUserFileSystemNegativeLookupCacheKey = @"kGMUserFileSystemNegativeLookupCacheKey";
+GM_EXPORT NSString* const kGMUserFileSystemDirectoryContentsCacheKey = @"kGMUserFileSystemDirectoryContentsCacheKey";
+GM_EXPORT NSString* const kGMUserFileSystemFileContentsCacheKey = @"kGMUserFileSystemFileContentsCacheKey";
+GM_EXPORT NSString* const kGMUserFileSystemExtendedAttributesCacheKey = @"kGMUserFileSystemExtendedAttributesCacheKey";
+GM_EXPORT NSString* const kGMUserFileSystemResourcesCacheKey = @"kGMUserFileSystemResourcesCacheKey";
+GM_EXPORT NSString* const kGMUserFileSystemFileBlockCacheKey = @"kGMUserFileSystemFileBlockCacheKey";
+GM_EXPORT NSString* const kGMUserFileSystemFileDataKey = @"kGMUserFileSystemFileDataKey";
+GM_EXPORT NSString* const kGMUserFileSystemReadaheadKey = @"kGMUserFileSystemReadaheadKey";
+GM_EXPORT NSString* const kGMUserFileSystemDiskBlockCacheKey = @"kGMUserFileSystemDiskBlockCacheKey";
+GM_EXPORT NSString* const kGMUserFileSystemWriteBackKey = @"kGMUserFileSystemWriteBackKey";
+GM_EXPORT NSString* const kGMUserFileSystemMemoryBudgetKey = @"kGMUserFileSystemMemoryBudgetKey";
+GM_EXPORT NSString* const kGMUserFileSystemInodeTableKey = @"kGMUserFileSystemInodeTableKey";
+GM_EXPORT NSString* const kGMUserFileSystemMetadataSnapshotKey = @"kGMUserFileSystemMetadataSnapshotKey";
+GM_EXPORT NSString* const kGMUserFileSystemStatisticsHitsKey = @"kGMUserFileSystemStatisticsHitsKey";
+GM_EXPORT NSString* const kGMUserFileSystemStatisticsMissesKey = @"kGMUserFileSystemStatisticsMissesKey";
+GM_EXPORT NSString* const kGMUserFileSystemStatisticsCountKey = @"kGMUserFileSystemStatisticsCountKey";
+GM_EXPORT NSString* const kGMUserFileSystemStatisticsSizeKey = @"kGMUserFileSystemStatisticsSizeKey";
+GM_EXPORT NSString* const kGMUserFileSystemStatisticsSpilledSizeKey = @"kGMUserFileSystemStatisticsSpilledSizeKey";
+GM_EXPORT NSString* const kGMUserFileSystemStatisticsLimitKey = @"kGMUserFileSystemStatisticsLimitKey";
+GM_EXPORT NSString* const kGMUserFileSystemStatisticsPurgedSizeKey = @"kGMUserFileSystemStatisticsPurgedSizeKey";
+GM_EXPORT NSString* const kGMUserFileSystemStatisticsConsumersKey = @"kGMUserFileSystemStatisticsConsumersKey";
+
 // Attribute keys
 GM_EXPORT NSString* const kGMUserFileSystemFileFlagsKey = @"kGMUserFileSystemFileFlagsKey";
 GM_EXPORT NSString* const kGMUserFileSystemFileAccessDateKey = @"kGMUserFileSystemFileAccessDateKey";
@@ -98,6 +135,28 @@ GM_EXPORT NSString* const kGMUserFileSystemVolumeSupportsExchangeDataKey = @"kGM
 GM_EXPORT NSString* const kGMUserFileSystemVolumeSupportsExtendedDatesKey = @"kGMUserFileSystemVolumeSupportsExtendedDatesKey";
 GM_EXPORT NSString* const kGMUserFileSystemVolumeMaxFilenameLengthKey = @"kGMUserFileSystemVolumeMaxFilenameLengthKey";
 GM_EXPORT NSString* const kGMUserFileSystemVolumeFileSystemBlockSizeKey = @"kGMUserFileSystemVolumeFileSystemBlockSizeKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeItemAttributesCacheTimeoutKey = @"kGMUserFileSystemVolumeItemAttributesCacheTimeoutKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeFileSystemAttributesCacheTimeoutKey = @"kGMUserFileSystemVolumeFileSystemAttributesCacheTimeoutKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeNegativeLookupCacheTimeoutKey = @"kGMUserFileSystemVolumeNegativeLookupCacheTimeoutKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeDirectoryContentsCacheTimeoutKey = @"kGMUserFileSystemVolumeDirectoryContentsCacheTimeoutKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeFileContentsCacheTimeoutKey = @"kGMUserFileSystemVolumeFileContentsCacheTimeoutKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeExtendedAttributesCacheTimeoutKey = @"kGMUserFileSystemVolumeExtendedAttributesCacheTimeoutKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeFileContentsBlockSizeKey = @"kGMUserFileSystemVolumeFileContentsBlockSizeKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeFileDataMemoryLimitKey = @"kGMUserFileSystemVolumeFileDataMemoryLimitKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeFileDataHandleMemoryLimitKey = @"kGMUserFileSystemVolumeFileDataHandleMemoryLimitKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeReadaheadSizeKey = @"kGMUserFileSystemVolumeReadaheadSizeKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeReadaheadMemoryLimitKey = @"kGMUserFileSystemVolumeReadaheadMemoryLimitKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeWriteBackSizeKey = @"kGMUserFileSystemVolumeWriteBackSizeKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeDiskCacheDirectoryKey = @"kGMUserFileSystemVolumeDiskCacheDirectoryKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeDiskCacheSizeKey = @"kGMUserFileSystemVolumeDiskCacheSizeKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeMetadataSnapshotPathKey = @"kGMUserFileSystemVolumeMetadataSnapshotPathKey";
+GM_EXPORT NSString* const kGMUserFileSystemVolumeMemoryLimitKey = @"kGMUserFileSystemVolumeMemoryLimitKey";
+
+// File access patterns
+GM_EXPORT NSString* const kGMUserFileSystemFileAccessPatternNormal = @"kGMUserFileSystemFileAccessPatternNormal";
+GM_EXPORT NSString* const kGMUserFileSystemFileAccessPatternSequential = @"kGMUserFileSystemFileAccessPatternSequential";
+GM_EXPORT NSString* const kGMUserFileSystemFileAccessPatternRandom = @"kGMUserFileSystemFileAccessPatternRandom";
+GM_EXPORT NSString* const kGMUserFileSystemFileAccessPatternWholeFile = @"kGMUserFileSystemFileAccessPatternWholeFile";
 
 // TODO: Remove comment on EXPORT if/when setvolname is supported.
 /* GM_EXPORT */ NSString* const kGMUserFileSystemVolumeSupportsSetVolumeNameKey = @"kGMUserFileSystemVolumeSupportsSetVolumeNameKey";
@@ -112,6 +171,107 @@ GM_EXPORT NSString* const kGMUserFileSystemWeblocURLKey = @"kGMUserFileSystemWeb
 // Used for time conversions to/from tv_nsec.
 static const double kNanoSecondsPerSecond = 1000000000.0;
 
+// Maximum number of items whose attributes are cached at a time.
+static const NSUInteger kItemAttributesCacheCountLimit = 65536;
+
+// Maximum number of nodes the inode table keeps for the high-level interface,
+// which only uses them to number items. Open items are not counted.
+static const NSUInteger kInodeTableCountLimit = 4 * kItemAttributesCacheCountLimit;
+
+// Maximum number of paths whose attributes are prefetched with a single call to
+// the delegate.
+static const NSUInteger kAttributesPrefetchBatchSize = 1024;
+
+// Maximum number of paths that are remembered not to exist at a time.
+static const NSUInteger kNegativeLookupCacheCountLimit = 4096;
+
+// Maximum number of directories whose contents are cached at a time.
+static const NSUInteger kDirectoryContentsCacheCountLimit = 1024;
+
+// Estimated size in bytes of a name in a cached directory listing, and the
+// maximum total size of cached directory listings (1048576 names).
+static const NSUInteger kDirectoryContentsNameCost = 64;
+static const NSUInteger kDirectoryContentsCacheCostLimit =
+  1048576 * kDirectoryContentsNameCost;
+
+// Cached listings with more names than this are dropped rather than updated
+// when an item is created or removed, since updating them means copying them.
+static const NSUInteger kDirectoryContentsUpdateLimit = 4096;
+
+// Maximum total size in bytes of cached file contents. Larger files are never
+// cached.
+static const NSUInteger kFileContentsCacheCostLimit = 64 * 1024 * 1024;
+
+// Maximum number of items and total size in bytes of cached extended
+// attributes, and the estimated size of a name.
+static const NSUInteger kExtendedAttributesCacheCountLimit = 4096;
+static const NSUInteger kExtendedAttributesCacheCostLimit = 16 * 1024 * 1024;
+static const NSUInteger kExtendedAttributeNameCost = 64;
+
+// Maximum number of items and total size in bytes of the FinderInfo and
+// resource forks built from the attributes returned by the delegate, and the
+// estimated size of an entry besides them. They are only built again if the
+// delegate returns other attributes, so they do not time out.
+static const NSUInteger kResourcesCacheCountLimit = 1024;
+static const NSUInteger kResourcesCacheCostLimit = 32 * 1024 * 1024;
+static const NSUInteger kResourcesEntryCost = 256;
+
+// Default size in bytes of the blocks returned by blockAtPath:index:error:.
+static const NSUInteger kDefaultFileContentsBlockSize = 128 * 1024;
+
+// Maximum total size in bytes of cached file blocks and the number of
+// independently locked shards they are spread over.
+static const NSUInteger kFileBlockCacheCostLimit = 128 * 1024 * 1024;
+static const NSUInteger kFileBlockCacheShardCount = 16;
+
+// Size in bytes of the chunks files are read ahead in, the default total size
+// of all chunks and the maximum number of chunks read at the same time.
+static const NSUInteger kReadaheadChunkSize = 128 * 1024;
+static const NSUInteger kDefaultReadaheadMemoryLimit = 64 * 1024 * 1024;
+static const NSInteger kReadaheadConcurrency = 4;
+
+// How long in seconds writes may be buffered before they are passed on to the
+// delegate by the next write.
+static const NSTimeInterval kWriteBackMaxAge = 1.0;
+
+// Size in bytes of the blocks of file contents cached on disk and the default
+// total size of the blocks.
+static const NSUInteger kDiskBlockCacheBlockSize = 128 * 1024;
+static const UInt64 kDefaultDiskBlockCacheSizeLimit = 1024ULL * 1024 * 1024;
+
+// Weights of the consumers of the memory budget. A consumer with a larger
+// weight keeps a larger share of the memory limit. Attributes are cheap to keep
+// and expensive to fetch again; file contents are the opposite. Memory of the
+// file delegates and buffered writes can only be accounted, as can the inode
+// table of the low-level interface, whose nodes the kernel references.
+static const NSUInteger kItemAttributesMemoryWeight = 4;
+static const NSUInteger kFileSystemAttributesMemoryWeight = 4;
+static const NSUInteger kNegativeLookupMemoryWeight = 2;
+static const NSUInteger kDirectoryContentsMemoryWeight = 2;
+static const NSUInteger kFileContentsMemoryWeight = 1;
+static const NSUInteger kExtendedAttributesMemoryWeight = 2;
+static const NSUInteger kResourcesMemoryWeight = 1;
+static const NSUInteger kFileBlockMemoryWeight = 1;
+static const NSUInteger kReadaheadMemoryWeight = 1;
+static const NSUInteger kMetadataSnapshotMemoryWeight = 1;
+static const NSUInteger kInodeTableMemoryWeight = 1;
+
+// The file system attributes are the same for every path, so they are cached
+// using a single key.
+static NSString* const kFileSystemAttributesCacheKey = @"/";
+
+// Mount option that selects the low-level FUSE interface. It is handled by the
+// framework and not passed on to FUSE.
+static NSString* const kLowLevelMountOption = @"lowlevel";
+
+// How long the kernel may cache entries and attributes returned by the
+// low-level interface. Matches the defaults of the high-level interface.
+static const double kLowLevelEntryTimeout = 1.0;
+static const double kLowLevelAttributeTimeout = 1.0;
+
+// The inode number reported for directory entries whose node is not known.
+static const ino_t kLowLevelUnknownInode = 0xffffffff;
+
 typedef enum {
   // Unable to unmount a dead FUSE files system located at mount point.
   GMUserFileSystem_ERROR_UNMOUNT_DEADFS = 1000,
@@ -136,6 +296,137 @@ typedef enum {
   GMUserFileSystem_FAILURE,         // Failed state; probably a mount failure.
 } GMUserFileSystemStatus;
 
+// The delegate methods the framework calls. Whether the delegate implements
+// them is resolved once, when the delegate is set, rather than on every call.
+// Keep in sync with the selectors in -[GMUserFileSystemInternal setDelegate:].
+typedef enum {
+  kGMDelegateWillMount,
+  kGMDelegateWillUnmount,
+  kGMDelegateFinderAttributes,
+  kGMDelegateResourceAttributes,
+  kGMDelegateAttributesOfItemWithNodeID,
+  kGMDelegateAttributesOfItemNamed,
+  kGMDelegateContentsOfDirectoryWithNodeID,
+  kGMDelegateForgetNodeID,
+  kGMDelegateCreateDirectory,
+  kGMDelegateCreateFile,
+  kGMDelegateCreateFileDeprecated,
+  kGMDelegateRemoveDirectory,
+  kGMDelegateRemoveItem,
+  kGMDelegateMoveItem,
+  kGMDelegateLinkItem,
+  kGMDelegateCreateSymbolicLink,
+  kGMDelegateDestinationOfSymbolicLink,
+  kGMDelegateMetadataGeneration,
+  kGMDelegatePathsOfItemsChanged,
+  kGMDelegateContentsOfDirectory,
+  kGMDelegateContentsAndAttributesOfDirectory,
+  kGMDelegateContentsOfDirectoryWithCookie,
+  kGMDelegateOpenDirectory,
+  kGMDelegateReleaseDirectory,
+  kGMDelegateSizeOfItem,
+  kGMDelegateBlock,
+  kGMDelegateContents,
+  kGMDelegateOpenFile,
+  kGMDelegateAccessPattern,
+  kGMDelegateContentVersion,
+  kGMDelegateReleaseFile,
+  kGMDelegateReadFile,
+  kGMDelegateReadDataFromFile,
+  kGMDelegateFileDescriptor,
+  kGMDelegateWriteFile,
+  kGMDelegateFlushFile,
+  kGMDelegateSynchronizeFile,
+  kGMDelegatePreallocateFile,
+  kGMDelegateExchangeData,
+  kGMDelegateAttributesOfFileSystem,
+  kGMDelegateSetAttributesOfFileSystem,
+  kGMDelegateAttributesOfItem,
+  kGMDelegateGetItemAttributes,
+  kGMDelegateAttributesOfItems,
+  kGMDelegateSetAttributes,
+  kGMDelegateSetItemAttributes,
+  kGMDelegateValuesOfExtendedAttributes,
+  kGMDelegateExtendedAttributes,
+  kGMDelegateValueOfExtendedAttribute,
+  kGMDelegateSetExtendedAttribute,
+  kGMDelegateRemoveExtendedAttribute,
+  kGMDelegateMethodCount
+} GMDelegateMethod;
+
+// Signatures of the delegate methods called through their IMP on the hot path.
+typedef NSDictionary* (*GMAttributesOfItemIMP)(id, SEL, NSString*, id,
+                                               NSError**);
+typedef BOOL (*GMGetItemAttributesIMP)(id, SEL, GMItemAttributes*, NSString*,
+                                       id, NSError**);
+typedef NSArray* (*GMContentsOfDirectoryIMP)(id, SEL, NSString*, NSError**);
+typedef int (*GMReadFileIMP)(id, SEL, NSString*, id, char*, size_t, off_t,
+                             NSError**);
+typedef int (*GMWriteFileIMP)(id, SEL, NSString*, id, const char*, size_t,
+                              off_t, NSError**);
+typedef NSData* (*GMValueOfExtendedAttributeIMP)(id, SEL, NSString*, NSString*,
+                                                 off_t, NSError**);
+typedef int (*GMReadToBufferIMP)(id, SEL, char*, size_t, off_t, NSError**);
+typedef NSData* (*GMReadDataIMP)(id, SEL, size_t, off_t, NSError**);
+typedef int (*GMWriteFromBufferIMP)(id, SEL, const char*, size_t, off_t,
+                                    NSError**);
+
+// Returns the implementation of selector by object, or NULL if object does not
+// respond to it. A method that object only responds to dynamically resolves to
+// the forwarding IMP, which still ends up at object.
+static IMP GMResolveMethod(id object, SEL selector) {
+  if (![object respondsToSelector:selector]) {
+    return NULL;
+  }
+  return class_getMethodImplementation(object_getClass(object), selector);
+}
+
+// An open file: the userData returned by the delegate and the state the
+// framework keeps for the file while it is open.
+@interface GMFileHandle : NSObject {
+  GMUserFileSystem* fileSystem_;  // Not retained
+  pthread_mutex_t mutex_;         // Protects path_ and contentVersion_.
+  NSString* path_;                // The path the file was last accessed by.
+  NSString* contentVersion_;      // nil if the file is not cached on disk.
+  id userData_;
+  IMP readToBuffer_;              // Of userData_, or NULL if not implemented.
+  IMP readData_;                  // Of userData_, or NULL if not implemented.
+  IMP writeFromBuffer_;           // Of userData_, or NULL if not implemented.
+  GMReadahead* readahead_;        // nil if the file is not read ahead.
+  GMWriteBack* writeBack_;        // nil if writes are not buffered.
+  UInt64 nodeID_;                 // Pinned in the inode table, or 0.
+}
+- (id)initWithFileSystem:(GMUserFileSystem *)fileSystem
+                    path:(NSString *)path
+                userData:(id)userData;
+- (NSString *)path;
+- (void)setPath:(NSString *)path;
+- (id)userData;
+- (IMP)userDataReadToBuffer;
+- (IMP)userDataReadData;
+- (IMP)userDataWriteFromBuffer;
+- (GMReadahead *)readahead;
+- (void)setReadahead:(GMReadahead *)readahead;
+- (GMWriteBack *)writeBack;
+- (void)setWriteBack:(GMWriteBack *)writeBack;
+- (UInt64)nodeID;
+- (void)setNodeID:(UInt64)nodeID;
+- (NSString *)contentVersion;
+- (void)setContentVersion:(NSString *)contentVersion;
+
+// Reads from the disk cache or the delegate. Used by the readahead.
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error;
+
+// Writes to the delegate. Used by the write-back.
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error;
+@end
+
 @interface GMUserFileSystemInternal : NSObject {
   struct fuse* handle_;
   NSString* mountPath_;
@@ -148,7 +439,40 @@ typedef enum {
   BOOL supportsExtendedTimes_;      // Delegate supports create and backup times?
   BOOL supportsSetVolumeName_;      // Delegate supports setvolname?
   BOOL isReadOnly_;                 // Is this mounted read-only?
+  BOOL usesLowLevelInterface_;      // Mounted using the low-level interface?
+  struct fuse_chan* channel_;       // Channel of the low-level session.
+  GMInodeTable* inodeTable_;        // Node IDs and interned paths.
+  GMCache* itemAttributesCache_;    // Cached struct stat by path, or nil.
+  GMCache* fileSystemAttributesCache_;  // Cached struct statfs, or nil.
+  GMCache* negativeLookupCache_;    // Paths known not to exist, or nil.
+  GMCache* directoryContentsCache_; // Cached directory listings, or nil.
+  GMCache* fileContentsCache_;      // Cached results of contentsAtPath:, or nil.
+  GMCache* extendedAttributesCache_;  // Cached GMExtendedAttributes, or nil.
+  GMCache* resourcesCache_;         // Cached GMItemResources, or nil.
+  GMBlockCache* fileBlockCache_;    // Cached results of blockAtPath:, or nil.
+  NSUInteger fileContentsBlockSize_;  // Size of blocks from blockAtPath:.
+  GMPageStoreBudget* fileDataBudget_;  // Memory of paged file delegates, or nil.
+  NSUInteger fileDataHandleMemoryLimit_;  // Per paged file delegate.
+  NSUInteger readaheadSize_;        // Maximum readahead per open file.
+  NSOperationQueue* readaheadQueue_;   // Reads files ahead, or nil.
+  NSOperationQueue* prefetchQueue_;    // Prefetches attributes, or nil.
+  GMPageStoreBudget* readaheadBudget_; // Memory of read ahead chunks, or nil.
+  NSUInteger writeBackSize_;        // Maximum buffered writes per open file.
+  GMDiskBlockCache* diskBlockCache_;  // File contents cached on disk, or nil.
+  GMMetadataSnapshot* metadataSnapshot_;  // Metadata kept across mounts, or nil.
+  GMMemoryBudget* memoryBudget_;    // Memory of the caches and buffers, or nil.
+  pthread_mutex_t fileHandlesMutex_;
+  NSMutableSet* fileHandles_;       // Open files with per-file state.
+  NSMutableDictionary* fileHandlesByPath_;  // Path -> NSMutableSet
+  NSUInteger writeBackFileCount_;   // Open files that buffer writes.
+  pthread_mutex_t prefetchMutex_;
+  NSUInteger prefetchCount_;        // Batches of attributes being prefetched.
+  UInt64 invalidationCount_;        // Invalidations while prefetching.
+  NSMutableDictionary* invalidatedPaths_;     // Path -> NSNumber count
+  NSMutableDictionary* invalidatedSubtrees_;  // Path -> NSNumber count
   id delegate_;
+ @public
+  IMP delegateMethods_[kGMDelegateMethodCount];  // NULL if not implemented.
 }
 - (id)initWithDelegate:(id)delegate isThreadSafe:(BOOL)isThreadSafe;
 - (void)setDelegate:(id)delegate;
@@ -171,12 +495,41 @@ typedef enum {
     supportsExtendedTimes_ = NO;
     supportsSetVolumeName_ = NO;
     isReadOnly_ = NO;
+    fileContentsBlockSize_ = kDefaultFileContentsBlockSize;
+    pthread_mutex_init(&fileHandlesMutex_, NULL);
+    fileHandles_ = [[NSMutableSet alloc] init];
+    fileHandlesByPath_ = [[NSMutableDictionary alloc] init];
+    pthread_mutex_init(&prefetchMutex_, NULL);
+    invalidatedPaths_ = [[NSMutableDictionary alloc] init];
+    invalidatedSubtrees_ = [[NSMutableDictionary alloc] init];
     [self setDelegate:delegate];
   }
   return self;
 }
 - (void)dealloc {
   [mountPath_ release];
+  [itemAttributesCache_ release];
+  [fileSystemAttributesCache_ release];
+  [negativeLookupCache_ release];
+  [directoryContentsCache_ release];
+  [fileContentsCache_ release];
+  [extendedAttributesCache_ release];
+  [resourcesCache_ release];
+  [fileBlockCache_ release];
+  [fileDataBudget_ release];
+  [readaheadQueue_ release];
+  [prefetchQueue_ release];
+  [readaheadBudget_ release];
+  [diskBlockCache_ release];
+  [metadataSnapshot_ release];
+  [memoryBudget_ release];
+  [fileHandles_ release];
+  [fileHandlesByPath_ release];
+  pthread_mutex_destroy(&fileHandlesMutex_);
+  [invalidatedPaths_ release];
+  [invalidatedSubtrees_ release];
+  pthread_mutex_destroy(&prefetchMutex_);
+  [inodeTable_ release];
   [super dealloc];
 }
 
@@ -203,12 +556,335 @@ typedef enum {
 - (BOOL)shouldCheckForResource { return shouldCheckForResource_; }
 - (BOOL)isReadOnly { return isReadOnly_; }
 - (void)setIsReadOnly:(BOOL)val { isReadOnly_ = val; }
+- (BOOL)usesLowLevelInterface { return usesLowLevelInterface_; }
+- (void)setUsesLowLevelInterface:(BOOL)val { usesLowLevelInterface_ = val; }
+- (struct fuse_chan *)channel { return channel_; }
+- (void)setChannel:(struct fuse_chan *)channel { channel_ = channel; }
+- (GMInodeTable *)inodeTable { return inodeTable_; }
+- (void)setInodeTable:(GMInodeTable *)inodeTable {
+  [inodeTable_ autorelease];
+  inodeTable_ = [inodeTable retain];
+}
+- (GMCache *)itemAttributesCache { return itemAttributesCache_; }
+- (void)setItemAttributesCache:(GMCache *)cache {
+  [itemAttributesCache_ autorelease];
+  itemAttributesCache_ = [cache retain];
+}
+- (GMCache *)fileSystemAttributesCache { return fileSystemAttributesCache_; }
+- (void)setFileSystemAttributesCache:(GMCache *)cache {
+  [fileSystemAttributesCache_ autorelease];
+  fileSystemAttributesCache_ = [cache retain];
+}
+- (GMCache *)negativeLookupCache { return negativeLookupCache_; }
+- (void)setNegativeLookupCache:(GMCache *)cache {
+  [negativeLookupCache_ autorelease];
+  negativeLookupCache_ = [cache retain];
+}
+- (GMCache *)directoryContentsCache { return directoryContentsCache_; }
+- (void)setDirectoryContentsCache:(GMCache *)cache {
+  [directoryContentsCache_ autorelease];
+  directoryContentsCache_ = [cache retain];
+}
+- (GMCache *)fileContentsCache { return fileContentsCache_; }
+- (void)setFileContentsCache:(GMCache *)cache {
+  [fileContentsCache_ autorelease];
+  fileContentsCache_ = [cache retain];
+}
+- (GMCache *)extendedAttributesCache { return extendedAttributesCache_; }
+- (void)setExtendedAttributesCache:(GMCache *)cache {
+  [extendedAttributesCache_ autorelease];
+  extendedAttributesCache_ = [cache retain];
+}
+- (GMCache *)resourcesCache { return resourcesCache_; }
+- (void)setResourcesCache:(GMCache *)cache {
+  [resourcesCache_ autorelease];
+  resourcesCache_ = [cache retain];
+}
+- (GMBlockCache *)fileBlockCache { return fileBlockCache_; }
+- (void)setFileBlockCache:(GMBlockCache *)cache {
+  [fileBlockCache_ autorelease];
+  fileBlockCache_ = [cache retain];
+}
+- (NSUInteger)fileContentsBlockSize { return fileContentsBlockSize_; }
+- (void)setFileContentsBlockSize:(NSUInteger)val { fileContentsBlockSize_ = val; }
+- (GMPageStoreBudget *)fileDataBudget { return fileDataBudget_; }
+- (void)setFileDataBudget:(GMPageStoreBudget *)budget {
+  [fileDataBudget_ autorelease];
+  fileDataBudget_ = [budget retain];
+}
+- (NSUInteger)fileDataHandleMemoryLimit { return fileDataHandleMemoryLimit_; }
+- (void)setFileDataHandleMemoryLimit:(NSUInteger)val { fileDataHandleMemoryLimit_ = val; }
+- (NSUInteger)readaheadSize { return readaheadSize_; }
+- (void)setReadaheadSize:(NSUInteger)val { readaheadSize_ = val; }
+- (NSOperationQueue *)readaheadQueue { return readaheadQueue_; }
+- (void)setReadaheadQueue:(NSOperationQueue *)queue {
+  [readaheadQueue_ autorelease];
+  readaheadQueue_ = [queue retain];
+}
+- (NSOperationQueue *)prefetchQueue { return prefetchQueue_; }
+- (void)setPrefetchQueue:(NSOperationQueue *)queue {
+  [prefetchQueue_ autorelease];
+  prefetchQueue_ = [queue retain];
+}
+- (GMPageStoreBudget *)readaheadBudget { return readaheadBudget_; }
+- (void)setReadaheadBudget:(GMPageStoreBudget *)budget {
+  [readaheadBudget_ autorelease];
+  readaheadBudget_ = [budget retain];
+}
+- (NSUInteger)writeBackSize { return writeBackSize_; }
+- (void)setWriteBackSize:(NSUInteger)val { writeBackSize_ = val; }
+- (GMDiskBlockCache *)diskBlockCache { return diskBlockCache_; }
+- (void)setDiskBlockCache:(GMDiskBlockCache *)cache {
+  [diskBlockCache_ autorelease];
+  diskBlockCache_ = [cache retain];
+}
+- (GMMetadataSnapshot *)metadataSnapshot { return metadataSnapshot_; }
+- (void)setMetadataSnapshot:(GMMetadataSnapshot *)snapshot {
+  [metadataSnapshot_ autorelease];
+  metadataSnapshot_ = [snapshot retain];
+}
+- (GMMemoryBudget *)memoryBudget { return memoryBudget_; }
+- (void)setMemoryBudget:(GMMemoryBudget *)budget {
+  [memoryBudget_ autorelease];
+  memoryBudget_ = [budget retain];
+}
+// fileHandlesMutex_ must be held by the following two methods.
+- (void)indexFileHandle:(GMFileHandle *)handle {
+  NSString* path = [handle path];
+  NSMutableSet* handles = [fileHandlesByPath_ objectForKey:path];
+  if (!handles) {
+    handles = [[NSMutableSet alloc] init];
+    [fileHandlesByPath_ setObject:handles forKey:path];
+    [handles release];
+  }
+  [handles addObject:handle];
+}
+- (void)unindexFileHandle:(GMFileHandle *)handle {
+  NSString* path = [handle path];
+  NSMutableSet* handles = [fileHandlesByPath_ objectForKey:path];
+  [handles removeObject:handle];
+  if ([handles count] == 0) {
+    [fileHandlesByPath_ removeObjectForKey:path];
+  }
+}
+- (void)addFileHandle:(GMFileHandle *)handle {
+  pthread_mutex_lock(&fileHandlesMutex_);
+  if (![fileHandles_ containsObject:handle]) {
+    [fileHandles_ addObject:handle];
+    [self indexFileHandle:handle];
+    if ([handle writeBack]) {
+      ++writeBackFileCount_;
+    }
+  }
+  pthread_mutex_unlock(&fileHandlesMutex_);
+}
+- (void)removeFileHandle:(GMFileHandle *)handle {
+  pthread_mutex_lock(&fileHandlesMutex_);
+  if ([fileHandles_ containsObject:handle]) {
+    [self unindexFileHandle:handle];
+    if ([handle writeBack]) {
+      --writeBackFileCount_;
+    }
+    [fileHandles_ removeObject:handle];
+  }
+  pthread_mutex_unlock(&fileHandlesMutex_);
+}
+// Sets the path that the open file was last accessed by, keeping the index of
+// open files by path in step.
+- (void)setPath:(NSString *)path ofFileHandle:(GMFileHandle *)handle {
+  if (!path || [path isEqualToString:[handle path]]) {
+    return;
+  }
+  pthread_mutex_lock(&fileHandlesMutex_);
+  BOOL isIndexed = [fileHandles_ containsObject:handle];
+  if (isIndexed) {
+    [self unindexFileHandle:handle];
+  }
+  [handle setPath:path];
+  if (isIndexed) {
+    [self indexFileHandle:handle];
+  }
+  pthread_mutex_unlock(&fileHandlesMutex_);
+}
+- (NSArray *)fileHandlesAtPath:(NSString *)path recursive:(BOOL)recursive {
+  NSMutableArray* matches = nil;
+  pthread_mutex_lock(&fileHandlesMutex_);
+  if ([fileHandlesByPath_ count] > 0) {
+    matches = [NSMutableArray array];
+    NSSet* handles = [fileHandlesByPath_ objectForKey:path];
+    if (handles) {
+      [matches addObjectsFromArray:[handles allObjects]];
+    }
+    if (recursive) {
+      NSString* prefix =
+        [path isEqualToString:@"/"] ? path : [path stringByAppendingString:@"/"];
+      NSArray* paths = [fileHandlesByPath_ allKeys];
+      for (int i = 0, count = [paths count]; i < count; i++) {
+        NSString* handlePath = [paths objectAtIndex:i];
+        if ([handlePath hasPrefix:prefix] && ![handlePath isEqualToString:path]) {
+          [matches addObjectsFromArray:
+           [[fileHandlesByPath_ objectForKey:handlePath] allObjects]];
+        }
+      }
+    }
+  }
+  pthread_mutex_unlock(&fileHandlesMutex_);
+  return matches;
+}
+- (NSUInteger)writeBackFileCount {
+  pthread_mutex_lock(&fileHandlesMutex_);
+  NSUInteger count = writeBackFileCount_;
+  pthread_mutex_unlock(&fileHandlesMutex_);
+  return count;
+}
+- (NSArray *)fileHandles {
+  pthread_mutex_lock(&fileHandlesMutex_);
+  NSArray* handles = [fileHandles_ count] > 0 ? [fileHandles_ allObjects] : nil;
+  pthread_mutex_unlock(&fileHandlesMutex_);
+  return handles;
+}
+// Invalidations are only recorded while attributes are being prefetched, so
+// that a batch can tell whether what it fetched has been invalidated since it
+// started. Returns the invalidation count to pass to the methods below.
+- (UInt64)beginPrefetch {
+  pthread_mutex_lock(&prefetchMutex_);
+  ++prefetchCount_;
+  UInt64 count = invalidationCount_;
+  pthread_mutex_unlock(&prefetchMutex_);
+  return count;
+}
+- (void)endPrefetch {
+  pthread_mutex_lock(&prefetchMutex_);
+  if (--prefetchCount_ == 0) {
+    [invalidatedPaths_ removeAllObjects];
+    [invalidatedSubtrees_ removeAllObjects];
+  }
+  pthread_mutex_unlock(&prefetchMutex_);
+}
+- (void)noteInvalidationOfPath:(NSString *)path recursive:(BOOL)recursive {
+  pthread_mutex_lock(&prefetchMutex_);
+  if (prefetchCount_ > 0) {
+    NSNumber* count = [NSNumber numberWithUnsignedLongLong:++invalidationCount_];
+    [(recursive ? invalidatedSubtrees_ : invalidatedPaths_) setObject:count
+                                                               forKey:path];
+  }
+  pthread_mutex_unlock(&prefetchMutex_);
+}
+- (BOOL)isPathInvalidated:(NSString *)path sinceCount:(UInt64)count {
+  BOOL isInvalidated = NO;
+  pthread_mutex_lock(&prefetchMutex_);
+  if ([[invalidatedPaths_ objectForKey:path] unsignedLongLongValue] > count) {
+    isInvalidated = YES;
+  }
+  for (NSString* ancestor = path; !isInvalidated;
+       ancestor = [ancestor stringByDeletingLastPathComponent]) {
+    if ([[invalidatedSubtrees_ objectForKey:ancestor] unsignedLongLongValue] > count) {
+      isInvalidated = YES;
+    }
+    if ([ancestor isEqualToString:@"/"]) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&prefetchMutex_);
+  return isInvalidated;
+}
 - (id)delegate { return delegate_; }
 - (void)setDelegate:(id)delegate { 
   delegate_ = delegate;
+
+  // Resolve the delegate methods once, so that the callbacks neither ask the
+  // delegate whether it implements them nor look them up on every call.
+  SEL selectors[kGMDelegateMethodCount] = {
+    [kGMDelegateWillMount] = @selector(willMount),
+    [kGMDelegateWillUnmount] = @selector(willUnmount),
+    [kGMDelegateFinderAttributes] = @selector(finderAttributesAtPath:error:),
+    [kGMDelegateResourceAttributes] = @selector(resourceAttributesAtPath:error:),
+    [kGMDelegateAttributesOfItemWithNodeID] =
+      @selector(attributesOfItemWithNodeID:userData:error:),
+    [kGMDelegateAttributesOfItemNamed] =
+      @selector(attributesOfItemNamed:inDirectoryWithNodeID:error:),
+    [kGMDelegateContentsOfDirectoryWithNodeID] =
+      @selector(contentsOfDirectoryWithNodeID:error:),
+    [kGMDelegateForgetNodeID] = @selector(forgetNodeID:),
+    [kGMDelegateCreateDirectory] =
+      @selector(createDirectoryAtPath:attributes:error:),
+    [kGMDelegateCreateFile] =
+      @selector(createFileAtPath:attributes:flags:userData:error:),
+    [kGMDelegateCreateFileDeprecated] =
+      @selector(createFileAtPath:attributes:userData:error:),
+    [kGMDelegateRemoveDirectory] = @selector(removeDirectoryAtPath:error:),
+    [kGMDelegateRemoveItem] = @selector(removeItemAtPath:error:),
+    [kGMDelegateMoveItem] = @selector(moveItemAtPath:toPath:error:),
+    [kGMDelegateLinkItem] = @selector(linkItemAtPath:toPath:error:),
+    [kGMDelegateCreateSymbolicLink] =
+      @selector(createSymbolicLinkAtPath:withDestinationPath:error:),
+    [kGMDelegateDestinationOfSymbolicLink] =
+      @selector(destinationOfSymbolicLinkAtPath:error:),
+    [kGMDelegateMetadataGeneration] = @selector(metadataGeneration),
+    [kGMDelegatePathsOfItemsChanged] =
+      @selector(pathsOfItemsChangedSinceMetadataGeneration:error:),
+    [kGMDelegateContentsOfDirectory] =
+      @selector(contentsOfDirectoryAtPath:error:),
+    [kGMDelegateContentsAndAttributesOfDirectory] =
+      @selector(contentsAndAttributesOfDirectoryAtPath:error:),
+    [kGMDelegateContentsOfDirectoryWithCookie] =
+      @selector(contentsOfDirectoryAtPath:userData:cookie:nextCookie:error:),
+    [kGMDelegateOpenDirectory] = @selector(openDirectoryAtPath:userData:error:),
+    [kGMDelegateReleaseDirectory] = @selector(releaseDirectoryAtPath:userData:),
+    [kGMDelegateSizeOfItem] = @selector(sizeOfItemAtPath:error:),
+    [kGMDelegateBlock] = @selector(blockAtPath:index:error:),
+    [kGMDelegateContents] = @selector(contentsAtPath:),
+    [kGMDelegateOpenFile] = @selector(openFileAtPath:mode:userData:error:),
+    [kGMDelegateAccessPattern] =
+      @selector(accessPatternOfFileAtPath:userData:),
+    [kGMDelegateContentVersion] =
+      @selector(contentVersionOfFileAtPath:userData:),
+    [kGMDelegateReleaseFile] = @selector(releaseFileAtPath:userData:),
+    [kGMDelegateReadFile] =
+      @selector(readFileAtPath:userData:buffer:size:offset:error:),
+    [kGMDelegateReadDataFromFile] =
+      @selector(readDataFromFileAtPath:userData:size:offset:error:),
+    [kGMDelegateFileDescriptor] =
+      @selector(fileDescriptorForFileAtPath:userData:),
+    [kGMDelegateWriteFile] =
+      @selector(writeFileAtPath:userData:buffer:size:offset:error:),
+    [kGMDelegateFlushFile] = @selector(flushFileAtPath:userData:error:),
+    [kGMDelegateSynchronizeFile] =
+      @selector(synchronizeFileAtPath:userData:dataOnly:error:),
+    [kGMDelegatePreallocateFile] =
+      @selector(preallocateFileAtPath:userData:options:offset:length:error:),
+    [kGMDelegateExchangeData] =
+      @selector(exchangeDataOfItemAtPath:withItemAtPath:error:),
+    [kGMDelegateAttributesOfFileSystem] =
+      @selector(attributesOfFileSystemForPath:error:),
+    [kGMDelegateSetAttributesOfFileSystem] =
+      @selector(setAttributes:ofFileSystemAtPath:error:),
+    [kGMDelegateAttributesOfItem] =
+      @selector(attributesOfItemAtPath:userData:error:),
+    [kGMDelegateGetItemAttributes] =
+      @selector(getItemAttributes:ofItemAtPath:userData:error:),
+    [kGMDelegateAttributesOfItems] = @selector(attributesOfItemsAtPaths:error:),
+    [kGMDelegateSetAttributes] =
+      @selector(setAttributes:ofItemAtPath:userData:error:),
+    [kGMDelegateSetItemAttributes] =
+      @selector(setItemAttributes:ofItemAtPath:userData:error:),
+    [kGMDelegateValuesOfExtendedAttributes] =
+      @selector(valuesOfExtendedAttributesOfItemAtPath:error:),
+    [kGMDelegateExtendedAttributes] =
+      @selector(extendedAttributesOfItemAtPath:error:),
+    [kGMDelegateValueOfExtendedAttribute] =
+      @selector(valueOfExtendedAttribute:ofItemAtPath:position:error:),
+    [kGMDelegateSetExtendedAttribute] =
+      @selector(setExtendedAttribute:ofItemAtPath:value:position:options:error:),
+    [kGMDelegateRemoveExtendedAttribute] =
+      @selector(removeExtendedAttribute:ofItemAtPath:error:),
+  };
+  for (int i = 0; i < kGMDelegateMethodCount; ++i) {
+    delegateMethods_[i] = GMResolveMethod(delegate_, selectors[i]);
+  }
   shouldCheckForResource_ =
-    [delegate_ respondsToSelector:@selector(finderAttributesAtPath:error:)] ||
-    [delegate_ respondsToSelector:@selector(resourceAttributesAtPath:error:)];
+    delegateMethods_[kGMDelegateFinderAttributes] != NULL ||
+    delegateMethods_[kGMDelegateResourceAttributes] != NULL;
   
   // Check for deprecated methods.
   SEL deprecatedMethods[] = {
@@ -225,6 +901,18 @@ typedef enum {
 
 @end
 
+// Returns YES if the delegate of internal implements method.
+static inline BOOL GMDelegateImplements(GMUserFileSystemInternal* internal,
+                                        GMDelegateMethod method) {
+  return internal->delegateMethods_[method] != NULL;
+}
+
+// Returns the implementation of method by the delegate of internal, or NULL.
+static inline IMP GMDelegateMethodIMP(GMUserFileSystemInternal* internal,
+                                      GMDelegateMethod method) {
+  return internal->delegateMethods_[method];
+}
+
 // Deprecated delegate methods that we still support for backward compatibility
 // with previously compiled file systems. This will be actively trimmed as
 // new releases occur.
@@ -250,2027 +938,6455 @@ typedef enum {
 - (void)mount:(NSDictionary *)args;
 - (void)waitUntilMounted:(NSNumber *)fileDescriptor;
 
+// Discards cached state for the item at path. If recursive is YES, cached state
+// for all items below path is discarded as well.
+- (void)invalidateCachesForPath:(NSString *)path recursive:(BOOL)recursive;
+
+// Discards cached state for the file at path after data has been written to it
+// through handle. Writes that have only been buffered by the write-back just
+// discard the cached attributes; the rest is discarded once they reach the
+// delegate.
+- (void)invalidateCachesForWriteToFileAtPath:(NSString *)path
+                                      handle:(GMFileHandle *)handle;
+
+// Discards cached state for the directory containing the item at path, e.g.
+// because an entry has been added to or removed from the directory.
+- (void)invalidateCachesForParentOfPath:(NSString *)path;
+- (void)updateDirectoryContentsCacheForItemAtPath:(NSString *)path
+                                           exists:(BOOL)exists;
+
 - (NSDictionary *)finderAttributesAtPath:(NSString *)path;
 - (NSDictionary *)resourceAttributesAtPath:(NSString *)path;
 
 - (BOOL)hasCustomIconAtPath:(NSString *)path;
 - (BOOL)isDirectoryIconAtPath:(NSString *)path dirPath:(NSString **)dirPath;
 - (NSData *)finderDataForAttributes:(NSDictionary *)attributes;
-- (NSData *)resourceDataForAttributes:(NSDictionary *)attributes;
-
+- (GMResourceFork *)resourceForkForAttributes:(NSDictionary *)attributes;
+
+// The FinderInfo and resource fork for the item at path, built again only if
+// the delegate returns other attributes than the last time.
+- (NSData *)finderDataAtPath:(NSString *)path;
+- (GMResourceFork *)resourceForkAtPath:(NSString *)path;
+
+- (NSMutableDictionary *)baseAttributesOfItemAtPath:(NSString *)path;
+- (void)getBaseItemAttributes:(GMItemAttributes *)attributes
+                 ofItemAtPath:(NSString *)path;
+- (BOOL)supportsItemAttributes;
+- (BOOL)getDefaultItemAttributes:(GMItemAttributes *)attributes
+                    ofItemAtPath:(NSString *)path
+                        userData:(id)userData
+                           error:(NSError **)error;
+- (BOOL)supportsSetItemAttributes;
+- (BOOL)setItemAttributes:(const GMItemAttributes *)attributes
+             ofItemAtPath:(NSString *)path
+                 userData:(id)userData
+                    error:(NSError **)error;
 - (NSDictionary *)defaultAttributesOfItemAtPath:(NSString *)path 
                                        userData:userData
                                           error:(NSError **)error;  
+- (BOOL)addSizeToAttributes:(NSMutableDictionary *)attributes
+               ofItemAtPath:(NSString *)path
+                      error:(NSError **)error;
+- (NSDictionary *)attributesOfItemAtPath:(NSString *)path
+                    withItemAttributes:(NSDictionary *)itemAttributes
+                                 error:(NSError **)error;
+- (BOOL)isImplicitItemAtPath:(NSString *)path;
 - (BOOL)fillStatBuffer:(struct stat *)stbuf 
                forPath:(NSString *)path
               userData:(id)userData
                  error:(NSError **)error;
+- (BOOL)fillStatBuffer:(struct stat *)stbuf
+        withAttributes:(NSDictionary *)attributes
+                 error:(NSError **)error;
+- (BOOL)fillStatBuffer:(struct stat *)stbuf
+               forPath:(NSString *)path
+    withItemAttributes:(NSDictionary *)itemAttributes
+                 error:(NSError **)error;
+- (BOOL)needsSizeForItemAttributes:(NSDictionary *)itemAttributes;
+- (BOOL)fillStatBuffer:(struct stat *)stbuf
+    forDirectoryEntryAtPath:(NSString *)path
+         withItemAttributes:(NSDictionary *)itemAttributes
+                      error:(NSError **)error;
+- (BOOL)supportsAttributesOfItemsAtPaths;
+- (void)prefetchAttributesOfItemsNamed:(NSArray *)names
+                     inDirectoryAtPath:(NSString *)path;
+- (void)prefetchAttributesOfItemsAtPaths:(NSArray *)paths;
 - (BOOL)fillStatfsBuffer:(struct statfs *)stbuf
                  forPath:(NSString *)path
                    error:(NSError **)error;
 
+// Writes the data described by buf, which may reference memory or a file
+// descriptor, e.g. a pipe spliced from the kernel. Returns the number of bytes
+// written or -1 on error.
+- (int)writeFileAtPath:(NSString *)path
+                handle:(GMFileHandle *)handle
+          bufferVector:(struct fuse_bufvec *)buf
+                offset:(off_t)offset
+                 error:(NSError **)error;
+
 - (void)fuseInit;
 - (void)fuseDestroy;
 
-@end
+// Metadata snapshot.
+- (NSString *)metadataGeneration;
+- (NSArray *)pathsOfItemsChangedSinceMetadataGeneration:(NSString *)generation
+                                                  error:(NSError **)error;
 
-@implementation GMUserFileSystem
+// Low-level interface: items are identified by the node IDs of the inode table.
+- (GMInodeTable *)inodeTable;
+- (BOOL)fillStatBuffer:(struct stat *)stbuf
+             forNodeID:(UInt64)nodeID
+              userData:(id)userData
+                 error:(NSError **)error;
+- (BOOL)fillEntry:(struct fuse_entry_param *)entry
+          forName:(NSString *)name
+     parentNodeID:(UInt64)parentID
+            error:(NSError **)error;
+- (NSArray *)contentsOfDirectoryWithNodeID:(UInt64)nodeID
+                                     error:(NSError **)error;
+- (void)forgetNodeID:(UInt64)nodeID count:(UInt64)count;
+- (int)lowLevelMainWithArgc:(int)argc argv:(char **)argv;
+
+// Cursor-based directory enumeration.
+- (BOOL)supportsDirectoryCursors;
+- (BOOL)openDirectoryAtPath:(NSString *)path
+                   userData:(id *)userData
+                      error:(NSError **)error;
+- (NSArray *)contentsOfDirectoryAtPath:(NSString *)path
+                              userData:(id)userData
+                                cookie:(UInt64)cookie
+                            nextCookie:(UInt64 *)nextCookie
+                                 error:(NSError **)error;
+- (void)releaseDirectoryAtPath:(NSString *)path userData:(id)userData;
+
+- (void)applyMemoryLimitsToUserData:(id)userData;
+
+// Extended attributes.
+- (NSDictionary *)valuesOfExtendedAttributesOfItemAtPath:(NSString *)path
+                                                   error:(NSError **)error;
+
+// Returns at most size bytes of the value starting at position and sets length
+// to the length of the whole value from position on. Synthesized resource
+// forks are only copied as far as they are returned.
+- (NSData *)valueOfExtendedAttribute:(NSString *)name
+                        ofItemAtPath:(NSString *)path
+                            position:(off_t)position
+                                size:(size_t)size
+                              length:(size_t *)length
+                               error:(NSError **)error;
+
+// Block-based file contents.
+- (BOOL)supportsFileContentsBlocks;
+- (int)readBlocksOfFileAtPath:(NSString *)path
+                     fileSize:(off_t)fileSize
+                       buffer:(char *)buffer
+                         size:(size_t)size
+                       offset:(off_t)offset
+                        error:(NSError **)error;
+
+// Open files. The fh of the fuse_file_info of an open file is a GMFileHandle.
+- (GMFileHandle *)newFileHandleForFileAtPath:(NSString *)path
+                                        mode:(int)mode
+                                    userData:(id)userData;
+- (void)releaseFileHandle:(GMFileHandle *)handle atPath:(NSString *)path;
+- (NSArray *)fileHandlesAtPath:(NSString *)path recursive:(BOOL)recursive;
+- (NSString *)accessPatternOfFileAtPath:(NSString *)path userData:(id)userData;
+- (NSString *)contentVersionOfFileAtPath:(NSString *)path userData:(id)userData;
+- (int)readFileAtPath:(NSString *)path
+               handle:(GMFileHandle *)handle
+               buffer:(char *)buffer
+                 size:(size_t)size
+               offset:(off_t)offset
+                error:(NSError **)error;
+- (int)writeFileAtPath:(NSString *)path
+                handle:(GMFileHandle *)handle
+                buffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error;
 
-+ (NSDictionary *)currentContext {
-  struct fuse_context* context = fuse_get_context();
-  if (!context) {
-    return nil;
-  }
-  
-  NSMutableDictionary* dict = [[NSMutableDictionary alloc] init];
-  [dict setObject:[NSNumber numberWithUnsignedInt:context->uid]
-                 forKey:kGMUserFileSystemContextUserIDKey];
-  [dict setObject:[NSNumber numberWithUnsignedInt:context->gid]
-                 forKey:kGMUserFileSystemContextGroupIDKey];
-  [dict setObject:[NSNumber numberWithInt:context->pid]
-                 forKey:kGMUserFileSystemContextProcessIDKey];
-  return [dict autorelease];
-}
+// Reads through the disk block cache if the open file has a content version,
+// and from the delegate otherwise.
+- (int)readDiskCachedFileAtPath:(NSString *)path
+                         handle:(GMFileHandle *)handle
+                         buffer:(char *)buffer
+                           size:(size_t)size
+                         offset:(off_t)offset
+                          error:(NSError **)error;
+
+// Read from and write to userData, or the delegate. readToBuffer and
+// writeFromBuffer are the implementations of these methods by userData as
+// resolved when the file was opened, or NULL.
+- (int)readFileAtPath:(NSString *)path
+             userData:(id)userData
+         readToBuffer:(IMP)readToBuffer
+               buffer:(char *)buffer
+                 size:(size_t)size
+               offset:(off_t)offset
+                error:(NSError **)error;
+- (int)writeFileAtPath:(NSString *)path
+              userData:(id)userData
+       writeFromBuffer:(IMP)writeFromBuffer
+                buffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error;
 
-- (id)init {
-  return [self initWithDelegate:nil isThreadSafe:NO];
+// Passes the writes buffered for the open files at path on to the delegate.
+- (void)writeBackFilesAtPath:(NSString *)path recursive:(BOOL)recursive;
+- (BOOL)flushWriteBackOfFileAtPath:(NSString *)path
+                            handle:(GMFileHandle *)handle
+                             error:(NSError **)error;
+- (BOOL)flushFileAtPath:(NSString *)path
+                 handle:(GMFileHandle *)handle
+                  error:(NSError **)error;
+- (BOOL)synchronizeFileAtPath:(NSString *)path
+                       handle:(GMFileHandle *)handle
+                     dataOnly:(BOOL)dataOnly
+                        error:(NSError **)error;
+
+@end
+
+// Enumerates a directory in batches using the delegate's cursor-based directory
+// methods, so only one batch of names is held in memory at a time. Positions
+// are FUSE directory offsets: 0 is ".", 1 is ".." and n + 2 is the n-th name
+// returned by the delegate.
+@interface GMDirectoryEnumerator : NSObject {
+  GMUserFileSystem* fileSystem_;  // Not retained
+  NSString* path_;
+  id userData_;
+  NSArray* batch_;                // The batch containing the current name.
+  NSUInteger batchIndex_;         // Index of the current name in batch_.
+  UInt64 nextCookie_;             // Cookie of the batch following batch_.
+  BOOL isAtEnd_;                  // No batch follows batch_.
+  off_t position_;
 }
+- (id)initWithFileSystem:(GMUserFileSystem *)fileSystem
+                    path:(NSString *)path
+                userData:(id)userData;
+- (NSString *)path;
+- (id)userData;
+- (off_t)position;
+
+// Returns the name at the current position or nil if the end of the directory
+// has been reached or an error occurred.
+- (NSString *)currentNameWithError:(NSError **)error;
+- (void)advance;
+
+// Moves to position offset. Moving backwards restarts the enumeration.
+- (BOOL)seekToOffset:(off_t)offset error:(NSError **)error;
+@end
 
-- (id)initWithDelegate:(id)delegate isThreadSafe:(BOOL)isThreadSafe {
+@implementation GMDirectoryEnumerator
+
+- (id)initWithFileSystem:(GMUserFileSystem *)fileSystem
+                    path:(NSString *)path
+                userData:(id)userData {
   self = [super init];
   if (self) {
-    internal_ = [[GMUserFileSystemInternal alloc] initWithDelegate:delegate
-                                                      isThreadSafe:isThreadSafe];
+    fileSystem_ = fileSystem;
+    path_ = [path copy];
+    userData_ = [userData retain];
   }
   return self;
 }
 
 - (void)dealloc {
-  [internal_ release];
+  [path_ release];
+  [userData_ release];
+  [batch_ release];
   [super dealloc];
 }
 
-- (void)setDelegate:(id)delegate {
-  [internal_ setDelegate:delegate];
-}
-- (id)delegate {
-  return [internal_ delegate];
+- (NSString *)path { return path_; }
+- (id)userData { return userData_; }
+- (off_t)position { return position_; }
+
+- (NSString *)currentNameWithError:(NSError **)error {
+  if (position_ == 0) {
+    return @".";
+  }
+  if (position_ == 1) {
+    return @"..";
+  }
+  while (batchIndex_ >= [batch_ count]) {
+    if (isAtEnd_) {
+      return nil;
+    }
+    UInt64 cookie = nextCookie_;
+    NSArray* batch = [fileSystem_ contentsOfDirectoryAtPath:path_
+                                                   userData:userData_
+                                                     cookie:cookie
+                                                 nextCookie:&nextCookie_
+                                                      error:error];
+    if (!batch) {
+      return nil;
+    }
+    [batch_ autorelease];
+    batch_ = [batch retain];
+    batchIndex_ = 0;
+    [fileSystem_ prefetchAttributesOfItemsNamed:batch_ inDirectoryAtPath:path_];
+
+    // An empty batch marks the end of the directory. Guard against delegates
+    // that do not advance the cookie as well.
+    if ([batch count] == 0 || nextCookie_ == cookie) {
+      isAtEnd_ = YES;
+    }
+  }
+  return [batch_ objectAtIndex:batchIndex_];
 }
 
-- (BOOL)enableAllocate {
-  return [internal_ supportsAllocate];
+- (void)advance {
+  if (position_ >= 2) {
+    ++batchIndex_;
+  }
+  ++position_;
 }
-- (BOOL)enableCaseSensitiveNames {
-  return [internal_ supportsCaseSensitiveNames];
+
+- (BOOL)seekToOffset:(off_t)offset error:(NSError **)error {
+  if (offset < position_) {
+    [batch_ release];
+    batch_ = nil;
+    batchIndex_ = 0;
+    nextCookie_ = 0;
+    isAtEnd_ = NO;
+    position_ = 0;
+  }
+  while (position_ < offset) {
+    if (![self currentNameWithError:error]) {
+      return (*error == nil);  // Seeking past the end is not an error.
+    }
+    [self advance];
+  }
+  return YES;
 }
-- (BOOL)enableExchangeData {
-  return [internal_ supportsExchangeData];
+
+@end
+
+// The extended attributes of an item as far as they are known: their names if
+// they have been listed and the values that have been read. Immutable; cached
+// entries are updated by replacing them.
+@interface GMExtendedAttributes : NSObject {
+  NSArray* names_;        // nil if not listed yet.
+  NSDictionary* values_;  // Name -> NSData, or NSNull if there is no such attribute.
+  BOOL isComplete_;       // values_ holds all attributes of the item.
 }
-- (BOOL)enableExtendedTimes {
-  return [internal_ supportsExtendedTimes];
+- (id)initWithNames:(NSArray *)names
+             values:(NSDictionary *)values
+           complete:(BOOL)isComplete;
+- (NSArray *)names;
+
+// Returns the value of the attribute, NSNull if the item is known not to have
+// the attribute, or nil if it is not known.
+- (id)valueForName:(NSString *)name;
+
+- (GMExtendedAttributes *)extendedAttributesBySettingNames:(NSArray *)names;
+- (GMExtendedAttributes *)extendedAttributesBySettingValue:(id)value
+                                                   forName:(NSString *)name;
+- (NSUInteger)cost;
+@end
+
+@implementation GMExtendedAttributes
+
+- (id)initWithNames:(NSArray *)names
+             values:(NSDictionary *)values
+           complete:(BOOL)isComplete {
+  self = [super init];
+  if (self) {
+    names_ = [names copy];
+    values_ = values ? [values copy] : [[NSDictionary alloc] init];
+    isComplete_ = isComplete;
+  }
+  return self;
 }
-- (BOOL)enableSetVolumeName {
-  return [internal_ supportsSetVolumeName];
+
+- (void)dealloc {
+  [names_ release];
+  [values_ release];
+  [super dealloc];
 }
 
-- (void)mountAtPath:(NSString *)mountPath 
-        withOptions:(NSArray *)options {
-  [self mountAtPath:mountPath
-        withOptions:options
-   shouldForeground:YES
-    detachNewThread:YES];
+- (NSArray *)names {
+  return names_;
 }
 
-- (void)mountAtPath:(NSString *)mountPath 
-        withOptions:(NSArray *)options
-   shouldForeground:(BOOL)shouldForeground
-    detachNewThread:(BOOL)detachNewThread {
-  [internal_ setMountPath:mountPath];
-  NSMutableArray* optionsCopy = [NSMutableArray array];
-  for (int i = 0; i < [options count]; ++i) {
-    NSString* option = [options objectAtIndex:i];
-    NSString* optionLowercase = [option lowercaseString];
-    if ([optionLowercase compare:@"rdonly"] == NSOrderedSame ||
-        [optionLowercase compare:@"ro"] == NSOrderedSame) {
-      [internal_ setIsReadOnly:YES];
-    }
-    [optionsCopy addObject:[[option copy] autorelease]];
-  }
-  NSDictionary* args = 
-  [[NSDictionary alloc] initWithObjectsAndKeys:
-   optionsCopy, @"options",
-   [NSNumber numberWithBool:shouldForeground], @"shouldForeground", 
-   nil, nil];
-  if (detachNewThread) {
-    [NSThread detachNewThreadSelector:@selector(mount:) 
-                             toTarget:self 
-                           withObject:args];
-  } else {
-    [self mount:args];
+- (id)valueForName:(NSString *)name {
+  id value = [values_ objectForKey:name];
+  if (!value && isComplete_) {
+    value = [NSNull null];
   }
+  return value;
 }
 
-- (void)unmount {
-  if ([internal_ status] == GMUserFileSystem_MOUNTED) {
-    NSArray* args = [NSArray arrayWithObjects:@"-v", [internal_ mountPath], nil];
-    NSTask* unmountTask = [NSTask launchedTaskWithLaunchPath:@"/sbin/umount" 
-                                                   arguments:args];
-    [unmountTask waitUntilExit];
-  }
+- (GMExtendedAttributes *)extendedAttributesBySettingNames:(NSArray *)names {
+  return [[[GMExtendedAttributes alloc] initWithNames:names
+                                               values:values_
+                                             complete:isComplete_] autorelease];
 }
 
-- (BOOL)invalidateItemAtPath:(NSString *)path error:(NSError **)error {
-  int ret = -ENOTCONN;
+- (GMExtendedAttributes *)extendedAttributesBySettingValue:(id)value
+                                                   forName:(NSString *)name {
+  NSMutableDictionary* values = [[values_ mutableCopy] autorelease];
+  [values setObject:value forKey:name];
+  return [[[GMExtendedAttributes alloc] initWithNames:names_
+                                               values:values
+                                             complete:isComplete_] autorelease];
+}
 
-  struct fuse* handle = [internal_ handle];
-  if (handle) {
-    ret = fuse_invalidate_path(handle, [path fileSystemRepresentation]);
-    
-    // Note: fuse_invalidate_path() may return -ENOENT to indicate that there
-    // was no entry to be invalidated, e.g., because the path has not been seen
-    // before or has been forgotten. This should not be considered to be an
-    // error.
-    if (ret == -ENOENT) {
-      ret = 0;
+- (NSUInteger)cost {
+  NSUInteger cost = ([names_ count] + [values_ count]) * kExtendedAttributeNameCost;
+  NSArray* values = [values_ allValues];
+  for (int i = 0, count = [values count]; i < count; i++) {
+    id value = [values objectAtIndex:i];
+    if ([value isKindOfClass:[NSData class]]) {
+      cost += [value length];
     }
   }
+  return cost;
+}
 
-  if (ret != 0) {
-    if (error) {
-      *error = [GMUserFileSystem errorWithCode:-ret];
-    }
+@end
+
+// Returns YES if both dictionaries hold the same objects for the same keys.
+// Data is compared by identity rather than contents, so that large icons need
+// not be compared to tell that the delegate returned what it returned before.
+// The cached attributes retain their data, so its address cannot be reused.
+static BOOL attributesAreIdentical(NSDictionary* attributes,
+                                   NSDictionary* other) {
+  if (attributes == other) {
+    return YES;
+  }
+  if ([attributes count] != [other count]) {
     return NO;
   }
-
+  NSArray* keys = [attributes allKeys];
+  for (int i = 0, count = [keys count]; i < count; i++) {
+    id key = [keys objectAtIndex:i];
+    id value = [attributes objectForKey:key];
+    id otherValue = [other objectForKey:key];
+    if (value == otherValue) {
+      continue;
+    }
+    if (!otherValue || [value isKindOfClass:[NSData class]] ||
+        ![value isEqual:otherValue]) {
+      return NO;
+    }
+  }
   return YES;
 }
 
-+ (NSError *)errorWithCode:(int)code {
-  return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+// The FinderInfo and resource fork of an item, along with the attributes they
+// were built from. Immutable; cached entries are updated by replacing them.
+@interface GMItemResources : NSObject {
+  NSDictionary* finderAttributes_;    // nil if not built yet.
+  NSData* finderData_;                // nil if there is no FinderInfo.
+  NSDictionary* resourceAttributes_;  // nil if not built yet.
+  GMResourceFork* resourceFork_;      // Laid out; nil if there are no resources.
 }
+- (BOOL)hasFinderDataForAttributes:(NSDictionary *)attributes;
+- (NSData *)finderData;
+- (BOOL)hasResourceForkForAttributes:(NSDictionary *)attributes;
+- (GMResourceFork *)resourceFork;
+
+- (GMItemResources *)itemResourcesBySettingFinderData:(NSData *)data
+                                        forAttributes:(NSDictionary *)attributes;
+- (GMItemResources *)itemResourcesBySettingResourceFork:(GMResourceFork *)fork
+                                          forAttributes:(NSDictionary *)attributes;
+- (NSUInteger)cost;
+@end
 
-+ (GMUserFileSystem *)currentFS {
-  struct fuse_context* context = fuse_get_context();
-  assert(context);
-  return (GMUserFileSystem *)context->private_data;
+@implementation GMItemResources
+
+- (id)initWithFinderAttributes:(NSDictionary *)finderAttributes
+                    finderData:(NSData *)finderData
+            resourceAttributes:(NSDictionary *)resourceAttributes
+                  resourceFork:(GMResourceFork *)resourceFork {
+  self = [super init];
+  if (self) {
+    finderAttributes_ = [finderAttributes retain];
+    finderData_ = [finderData retain];
+    resourceAttributes_ = [resourceAttributes retain];
+    resourceFork_ = [resourceFork retain];
+  }
+  return self;
 }
 
-#define FUSEDEVIOCGETHANDSHAKECOMPLETE _IOR('F', 2, u_int32_t)
-static const int kMaxWaitForMountTries = 50;
-static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
+- (void)dealloc {
+  [finderAttributes_ release];
+  [finderData_ release];
+  [resourceAttributes_ release];
+  [resourceFork_ release];
+  [super dealloc];
+}
 
-- (void)waitUntilMounted:(NSNumber *)fileDescriptor {
-  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  
-  for (int i = 0; i < kMaxWaitForMountTries; ++i) {
-    UInt32 handShakeComplete = 0;
-    int ret = ioctl([fileDescriptor intValue], FUSEDEVIOCGETHANDSHAKECOMPLETE,
-                    &handShakeComplete);
-    if (ret == 0 && handShakeComplete) {
-      [internal_ setStatus:GMUserFileSystem_MOUNTED];
-      
-      // Successfully mounted, so post notification.
-      NSDictionary* userInfo = 
-        [NSDictionary dictionaryWithObjectsAndKeys:
-         [internal_ mountPath], kGMUserFileSystemMountPathKey,
-         nil];
-      NSNotificationCenter* center = [NSNotificationCenter defaultCenter];
-      [center postNotificationName:kGMUserFileSystemDidMount object:self
-                          userInfo:userInfo];
-      [pool release];
-      return;
-    }
-    usleep(kWaitForMountUSleepInterval);
-  }
-  
-  // Tried for a long time and no luck :-(
-  // Unmount and report failure?
-  [pool release];
+- (BOOL)hasFinderDataForAttributes:(NSDictionary *)attributes {
+  return finderAttributes_ != nil &&
+    attributesAreIdentical(finderAttributes_, attributes);
 }
 
-- (void)fuseInit {
-  struct fuse_context* context = fuse_get_context();
+- (NSData *)finderData {
+  return finderData_;
+}
 
-  [internal_ setHandle:context->fuse];
-  [internal_ setStatus:GMUserFileSystem_INITIALIZING];
+- (BOOL)hasResourceForkForAttributes:(NSDictionary *)attributes {
+  return resourceAttributes_ != nil &&
+    attributesAreIdentical(resourceAttributes_, attributes);
+}
 
-  NSError* error = nil;
-  NSDictionary* attribs = [self attributesOfFileSystemForPath:@"/" error:&error];
+- (GMResourceFork *)resourceFork {
+  return resourceFork_;
+}
 
-  if (attribs) {
-    NSNumber* supports = nil;
+- (GMItemResources *)itemResourcesBySettingFinderData:(NSData *)data
+                                        forAttributes:(NSDictionary *)attributes {
+  return [[[GMItemResources alloc] initWithFinderAttributes:attributes
+                                                 finderData:data
+                                         resourceAttributes:resourceAttributes_
+                                               resourceFork:resourceFork_] autorelease];
+}
 
-    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsAllocateKey];
-    if (supports) {
-      [internal_ setSupportsAllocate:[supports boolValue]];
-    }
+- (GMItemResources *)itemResourcesBySettingResourceFork:(GMResourceFork *)fork
+                                          forAttributes:(NSDictionary *)attributes {
+  return [[[GMItemResources alloc] initWithFinderAttributes:finderAttributes_
+                                                 finderData:finderData_
+                                         resourceAttributes:attributes
+                                               resourceFork:fork] autorelease];
+}
 
-    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsCaseSensitiveNamesKey];
-    if (supports) {
-      [internal_ setSupportsCaseSensitiveNames:[supports boolValue]];
-    }
+- (NSUInteger)cost {
+  return kResourcesEntryCost + [finderData_ length] + [resourceFork_ length];
+}
 
-    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsExchangeDataKey];
-    if (supports) {
-      [internal_ setSupportsExchangeData:[supports boolValue]];
-    }
+@end
 
-    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsExtendedDatesKey];
-    if (supports) {
-      [internal_ setSupportsExtendedTimes:[supports boolValue]];
-    }
+// The userData of files whose contents the delegate provides in blocks. Reads
+// are served from the file block cache.
+@interface GMBlockBackedFileDelegate : NSObject {
+  GMUserFileSystem* fileSystem_;  // Not retained
+  NSString* path_;
+  off_t size_;                    // The file size when the file was opened.
+}
+- (id)initWithFileSystem:(GMUserFileSystem *)fileSystem
+                    path:(NSString *)path
+                    size:(off_t)size;
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error;
+@end
 
-    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsSetVolumeNameKey];
-    if (supports) {
-      [internal_ setSupportsSetVolumeName:[supports boolValue]];
-    }
+@implementation GMBlockBackedFileDelegate
+
+- (id)initWithFileSystem:(GMUserFileSystem *)fileSystem
+                    path:(NSString *)path
+                    size:(off_t)size {
+  self = [super init];
+  if (self) {
+    fileSystem_ = fileSystem;
+    path_ = [path copy];
+    size_ = size;
   }
-  
-  // The mount point won't actually show up until this winds its way
-  // back through the kernel after this routine returns. In order to post
-  // the kGMUserFileSystemDidMount notification we start a new thread that will
-  // poll until it is mounted.
-  struct fuse_session* se = fuse_get_session(context->fuse);
-  struct fuse_chan* chan = fuse_session_next_chan(se, NULL);
-  int fd = fuse_chan_fd(chan);
-  
-  [NSThread detachNewThreadSelector:@selector(waitUntilMounted:)
-                           toTarget:self
-                         withObject:[NSNumber numberWithInteger:fd]];
+  return self;
 }
 
-- (void)fuseDestroy {
-  if ([[internal_ delegate] respondsToSelector:@selector(willUnmount)]) {
-    [[internal_ delegate] willUnmount];
-  }
-  [internal_ setStatus:GMUserFileSystem_UNMOUNTING];
+- (void)dealloc {
+  [path_ release];
+  [super dealloc];
+}
 
-  NSDictionary* userInfo = 
-    [NSDictionary dictionaryWithObjectsAndKeys:
-     [internal_ mountPath], kGMUserFileSystemMountPathKey,
-     nil];
-  NSNotificationCenter* center = [NSNotificationCenter defaultCenter];
-  [center postNotificationName:kGMUserFileSystemDidUnmount object:self
-                      userInfo:userInfo];
-  [internal_ setStatus:GMUserFileSystem_NOT_MOUNTED];
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error {
+  return [fileSystem_ readBlocksOfFileAtPath:path_
+                                    fileSize:size_
+                                      buffer:buffer
+                                        size:size
+                                      offset:offset
+                                       error:error];
 }
 
-#pragma mark Finder Info, Resource Forks and HFS headers
+@end
 
-- (NSDictionary *)finderAttributesAtPath:(NSString *)path {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+@implementation GMFileHandle
+
+- (id)initWithFileSystem:(GMUserFileSystem *)fileSystem
+                    path:(NSString *)path
+                userData:(id)userData {
+  self = [super init];
+  if (self) {
+    fileSystem_ = fileSystem;
+    pthread_mutex_init(&mutex_, NULL);
+    path_ = [path copy];
+    userData_ = [userData retain];
+    if (userData_) {
+      readToBuffer_ =
+        GMResolveMethod(userData_, @selector(readToBuffer:size:offset:error:));
+      readData_ =
+        GMResolveMethod(userData_, @selector(readDataWithSize:offset:error:));
+      writeFromBuffer_ =
+        GMResolveMethod(userData_, @selector(writeFromBuffer:size:offset:error:));
+    }
   }
+  return self;
+}
 
-  UInt16 flags = 0;
+- (void)dealloc {
+  [writeBack_ release];
+  [readahead_ release];
+  [userData_ release];
+  [contentVersion_ release];
+  [path_ release];
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
 
-  // If a directory icon, we'll make invisible and update the path to parent.
-  if ([self isDirectoryIconAtPath:path dirPath:&path]) {
-    flags |= kIsInvisible;
-  }
+- (NSString *)path {
+  pthread_mutex_lock(&mutex_);
+  NSString* path = [[path_ retain] autorelease];
+  pthread_mutex_unlock(&mutex_);
+  return path;
+}
 
-  id delegate = [internal_ delegate];
-  if ([delegate respondsToSelector:@selector(finderAttributesAtPath:error:)]) {
-    NSError* error = nil;
-    NSDictionary* dict = [delegate finderAttributesAtPath:path error:&error];
-    if (dict != nil) {
-      if ([dict objectForKey:kGMUserFileSystemCustomIconDataKey]) {
-        // They have custom icon data, so make sure the FinderFlags bit is set.
-        flags |= kHasCustomIcon;
-      }
-      if (flags != 0) {
-        // May need to update kGMUserFileSystemFinderFlagsKey if different.
-        NSNumber* finderFlags = [dict objectForKey:kGMUserFileSystemFinderFlagsKey];
-        if (finderFlags != nil) {
-          UInt16 tmp = (UInt16)[finderFlags longValue];
-          if (flags == tmp) {
-            return dict;  // They already have our desired flags.
-          }          
-          flags |= tmp;
-        }
-        // Doh! We need to create a new dict with the updated flags key.
-        NSMutableDictionary* newDict = 
-          [NSMutableDictionary dictionaryWithDictionary:dict];
-        [newDict setObject:[NSNumber numberWithLong:flags] 
-                    forKey:kGMUserFileSystemFinderFlagsKey];
-        return newDict;
-      }
-      return dict;
-    }
-    // Fall through and create dictionary based on flags if necessary.
-  }
-  if (flags != 0) {
-    return [NSDictionary dictionaryWithObject:[NSNumber numberWithLong:flags]
-                                       forKey:kGMUserFileSystemFinderFlagsKey];
+- (void)setPath:(NSString *)path {
+  pthread_mutex_lock(&mutex_);
+  if (path && ![path isEqualToString:path_]) {
+    [path_ autorelease];
+    path_ = [path copy];
   }
-  return nil;
+  pthread_mutex_unlock(&mutex_);
 }
 
-- (NSDictionary *)resourceAttributesAtPath:(NSString *)path {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
-  }
-  
-  id delegate = [internal_ delegate];
-  if ([delegate respondsToSelector:@selector(resourceAttributesAtPath:error:)]) {
-    NSError* error = nil;
-    return [delegate resourceAttributesAtPath:path error:&error];
-  }
-  return nil;
+- (id)userData { return userData_; }
+- (IMP)userDataReadToBuffer { return readToBuffer_; }
+- (IMP)userDataReadData { return readData_; }
+- (IMP)userDataWriteFromBuffer { return writeFromBuffer_; }
+- (GMReadahead *)readahead { return readahead_; }
+- (void)setReadahead:(GMReadahead *)readahead {
+  [readahead_ autorelease];
+  readahead_ = [readahead retain];
+}
+- (GMWriteBack *)writeBack { return writeBack_; }
+- (void)setWriteBack:(GMWriteBack *)writeBack {
+  [writeBack_ autorelease];
+  writeBack_ = [writeBack retain];
+}
+- (UInt64)nodeID { return nodeID_; }
+- (void)setNodeID:(UInt64)nodeID { nodeID_ = nodeID; }
+
+- (NSString *)contentVersion {
+  pthread_mutex_lock(&mutex_);
+  NSString* contentVersion = [[contentVersion_ retain] autorelease];
+  pthread_mutex_unlock(&mutex_);
+  return contentVersion;
 }
 
-- (BOOL)hasCustomIconAtPath:(NSString *)path {
-  if ([path isEqualToString:@"/"]) {
-    return NO;  // For a volume icon they should use the volicon= option.
+- (void)setContentVersion:(NSString *)contentVersion {
+  pthread_mutex_lock(&mutex_);
+  [contentVersion_ autorelease];
+  contentVersion_ = [contentVersion copy];
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error {
+  return [fileSystem_ readDiskCachedFileAtPath:[self path]
+                                        handle:self
+                                        buffer:buffer
+                                          size:size
+                                        offset:offset
+                                         error:error];
+}
+
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error {
+  NSString* path = [self path];
+  int ret = [fileSystem_ writeFileAtPath:path
+                                userData:userData_
+                         writeFromBuffer:writeFromBuffer_
+                                  buffer:buffer
+                                    size:size
+                                  offset:offset
+                                   error:error];
+  if (ret > 0) {
+    // The buffered writes have reached the delegate only now.
+    [fileSystem_ invalidateCachesForPath:path recursive:NO];
   }
-  NSDictionary* finderAttribs = [self finderAttributesAtPath:path];
-  if (finderAttribs) {
-    NSNumber* finderFlags = 
-      [finderAttribs objectForKey:kGMUserFileSystemFinderFlagsKey];
-    if (finderFlags) {
-      UInt16 flags = (UInt16)[finderFlags longValue];
-      return (flags & kHasCustomIcon) == kHasCustomIcon;
-    }
+  return ret;
+}
+
+@end
+
+typedef enum {
+  GMOpenFileBuffersFileData,   // Pages of paged file delegates.
+  GMOpenFileBuffersReadahead,  // Read ahead chunks.
+  GMOpenFileBuffersWriteBack,  // Buffered writes.
+} GMOpenFileBuffersKind;
+
+// Accounts a kind of memory held by the open files of a file system to its
+// memory budget. Only read ahead chunks can be purged; they are read again when
+// needed. Writing back buffered writes could call into the delegate while the
+// purging thread is in the middle of a delegate call itself.
+@interface GMOpenFileBuffers : NSObject {
+  GMUserFileSystemInternal* internal_;  // Not retained
+  GMOpenFileBuffersKind kind_;
+}
+- (id)initWithInternal:(GMUserFileSystemInternal *)internal
+                  kind:(GMOpenFileBuffersKind)kind;
+- (NSUInteger)totalCost;
+- (NSUInteger)purgeCost:(NSUInteger)cost;
+@end
+
+@implementation GMOpenFileBuffers
+
+- (id)initWithInternal:(GMUserFileSystemInternal *)internal
+                  kind:(GMOpenFileBuffersKind)kind {
+  self = [super init];
+  if (self) {
+    internal_ = internal;
+    kind_ = kind;
   }
-  return NO;
+  return self;
 }
 
-- (BOOL)isDirectoryIconAtPath:(NSString *)path dirPath:(NSString **)dirPath {
-  NSString* name = [path lastPathComponent];
-  if ([name isEqualToString:@"Icon\r"]) {
-    if (dirPath) {
-      *dirPath = [path stringByDeletingLastPathComponent];
+- (NSUInteger)totalCost {
+  switch (kind_) {
+    case GMOpenFileBuffersFileData:
+      return [[internal_ fileDataBudget] size];
+    case GMOpenFileBuffersReadahead:
+      return [[internal_ readaheadBudget] size];
+    case GMOpenFileBuffersWriteBack: {
+      NSUInteger size = 0;
+      NSArray* handles = [internal_ fileHandles];
+      for (int i = 0, count = [handles count]; i < count; i++) {
+        size += [[[handles objectAtIndex:i] writeBack] size];
+      }
+      return size;
     }
-    return YES;
   }
-  return NO;
+  return 0;
 }
 
-// If the given attribs dictionary contains any FinderInfo attributes then 
-// returns NSData for FinderInfo; otherwise returns nil.
-- (NSData *)finderDataForAttributes:(NSDictionary *)attribs {
-  if (!attribs) { 
-    return nil;
+- (NSUInteger)purgeCost:(NSUInteger)cost {
+  if (kind_ != GMOpenFileBuffersReadahead) {
+    return 0;
   }
+  GMPageStoreBudget* budget = [internal_ readaheadBudget];
+  NSUInteger size = [budget size];
+  NSUInteger purged = 0;
+  NSArray* handles = [internal_ fileHandles];
+  for (int i = 0, count = [handles count]; i < count && purged < cost; i++) {
+    [[[handles objectAtIndex:i] readahead] invalidate];
+    NSUInteger current = [budget size];
+    purged = (current < size) ? size - current : 0;
+  }
+  return purged;
+}
 
-  GMFinderInfo* info = [GMFinderInfo finderInfo];
-  BOOL attributeFound = NO;  // Have we found at least one relevant attribute?
+@end
 
-  NSNumber* flags = [attribs objectForKey:kGMUserFileSystemFinderFlagsKey];
-  if (flags) {
-    attributeFound = YES;
-    [info setFlags:(UInt16)[flags longValue]];
-  }
-  
-  NSNumber* extendedFlags = 
-    [attribs objectForKey:kGMUserFileSystemFinderExtendedFlagsKey];
-  if (extendedFlags) {
-    attributeFound = YES;
-    [info setExtendedFlags:(UInt16)[extendedFlags longValue]];
-  }
-  
-  NSNumber* typeCode = [attribs objectForKey:NSFileHFSTypeCode];
-  if (typeCode) {
-    attributeFound = YES;
-    [info setTypeCode:(OSType)[typeCode longValue]];
-  }
+// Returns the open file described by fi, or nil if fi does not describe an
+// open file.
+static GMFileHandle* fusefm_file_handle(struct fuse_file_info* fi) {
+  id handle = fi ? (id)(uintptr_t)fi->fh : nil;
+  return [handle isKindOfClass:[GMFileHandle class]] ? handle : nil;
+}
 
-  NSNumber* creatorCode = [attribs objectForKey:NSFileHFSCreatorCode];
-  if (creatorCode) {
-    attributeFound = YES;
-    [info setCreatorCode:(OSType)[creatorCode longValue]];
-  }
+// Returns the userData of the open file described by fi, or nil.
+static id fusefm_user_data(struct fuse_file_info* fi) {
+  return [fusefm_file_handle(fi) userData];
+}
 
-  return attributeFound ? [info data] : nil;
+// The low-level request being handled on the current thread, if any. Used to
+// provide the operation context, since the low-level interface does not set up
+// a fuse_context.
+static pthread_key_t currentRequestKey;
+static pthread_once_t currentRequestKeyOnce = PTHREAD_ONCE_INIT;
+
+static void createCurrentRequestKey(void) {
+  pthread_key_create(&currentRequestKey, NULL);
 }
 
-// If the given attribs dictionary contains any ResourceFork attributes then 
-// returns NSData for the ResourceFork; otherwise returns nil.
-- (NSData *)resourceDataForAttributes:(NSDictionary *)attribs {
-  if (!attribs) {
-    return nil;
-  }
+static fuse_req_t currentRequest(void) {
+  pthread_once(&currentRequestKeyOnce, createCurrentRequestKey);
+  return (fuse_req_t)pthread_getspecific(currentRequestKey);
+}
 
-  GMResourceFork* fork = [GMResourceFork resourceFork];
-  BOOL attributeFound = NO;  // Have we found at least one relevant attribute?
-  
-  NSData* imageData = [attribs objectForKey:kGMUserFileSystemCustomIconDataKey];
-  if (imageData) {
-    attributeFound = YES;
-    [fork addResourceWithType:'icns'
-                        resID:kCustomIconResource // -16455
-                         name:nil
-                         data:imageData];    
-  }
-  NSURL* url = [attribs objectForKey:kGMUserFileSystemWeblocURLKey];
-  if (url) {
-    attributeFound = YES;
-    NSString* urlString = [url absoluteString];
-    NSData* data = [urlString dataUsingEncoding:NSUTF8StringEncoding];
-    [fork addResourceWithType:'url '
-                        resID:256
-                         name:nil
-                         data:data];
-  }
-  return attributeFound ? [fork data] : nil;
+static void setCurrentRequest(fuse_req_t req) {
+  pthread_once(&currentRequestKeyOnce, createCurrentRequestKey);
+  pthread_setspecific(currentRequestKey, req);
 }
 
-#pragma mark Internal Stat Operations
+@implementation GMUserFileSystem
 
-- (BOOL)fillStatfsBuffer:(struct statfs *)stbuf
-                 forPath:(NSString *)path
-                   error:(NSError **)error {
-  NSDictionary* attributes = [self attributesOfFileSystemForPath:path error:error];
-  if (!attributes) {
-    return NO;
++ (NSDictionary *)currentContext {
+  uid_t uid;
+  gid_t gid;
+  pid_t pid;
+
+  fuse_req_t req = currentRequest();
+  if (req) {
+    const struct fuse_ctx* ctx = fuse_req_ctx(req);
+    uid = ctx->uid;
+    gid = ctx->gid;
+    pid = ctx->pid;
+  } else {
+    struct fuse_context* context = fuse_get_context();
+    if (!context) {
+      return nil;
+    }
+    uid = context->uid;
+    gid = context->gid;
+    pid = context->pid;
   }
   
-  // Block size
-  NSNumber* blocksize = [attributes objectForKey:kGMUserFileSystemVolumeFileSystemBlockSizeKey];
-  assert(blocksize);
-  stbuf->f_bsize = (uint32_t)[blocksize unsignedIntValue];
-  stbuf->f_iosize = (int32_t)[blocksize intValue];
-  
-  // Size in blocks
-  NSNumber* size = [attributes objectForKey:NSFileSystemSize];
-  assert(size);
-  stbuf->f_blocks = (uint64_t)([size unsignedLongLongValue] / stbuf->f_bsize);
-  
-  // Number of free / available blocks
-  NSNumber* freeSize = [attributes objectForKey:NSFileSystemFreeSize];
-  assert(freeSize);
-  stbuf->f_bavail = stbuf->f_bfree =
-    (uint64_t)([freeSize unsignedLongLongValue] / stbuf->f_bsize);
-  
-  // Number of nodes
-  NSNumber* numNodes = [attributes objectForKey:NSFileSystemNodes];
-  assert(numNodes);
-  stbuf->f_files = (uint64_t)[numNodes unsignedLongLongValue];
-  
-  // Number of free / available nodes
-  NSNumber* freeNodes = [attributes objectForKey:NSFileSystemFreeNodes];
-  assert(freeNodes);
-  stbuf->f_ffree = (uint64_t)[freeNodes unsignedLongLongValue];
-  
-  return YES;
+  NSMutableDictionary* dict = [[NSMutableDictionary alloc] init];
+  [dict setObject:[NSNumber numberWithUnsignedInt:uid]
+                 forKey:kGMUserFileSystemContextUserIDKey];
+  [dict setObject:[NSNumber numberWithUnsignedInt:gid]
+                 forKey:kGMUserFileSystemContextGroupIDKey];
+  [dict setObject:[NSNumber numberWithInt:pid]
+                 forKey:kGMUserFileSystemContextProcessIDKey];
+  return [dict autorelease];
 }
 
-- (BOOL)fillStatBuffer:(struct stat *)stbuf 
-               forPath:(NSString *)path 
-              userData:(id)userData
-                 error:(NSError **)error {
-  NSDictionary* attributes = [self defaultAttributesOfItemAtPath:path 
-                                                        userData:userData
-                                                           error:error];
-  if (!attributes) {
-    return NO;
-  }
+- (id)init {
+  return [self initWithDelegate:nil isThreadSafe:NO];
+}
 
-  // Inode
-  NSNumber* inode = [attributes objectForKey:NSFileSystemFileNumber];
-  if (inode) {
-    stbuf->st_ino = [inode longLongValue];
-  }
-  
-  // Permissions (mode)
-  NSNumber* perm = [attributes objectForKey:NSFilePosixPermissions];
-  stbuf->st_mode = [perm longValue];
-  NSString* fileType = [attributes objectForKey:NSFileType];
-  if ([fileType isEqualToString:NSFileTypeDirectory ]) {
-    stbuf->st_mode |= S_IFDIR;
-  } else if ([fileType isEqualToString:NSFileTypeRegular]) {
-    stbuf->st_mode |= S_IFREG;
-  } else if ([fileType isEqualToString:NSFileTypeSymbolicLink]) {
-    stbuf->st_mode |= S_IFLNK;
-  } else {
-    *error = [GMUserFileSystem errorWithCode:EFTYPE];
-    return NO;
+- (id)initWithDelegate:(id)delegate isThreadSafe:(BOOL)isThreadSafe {
+  self = [super init];
+  if (self) {
+    internal_ = [[GMUserFileSystemInternal alloc] initWithDelegate:delegate
+                                                      isThreadSafe:isThreadSafe];
   }
-  
-  // Owner and Group
-  // Note that if the owner or group IDs are not specified, the effective
-  // user and group IDs for the current process are used as defaults.
-  NSNumber* uid = [attributes objectForKey:NSFileOwnerAccountID];
-  NSNumber* gid = [attributes objectForKey:NSFileGroupOwnerAccountID];
-  stbuf->st_uid = uid ? [uid longValue] : geteuid();
-  stbuf->st_gid = gid ? [gid longValue] : getegid();
+  return self;
+}
 
-  // nlink
-  NSNumber* nlink = [attributes objectForKey:NSFileReferenceCount];
-  stbuf->st_nlink = [nlink longValue];
+- (void)dealloc {
+  [internal_ release];
+  [super dealloc];
+}
 
-  // flags
-  NSNumber* flags = [attributes objectForKey:kGMUserFileSystemFileFlagsKey];
-  if (flags) {
-    stbuf->st_flags = [flags longValue];
-  } else {
-    // Just in case they tried to use NSFileImmutable or NSFileAppendOnly
-    NSNumber* immutableFlag = [attributes objectForKey:NSFileImmutable];
-    if (immutableFlag && [immutableFlag boolValue]) {
-      stbuf->st_flags |= UF_IMMUTABLE;
-    }
-    NSNumber* appendFlag = [attributes objectForKey:NSFileAppendOnly];
-    if (appendFlag && [appendFlag boolValue]) {
-      stbuf->st_flags |= UF_APPEND;
-    }
-  }
+- (void)setDelegate:(id)delegate {
+  [internal_ setDelegate:delegate];
+}
+- (id)delegate {
+  return [internal_ delegate];
+}
 
-  // Note: We default atime, ctime to mtime if it is provided.
-  NSDate* mdate = [attributes objectForKey:NSFileModificationDate];
-  if (mdate) {
-    const double seconds_dp = [mdate timeIntervalSince1970];
-    const time_t t_sec = (time_t) seconds_dp;
-    const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
-    const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
+- (BOOL)enableAllocate {
+  return [internal_ supportsAllocate];
+}
+- (BOOL)enableCaseSensitiveNames {
+  return [internal_ supportsCaseSensitiveNames];
+}
+- (BOOL)enableExchangeData {
+  return [internal_ supportsExchangeData];
+}
+- (BOOL)enableExtendedTimes {
+  return [internal_ supportsExtendedTimes];
+}
+- (BOOL)enableSetVolumeName {
+  return [internal_ supportsSetVolumeName];
+}
 
-    stbuf->st_mtimespec.tv_sec = t_sec;
-    stbuf->st_mtimespec.tv_nsec = t_nsec;
-    stbuf->st_atimespec = stbuf->st_mtimespec;  // Default to mtime
-    stbuf->st_ctimespec = stbuf->st_mtimespec;  // Default to mtime
+- (void)mountAtPath:(NSString *)mountPath 
+        withOptions:(NSArray *)options {
+  [self mountAtPath:mountPath
+        withOptions:options
+   shouldForeground:YES
+    detachNewThread:YES];
+}
+
+- (void)mountAtPath:(NSString *)mountPath 
+        withOptions:(NSArray *)options
+   shouldForeground:(BOOL)shouldForeground
+    detachNewThread:(BOOL)detachNewThread {
+  [internal_ setMountPath:mountPath];
+  NSMutableArray* optionsCopy = [NSMutableArray array];
+  for (int i = 0; i < [options count]; ++i) {
+    NSString* option = [options objectAtIndex:i];
+    NSString* optionLowercase = [option lowercaseString];
+    if ([optionLowercase compare:@"rdonly"] == NSOrderedSame ||
+        [optionLowercase compare:@"ro"] == NSOrderedSame) {
+      [internal_ setIsReadOnly:YES];
+    }
+    if ([optionLowercase compare:kLowLevelMountOption] == NSOrderedSame) {
+      [internal_ setUsesLowLevelInterface:YES];
+      continue;  // Not a FUSE option.
+    }
+    [optionsCopy addObject:[[option copy] autorelease]];
   }
-  NSDate* adate = [attributes objectForKey:kGMUserFileSystemFileAccessDateKey];
-  if (adate) {
-    const double seconds_dp = [adate timeIntervalSince1970];
-    const time_t t_sec = (time_t) seconds_dp;
-    const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
-    const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
-    stbuf->st_atimespec.tv_sec = t_sec;
-    stbuf->st_atimespec.tv_nsec = t_nsec;
-  }    
-  NSDate* cdate = [attributes objectForKey:kGMUserFileSystemFileChangeDateKey];
-  if (cdate) {
-    const double seconds_dp = [cdate timeIntervalSince1970];
-    const time_t t_sec = (time_t) seconds_dp;
-    const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
-    const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
-    stbuf->st_ctimespec.tv_sec = t_sec;
-    stbuf->st_ctimespec.tv_nsec = t_nsec;
+  NSDictionary* args = 
+  [[NSDictionary alloc] initWithObjectsAndKeys:
+   optionsCopy, @"options",
+   [NSNumber numberWithBool:shouldForeground], @"shouldForeground", 
+   nil, nil];
+  if (detachNewThread) {
+    [NSThread detachNewThreadSelector:@selector(mount:) 
+                             toTarget:self 
+                           withObject:args];
+  } else {
+    [self mount:args];
   }
+}
 
-#ifdef _DARWIN_USE_64_BIT_INODE
-  NSDate* bdate = [attributes objectForKey:NSFileCreationDate];
-  if (bdate) {
-    const double seconds_dp = [bdate timeIntervalSince1970];
-    const time_t t_sec = (time_t) seconds_dp;
-    const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
-    const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
-    stbuf->st_birthtimespec.tv_sec = t_sec;
-    stbuf->st_birthtimespec.tv_nsec = t_nsec;
+- (void)unmount {
+  if ([internal_ status] == GMUserFileSystem_MOUNTED) {
+    NSArray* args = [NSArray arrayWithObjects:@"-v", [internal_ mountPath], nil];
+    NSTask* unmountTask = [NSTask launchedTaskWithLaunchPath:@"/sbin/umount" 
+                                                   arguments:args];
+    [unmountTask waitUntilExit];
   }
-#endif
+}
 
-  // File size
-  // Note that the actual file size of a directory depends on the internal 
-  // representation of directories in the particular file system. In general
-  // this is not the combined size of the files in that directory.
-  NSNumber* size = [attributes objectForKey:NSFileSize];
-  if (size) {
-    stbuf->st_size = [size longLongValue];
+- (BOOL)invalidateItemAtPath:(NSString *)path error:(NSError **)error {
+  int ret = -ENOTCONN;
+
+  [self invalidateCachesForPath:path recursive:NO];
+  if (![path isEqualToString:@"/"]) {
+    // The item might have been created or removed remotely.
+    NSString* parentPath = [path stringByDeletingLastPathComponent];
+    [[internal_ directoryContentsCache] removeObjectForKey:parentPath];
+    [[internal_ metadataSnapshot] removeEntriesForPath:parentPath recursive:NO];
   }
 
-  // Set the number of blocks used so that Finder will display size on disk 
-  // properly. The man page says that this is in terms of 512 byte blocks.
-  NSNumber* blocks = [attributes objectForKey:kGMUserFileSystemFileSizeInBlocksKey];
-  if (blocks) {
-    stbuf->st_blocks = [blocks longLongValue];
-  } else if (stbuf->st_size > 0) {
-    stbuf->st_blocks = stbuf->st_size / 512;
-    if (stbuf->st_size % 512) {
-      ++(stbuf->st_blocks);
+  struct fuse* handle = [internal_ handle];
+  if (handle) {
+    ret = fuse_invalidate_path(handle, [path fileSystemRepresentation]);
+    
+    // Note: fuse_invalidate_path() may return -ENOENT to indicate that there
+    // was no entry to be invalidated, e.g., because the path has not been seen
+    // before or has been forgotten. This should not be considered to be an
+    // error.
+    if (ret == -ENOENT) {
+      ret = 0;
+    }
+  } else if ([internal_ channel]) {
+    // The kernel only knows about nodes that have been looked up, so there is
+    // nothing to invalidate for paths that are not in the inode table.
+    ret = 0;
+    UInt64 parentID = 0;
+    UInt64 nodeID = [[internal_ inodeTable] nodeIDForPath:path
+                                             parentNodeID:&parentID];
+    if (nodeID != 0) {
+      struct fuse_chan* chan = [internal_ channel];
+      ret = fuse_lowlevel_notify_inval_inode(chan, nodeID, 0, 0);
+      if ((ret == 0 || ret == -ENOENT) && parentID != 0) {
+        const char* name = [[path lastPathComponent] fileSystemRepresentation];
+        ret = fuse_lowlevel_notify_inval_entry(chan, parentID, name, strlen(name));
+      }
+      if (ret == -ENOENT) {
+        ret = 0;
+      }
     }
   }
 
-  // Optimal file I/O size
-  NSNumber *ioSize = [attributes objectForKey:kGMUserFileSystemFileOptimalIOSizeKey];
-  if (ioSize) {
-    stbuf->st_blksize = [ioSize intValue];
+  if (ret != 0) {
+    if (error) {
+      *error = [GMUserFileSystem errorWithCode:-ret];
+    }
+    return NO;
   }
 
-  return YES;  
+  return YES;
 }
 
-#pragma mark Creating an Item
-
-- (BOOL)createDirectoryAtPath:(NSString *)path 
-                   attributes:(NSDictionary *)attributes
-                        error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSMutableString* traceinfo = 
-     [NSMutableString stringWithFormat:@"%@ [%@]", path, attributes]; 
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
-  }
-  
-  if ([[internal_ delegate] respondsToSelector:@selector(createDirectoryAtPath:attributes:error:)]) {
-    return [[internal_ delegate] createDirectoryAtPath:path attributes:attributes error:error];
+// Adds the statistics of cache to the statistics dictionary if cache is enabled.
+// Accepts a GMCache, GMBlockCache or GMDiskBlockCache.
+static void addCacheStatistics(NSMutableDictionary* statistics, NSString* key,
+                               id cache) {
+  if (!cache) {
+    return;
   }
+  NSDictionary* cacheStatistics =
+    [NSDictionary dictionaryWithObjectsAndKeys:
+     [NSNumber numberWithUnsignedLongLong:[cache hits]], kGMUserFileSystemStatisticsHitsKey,
+     [NSNumber numberWithUnsignedLongLong:[cache misses]], kGMUserFileSystemStatisticsMissesKey,
+     [NSNumber numberWithUnsignedLongLong:[cache count]], kGMUserFileSystemStatisticsCountKey,
+     [NSNumber numberWithUnsignedLongLong:[cache totalCost]], kGMUserFileSystemStatisticsSizeKey,
+     nil];
+  [statistics setObject:cacheStatistics forKey:key];
+}
 
-  *error = [GMUserFileSystem errorWithCode:EACCES];
-  return NO;
+- (NSDictionary *)statistics {
+  NSMutableDictionary* statistics = [NSMutableDictionary dictionary];
+  addCacheStatistics(statistics, kGMUserFileSystemItemAttributesCacheKey,
+                     [internal_ itemAttributesCache]);
+  addCacheStatistics(statistics, kGMUserFileSystemFileSystemAttributesCacheKey,
+                     [internal_ fileSystemAttributesCache]);
+  addCacheStatistics(statistics, kGMUserFileSystemNegativeLookupCacheKey,
+                     [internal_ negativeLookupCache]);
+  addCacheStatistics(statistics, kGMUserFileSystemDirectoryContentsCacheKey,
+                     [internal_ directoryContentsCache]);
+  addCacheStatistics(statistics, kGMUserFileSystemFileContentsCacheKey,
+                     [internal_ fileContentsCache]);
+  addCacheStatistics(statistics, kGMUserFileSystemExtendedAttributesCacheKey,
+                     [internal_ extendedAttributesCache]);
+  addCacheStatistics(statistics, kGMUserFileSystemResourcesCacheKey,
+                     [internal_ resourcesCache]);
+  addCacheStatistics(statistics, kGMUserFileSystemFileBlockCacheKey,
+                     [internal_ fileBlockCache]);
+  addCacheStatistics(statistics, kGMUserFileSystemDiskBlockCacheKey,
+                     [internal_ diskBlockCache]);
+  GMPageStoreBudget* budget = [internal_ fileDataBudget];
+  if (budget) {
+    NSDictionary* fileDataStatistics =
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       [NSNumber numberWithUnsignedLongLong:[budget size]], kGMUserFileSystemStatisticsSizeKey,
+       [NSNumber numberWithUnsignedLongLong:[budget spilledSize]], kGMUserFileSystemStatisticsSpilledSizeKey,
+       nil];
+    [statistics setObject:fileDataStatistics forKey:kGMUserFileSystemFileDataKey];
+  }
+  budget = [internal_ readaheadBudget];
+  if (budget) {
+    NSDictionary* readaheadStatistics =
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       [NSNumber numberWithUnsignedLongLong:[budget size]], kGMUserFileSystemStatisticsSizeKey,
+       nil];
+    [statistics setObject:readaheadStatistics forKey:kGMUserFileSystemReadaheadKey];
+  }
+  GMInodeTable* inodeTable = [internal_ inodeTable];
+  if (inodeTable) {
+    NSDictionary* inodeTableStatistics =
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       [NSNumber numberWithUnsignedLongLong:[inodeTable count]], kGMUserFileSystemStatisticsCountKey,
+       [NSNumber numberWithUnsignedLongLong:[inodeTable totalCost]], kGMUserFileSystemStatisticsSizeKey,
+       nil];
+    [statistics setObject:inodeTableStatistics forKey:kGMUserFileSystemInodeTableKey];
+  }
+  GMMetadataSnapshot* metadataSnapshot = [internal_ metadataSnapshot];
+  if (metadataSnapshot) {
+    NSDictionary* metadataSnapshotStatistics =
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       [NSNumber numberWithUnsignedLongLong:[metadataSnapshot count]], kGMUserFileSystemStatisticsCountKey,
+       [NSNumber numberWithUnsignedLongLong:[metadataSnapshot totalCost]], kGMUserFileSystemStatisticsSizeKey,
+       nil];
+    [statistics setObject:metadataSnapshotStatistics forKey:kGMUserFileSystemMetadataSnapshotKey];
+  }
+  GMMemoryBudget* memoryBudget = [internal_ memoryBudget];
+  if (memoryBudget) {
+    NSDictionary* sizes = [memoryBudget sizesByConsumerName];
+    NSNumber* writeBackSize = [sizes objectForKey:kGMUserFileSystemWriteBackKey];
+    if (writeBackSize) {
+      NSDictionary* writeBackStatistics =
+        [NSDictionary dictionaryWithObjectsAndKeys:
+         writeBackSize, kGMUserFileSystemStatisticsSizeKey,
+         nil];
+      [statistics setObject:writeBackStatistics forKey:kGMUserFileSystemWriteBackKey];
+    }
+    NSUInteger size = 0;
+    NSArray* values = [sizes allValues];
+    for (int i = 0, count = [values count]; i < count; i++) {
+      size += [[values objectAtIndex:i] unsignedIntegerValue];
+    }
+    NSDictionary* memoryStatistics =
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       [NSNumber numberWithUnsignedLongLong:size], kGMUserFileSystemStatisticsSizeKey,
+       [NSNumber numberWithUnsignedLongLong:[memoryBudget limit]], kGMUserFileSystemStatisticsLimitKey,
+       [NSNumber numberWithUnsignedLongLong:[memoryBudget purgedSize]], kGMUserFileSystemStatisticsPurgedSizeKey,
+       sizes, kGMUserFileSystemStatisticsConsumersKey,
+       nil];
+    [statistics setObject:memoryStatistics forKey:kGMUserFileSystemMemoryBudgetKey];
+  }
+  return statistics;
 }
 
-- (BOOL)createFileAtPath:(NSString *)path 
-              attributes:(NSDictionary *)attributes
-                   flags:(int)flags
-                userData:(id *)userData
-                   error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = [NSString stringWithFormat:@"%@ [%@]", path, attributes]; 
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+- (void)invalidateCachesForPath:(NSString *)path recursive:(BOOL)recursive {
+  [internal_ noteInvalidationOfPath:path recursive:recursive];
+  GMCache* caches[] = {
+    [internal_ itemAttributesCache],
+    [internal_ negativeLookupCache],
+    [internal_ directoryContentsCache],
+    [internal_ fileContentsCache],
+    [internal_ extendedAttributesCache],
+    [internal_ resourcesCache]
+  };
+  for (size_t i = 0; i < sizeof(caches) / sizeof(GMCache *); ++i) {
+    if (recursive) {
+      [caches[i] removeObjectsForPathAndDescendants:path];
+    } else {
+      [caches[i] removeObjectForKey:path];
+    }
   }
+  [[internal_ fileBlockCache] removeBlocksForPath:path recursive:recursive];
+  [[internal_ fileSystemAttributesCache] removeAllObjects];
+  [[internal_ metadataSnapshot] removeEntriesForPath:path recursive:recursive];
 
-  if ([[internal_ delegate] respondsToSelector:@selector(createFileAtPath:attributes:flags:userData:error:)]) {
-    return [[internal_ delegate] createFileAtPath:path
-                                       attributes:attributes
-                                            flags:flags
-                                         userData:userData
-                                            error:error];
-  } else if ([[internal_ delegate] respondsToSelector:@selector(createFileAtPath:attributes:userData:error:)]) {
-    return [[internal_ delegate] createFileAtPath:path
-                                       attributes:attributes
-                                         userData:userData
-                                            error:error];
+  NSArray* handles = [self fileHandlesAtPath:path recursive:recursive];
+  for (int i = 0, count = [handles count]; i < count; i++) {
+    GMFileHandle* handle = [handles objectAtIndex:i];
+    [[handle readahead] invalidate];
+    // The version the file was opened with no longer describes its contents.
+    [handle setContentVersion:nil];
   }
-
-  *error = [GMUserFileSystem errorWithCode:EACCES];
-  return NO;
 }
 
-#pragma mark Removing an Item
+- (void)invalidateCachesForWriteToFileAtPath:(NSString *)path
+                                      handle:(GMFileHandle *)handle {
+  if (![handle writeBack]) {
+    [self invalidateCachesForPath:path recursive:NO];
+    return;
+  }
+  // Attributes fetched again include the buffered writes.
+  [internal_ noteInvalidationOfPath:path recursive:NO];
+  [[internal_ itemAttributesCache] removeObjectForKey:path];
+  [[internal_ metadataSnapshot] removeEntriesForPath:path recursive:NO];
+}
 
-- (BOOL)removeDirectoryAtPath:(NSString *)path error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
-  }  
+- (void)invalidateCachesForParentOfPath:(NSString *)path {
+  if ([path isEqualToString:@"/"]) {
+    return;
+  }
+  NSString* parentPath = [path stringByDeletingLastPathComponent];
+  [internal_ noteInvalidationOfPath:parentPath recursive:NO];
+  [[internal_ itemAttributesCache] removeObjectForKey:parentPath];
+  // The snapshot does not track single entries of a listing.
+  [[internal_ metadataSnapshot] removeEntriesForPath:parentPath recursive:NO];
+}
 
-  if ([[internal_ delegate] respondsToSelector:@selector(removeDirectoryAtPath:error:)]) {
-    return [[internal_ delegate] removeDirectoryAtPath:path error:error];
+// Adds the item to or removes it from the cached listing of its parent
+// directory, so the listing does not have to be fetched again after the file
+// system itself has modified the directory.
+- (void)updateDirectoryContentsCacheForItemAtPath:(NSString *)path
+                                           exists:(BOOL)exists {
+  GMCache* cache = [internal_ directoryContentsCache];
+  if (!cache || [path isEqualToString:@"/"]) {
+    return;
+  }
+  NSString* parentPath = [path stringByDeletingLastPathComponent];
+  NSString* name = [path lastPathComponent];
+  while (YES) {
+    NSArray* contents = [cache peekObjectForKey:parentPath];
+    if (!contents) {
+      return;  // Not cached.
+    }
+    if ([contents count] > kDirectoryContentsUpdateLimit) {
+      [cache removeObjectForKey:parentPath];
+      return;
+    }
+    if ([contents containsObject:name] == exists) {
+      return;  // Already up to date.
+    }
+    NSArray* updated = nil;
+    if (exists) {
+      updated = [contents arrayByAddingObject:name];
+    } else {
+      NSMutableArray* mutableContents = [[contents mutableCopy] autorelease];
+      [mutableContents removeObject:name];
+      updated = mutableContents;
+    }
+    if ([cache replaceObject:contents
+                  withObject:updated
+                      forKey:parentPath
+                        cost:[updated count] * kDirectoryContentsNameCost]) {
+      return;
+    }
+    // The listing has been replaced concurrently; try again.
   }
-  return [self removeItemAtPath:path error:error];
 }
 
-- (BOOL)removeItemAtPath:(NSString *)path error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
-  }  
+- (NSString *)pathForNodeID:(UInt64)nodeID {
+  return [[internal_ inodeTable] pathForNodeID:nodeID];
+}
 
-  if ([[internal_ delegate] respondsToSelector:@selector(removeItemAtPath:error:)]) {
-    return [[internal_ delegate] removeItemAtPath:path error:error];
-  }
++ (NSError *)errorWithCode:(int)code {
+  return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+}
 
-  *error = [GMUserFileSystem errorWithCode:EACCES];
-  return NO;
++ (GMUserFileSystem *)currentFS {
+  struct fuse_context* context = fuse_get_context();
+  assert(context);
+  return (GMUserFileSystem *)context->private_data;
 }
 
-#pragma mark Moving an Item
+#define FUSEDEVIOCGETHANDSHAKECOMPLETE _IOR('F', 2, u_int32_t)
+static const int kMaxWaitForMountTries = 50;
+static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
 
-- (BOOL)moveItemAtPath:(NSString *)source 
-                toPath:(NSString *)destination
-                 error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = 
-      [NSString stringWithFormat:@"%@ -> %@", source, destination];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+- (void)waitUntilMounted:(NSNumber *)fileDescriptor {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  
+  for (int i = 0; i < kMaxWaitForMountTries; ++i) {
+    UInt32 handShakeComplete = 0;
+    int ret = ioctl([fileDescriptor intValue], FUSEDEVIOCGETHANDSHAKECOMPLETE,
+                    &handShakeComplete);
+    if (ret == 0 && handShakeComplete) {
+      [internal_ setStatus:GMUserFileSystem_MOUNTED];
+      
+      // Successfully mounted, so post notification.
+      NSDictionary* userInfo = 
+        [NSDictionary dictionaryWithObjectsAndKeys:
+         [internal_ mountPath], kGMUserFileSystemMountPathKey,
+         nil];
+      NSNotificationCenter* center = [NSNotificationCenter defaultCenter];
+      [center postNotificationName:kGMUserFileSystemDidMount object:self
+                          userInfo:userInfo];
+      [pool release];
+      return;
+    }
+    usleep(kWaitForMountUSleepInterval);
   }
-
-  if ([[internal_ delegate] respondsToSelector:@selector(moveItemAtPath:toPath:error:)]) {
-    return [[internal_ delegate] moveItemAtPath:source toPath:destination error:error];
-  }  
   
-  *error = [GMUserFileSystem errorWithCode:EACCES];
-  return NO;
+  // Tried for a long time and no luck :-(
+  // Unmount and report failure?
+  [pool release];
 }
 
-#pragma mark Linking an Item
+// Adds consumer to the memory budget if consumer is enabled.
+static void addMemoryConsumer(GMMemoryBudget* budget, id consumer,
+                              NSString* name, NSUInteger weight) {
+  if (consumer) {
+    [budget addConsumer:consumer name:name weight:weight];
+  }
+}
 
-- (BOOL)linkItemAtPath:(NSString *)path
-                toPath:(NSString *)otherPath
-                 error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = [NSString stringWithFormat:@"%@ -> %@", path, otherPath];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+- (void)fuseInit {
+  struct fuse_chan* chan = [internal_ channel];
+  if (!chan) {
+    struct fuse_context* context = fuse_get_context();
+    [internal_ setHandle:context->fuse];
+
+    struct fuse_session* se = fuse_get_session(context->fuse);
+    chan = fuse_session_next_chan(se, NULL);
   }
+  [internal_ setStatus:GMUserFileSystem_INITIALIZING];
 
-  if ([[internal_ delegate] respondsToSelector:@selector(linkItemAtPath:toPath:error:)]) {
-    return [[internal_ delegate] linkItemAtPath:path toPath:otherPath error:error];
-  }  
+  NSError* error = nil;
+  NSDictionary* attribs = [self attributesOfFileSystemForPath:@"/" error:&error];
+  NSUInteger memoryLimit = 0;
 
-  *error = [GMUserFileSystem errorWithCode:ENOTSUP];  // Note: error not in man page.
-  return NO;
-}
+  if (attribs) {
+    NSNumber* supports = nil;
 
-#pragma mark Symbolic Links
+    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsAllocateKey];
+    if (supports) {
+      [internal_ setSupportsAllocate:[supports boolValue]];
+    }
 
-- (BOOL)createSymbolicLinkAtPath:(NSString *)path 
-             withDestinationPath:(NSString *)otherPath
-                           error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = [NSString stringWithFormat:@"%@ -> %@", path, otherPath];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
-  }  
-  
-  if ([[internal_ delegate] respondsToSelector:@selector(createSymbolicLinkAtPath:withDestinationPath:error:)]) {
-    return [[internal_ delegate] createSymbolicLinkAtPath:path
-                                      withDestinationPath:otherPath
-                                                    error:error];
-  }
+    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsCaseSensitiveNamesKey];
+    if (supports) {
+      [internal_ setSupportsCaseSensitiveNames:[supports boolValue]];
+    }
 
-  *error = [GMUserFileSystem errorWithCode:ENOTSUP];  // Note: error not in man page.
-  return NO; 
-}
+    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsExchangeDataKey];
+    if (supports) {
+      [internal_ setSupportsExchangeData:[supports boolValue]];
+    }
 
-- (NSString *)destinationOfSymbolicLinkAtPath:(NSString *)path
-                                        error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
-  }
-  
-  if ([[internal_ delegate] respondsToSelector:@selector(destinationOfSymbolicLinkAtPath:error:)]) {
-    return [[internal_ delegate] destinationOfSymbolicLinkAtPath:path error:error];
-  }
+    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsExtendedDatesKey];
+    if (supports) {
+      [internal_ setSupportsExtendedTimes:[supports boolValue]];
+    }
 
-  *error = [GMUserFileSystem errorWithCode:ENOENT];
-  return nil;
-}
+    supports = [attribs objectForKey:kGMUserFileSystemVolumeSupportsSetVolumeNameKey];
+    if (supports) {
+      [internal_ setSupportsSetVolumeName:[supports boolValue]];
+    }
 
-#pragma mark Directory Contents
+    NSNumber* timeout = nil;
+
+    timeout = [attribs objectForKey:kGMUserFileSystemVolumeItemAttributesCacheTimeoutKey];
+    if (timeout && [timeout doubleValue] > 0) {
+      GMCache* cache =
+        [[GMCache alloc] initWithCountLimit:kItemAttributesCacheCountLimit
+                                  costLimit:0
+                                    timeout:[timeout doubleValue]];
+      [internal_ setItemAttributesCache:cache];
+      [cache release];
+
+      // Attributes of listed items beyond the first batch are prefetched on
+      // another thread, so that listing a large directory does not wait for
+      // them.
+      if ([self supportsAttributesOfItemsAtPaths] && [internal_ isThreadSafe]) {
+        NSOperationQueue* queue = [[NSOperationQueue alloc] init];
+        [queue setMaxConcurrentOperationCount:1];
+        [internal_ setPrefetchQueue:queue];
+        [queue release];
+      }
+    }
 
-- (NSArray *)contentsOfDirectoryAtPath:(NSString *)path error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
-  }
+    timeout = [attribs objectForKey:kGMUserFileSystemVolumeFileSystemAttributesCacheTimeoutKey];
+    if (timeout && [timeout doubleValue] > 0) {
+      GMCache* cache = [[GMCache alloc] initWithCountLimit:1
+                                                 costLimit:0
+                                                   timeout:[timeout doubleValue]];
+      [internal_ setFileSystemAttributesCache:cache];
+      [cache release];
+    }
 
-  NSArray* contents = nil;
-  if ([[internal_ delegate] respondsToSelector:@selector(contentsOfDirectoryAtPath:error:)]) {
-    contents = [[internal_ delegate] contentsOfDirectoryAtPath:path error:error];
-  } else if ([path isEqualToString:@"/"]) {
-    contents = [NSArray array];  // Give them an empty root directory for free.
-  }
-  return contents;
-}
+    timeout = [attribs objectForKey:kGMUserFileSystemVolumeNegativeLookupCacheTimeoutKey];
+    if (timeout && [timeout doubleValue] > 0) {
+      GMCache* cache =
+        [[GMCache alloc] initWithCountLimit:kNegativeLookupCacheCountLimit
+                                  costLimit:0
+                                    timeout:[timeout doubleValue]];
+      [internal_ setNegativeLookupCache:cache];
+      [cache release];
+    }
 
-#pragma mark File Contents
+    timeout = [attribs objectForKey:kGMUserFileSystemVolumeDirectoryContentsCacheTimeoutKey];
+    if (timeout && [timeout doubleValue] > 0) {
+      GMCache* cache =
+        [[GMCache alloc] initWithCountLimit:kDirectoryContentsCacheCountLimit
+                                  costLimit:kDirectoryContentsCacheCostLimit
+                                    timeout:[timeout doubleValue]];
+      [internal_ setDirectoryContentsCache:cache];
+      [cache release];
+    }
 
-// Note: Only call this if the delegate does indeed support this method.
-- (NSData *)contentsAtPath:(NSString *)path {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
-  }
+    timeout = [attribs objectForKey:kGMUserFileSystemVolumeFileContentsCacheTimeoutKey];
+    if (timeout && [timeout doubleValue] > 0) {
+      GMCache* cache =
+        [[GMCache alloc] initWithCountLimit:0
+                                  costLimit:kFileContentsCacheCostLimit
+                                    timeout:[timeout doubleValue]];
+      [internal_ setFileContentsCache:cache];
+      [cache release];
+    }
 
-  id delegate = [internal_ delegate];
-  return [delegate contentsAtPath:path];
-}
+    timeout = [attribs objectForKey:kGMUserFileSystemVolumeExtendedAttributesCacheTimeoutKey];
+    if (timeout && [timeout doubleValue] > 0) {
+      GMCache* cache =
+        [[GMCache alloc] initWithCountLimit:kExtendedAttributesCacheCountLimit
+                                  costLimit:kExtendedAttributesCacheCostLimit
+                                    timeout:[timeout doubleValue]];
+      [internal_ setExtendedAttributesCache:cache];
+      [cache release];
+    }
 
-- (BOOL)openFileAtPath:(NSString *)path 
-                  mode:(int)mode
-              userData:(id *)userData 
-                 error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = [NSString stringWithFormat:@"%@, mode=0x%x", path, mode];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
-  }
+    NSNumber* blockSize = [attribs objectForKey:kGMUserFileSystemVolumeFileContentsBlockSizeKey];
+    if (blockSize && [blockSize unsignedIntegerValue] > 0) {
+      [internal_ setFileContentsBlockSize:[blockSize unsignedIntegerValue]];
+    }
 
-  id delegate = [internal_ delegate];
-  if ([delegate respondsToSelector:@selector(contentsAtPath:)]) {
-    NSData* data = [self contentsAtPath:path];
-    if (data != nil) {
-      *userData = [GMDataBackedFileDelegate fileDelegateWithData:data];
-      return YES;
+    NSNumber* limit = [attribs objectForKey:kGMUserFileSystemVolumeFileDataHandleMemoryLimitKey];
+    if (limit) {
+      [internal_ setFileDataHandleMemoryLimit:[limit unsignedIntegerValue]];
     }
-  } else if ([delegate respondsToSelector:@selector(openFileAtPath:mode:userData:error:)]) {
-    if ([delegate openFileAtPath:path 
-                            mode:mode 
-                        userData:userData 
-                           error:error]) {
-      return YES;  // They handled it.
+    limit = [attribs objectForKey:kGMUserFileSystemVolumeFileDataMemoryLimitKey];
+    if (limit || [internal_ fileDataHandleMemoryLimit] > 0) {
+      GMPageStoreBudget* budget =
+        [[GMPageStoreBudget alloc] initWithLimit:[limit unsignedIntegerValue]];
+      [internal_ setFileDataBudget:budget];
+      [budget release];
     }
-  }
 
-  // Still unable to open the file; maybe it is an Icon\r or AppleDouble?
-  if ([internal_ shouldCheckForResource]) {
-    NSData* data = nil;  // Synthesized data that we provide a file delegate for.
+    // Reads ahead happen on other threads, concurrently with other operations.
+    NSNumber* size = [attribs objectForKey:kGMUserFileSystemVolumeReadaheadSizeKey];
+    if (size && [size unsignedIntegerValue] > 0 && [internal_ isThreadSafe]) {
+      [internal_ setReadaheadSize:[size unsignedIntegerValue]];
+      limit = [attribs objectForKey:kGMUserFileSystemVolumeReadaheadMemoryLimitKey];
+      GMPageStoreBudget* budget =
+        [[GMPageStoreBudget alloc] initWithLimit:(limit ? [limit unsignedIntegerValue]
+                                                        : kDefaultReadaheadMemoryLimit)];
+      [internal_ setReadaheadBudget:budget];
+      [budget release];
+      NSOperationQueue* queue = [[NSOperationQueue alloc] init];
+      [queue setMaxConcurrentOperationCount:kReadaheadConcurrency];
+      [internal_ setReadaheadQueue:queue];
+      [queue release];
+    }
 
-    // Is it an Icon\r file that we handle?
-    if ([self isDirectoryIconAtPath:path dirPath:nil]) {
-      data = [NSData data];  // The Icon\r file is empty.
+    size = [attribs objectForKey:kGMUserFileSystemVolumeWriteBackSizeKey];
+    [internal_ setWriteBackSize:[size unsignedIntegerValue]];
+
+    NSString* directory = [attribs objectForKey:kGMUserFileSystemVolumeDiskCacheDirectoryKey];
+    if (directory) {
+      limit = [attribs objectForKey:kGMUserFileSystemVolumeDiskCacheSizeKey];
+      GMDiskBlockCache* cache =
+        [[GMDiskBlockCache alloc] initWithDirectory:directory
+                                          sizeLimit:(limit ? [limit unsignedLongLongValue]
+                                                           : kDefaultDiskBlockCacheSizeLimit)];
+      [internal_ setDiskBlockCache:cache];
+      [cache release];
     }
 
-    if (data != nil) {
-      if ((mode & O_ACCMODE) == O_RDONLY) {
-        *userData = [GMDataBackedFileDelegate fileDelegateWithData:data];
-      } else {
-        NSMutableData* mutableData = [NSMutableData dataWithData:data];
-        *userData = 
-          [GMMutableDataBackedFileDelegate fileDelegateWithData:mutableData];
+    NSString* snapshotPath = [attribs objectForKey:kGMUserFileSystemVolumeMetadataSnapshotPathKey];
+    NSString* generation = snapshotPath ? [self metadataGeneration] : nil;
+    if (generation) {
+      GMMetadataSnapshot* snapshot =
+        [[GMMetadataSnapshot alloc] initWithContentsOfFile:snapshotPath];
+      NSString* snapshotGeneration = [snapshot generation];
+      NSArray* changedPaths = nil;
+      if (snapshotGeneration && ![snapshotGeneration isEqualToString:generation]) {
+        changedPaths =
+          [self pathsOfItemsChangedSinceMetadataGeneration:snapshotGeneration
+                                                     error:&error];
       }
-      return YES;  // Handled by a synthesized file delegate.
+      [snapshot updateGeneration:generation changedPaths:changedPaths];
+      [internal_ setMetadataSnapshot:snapshot];
+      [snapshot release];
+    }
+
+    limit = [attribs objectForKey:kGMUserFileSystemVolumeMemoryLimitKey];
+    if (limit) {
+      memoryLimit = [limit unsignedIntegerValue];
     }
   }
   
-  if (*error == nil) {
-    *error = [GMUserFileSystem errorWithCode:ENOENT];
+  if ([self supportsFileContentsBlocks]) {
+    GMBlockCache* cache =
+      [[GMBlockCache alloc] initWithShardCount:kFileBlockCacheShardCount
+                                     costLimit:kFileBlockCacheCostLimit
+                                       timeout:0];
+    [internal_ setFileBlockCache:cache];
+    [cache release];
   }
-  return NO;
+
+  if ([internal_ shouldCheckForResource]) {
+    GMCache* cache =
+      [[GMCache alloc] initWithCountLimit:kResourcesCacheCountLimit
+                                costLimit:kResourcesCacheCostLimit
+                                  timeout:0];
+    [internal_ setResourcesCache:cache];
+    [cache release];
+  }
+
+  GMMemoryBudget* memoryBudget = [[GMMemoryBudget alloc] initWithLimit:memoryLimit];
+  addMemoryConsumer(memoryBudget, [internal_ itemAttributesCache],
+                    kGMUserFileSystemItemAttributesCacheKey,
+                    kItemAttributesMemoryWeight);
+  addMemoryConsumer(memoryBudget, [internal_ fileSystemAttributesCache],
+                    kGMUserFileSystemFileSystemAttributesCacheKey,
+                    kFileSystemAttributesMemoryWeight);
+  addMemoryConsumer(memoryBudget, [internal_ negativeLookupCache],
+                    kGMUserFileSystemNegativeLookupCacheKey,
+                    kNegativeLookupMemoryWeight);
+  addMemoryConsumer(memoryBudget, [internal_ directoryContentsCache],
+                    kGMUserFileSystemDirectoryContentsCacheKey,
+                    kDirectoryContentsMemoryWeight);
+  addMemoryConsumer(memoryBudget, [internal_ fileContentsCache],
+                    kGMUserFileSystemFileContentsCacheKey,
+                    kFileContentsMemoryWeight);
+  addMemoryConsumer(memoryBudget, [internal_ extendedAttributesCache],
+                    kGMUserFileSystemExtendedAttributesCacheKey,
+                    kExtendedAttributesMemoryWeight);
+  addMemoryConsumer(memoryBudget, [internal_ resourcesCache],
+                    kGMUserFileSystemResourcesCacheKey,
+                    kResourcesMemoryWeight);
+  addMemoryConsumer(memoryBudget, [internal_ fileBlockCache],
+                    kGMUserFileSystemFileBlockCacheKey,
+                    kFileBlockMemoryWeight);
+  if ([internal_ fileDataBudget]) {
+    addMemoryConsumer(memoryBudget,
+                      [[[GMOpenFileBuffers alloc] initWithInternal:internal_
+                                                              kind:GMOpenFileBuffersFileData] autorelease],
+                      kGMUserFileSystemFileDataKey, 0);
+  }
+  if ([internal_ readaheadBudget]) {
+    addMemoryConsumer(memoryBudget,
+                      [[[GMOpenFileBuffers alloc] initWithInternal:internal_
+                                                              kind:GMOpenFileBuffersReadahead] autorelease],
+                      kGMUserFileSystemReadaheadKey, kReadaheadMemoryWeight);
+  }
+  if ([internal_ writeBackSize] > 0) {
+    addMemoryConsumer(memoryBudget,
+                      [[[GMOpenFileBuffers alloc] initWithInternal:internal_
+                                                              kind:GMOpenFileBuffersWriteBack] autorelease],
+                      kGMUserFileSystemWriteBackKey, 0);
+  }
+  addMemoryConsumer(memoryBudget, [internal_ inodeTable],
+                    kGMUserFileSystemInodeTableKey,
+                    ([internal_ usesLowLevelInterface] ? 0 : kInodeTableMemoryWeight));
+  addMemoryConsumer(memoryBudget, [internal_ metadataSnapshot],
+                    kGMUserFileSystemMetadataSnapshotKey,
+                    kMetadataSnapshotMemoryWeight);
+  [internal_ setMemoryBudget:memoryBudget];
+  [memoryBudget release];
+
+  // The mount point won't actually show up until this winds its way
+  // back through the kernel after this routine returns. In order to post
+  // the kGMUserFileSystemDidMount notification we start a new thread that will
+  // poll until it is mounted.
+  int fd = fuse_chan_fd(chan);
+  
+  [NSThread detachNewThreadSelector:@selector(waitUntilMounted:)
+                           toTarget:self
+                         withObject:[NSNumber numberWithInteger:fd]];
 }
 
-- (void)releaseFileAtPath:(NSString *)path userData:(id)userData {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo =
-      [NSString stringWithFormat:@"%@, userData=%p", path, userData];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
-  }
-  
-  if (userData != nil && 
-      [userData isKindOfClass:[GMDataBackedFileDelegate class]]) {
-    return;  // Don't report releaseFileAtPath for internal file.
-  }
-  if ([[internal_ delegate] respondsToSelector:@selector(releaseFileAtPath:userData:)]) {
-    [[internal_ delegate] releaseFileAtPath:path userData:userData];
+- (void)fuseDestroy {
+  if (GMDelegateImplements(internal_, kGMDelegateWillUnmount)) {
+    [[internal_ delegate] willUnmount];
   }
+  [internal_ setStatus:GMUserFileSystem_UNMOUNTING];
+  [[internal_ prefetchQueue] cancelAllOperations];
+  [[internal_ prefetchQueue] waitUntilAllOperationsAreFinished];
+  [internal_ setPrefetchQueue:nil];
+  // Read ahead chunks of files that are still open are accounted to the memory
+  // budget until they are dropped, and reading them ahead may grow it.
+  NSArray* handles = [internal_ fileHandles];
+  for (int i = 0, count = [handles count]; i < count; i++) {
+    [[[handles objectAtIndex:i] readahead] close];
+  }
+  [[internal_ readaheadQueue] waitUntilAllOperationsAreFinished];
+  [internal_ setReadaheadQueue:nil];
+  [[internal_ memoryBudget] removeAllConsumers];
+  [internal_ setMemoryBudget:nil];
+  [internal_ setItemAttributesCache:nil];
+  [internal_ setFileSystemAttributesCache:nil];
+  [internal_ setNegativeLookupCache:nil];
+  [internal_ setDirectoryContentsCache:nil];
+  [internal_ setFileContentsCache:nil];
+  [internal_ setExtendedAttributesCache:nil];
+  [internal_ setResourcesCache:nil];
+  [internal_ setFileBlockCache:nil];
+  [internal_ setFileDataBudget:nil];
+  [internal_ setReadaheadBudget:nil];
+  [internal_ setWriteBackSize:0];
+  [[internal_ diskBlockCache] synchronize];
+  [internal_ setDiskBlockCache:nil];
+  [[internal_ metadataSnapshot] synchronize];
+  [internal_ setMetadataSnapshot:nil];
+
+  NSDictionary* userInfo = 
+    [NSDictionary dictionaryWithObjectsAndKeys:
+     [internal_ mountPath], kGMUserFileSystemMountPathKey,
+     nil];
+  NSNotificationCenter* center = [NSNotificationCenter defaultCenter];
+  [center postNotificationName:kGMUserFileSystemDidUnmount object:self
+                      userInfo:userInfo];
+  [internal_ setStatus:GMUserFileSystem_NOT_MOUNTED];
 }
 
-- (int)readFileAtPath:(NSString *)path 
-             userData:(id)userData
-               buffer:(char *)buffer 
-                 size:(size_t)size 
-               offset:(off_t)offset
-                error:(NSError **)error {
+#pragma mark Finder Info, Resource Forks and HFS headers
+
+- (NSDictionary *)finderAttributesAtPath:(NSString *)path {
   if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo =
-      [NSString stringWithFormat:@"%@, userData=%p, offset=%lld, size=%lu", 
-       path, userData, offset, (unsigned long)size];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
   }
 
-  if (userData != nil &&
-      [userData respondsToSelector:@selector(readToBuffer:size:offset:error:)]) {
-    return [userData readToBuffer:buffer size:size offset:offset error:error];
-  } else if ([[internal_ delegate] respondsToSelector:@selector(readFileAtPath:userData:buffer:size:offset:error:)]) {
-    return [[internal_ delegate] readFileAtPath:path
-                                       userData:userData
-                                         buffer:buffer
-                                           size:size
-                                         offset:offset
-                                          error:error];
-  }
-  *error = [GMUserFileSystem errorWithCode:EACCES];
-  return -1;
-}
+  UInt16 flags = 0;
 
-- (int)writeFileAtPath:(NSString *)path 
-              userData:(id)userData
-                buffer:(const char *)buffer
-                  size:(size_t)size 
-                offset:(off_t)offset
-                 error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = 
-      [NSString stringWithFormat:@"%@, userData=%p, offset=%lld, size=%lu", 
-       path, userData, offset, (unsigned long)size];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  // If a directory icon, we'll make invisible and update the path to parent.
+  if ([self isDirectoryIconAtPath:path dirPath:&path]) {
+    flags |= kIsInvisible;
   }
 
-  if (userData != nil &&
-      [userData respondsToSelector:@selector(writeFromBuffer:size:offset:error:)]) {
-    return [userData writeFromBuffer:buffer size:size offset:offset error:error];
-  } else if ([[internal_ delegate] respondsToSelector:@selector(writeFileAtPath:userData:buffer:size:offset:error:)]) {
-    return [[internal_ delegate] writeFileAtPath:path
-                                        userData:userData
-                                          buffer:buffer
-                                            size:size
-                                          offset:offset
-                                           error:error];
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateFinderAttributes)) {
+    NSError* error = nil;
+    NSDictionary* dict = [delegate finderAttributesAtPath:path error:&error];
+    if (dict != nil) {
+      if ([dict objectForKey:kGMUserFileSystemCustomIconDataKey]) {
+        // They have custom icon data, so make sure the FinderFlags bit is set.
+        flags |= kHasCustomIcon;
+      }
+      if (flags != 0) {
+        // May need to update kGMUserFileSystemFinderFlagsKey if different.
+        NSNumber* finderFlags = [dict objectForKey:kGMUserFileSystemFinderFlagsKey];
+        if (finderFlags != nil) {
+          UInt16 tmp = (UInt16)[finderFlags longValue];
+          if (flags == tmp) {
+            return dict;  // They already have our desired flags.
+          }          
+          flags |= tmp;
+        }
+        // Doh! We need to create a new dict with the updated flags key.
+        NSMutableDictionary* newDict = 
+          [NSMutableDictionary dictionaryWithDictionary:dict];
+        [newDict setObject:[NSNumber numberWithLong:flags] 
+                    forKey:kGMUserFileSystemFinderFlagsKey];
+        return newDict;
+      }
+      return dict;
+    }
+    // Fall through and create dictionary based on flags if necessary.
   }
-  *error = [GMUserFileSystem errorWithCode:EACCES];
-  return -1; 
-}
-
-- (BOOL)truncateFileAtPath:(NSString *)path
-                  userData:(id)userData
-                    offset:(off_t)offset 
-                     error:(NSError **)error
-                   handled:(BOOL*)handled {
-  if (userData != nil &&
-      [userData respondsToSelector:@selector(truncateToOffset:error:)]) {
-    *handled = YES;
-    return [userData truncateToOffset:offset error:error];
+  if (flags != 0) {
+    return [NSDictionary dictionaryWithObject:[NSNumber numberWithLong:flags]
+                                       forKey:kGMUserFileSystemFinderFlagsKey];
   }
-  *handled = NO;
-  return NO;
+  return nil;
 }
 
-- (BOOL)supportsAllocateFileAtPath {
+- (NSDictionary *)resourceAttributesAtPath:(NSString *)path {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }
+  
   id delegate = [internal_ delegate];
-  return [delegate respondsToSelector:@selector(preallocateFileAtPath:userData:options:offset:length:error:)];
+  if (GMDelegateImplements(internal_, kGMDelegateResourceAttributes)) {
+    NSError* error = nil;
+    return [delegate resourceAttributesAtPath:path error:&error];
+  }
+  return nil;
 }
 
-- (BOOL)allocateFileAtPath:(NSString *)path
-                  userData:(id)userData
-                   options:(int)options
-                    offset:(off_t)offset
-                    length:(off_t)length
-                     error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = 
-      [NSString stringWithFormat:@"%@, userData=%p, options=%d, offset=%lld, length=%lld",
-       path, userData, options, offset, length];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+- (BOOL)hasCustomIconAtPath:(NSString *)path {
+  if ([path isEqualToString:@"/"]) {
+    return NO;  // For a volume icon they should use the volicon= option.
   }
-  
-  if ([self supportsAllocateFileAtPath]) {
-    if ((options & PREALLOCATE) == PREALLOCATE) {
-      if ([[internal_ delegate] respondsToSelector:@selector(preallocateFileAtPath:userData:options:offset:length:error:)]) {
-        return [[internal_ delegate] preallocateFileAtPath:path
-                                                  userData:userData
-                                                   options:options
-                                                    offset:offset
-                                                    length:length
-                                                     error:error];
-      }
+  NSDictionary* finderAttribs = [self finderAttributesAtPath:path];
+  if (finderAttribs) {
+    NSNumber* finderFlags = 
+      [finderAttribs objectForKey:kGMUserFileSystemFinderFlagsKey];
+    if (finderFlags) {
+      UInt16 flags = (UInt16)[finderFlags longValue];
+      return (flags & kHasCustomIcon) == kHasCustomIcon;
     }
-    *error = [GMUserFileSystem errorWithCode:ENOTSUP];
-    return NO;
   }
-  *error = [GMUserFileSystem errorWithCode:ENOSYS];
   return NO;
 }
 
-- (BOOL)supportsExchangeData {
-  id delegate = [internal_ delegate];
-  return [delegate respondsToSelector:@selector(exchangeDataOfItemAtPath:withItemAtPath:error:)];
-}
-
-- (BOOL)exchangeDataOfItemAtPath:(NSString *)path1
-                  withItemAtPath:(NSString *)path2
-                           error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = [NSString stringWithFormat:@"%@ <-> %@", path1, path2];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+- (BOOL)isDirectoryIconAtPath:(NSString *)path dirPath:(NSString **)dirPath {
+  NSString* name = [path lastPathComponent];
+  if ([name isEqualToString:@"Icon\r"]) {
+    if (dirPath) {
+      *dirPath = [path stringByDeletingLastPathComponent];
+    }
+    return YES;
   }
-
-  if ([[internal_ delegate] respondsToSelector:@selector(exchangeDataOfItemAtPath:withItemAtPath:error:)]) {
-    return [[internal_ delegate] exchangeDataOfItemAtPath:path1
-                                           withItemAtPath:path2
-                                                    error:error];
-  }  
-  *error = [GMUserFileSystem errorWithCode:ENOSYS];
   return NO;
 }
 
-#pragma mark Getting and Setting Attributes
-
-- (NSDictionary *)attributesOfFileSystemForPath:(NSString *)path
-                                          error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
-  }  
-
-  NSMutableDictionary* attributes = [NSMutableDictionary dictionary];
-
-  NSNumber* defaultSize = [NSNumber numberWithLongLong:(2LL * 1024 * 1024 * 1024)];
-  [attributes setObject:defaultSize forKey:NSFileSystemSize];
-  [attributes setObject:defaultSize forKey:NSFileSystemFreeSize];
-  [attributes setObject:defaultSize forKey:NSFileSystemNodes];
-  [attributes setObject:defaultSize forKey:NSFileSystemFreeNodes];
-  [attributes setObject:[NSNumber numberWithInt:255] forKey:kGMUserFileSystemVolumeMaxFilenameLengthKey];
-  [attributes setObject:[NSNumber numberWithInt:4096] forKey:kGMUserFileSystemVolumeFileSystemBlockSizeKey];
-
-  NSNumber* supports = nil;
-
-  supports = [NSNumber numberWithBool:[self supportsExchangeData]];
-  [attributes setObject:supports forKey:kGMUserFileSystemVolumeSupportsExchangeDataKey];
+// If the given attribs dictionary contains any FinderInfo attributes then 
+// returns NSData for FinderInfo; otherwise returns nil.
+- (NSData *)finderDataForAttributes:(NSDictionary *)attribs {
+  if (!attribs) { 
+    return nil;
+  }
 
-  supports = [NSNumber numberWithBool:[self supportsAllocateFileAtPath]];
-  [attributes setObject:supports forKey:kGMUserFileSystemVolumeSupportsAllocateKey];
+  GMFinderInfo* info = [GMFinderInfo finderInfo];
+  BOOL attributeFound = NO;  // Have we found at least one relevant attribute?
 
-  // The delegate can override any of the above defaults by implementing the
-  // attributesOfFileSystemForPath selector and returning a custom dictionary.
-  if ([[internal_ delegate] respondsToSelector:@selector(attributesOfFileSystemForPath:error:)]) {
-    *error = nil;
-    NSDictionary* customAttribs = 
-      [[internal_ delegate] attributesOfFileSystemForPath:path error:error];    
-    if (!customAttribs) {
-      if (!(*error)) {
-        *error = [GMUserFileSystem errorWithCode:ENODEV];
-      }
-      return nil;
-    }
-    [attributes addEntriesFromDictionary:customAttribs];
+  NSNumber* flags = [attribs objectForKey:kGMUserFileSystemFinderFlagsKey];
+  if (flags) {
+    attributeFound = YES;
+    [info setFlags:(UInt16)[flags longValue]];
   }
-  return attributes;
-}
-
-- (BOOL)setAttributes:(NSDictionary *)attributes
-   ofFileSystemAtPath:(NSString *)path
-                error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = 
-      [NSString stringWithFormat:@"%@, attributes=%@", path, attributes];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  
+  NSNumber* extendedFlags = 
+    [attribs objectForKey:kGMUserFileSystemFinderExtendedFlagsKey];
+  if (extendedFlags) {
+    attributeFound = YES;
+    [info setExtendedFlags:(UInt16)[extendedFlags longValue]];
+  }
+  
+  NSNumber* typeCode = [attribs objectForKey:NSFileHFSTypeCode];
+  if (typeCode) {
+    attributeFound = YES;
+    [info setTypeCode:(OSType)[typeCode longValue]];
   }
 
-  if ([[internal_ delegate] respondsToSelector:@selector(setAttributes:ofFileSystemAtPath:error:)]) {
-    return [[internal_ delegate] setAttributes:attributes ofFileSystemAtPath:path error:error];
+  NSNumber* creatorCode = [attribs objectForKey:NSFileHFSCreatorCode];
+  if (creatorCode) {
+    attributeFound = YES;
+    [info setCreatorCode:(OSType)[creatorCode longValue]];
   }
-  *error = [GMUserFileSystem errorWithCode:ENOSYS];
-  return NO;
-}
 
-- (BOOL)supportsAttributesOfItemAtPath {
-  id delegate = [internal_ delegate];
-  return [delegate respondsToSelector:@selector(attributesOfItemAtPath:userData:error:)];
+  return attributeFound ? [info data] : nil;
 }
 
-- (NSDictionary *)attributesOfItemAtPath:(NSString *)path
-                                userData:userData
-                                   error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo =
-      [NSString stringWithFormat:@"%@, userData=%p", path, userData];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+// If the given attribs dictionary contains any ResourceFork attributes then 
+// returns the ResourceFork; otherwise returns nil.
+- (GMResourceFork *)resourceForkForAttributes:(NSDictionary *)attribs {
+  if (!attribs) {
+    return nil;
   }
 
-  id delegate = [internal_ delegate];
-  if ([delegate respondsToSelector:@selector(attributesOfItemAtPath:userData:error:)]) {
-    return [delegate attributesOfItemAtPath:path userData:userData error:error];
-  }
-  return nil;
+  GMResourceFork* fork = [GMResourceFork resourceFork];
+  BOOL attributeFound = NO;  // Have we found at least one relevant attribute?
+  
+  NSData* imageData = [attribs objectForKey:kGMUserFileSystemCustomIconDataKey];
+  if (imageData) {
+    attributeFound = YES;
+    [fork addResourceWithType:'icns'
+                        resID:kCustomIconResource // -16455
+                         name:nil
+                         data:imageData];    
+  }
+  NSURL* url = [attribs objectForKey:kGMUserFileSystemWeblocURLKey];
+  if (url) {
+    attributeFound = YES;
+    NSString* urlString = [url absoluteString];
+    NSData* data = [urlString dataUsingEncoding:NSUTF8StringEncoding];
+    [fork addResourceWithType:'url '
+                        resID:256
+                         name:nil
+                         data:data];
+  }
+  return attributeFound ? fork : nil;
 }
 
-// Get attributesOfItemAtPath from the delegate with default values.
-- (NSDictionary *)defaultAttributesOfItemAtPath:(NSString *)path 
-                                       userData:userData
-                                          error:(NSError **)error {
-  // Set up default item attributes.
-  NSMutableDictionary* attributes = [NSMutableDictionary dictionary];
-  BOOL isReadOnly = [internal_ isReadOnly];
-  [attributes setObject:[NSNumber numberWithLong:(isReadOnly ? 0555 : 0775)]
-                 forKey:NSFilePosixPermissions];
-  [attributes setObject:[NSNumber numberWithLong:1]
-                 forKey:NSFileReferenceCount];    // 1 means "don't know"
-  if ([path isEqualToString:@"/"]) {
-    [attributes setObject:NSFileTypeDirectory forKey:NSFileType];
-  } else {
-    [attributes setObject:NSFileTypeRegular forKey:NSFileType];
+- (NSData *)finderDataAtPath:(NSString *)path {
+  NSDictionary* attributes = [self finderAttributesAtPath:path];
+  if (!attributes) {
+    return nil;
   }
-  
-  id delegate = [internal_ delegate];
-  BOOL isDirectoryIcon = NO;
+  GMCache* cache = [internal_ resourcesCache];
+  GMItemResources* resources = [cache objectForKey:path];
+  if ([resources hasFinderDataForAttributes:attributes]) {
+    return [resources finderData];
+  }
+  NSData* data = [self finderDataForAttributes:attributes];
+  if (cache) {
+    if (!resources) {
+      resources = [[[GMItemResources alloc] init] autorelease];
+    }
+    resources = [resources itemResourcesBySettingFinderData:data
+                                              forAttributes:attributes];
+    [cache setObject:resources forKey:path cost:[resources cost]];
+  }
+  return data;
+}
 
-  // The delegate can override any of the above defaults by implementing the
-  // attributesOfItemAtPath: selector and returning a custom dictionary.
-  NSDictionary* customAttribs = nil;
-  BOOL supportsAttributesSelector = [self supportsAttributesOfItemAtPath];
-  if (supportsAttributesSelector) {
-    customAttribs = [self attributesOfItemAtPath:path 
-                                        userData:userData
-                                           error:error];
+- (GMResourceFork *)resourceForkAtPath:(NSString *)path {
+  NSDictionary* attributes = [self resourceAttributesAtPath:path];
+  if (!attributes) {
+    return nil;
   }
-  
-  // Maybe this is the root directory?  If so, we'll claim it always exists.
-  if (!customAttribs && [path isEqualToString:@"/"]) {
-    return attributes;  // The root directory always exists.
+  GMCache* cache = [internal_ resourcesCache];
+  GMItemResources* resources = [cache objectForKey:path];
+  if ([resources hasResourceForkForAttributes:attributes]) {
+    return [resources resourceFork];
+  }
+  GMResourceFork* fork = [self resourceForkForAttributes:attributes];
+  // Lay the fork out before it is shared; reading it is thread-safe after that.
+  [fork length];
+  if (cache) {
+    if (!resources) {
+      resources = [[[GMItemResources alloc] init] autorelease];
+    }
+    resources = [resources itemResourcesBySettingResourceFork:fork
+                                                forAttributes:attributes];
+    [cache setObject:resources forKey:path cost:[resources cost]];
   }
-  
-  // Maybe check to see if this is a special file that we should handle. If they
-  // wanted to handle it, then they would have given us back customAttribs.
-  if (!customAttribs && [internal_ shouldCheckForResource]) {
-    // If the maybe-fixed-up path is a directoryIcon, we'll modify the path to
-    // refer to the parent directory and note that we are a directory icon.
-    isDirectoryIcon = [self isDirectoryIconAtPath:path dirPath:&path];
-    
-    // Maybe we'll try again to get custom attribs on the real path.
-    if (supportsAttributesSelector && isDirectoryIcon) {
-      customAttribs = [self attributesOfItemAtPath:path 
-                                          userData:userData
-                                             error:error];
+  return fork;
+}
+
+#pragma mark Internal Stat Operations
+
+- (BOOL)fillStatfsBuffer:(struct statfs *)stbuf
+                 forPath:(NSString *)path
+                   error:(NSError **)error {
+  GMCache* cache = [internal_ fileSystemAttributesCache];
+  if (cache) {
+    NSData* cached = [cache objectForKey:kFileSystemAttributesCacheKey];
+    if (cached) {
+      [cached getBytes:stbuf length:sizeof(struct statfs)];
+      return YES;
     }
   }
+
+  NSDictionary* attributes = [self attributesOfFileSystemForPath:path error:error];
+  if (!attributes) {
+    return NO;
+  }
   
-  if (customAttribs) {
-    [attributes addEntriesFromDictionary:customAttribs];
-  } else if (supportsAttributesSelector) {
-    // They explicitly support attributesOfItemAtPath: and returned nil.
-    if (!(*error)) {
-      *error = [GMUserFileSystem errorWithCode:ENOENT];
+  // Block size
+  NSNumber* blocksize = [attributes objectForKey:kGMUserFileSystemVolumeFileSystemBlockSizeKey];
+  assert(blocksize);
+  stbuf->f_bsize = (uint32_t)[blocksize unsignedIntValue];
+  stbuf->f_iosize = (int32_t)[blocksize intValue];
+  
+  // Size in blocks
+  NSNumber* size = [attributes objectForKey:NSFileSystemSize];
+  assert(size);
+  stbuf->f_blocks = (uint64_t)([size unsignedLongLongValue] / stbuf->f_bsize);
+  
+  // Number of free / available blocks
+  NSNumber* freeSize = [attributes objectForKey:NSFileSystemFreeSize];
+  assert(freeSize);
+  stbuf->f_bavail = stbuf->f_bfree =
+    (uint64_t)([freeSize unsignedLongLongValue] / stbuf->f_bsize);
+  
+  // Number of nodes
+  NSNumber* numNodes = [attributes objectForKey:NSFileSystemNodes];
+  assert(numNodes);
+  stbuf->f_files = (uint64_t)[numNodes unsignedLongLongValue];
+  
+  // Number of free / available nodes
+  NSNumber* freeNodes = [attributes objectForKey:NSFileSystemFreeNodes];
+  assert(freeNodes);
+  stbuf->f_ffree = (uint64_t)[freeNodes unsignedLongLongValue];
+
+  if (cache) {
+    [cache setObject:[NSData dataWithBytes:stbuf length:sizeof(struct statfs)]
+              forKey:kFileSystemAttributesCacheKey
+                cost:sizeof(struct statfs)];
+  }
+  return YES;
+}
+
+static NSDate* dateWithTimespec(const struct timespec* spec) {
+  const NSTimeInterval time_ns = spec->tv_nsec;
+  const NSTimeInterval time_sec = spec->tv_sec + (time_ns / kNanoSecondsPerSecond);
+  return [NSDate dateWithTimeIntervalSince1970:time_sec];
+}
+
+// Fills stbuf using attributes in the same way as fillStatBuffer:withAttributes:
+// does using an attribute dictionary, but keeps times in nanoseconds.
+static BOOL fillStatBufferWithItemAttributes(struct stat* stbuf,
+                                             const GMItemAttributes* attributes,
+                                             NSError** error) {
+  UInt32 valid = attributes->valid;
+
+  // Inode
+  if (valid & kGMItemAttributeInode) {
+    stbuf->st_ino = attributes->inode;
+  }
+
+  // Permissions (mode)
+  mode_t type = (valid & kGMItemAttributeType) ? attributes->type : 0;
+  if (type != S_IFDIR && type != S_IFREG && type != S_IFLNK) {
+    *error = [GMUserFileSystem errorWithCode:EFTYPE];
+    return NO;
+  }
+  stbuf->st_mode = type;
+  if (valid & kGMItemAttributePermissions) {
+    stbuf->st_mode |= attributes->permissions & ~S_IFMT;
+  }
+
+  // Owner and Group
+  stbuf->st_uid = (valid & kGMItemAttributeOwner) ? attributes->uid : geteuid();
+  stbuf->st_gid = (valid & kGMItemAttributeGroup) ? attributes->gid : getegid();
+
+  // nlink
+  if (valid & kGMItemAttributeLinkCount) {
+    stbuf->st_nlink = attributes->linkCount;
+  }
+
+  // flags
+  if (valid & kGMItemAttributeFlags) {
+    stbuf->st_flags = attributes->flags;
+  }
+
+  // Note: We default atime, ctime to mtime if it is provided.
+  if (valid & kGMItemAttributeModificationTime) {
+    stbuf->st_mtimespec = attributes->modificationTime;
+    stbuf->st_atimespec = stbuf->st_mtimespec;  // Default to mtime
+    stbuf->st_ctimespec = stbuf->st_mtimespec;  // Default to mtime
+  }
+  if (valid & kGMItemAttributeAccessTime) {
+    stbuf->st_atimespec = attributes->accessTime;
+  }
+  if (valid & kGMItemAttributeChangeTime) {
+    stbuf->st_ctimespec = attributes->changeTime;
+  }
+#ifdef _DARWIN_USE_64_BIT_INODE
+  if (valid & kGMItemAttributeCreationTime) {
+    stbuf->st_birthtimespec = attributes->creationTime;
+  }
+#endif
+
+  // File size
+  if (valid & kGMItemAttributeSize) {
+    stbuf->st_size = attributes->size;
+  }
+
+  // Number of 512 byte blocks
+  if (valid & kGMItemAttributeSizeInBlocks) {
+    stbuf->st_blocks = attributes->sizeInBlocks;
+  } else if (stbuf->st_size > 0) {
+    stbuf->st_blocks = stbuf->st_size / 512;
+    if (stbuf->st_size % 512) {
+      ++(stbuf->st_blocks);
     }
-    return nil;
+  }
+
+  // Optimal file I/O size
+  if (valid & kGMItemAttributeOptimalIOSize) {
+    stbuf->st_blksize = attributes->optimalIOSize;
+  }
+  return YES;
+}
+
+- (BOOL)fillStatBuffer:(struct stat *)stbuf 
+               forPath:(NSString *)path 
+              userData:(id)userData
+                 error:(NSError **)error {
+  GMCache* cache = [internal_ itemAttributesCache];
+  if (cache) {
+    NSData* cached = [cache objectForKey:path];
+    if (cached) {
+      [cached getBytes:stbuf length:sizeof(struct stat)];
+      return YES;
+    }
+  }
+  GMCache* negativeCache = [internal_ negativeLookupCache];
+  if (negativeCache && [negativeCache objectForKey:path]) {
+    *error = [GMUserFileSystem errorWithCode:ENOENT];
+    return NO;
+  }
+  GMMetadataSnapshot* snapshot = [internal_ metadataSnapshot];
+  if ([snapshot getStat:stbuf forPath:path]) {
+    [cache setObject:[NSData dataWithBytes:stbuf length:sizeof(struct stat)]
+              forKey:path
+                cost:sizeof(struct stat)];
+    return YES;
+  }
+
+  BOOL exists;
+  if ([self supportsItemAttributes]) {
+    GMItemAttributes attributes;
+    exists = [self getDefaultItemAttributes:&attributes
+                               ofItemAtPath:path
+                                   userData:userData
+                                      error:error];
+    if (exists && !fillStatBufferWithItemAttributes(stbuf, &attributes, error)) {
+      return NO;
+    }
+  } else {
+    NSDictionary* attributes = [self defaultAttributesOfItemAtPath:path 
+                                                          userData:userData
+                                                             error:error];
+    exists = (attributes != nil);
+    if (exists && ![self fillStatBuffer:stbuf withAttributes:attributes error:error]) {
+      return NO;
+    }
+  }
+  if (!exists) {
+    if (negativeCache && *error &&
+        [[*error domain] isEqualToString:NSPOSIXErrorDomain] &&
+        [*error code] == ENOENT) {
+      [negativeCache setObject:[NSNull null]
+                        forKey:path
+                          cost:[path length]];
+    }
+    return NO;
+  }
+
+  if (cache) {
+    [cache setObject:[NSData dataWithBytes:stbuf length:sizeof(struct stat)]
+              forKey:path
+                cost:sizeof(struct stat)];
+  }
+  [snapshot setStat:stbuf forPath:path];
+  return YES;
+}
+
+// Fills stbuf using attributes of the item at path that the delegate returned
+// as part of another operation, e.g. a directory listing, and seeds the item
+// attributes cache with the result.
+- (BOOL)fillStatBuffer:(struct stat *)stbuf
+               forPath:(NSString *)path
+    withItemAttributes:(NSDictionary *)itemAttributes
+                 error:(NSError **)error {
+  NSDictionary* attributes = [self attributesOfItemAtPath:path
+                                       withItemAttributes:itemAttributes
+                                                    error:error];
+  if (!attributes ||
+      ![self fillStatBuffer:stbuf withAttributes:attributes error:error]) {
+    return NO;
+  }
+
+  GMCache* cache = [internal_ itemAttributesCache];
+  if (cache) {
+    [cache setObject:[NSData dataWithBytes:stbuf length:sizeof(struct stat)]
+              forKey:path
+                cost:sizeof(struct stat)];
+  }
+  [[internal_ negativeLookupCache] removeObjectForKey:path];
+  [[internal_ metadataSnapshot] setStat:stbuf forPath:path];
+  return YES;
+}
+
+// Returns YES if the size of an item with itemAttributes would have to be
+// computed using contentsAtPath: or sizeOfItemAtPath:error:.
+- (BOOL)needsSizeForItemAttributes:(NSDictionary *)itemAttributes {
+  if ([itemAttributes objectForKey:NSFileSize] ||
+      [[itemAttributes objectForKey:NSFileType] isEqualToString:NSFileTypeDirectory]) {
+    return NO;
+  }
+  return GMDelegateImplements(internal_, kGMDelegateContents) ||
+         [self supportsFileContentsBlocks];
+}
+
+// Fills stbuf for an entry of a directory listing using the attributes listed
+// with it. Rather than computing the size of every listed file, entries whose
+// attributes leave out the size only get their type and inode number, and are
+// not cached; their size is left to the items that are actually looked up.
+- (BOOL)fillStatBuffer:(struct stat *)stbuf
+    forDirectoryEntryAtPath:(NSString *)path
+         withItemAttributes:(NSDictionary *)itemAttributes
+                      error:(NSError **)error {
+  if (![self needsSizeForItemAttributes:itemAttributes]) {
+    return [self fillStatBuffer:stbuf
+                        forPath:path
+             withItemAttributes:itemAttributes
+                          error:error];
+  }
+  NSString* fileType = [itemAttributes objectForKey:NSFileType];
+  if (!fileType || [fileType isEqualToString:NSFileTypeRegular]) {
+    stbuf->st_mode = S_IFREG;
+  } else if ([fileType isEqualToString:NSFileTypeSymbolicLink]) {
+    stbuf->st_mode = S_IFLNK;
+  } else {
+    *error = [GMUserFileSystem errorWithCode:EFTYPE];
+    return NO;
+  }
+  NSNumber* inode = [itemAttributes objectForKey:NSFileSystemFileNumber];
+  if (inode) {
+    stbuf->st_ino = [inode longLongValue];
+  }
+  return YES;
+}
+
+- (BOOL)fillStatBuffer:(struct stat *)stbuf
+        withAttributes:(NSDictionary *)attributes
+                 error:(NSError **)error {
+  // Inode
+  NSNumber* inode = [attributes objectForKey:NSFileSystemFileNumber];
+  if (inode) {
+    stbuf->st_ino = [inode longLongValue];
   }
   
-  // If this is a directory Icon\r then it is an empty file and we're done.
-  if (isDirectoryIcon) {
-    if ([self hasCustomIconAtPath:path]) {
-      [attributes setObject:NSFileTypeRegular forKey:NSFileType];
-      [attributes setObject:[NSNumber numberWithLongLong:0] forKey:NSFileSize];
-      return attributes;
+  // Permissions (mode)
+  NSNumber* perm = [attributes objectForKey:NSFilePosixPermissions];
+  stbuf->st_mode = [perm longValue];
+  NSString* fileType = [attributes objectForKey:NSFileType];
+  if ([fileType isEqualToString:NSFileTypeDirectory ]) {
+    stbuf->st_mode |= S_IFDIR;
+  } else if ([fileType isEqualToString:NSFileTypeRegular]) {
+    stbuf->st_mode |= S_IFREG;
+  } else if ([fileType isEqualToString:NSFileTypeSymbolicLink]) {
+    stbuf->st_mode |= S_IFLNK;
+  } else {
+    *error = [GMUserFileSystem errorWithCode:EFTYPE];
+    return NO;
+  }
+  
+  // Owner and Group
+  // Note that if the owner or group IDs are not specified, the effective
+  // user and group IDs for the current process are used as defaults.
+  NSNumber* uid = [attributes objectForKey:NSFileOwnerAccountID];
+  NSNumber* gid = [attributes objectForKey:NSFileGroupOwnerAccountID];
+  stbuf->st_uid = uid ? [uid longValue] : geteuid();
+  stbuf->st_gid = gid ? [gid longValue] : getegid();
+
+  // nlink
+  NSNumber* nlink = [attributes objectForKey:NSFileReferenceCount];
+  stbuf->st_nlink = [nlink longValue];
+
+  // flags
+  NSNumber* flags = [attributes objectForKey:kGMUserFileSystemFileFlagsKey];
+  if (flags) {
+    stbuf->st_flags = [flags longValue];
+  } else {
+    // Just in case they tried to use NSFileImmutable or NSFileAppendOnly
+    NSNumber* immutableFlag = [attributes objectForKey:NSFileImmutable];
+    if (immutableFlag && [immutableFlag boolValue]) {
+      stbuf->st_flags |= UF_IMMUTABLE;
+    }
+    NSNumber* appendFlag = [attributes objectForKey:NSFileAppendOnly];
+    if (appendFlag && [appendFlag boolValue]) {
+      stbuf->st_flags |= UF_APPEND;
+    }
+  }
+
+  // Note: We default atime, ctime to mtime if it is provided.
+  NSDate* mdate = [attributes objectForKey:NSFileModificationDate];
+  if (mdate) {
+    const double seconds_dp = [mdate timeIntervalSince1970];
+    const time_t t_sec = (time_t) seconds_dp;
+    const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
+    const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
+
+    stbuf->st_mtimespec.tv_sec = t_sec;
+    stbuf->st_mtimespec.tv_nsec = t_nsec;
+    stbuf->st_atimespec = stbuf->st_mtimespec;  // Default to mtime
+    stbuf->st_ctimespec = stbuf->st_mtimespec;  // Default to mtime
+  }
+  NSDate* adate = [attributes objectForKey:kGMUserFileSystemFileAccessDateKey];
+  if (adate) {
+    const double seconds_dp = [adate timeIntervalSince1970];
+    const time_t t_sec = (time_t) seconds_dp;
+    const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
+    const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
+    stbuf->st_atimespec.tv_sec = t_sec;
+    stbuf->st_atimespec.tv_nsec = t_nsec;
+  }    
+  NSDate* cdate = [attributes objectForKey:kGMUserFileSystemFileChangeDateKey];
+  if (cdate) {
+    const double seconds_dp = [cdate timeIntervalSince1970];
+    const time_t t_sec = (time_t) seconds_dp;
+    const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
+    const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
+    stbuf->st_ctimespec.tv_sec = t_sec;
+    stbuf->st_ctimespec.tv_nsec = t_nsec;
+  }
+
+#ifdef _DARWIN_USE_64_BIT_INODE
+  NSDate* bdate = [attributes objectForKey:NSFileCreationDate];
+  if (bdate) {
+    const double seconds_dp = [bdate timeIntervalSince1970];
+    const time_t t_sec = (time_t) seconds_dp;
+    const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
+    const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
+    stbuf->st_birthtimespec.tv_sec = t_sec;
+    stbuf->st_birthtimespec.tv_nsec = t_nsec;
+  }
+#endif
+
+  // File size
+  // Note that the actual file size of a directory depends on the internal 
+  // representation of directories in the particular file system. In general
+  // this is not the combined size of the files in that directory.
+  NSNumber* size = [attributes objectForKey:NSFileSize];
+  if (size) {
+    stbuf->st_size = [size longLongValue];
+  }
+
+  // Set the number of blocks used so that Finder will display size on disk 
+  // properly. The man page says that this is in terms of 512 byte blocks.
+  NSNumber* blocks = [attributes objectForKey:kGMUserFileSystemFileSizeInBlocksKey];
+  if (blocks) {
+    stbuf->st_blocks = [blocks longLongValue];
+  } else if (stbuf->st_size > 0) {
+    stbuf->st_blocks = stbuf->st_size / 512;
+    if (stbuf->st_size % 512) {
+      ++(stbuf->st_blocks);
+    }
+  }
+
+  // Optimal file I/O size
+  NSNumber *ioSize = [attributes objectForKey:kGMUserFileSystemFileOptimalIOSizeKey];
+  if (ioSize) {
+    stbuf->st_blksize = [ioSize intValue];
+  }
+  return YES;
+}
+
+#pragma mark Node IDs
+
+- (GMInodeTable *)inodeTable {
+  return [internal_ inodeTable];
+}
+
+- (BOOL)fillStatBuffer:(struct stat *)stbuf
+             forNodeID:(UInt64)nodeID
+              userData:(id)userData
+                 error:(NSError **)error {
+  NSString* path = [[internal_ inodeTable] pathForNodeID:nodeID];
+  if (!path) {
+    *error = [GMUserFileSystem errorWithCode:ENOENT];
+    return NO;
+  }
+
+  id delegate = [internal_ delegate];
+  NSDictionary* customAttribs = nil;
+  if (GMDelegateImplements(internal_, kGMDelegateAttributesOfItemWithNodeID)) {
+    if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+      NSString* traceinfo =
+        [NSString stringWithFormat:@"%@, nodeID=%llu, userData=%p",
+         path, nodeID, userData];
+      OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+    }
+    customAttribs = [delegate attributesOfItemWithNodeID:nodeID
+                                                userData:userData
+                                                   error:error];
+    if (!customAttribs && ![self isImplicitItemAtPath:path]) {
+      if (!(*error)) {
+        *error = [GMUserFileSystem errorWithCode:ENOENT];
+      }
+      return NO;
+    }
+  }
+  if (customAttribs) {
+    NSDictionary* attributes = [self attributesOfItemAtPath:path
+                                         withItemAttributes:customAttribs
+                                                      error:error];
+    if (!attributes ||
+        ![self fillStatBuffer:stbuf withAttributes:attributes error:error]) {
+      return NO;
+    }
+  } else if (![self fillStatBuffer:stbuf
+                           forPath:path
+                          userData:userData
+                             error:error]) {
+    return NO;
+  }
+
+  if (stbuf->st_ino == 0) {
+    stbuf->st_ino = nodeID;
+  }
+  return YES;
+}
+
+- (BOOL)fillEntry:(struct fuse_entry_param *)entry
+          forName:(NSString *)name
+     parentNodeID:(UInt64)parentID
+            error:(NSError **)error {
+  memset(entry, 0, sizeof(struct fuse_entry_param));
+
+  GMInodeTable* inodeTable = [internal_ inodeTable];
+  NSString* path = [inodeTable pathForName:name parentNodeID:parentID];
+  if (!path) {
+    *error = [GMUserFileSystem errorWithCode:ENOENT];
+    return NO;
+  }
+
+  id delegate = [internal_ delegate];
+  NSDictionary* customAttribs = nil;
+  if (GMDelegateImplements(internal_, kGMDelegateAttributesOfItemNamed)) {
+    if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+      NSString* traceinfo =
+        [NSString stringWithFormat:@"%@, parentNodeID=%llu", path, parentID];
+      OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+    }
+    customAttribs = [delegate attributesOfItemNamed:name
+                              inDirectoryWithNodeID:parentID
+                                              error:error];
+    if (!customAttribs && ![self isImplicitItemAtPath:path]) {
+      if (!(*error)) {
+        *error = [GMUserFileSystem errorWithCode:ENOENT];
+      }
+      return NO;
+    }
+  }
+  if (customAttribs) {
+    NSDictionary* attributes = [self attributesOfItemAtPath:path
+                                         withItemAttributes:customAttribs
+                                                      error:error];
+    if (!attributes ||
+        ![self fillStatBuffer:&(entry->attr)
+               withAttributes:attributes
+                        error:error]) {
+      return NO;
+    }
+  } else if (![self fillStatBuffer:&(entry->attr)
+                           forPath:path
+                          userData:nil
+                             error:error]) {
+    return NO;
+  }
+
+  UInt64 nodeID = [inodeTable lookupName:name parentNodeID:parentID];
+  if (nodeID == 0) {
+    // The parent has been forgotten in the meantime.
+    *error = [GMUserFileSystem errorWithCode:ENOENT];
+    return NO;
+  }
+  entry->ino = nodeID;
+  if (entry->attr.st_ino == 0) {
+    entry->attr.st_ino = nodeID;
+  }
+  entry->attr_timeout = kLowLevelAttributeTimeout;
+  entry->entry_timeout = kLowLevelEntryTimeout;
+  return YES;
+}
+
+- (NSArray *)contentsOfDirectoryWithNodeID:(UInt64)nodeID
+                                     error:(NSError **)error {
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateContentsOfDirectoryWithNodeID)) {
+    if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+      NSString* traceinfo = [NSString stringWithFormat:@"nodeID=%llu", nodeID];
+      OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+    }
+    return [delegate contentsOfDirectoryWithNodeID:nodeID error:error];
+  }
+
+  NSString* path = [[internal_ inodeTable] pathForNodeID:nodeID];
+  if (!path) {
+    *error = [GMUserFileSystem errorWithCode:ENOENT];
+    return nil;
+  }
+  return [self contentsOfDirectoryAtPath:path error:error];
+}
+
+- (void)forgetNodeID:(UInt64)nodeID count:(UInt64)count {
+  if (![[internal_ inodeTable] forgetNodeID:nodeID count:count]) {
+    return;
+  }
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateForgetNodeID)) {
+    [delegate forgetNodeID:nodeID];
+  }
+}
+
+#pragma mark Creating an Item
+
+- (BOOL)createDirectoryAtPath:(NSString *)path 
+                   attributes:(NSDictionary *)attributes
+                        error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSMutableString* traceinfo = 
+     [NSMutableString stringWithFormat:@"%@ [%@]", path, attributes]; 
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+  
+  if (GMDelegateImplements(internal_, kGMDelegateCreateDirectory)) {
+    return [[internal_ delegate] createDirectoryAtPath:path attributes:attributes error:error];
+  }
+
+  *error = [GMUserFileSystem errorWithCode:EACCES];
+  return NO;
+}
+
+- (BOOL)createFileAtPath:(NSString *)path 
+              attributes:(NSDictionary *)attributes
+                   flags:(int)flags
+                userData:(id *)userData
+                   error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = [NSString stringWithFormat:@"%@ [%@]", path, attributes]; 
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  BOOL created = NO;
+  if (GMDelegateImplements(internal_, kGMDelegateCreateFile)) {
+    created = [[internal_ delegate] createFileAtPath:path
+                                          attributes:attributes
+                                               flags:flags
+                                            userData:userData
+                                               error:error];
+  } else if (GMDelegateImplements(internal_, kGMDelegateCreateFileDeprecated)) {
+    created = [[internal_ delegate] createFileAtPath:path
+                                          attributes:attributes
+                                            userData:userData
+                                               error:error];
+  } else {
+    *error = [GMUserFileSystem errorWithCode:EACCES];
+  }
+  if (created) {
+    [self applyMemoryLimitsToUserData:*userData];
+  }
+  return created;
+}
+
+// Puts file delegates that keep their contents in memory under the memory
+// limits of the mount.
+- (void)applyMemoryLimitsToUserData:(id)userData {
+  if (![userData isKindOfClass:[GMMutableDataBackedFileDelegate class]]) {
+    return;
+  }
+  GMMutableDataBackedFileDelegate* fileDelegate = userData;
+  if ([fileDelegate memoryLimit] == 0) {
+    [fileDelegate setMemoryLimit:[internal_ fileDataHandleMemoryLimit]];
+  }
+  [fileDelegate setPageStoreBudget:[internal_ fileDataBudget]];
+}
+
+#pragma mark Removing an Item
+
+- (BOOL)removeDirectoryAtPath:(NSString *)path error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }  
+
+  if (GMDelegateImplements(internal_, kGMDelegateRemoveDirectory)) {
+    return [[internal_ delegate] removeDirectoryAtPath:path error:error];
+  }
+  return [self removeItemAtPath:path error:error];
+}
+
+- (BOOL)removeItemAtPath:(NSString *)path error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }  
+
+  if (GMDelegateImplements(internal_, kGMDelegateRemoveItem)) {
+    return [[internal_ delegate] removeItemAtPath:path error:error];
+  }
+
+  *error = [GMUserFileSystem errorWithCode:EACCES];
+  return NO;
+}
+
+#pragma mark Moving an Item
+
+- (BOOL)moveItemAtPath:(NSString *)source 
+                toPath:(NSString *)destination
+                 error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = 
+      [NSString stringWithFormat:@"%@ -> %@", source, destination];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  if (GMDelegateImplements(internal_, kGMDelegateMoveItem)) {
+    return [[internal_ delegate] moveItemAtPath:source toPath:destination error:error];
+  }  
+  
+  *error = [GMUserFileSystem errorWithCode:EACCES];
+  return NO;
+}
+
+#pragma mark Linking an Item
+
+- (BOOL)linkItemAtPath:(NSString *)path
+                toPath:(NSString *)otherPath
+                 error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = [NSString stringWithFormat:@"%@ -> %@", path, otherPath];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  if (GMDelegateImplements(internal_, kGMDelegateLinkItem)) {
+    return [[internal_ delegate] linkItemAtPath:path toPath:otherPath error:error];
+  }  
+
+  *error = [GMUserFileSystem errorWithCode:ENOTSUP];  // Note: error not in man page.
+  return NO;
+}
+
+#pragma mark Symbolic Links
+
+- (BOOL)createSymbolicLinkAtPath:(NSString *)path 
+             withDestinationPath:(NSString *)otherPath
+                           error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = [NSString stringWithFormat:@"%@ -> %@", path, otherPath];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }  
+  
+  if (GMDelegateImplements(internal_, kGMDelegateCreateSymbolicLink)) {
+    return [[internal_ delegate] createSymbolicLinkAtPath:path
+                                      withDestinationPath:otherPath
+                                                    error:error];
+  }
+
+  *error = [GMUserFileSystem errorWithCode:ENOTSUP];  // Note: error not in man page.
+  return NO; 
+}
+
+- (NSString *)destinationOfSymbolicLinkAtPath:(NSString *)path
+                                        error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }
+  
+  GMMetadataSnapshot* snapshot = [internal_ metadataSnapshot];
+  NSString* destination = [snapshot destinationOfSymbolicLinkAtPath:path];
+  if (destination) {
+    return destination;
+  }
+  if (GMDelegateImplements(internal_, kGMDelegateDestinationOfSymbolicLink)) {
+    destination = [[internal_ delegate] destinationOfSymbolicLinkAtPath:path error:error];
+    if (destination) {
+      [snapshot setDestination:destination ofSymbolicLinkAtPath:path];
+    }
+    return destination;
+  }
+
+  *error = [GMUserFileSystem errorWithCode:ENOENT];
+  return nil;
+}
+
+#pragma mark Metadata Snapshot
+
+- (NSString *)metadataGeneration {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(@""));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateMetadataGeneration)) {
+    return [delegate metadataGeneration];
+  }
+  return nil;
+}
+
+- (NSArray *)pathsOfItemsChangedSinceMetadataGeneration:(NSString *)generation
+                                                  error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(generation));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegatePathsOfItemsChanged)) {
+    return [delegate pathsOfItemsChangedSinceMetadataGeneration:generation
+                                                          error:error];
+  }
+  *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  return nil;
+}
+
+#pragma mark Directory Contents
+
+- (NSArray *)contentsOfDirectoryAtPath:(NSString *)path error:(NSError **)error {
+  GMCache* cache = [internal_ directoryContentsCache];
+  if (cache) {
+    NSArray* cached = [cache objectForKey:path];
+    if (cached) {
+      return cached;
+    }
+  }
+  GMMetadataSnapshot* snapshot = [internal_ metadataSnapshot];
+  NSArray* contents = [snapshot contentsOfDirectoryAtPath:path];
+  if (contents) {
+    [cache setObject:contents
+              forKey:path
+                cost:[contents count] * kDirectoryContentsNameCost];
+    return contents;
+  }
+
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }
+
+  IMP contentsOfDirectory =
+    GMDelegateMethodIMP(internal_, kGMDelegateContentsOfDirectory);
+  if (contentsOfDirectory) {
+    contents = ((GMContentsOfDirectoryIMP)contentsOfDirectory)(
+      [internal_ delegate], @selector(contentsOfDirectoryAtPath:error:),
+      path, error);
+  } else if ([path isEqualToString:@"/"]) {
+    contents = [NSArray array];  // Give them an empty root directory for free.
+  }
+  if ((cache || snapshot) && contents) {
+    contents = [[contents copy] autorelease];  // The delegate might mutate it.
+    [cache setObject:contents
+              forKey:path
+                cost:[contents count] * kDirectoryContentsNameCost];
+    [snapshot setContents:contents ofDirectoryAtPath:path];
+  }
+  return contents;
+}
+
+- (BOOL)supportsContentsAndAttributesOfDirectoryAtPath {
+  return GMDelegateImplements(internal_, kGMDelegateContentsAndAttributesOfDirectory);
+}
+
+- (NSDictionary *)contentsAndAttributesOfDirectoryAtPath:(NSString *)path
+                                                   error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateContentsAndAttributesOfDirectory)) {
+    return [delegate contentsAndAttributesOfDirectoryAtPath:path error:error];
+  }
+  *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  return nil;
+}
+
+- (BOOL)supportsDirectoryCursors {
+  return GMDelegateImplements(internal_, kGMDelegateContentsOfDirectoryWithCookie);
+}
+
+- (BOOL)openDirectoryAtPath:(NSString *)path
+                   userData:(id *)userData
+                      error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateOpenDirectory)) {
+    return [delegate openDirectoryAtPath:path userData:userData error:error];
+  }
+  return YES;  // Opening a directory is optional.
+}
+
+- (NSArray *)contentsOfDirectoryAtPath:(NSString *)path
+                              userData:(id)userData
+                                cookie:(UInt64)cookie
+                            nextCookie:(UInt64 *)nextCookie
+                                 error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p, cookie=%llu",
+       path, userData, cookie];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  *nextCookie = cookie;
+  NSArray* contents =
+    [[internal_ delegate] contentsOfDirectoryAtPath:path
+                                           userData:userData
+                                             cookie:cookie
+                                         nextCookie:nextCookie
+                                              error:error];
+  if (!contents && !(*error)) {
+    *error = [GMUserFileSystem errorWithCode:EIO];
+  }
+  return contents;
+}
+
+- (void)releaseDirectoryAtPath:(NSString *)path userData:(id)userData {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p", path, userData];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateReleaseDirectory)) {
+    [delegate releaseDirectoryAtPath:path userData:userData];
+  }
+}
+
+#pragma mark File Contents
+
+// Note: Only call this if the delegate does indeed support this method.
+// Computing the size of a file and every open handle share the cached data, if
+// the file contents cache is enabled.
+- (NSData *)contentsAtPath:(NSString *)path {
+  GMCache* cache = [internal_ fileContentsCache];
+  if (cache) {
+    NSData* cached = [cache objectForKey:path];
+    if (cached) {
+      return cached;
+    }
+  }
+
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }
+
+  id delegate = [internal_ delegate];
+  NSData* data = [delegate contentsAtPath:path];
+  if (cache && data && [data length] <= kFileContentsCacheCostLimit) {
+    data = [[data copy] autorelease];  // The delegate might mutate it.
+    [cache setObject:data forKey:path cost:[data length]];
+  }
+  return data;
+}
+
+- (BOOL)supportsFileContentsBlocks {
+  return GMDelegateImplements(internal_, kGMDelegateSizeOfItem) &&
+         GMDelegateImplements(internal_, kGMDelegateBlock);
+}
+
+- (off_t)sizeOfItemAtPath:(NSString *)path error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateSizeOfItem)) {
+    off_t size = [delegate sizeOfItemAtPath:path error:error];
+    if (size < 0 && *error == nil) {
+      *error = [GMUserFileSystem errorWithCode:ENOENT];
+    }
+    return size;
+  }
+  *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  return -1;
+}
+
+- (NSData *)blockAtPath:(NSString *)path
+                  index:(UInt64)index
+                  error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, index=%llu", path, index];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateBlock)) {
+    return [delegate blockAtPath:path index:index error:error];
+  }
+  *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  return nil;
+}
+
+- (int)readBlocksOfFileAtPath:(NSString *)path
+                     fileSize:(off_t)fileSize
+                       buffer:(char *)buffer
+                         size:(size_t)size
+                       offset:(off_t)offset
+                        error:(NSError **)error {
+  if (offset >= fileSize) {
+    return 0;  // No data to read.
+  }
+  if (offset + size > fileSize) {
+    size = fileSize - offset;
+  }
+
+  GMBlockCache* cache = [internal_ fileBlockCache];
+  NSUInteger blockSize = [internal_ fileContentsBlockSize];
+  size_t bytesRead = 0;
+  while (bytesRead < size) {
+    off_t position = offset + bytesRead;
+    UInt64 index = position / blockSize;
+    NSUInteger blockOffset = position % blockSize;
+    NSData* block = [cache blockForPath:path index:index];
+    if (!block) {
+      block = [self blockAtPath:path index:index error:error];
+      if (!block) {
+        return (bytesRead > 0) ? (int)bytesRead : -1;
+      }
+      [cache setBlock:block forPath:path index:index];
+    }
+    if (blockOffset >= [block length]) {
+      break;  // The file is shorter than expected.
+    }
+    size_t length = MIN(size - bytesRead, [block length] - blockOffset);
+    [block getBytes:buffer + bytesRead range:NSMakeRange(blockOffset, length)];
+    bytesRead += length;
+  }
+  return (int)bytesRead;
+}
+
+- (BOOL)openFileAtPath:(NSString *)path 
+                  mode:(int)mode
+              userData:(id *)userData 
+                 error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = [NSString stringWithFormat:@"%@, mode=0x%x", path, mode];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateContents)) {
+    NSData* data = [self contentsAtPath:path];
+    if (data != nil) {
+      *userData = [GMDataBackedFileDelegate fileDelegateWithData:data];
+      return YES;
+    }
+  } else if ([self supportsFileContentsBlocks]) {
+    off_t size = [self sizeOfItemAtPath:path error:error];
+    if (size >= 0) {
+      *userData =
+        [[[GMBlockBackedFileDelegate alloc] initWithFileSystem:self
+                                                          path:path
+                                                          size:size] autorelease];
+      return YES;
+    }
+  } else if (GMDelegateImplements(internal_, kGMDelegateOpenFile)) {
+    if ([delegate openFileAtPath:path 
+                            mode:mode 
+                        userData:userData 
+                           error:error]) {
+      [self applyMemoryLimitsToUserData:*userData];
+      return YES;  // They handled it.
+    }
+  }
+
+  // Still unable to open the file; maybe it is an Icon\r or AppleDouble?
+  if ([internal_ shouldCheckForResource]) {
+    NSData* data = nil;  // Synthesized data that we provide a file delegate for.
+
+    // Is it an Icon\r file that we handle?
+    if ([self isDirectoryIconAtPath:path dirPath:nil]) {
+      data = [NSData data];  // The Icon\r file is empty.
+    }
+
+    if (data != nil) {
+      if ((mode & O_ACCMODE) == O_RDONLY) {
+        *userData = [GMDataBackedFileDelegate fileDelegateWithData:data];
+      } else {
+        NSMutableData* mutableData = [NSMutableData dataWithData:data];
+        *userData = 
+          [GMMutableDataBackedFileDelegate fileDelegateWithData:mutableData];
+      }
+      return YES;  // Handled by a synthesized file delegate.
+    }
+  }
+  
+  if (*error == nil) {
+    *error = [GMUserFileSystem errorWithCode:ENOENT];
+  }
+  return NO;
+}
+
+- (NSString *)accessPatternOfFileAtPath:(NSString *)path userData:(id)userData {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p", path, userData];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateAccessPattern)) {
+    return [delegate accessPatternOfFileAtPath:path userData:userData];
+  }
+  return kGMUserFileSystemFileAccessPatternNormal;
+}
+
+- (NSString *)contentVersionOfFileAtPath:(NSString *)path userData:(id)userData {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p", path, userData];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateContentVersion)) {
+    return [delegate contentVersionOfFileAtPath:path userData:userData];
+  }
+  return nil;
+}
+
+- (GMFileHandle *)newFileHandleForFileAtPath:(NSString *)path
+                                        mode:(int)mode
+                                    userData:(id)userData {
+  GMFileHandle* handle = [[GMFileHandle alloc] initWithFileSystem:self
+                                                             path:path
+                                                         userData:userData];
+  if (![internal_ usesLowLevelInterface]) {
+    // The inode number of an open file must not change.
+    [handle setNodeID:[[internal_ inodeTable] pinPath:path]];
+  }
+  NSOperationQueue* queue = [internal_ readaheadQueue];
+  NSUInteger writeBackSize = [internal_ writeBackSize];
+  GMDiskBlockCache* diskCache = [internal_ diskBlockCache];
+  if ((!queue && writeBackSize == 0 && !diskCache) ||
+      [self fileDescriptorForFileAtPath:path userData:userData] >= 0) {
+    return handle;  // Reads and writes are cheap already.
+  }
+
+  BOOL readsItself =
+    [userData respondsToSelector:@selector(readToBuffer:size:offset:error:)] ||
+    [userData respondsToSelector:@selector(readDataWithSize:offset:error:)];
+  if (diskCache && !readsItself) {
+    [handle setContentVersion:[self contentVersionOfFileAtPath:path
+                                                      userData:userData]];
+  }
+
+  if (queue && !readsItself) {
+    NSString* pattern = [self accessPatternOfFileAtPath:path userData:userData];
+    if (![pattern isEqualToString:kGMUserFileSystemFileAccessPatternRandom]) {
+      GMReadaheadMode readaheadMode = GMReadaheadModeNormal;
+      if ([pattern isEqualToString:kGMUserFileSystemFileAccessPatternSequential]) {
+        readaheadMode = GMReadaheadModeSequential;
+      } else if ([pattern isEqualToString:kGMUserFileSystemFileAccessPatternWholeFile]) {
+        readaheadMode = GMReadaheadModeWholeFile;
+      }
+      GMReadahead* readahead =
+        [[GMReadahead alloc] initWithSource:handle
+                                      queue:queue
+                                     budget:[internal_ readaheadBudget]
+                                       mode:readaheadMode
+                                  chunkSize:kReadaheadChunkSize
+                                  maxWindow:[internal_ readaheadSize]];
+      [handle setReadahead:readahead];
+      [readahead release];
+    }
+  }
+
+  if (writeBackSize > 0 && (mode & O_ACCMODE) != O_RDONLY &&
+      ![userData respondsToSelector:@selector(writeFromBuffer:size:offset:error:)]) {
+    GMWriteBack* writeBack = [[GMWriteBack alloc] initWithTarget:handle
+                                                         maxSize:writeBackSize
+                                                          maxAge:kWriteBackMaxAge];
+    [handle setWriteBack:writeBack];
+    [writeBack release];
+  }
+
+  if ([handle readahead] || [handle writeBack] || [handle contentVersion]) {
+    [internal_ addFileHandle:handle];
+  }
+  return handle;
+}
+
+- (void)releaseFileHandle:(GMFileHandle *)handle atPath:(NSString *)path {
+  [internal_ setPath:path ofFileHandle:handle];
+  // Errors can no longer be reported; close(2) has returned already.
+  NSError* error = nil;
+  [self flushWriteBackOfFileAtPath:[handle path] handle:handle error:&error];
+  if ([handle readahead]) {
+    [[handle readahead] close];
+  }
+  // The content version may have been reset since, so remove unconditionally.
+  [internal_ removeFileHandle:handle];
+  if ([handle nodeID] != 0) {
+    [[internal_ inodeTable] unpinNodeID:[handle nodeID]];
+  }
+  [self releaseFileAtPath:[handle path] userData:[handle userData]];
+  [handle release];
+}
+
+- (NSArray *)fileHandlesAtPath:(NSString *)path recursive:(BOOL)recursive {
+  return [internal_ fileHandlesAtPath:path recursive:recursive];
+}
+
+- (void)writeBackFilesAtPath:(NSString *)path recursive:(BOOL)recursive {
+  if ([internal_ writeBackSize] == 0 || [internal_ writeBackFileCount] == 0) {
+    return;
+  }
+  NSArray* handles = [self fileHandlesAtPath:path recursive:recursive];
+  for (int i = 0, count = [handles count]; i < count; i++) {
+    GMFileHandle* handle = [handles objectAtIndex:i];
+    GMWriteBack* writeBack = [handle writeBack];
+    if ([writeBack isDirty]) {
+      [writeBack writeBufferedExtents];
+    }
+  }
+}
+
+- (int)readFileAtPath:(NSString *)path
+               handle:(GMFileHandle *)handle
+               buffer:(char *)buffer
+                 size:(size_t)size
+               offset:(off_t)offset
+                error:(NSError **)error {
+  GMReadahead* readahead = [handle readahead];
+  // Reads have to see the writes buffered for the file, by any open file.
+  // Writing them back invalidates the readahead.
+  [self writeBackFilesAtPath:path recursive:NO];
+  if (readahead) {
+    [internal_ setPath:path ofFileHandle:handle];
+    return [readahead readToBuffer:buffer size:size offset:offset error:error];
+  }
+  return [self readDiskCachedFileAtPath:path
+                                 handle:handle
+                                 buffer:buffer
+                                   size:size
+                                 offset:offset
+                                  error:error];
+}
+
+- (int)readDiskCachedFileAtPath:(NSString *)path
+                         handle:(GMFileHandle *)handle
+                         buffer:(char *)buffer
+                           size:(size_t)size
+                         offset:(off_t)offset
+                          error:(NSError **)error {
+  GMDiskBlockCache* cache = [internal_ diskBlockCache];
+  NSString* version = [handle contentVersion];
+  if (!cache || !version) {
+    return [self readFileAtPath:path
+                       userData:[handle userData]
+                   readToBuffer:[handle userDataReadToBuffer]
+                         buffer:buffer
+                           size:size
+                         offset:offset
+                          error:error];
+  }
+
+  NSUInteger blockSize = kDiskBlockCacheBlockSize;
+  size_t bytesRead = 0;
+  while (bytesRead < size) {
+    off_t position = offset + bytesRead;
+    UInt64 index = position / blockSize;
+    NSUInteger blockOffset = position % blockSize;
+    NSData* block = [cache blockForPath:path version:version index:index];
+    if (!block) {
+      // Read the whole block, which is only short at the end of the file.
+      NSMutableData* data = [NSMutableData dataWithLength:blockSize];
+      size_t length = 0;
+      while (length < blockSize) {
+        int ret = [self readFileAtPath:path
+                              userData:[handle userData]
+                          readToBuffer:[handle userDataReadToBuffer]
+                                buffer:(char *)[data mutableBytes] + length
+                                  size:blockSize - length
+                                offset:index * blockSize + length
+                                 error:error];
+        if (ret < 0) {
+          return (bytesRead > 0) ? (int)bytesRead : -1;
+        }
+        if (ret == 0) {
+          break;
+        }
+        length += ret;
+      }
+      [data setLength:length];
+      block = data;
+      if ([version isEqualToString:[handle contentVersion]]) {
+        [cache setBlock:block forPath:path version:version index:index];
+      }  // Otherwise the file has been modified while the block was read.
+    }
+    if (blockOffset >= [block length]) {
+      break;  // End of file.
+    }
+    size_t length = MIN(size - bytesRead, [block length] - blockOffset);
+    [block getBytes:buffer + bytesRead range:NSMakeRange(blockOffset, length)];
+    bytesRead += length;
+    if ([block length] < blockSize) {
+      break;  // End of file.
+    }
+  }
+  return (int)bytesRead;
+}
+
+- (void)releaseFileAtPath:(NSString *)path userData:(id)userData {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p", path, userData];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+  
+  if (userData != nil && 
+      ([userData isKindOfClass:[GMDataBackedFileDelegate class]] ||
+       [userData isKindOfClass:[GMBlockBackedFileDelegate class]])) {
+    return;  // Don't report releaseFileAtPath for internal file.
+  }
+  if (GMDelegateImplements(internal_, kGMDelegateReleaseFile)) {
+    [[internal_ delegate] releaseFileAtPath:path userData:userData];
+  }
+}
+
+- (int)readFileAtPath:(NSString *)path
+             userData:(id)userData
+         readToBuffer:(IMP)readToBuffer
+               buffer:(char *)buffer
+                 size:(size_t)size
+               offset:(off_t)offset
+                error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p, offset=%lld, size=%lu", 
+       path, userData, offset, (unsigned long)size];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  IMP readFile;
+  if (readToBuffer) {
+    return ((GMReadToBufferIMP)readToBuffer)(
+      userData, @selector(readToBuffer:size:offset:error:),
+      buffer, size, offset, error);
+  } else if ((readFile = GMDelegateMethodIMP(internal_, kGMDelegateReadFile))) {
+    return ((GMReadFileIMP)readFile)(
+      [internal_ delegate],
+      @selector(readFileAtPath:userData:buffer:size:offset:error:),
+      path, userData, buffer, size, offset, error);
+  } else if (GMDelegateImplements(internal_, kGMDelegateReadDataFromFile)) {
+    NSData* data = [[internal_ delegate] readDataFromFileAtPath:path
+                                                       userData:userData
+                                                           size:size
+                                                         offset:offset
+                                                          error:error];
+    if (!data) {
+      return -1;
+    }
+    size = MIN(size, [data length]);
+    [data getBytes:buffer length:size];
+    return size;
+  }
+  *error = [GMUserFileSystem errorWithCode:EACCES];
+  return -1;
+}
+
+- (BOOL)supportsReadingDataFromFileWithHandle:(GMFileHandle *)handle {
+  if ([handle userDataReadData]) {
+    return YES;
+  }
+  if ([handle userDataReadToBuffer]) {
+    return NO;  // The userData handles reads itself.
+  }
+  return GMDelegateImplements(internal_, kGMDelegateReadDataFromFile);
+}
+
+- (NSData *)readDataFromFileAtPath:(NSString *)path
+                            handle:(GMFileHandle *)handle
+                              size:(size_t)size
+                            offset:(off_t)offset
+                             error:(NSError **)error {
+  id userData = [handle userData];
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p, offset=%lld, size=%lu",
+       path, userData, offset, (unsigned long)size];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  IMP readData = [handle userDataReadData];
+  if (readData) {
+    return ((GMReadDataIMP)readData)(
+      userData, @selector(readDataWithSize:offset:error:), size, offset, error);
+  } else if (GMDelegateImplements(internal_, kGMDelegateReadDataFromFile)) {
+    return [[internal_ delegate] readDataFromFileAtPath:path
+                                               userData:userData
+                                                   size:size
+                                                 offset:offset
+                                                  error:error];
+  }
+  *error = [GMUserFileSystem errorWithCode:EACCES];
+  return nil;
+}
+
+- (int)fileDescriptorForFileAtPath:(NSString *)path userData:(id)userData {
+  if (userData != nil &&
+      ([userData isKindOfClass:[GMDataBackedFileDelegate class]] ||
+       [userData isKindOfClass:[GMBlockBackedFileDelegate class]])) {
+    return -1;  // Internal file.
+  }
+  if (userData != nil &&
+      [userData isKindOfClass:[GMFileDescriptorBackedFileDelegate class]]) {
+    return [userData fileDescriptor];
+  }
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateFileDescriptor)) {
+    return [delegate fileDescriptorForFileAtPath:path userData:userData];
+  }
+  return -1;
+}
+
+- (int)writeFileAtPath:(NSString *)path
+              userData:(id)userData
+       writeFromBuffer:(IMP)writeFromBuffer
+                buffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = 
+      [NSString stringWithFormat:@"%@, userData=%p, offset=%lld, size=%lu", 
+       path, userData, offset, (unsigned long)size];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  IMP writeFile;
+  if (writeFromBuffer) {
+    return ((GMWriteFromBufferIMP)writeFromBuffer)(
+      userData, @selector(writeFromBuffer:size:offset:error:),
+      buffer, size, offset, error);
+  } else if ((writeFile = GMDelegateMethodIMP(internal_, kGMDelegateWriteFile))) {
+    return ((GMWriteFileIMP)writeFile)(
+      [internal_ delegate],
+      @selector(writeFileAtPath:userData:buffer:size:offset:error:),
+      path, userData, buffer, size, offset, error);
+  }
+  *error = [GMUserFileSystem errorWithCode:EACCES];
+  return -1; 
+}
+
+- (int)writeFileAtPath:(NSString *)path
+                handle:(GMFileHandle *)handle
+                buffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error {
+  GMWriteBack* writeBack = [handle writeBack];
+  if (writeBack) {
+    [internal_ setPath:path ofFileHandle:handle];
+    return [writeBack writeFromBuffer:buffer size:size offset:offset error:error];
+  }
+  return [self writeFileAtPath:path
+                      userData:[handle userData]
+               writeFromBuffer:[handle userDataWriteFromBuffer]
+                        buffer:buffer
+                          size:size
+                        offset:offset
+                         error:error];
+}
+
+- (int)writeFileAtPath:(NSString *)path
+                handle:(GMFileHandle *)handle
+          bufferVector:(struct fuse_bufvec *)buf
+                offset:(off_t)offset
+                 error:(NSError **)error {
+  size_t size = fuse_buf_size(buf);
+
+  // Writes to an open file that buffers writes must not overtake the buffered
+  // ones, so they do not bypass the write-back.
+  int fd = -1;
+  if (![handle writeBack]) {
+    fd = [self fileDescriptorForFileAtPath:path userData:[handle userData]];
+  }
+  if (fd >= 0) {
+    // Copy (or splice) the data straight into the backing file descriptor.
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    dst.buf[0].fd = fd;
+    dst.buf[0].pos = offset;
+    ssize_t res = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+    if (res < 0) {
+      *error = [GMUserFileSystem errorWithCode:(int)-res];
+      return -1;
+    }
+    return (int)res;
+  }
+
+  if (buf->count == 1 && buf->idx == 0 && buf->off == 0 &&
+      !(buf->buf[0].flags & FUSE_BUF_IS_FD)) {
+    // The data is already in a single contiguous buffer.
+    return [self writeFileAtPath:path
+                          handle:handle
+                          buffer:buf->buf[0].mem
+                            size:buf->buf[0].size
+                          offset:offset
+                           error:error];
+  }
+
+  char* mem = malloc(size);
+  if (!mem) {
+    *error = [GMUserFileSystem errorWithCode:ENOMEM];
+    return -1;
+  }
+  int ret = -1;
+  struct fuse_bufvec tmp = FUSE_BUFVEC_INIT(size);
+  tmp.buf[0].mem = mem;
+  ssize_t res = fuse_buf_copy(&tmp, buf, 0);
+  if (res < 0) {
+    *error = [GMUserFileSystem errorWithCode:(int)-res];
+  } else {
+    ret = [self writeFileAtPath:path
+                         handle:handle
+                         buffer:mem
+                           size:res
+                         offset:offset
+                          error:error];
+  }
+  free(mem);
+  return ret;
+}
+
+- (BOOL)truncateFileAtPath:(NSString *)path
+                  userData:(id)userData
+                    offset:(off_t)offset 
+                     error:(NSError **)error
+                   handled:(BOOL*)handled {
+  if (userData != nil &&
+      [userData respondsToSelector:@selector(truncateToOffset:error:)]) {
+    *handled = YES;
+    return [userData truncateToOffset:offset error:error];
+  }
+  *handled = NO;
+  return NO;
+}
+
+// Passes the writes buffered for the open file on to the delegate. Returns NO
+// if any of them failed since the file was last flushed.
+- (BOOL)flushWriteBackOfFileAtPath:(NSString *)path
+                            handle:(GMFileHandle *)handle
+                             error:(NSError **)error {
+  GMWriteBack* writeBack = [handle writeBack];
+  if (!writeBack) {
+    return YES;
+  }
+  [internal_ setPath:path ofFileHandle:handle];
+  return [writeBack flushWithError:error];
+}
+
+- (BOOL)flushFileAtPath:(NSString *)path
+                 handle:(GMFileHandle *)handle
+                  error:(NSError **)error {
+  id userData = [handle userData];
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p", path, userData];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  if (![self flushWriteBackOfFileAtPath:path handle:handle error:error]) {
+    return NO;
+  }
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateFlushFile)) {
+    return [delegate flushFileAtPath:path userData:userData error:error];
+  }
+  return YES;
+}
+
+- (BOOL)synchronizeFileAtPath:(NSString *)path
+                       handle:(GMFileHandle *)handle
+                     dataOnly:(BOOL)dataOnly
+                        error:(NSError **)error {
+  id userData = [handle userData];
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p, dataOnly=%d",
+       path, userData, dataOnly];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  if (![self flushWriteBackOfFileAtPath:path handle:handle error:error]) {
+    return NO;
+  }
+  if (userData != nil &&
+      [userData respondsToSelector:@selector(synchronizeWithError:)]) {
+    return [userData synchronizeWithError:error];
+  }
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateSynchronizeFile)) {
+    return [delegate synchronizeFileAtPath:path
+                                  userData:userData
+                                  dataOnly:dataOnly
+                                     error:error];
+  }
+  return YES;
+}
+
+- (BOOL)supportsAllocateFileAtPath {
+  return GMDelegateImplements(internal_, kGMDelegatePreallocateFile);
+}
+
+- (BOOL)allocateFileAtPath:(NSString *)path
+                  userData:(id)userData
+                   options:(int)options
+                    offset:(off_t)offset
+                    length:(off_t)length
+                     error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = 
+      [NSString stringWithFormat:@"%@, userData=%p, options=%d, offset=%lld, length=%lld",
+       path, userData, options, offset, length];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  [self writeBackFilesAtPath:path recursive:NO];
+  if (userData != nil &&
+      [userData respondsToSelector:@selector(preallocateWithOptions:offset:length:error:)]) {
+    if ((options & PREALLOCATE) == PREALLOCATE) {
+      return [userData preallocateWithOptions:options
+                                       offset:offset
+                                       length:length
+                                        error:error];
+    }
+    *error = [GMUserFileSystem errorWithCode:ENOTSUP];
+    return NO;
+  }
+  
+  if ([self supportsAllocateFileAtPath]) {
+    if ((options & PREALLOCATE) == PREALLOCATE) {
+      if (GMDelegateImplements(internal_, kGMDelegatePreallocateFile)) {
+        return [[internal_ delegate] preallocateFileAtPath:path
+                                                  userData:userData
+                                                   options:options
+                                                    offset:offset
+                                                    length:length
+                                                     error:error];
+      }
+    }
+    *error = [GMUserFileSystem errorWithCode:ENOTSUP];
+    return NO;
+  }
+  *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  return NO;
+}
+
+- (BOOL)supportsExchangeData {
+  return GMDelegateImplements(internal_, kGMDelegateExchangeData);
+}
+
+- (BOOL)exchangeDataOfItemAtPath:(NSString *)path1
+                  withItemAtPath:(NSString *)path2
+                           error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = [NSString stringWithFormat:@"%@ <-> %@", path1, path2];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  if (GMDelegateImplements(internal_, kGMDelegateExchangeData)) {
+    [self writeBackFilesAtPath:path1 recursive:NO];
+    [self writeBackFilesAtPath:path2 recursive:NO];
+    return [[internal_ delegate] exchangeDataOfItemAtPath:path1
+                                           withItemAtPath:path2
+                                                    error:error];
+  }  
+  *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  return NO;
+}
+
+#pragma mark Getting and Setting Attributes
+
+- (NSDictionary *)attributesOfFileSystemForPath:(NSString *)path
+                                          error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }  
+
+  NSMutableDictionary* attributes = [NSMutableDictionary dictionary];
+
+  NSNumber* defaultSize = [NSNumber numberWithLongLong:(2LL * 1024 * 1024 * 1024)];
+  [attributes setObject:defaultSize forKey:NSFileSystemSize];
+  [attributes setObject:defaultSize forKey:NSFileSystemFreeSize];
+  [attributes setObject:defaultSize forKey:NSFileSystemNodes];
+  [attributes setObject:defaultSize forKey:NSFileSystemFreeNodes];
+  [attributes setObject:[NSNumber numberWithInt:255] forKey:kGMUserFileSystemVolumeMaxFilenameLengthKey];
+  [attributes setObject:[NSNumber numberWithInt:4096] forKey:kGMUserFileSystemVolumeFileSystemBlockSizeKey];
+
+  NSNumber* supports = nil;
+
+  supports = [NSNumber numberWithBool:[self supportsExchangeData]];
+  [attributes setObject:supports forKey:kGMUserFileSystemVolumeSupportsExchangeDataKey];
+
+  supports = [NSNumber numberWithBool:[self supportsAllocateFileAtPath]];
+  [attributes setObject:supports forKey:kGMUserFileSystemVolumeSupportsAllocateKey];
+
+  // The delegate can override any of the above defaults by implementing the
+  // attributesOfFileSystemForPath selector and returning a custom dictionary.
+  if (GMDelegateImplements(internal_, kGMDelegateAttributesOfFileSystem)) {
+    *error = nil;
+    NSDictionary* customAttribs = 
+      [[internal_ delegate] attributesOfFileSystemForPath:path error:error];    
+    if (!customAttribs) {
+      if (!(*error)) {
+        *error = [GMUserFileSystem errorWithCode:ENODEV];
+      }
+      return nil;
+    }
+    [attributes addEntriesFromDictionary:customAttribs];
+  }
+  return attributes;
+}
+
+- (BOOL)setAttributes:(NSDictionary *)attributes
+   ofFileSystemAtPath:(NSString *)path
+                error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = 
+      [NSString stringWithFormat:@"%@, attributes=%@", path, attributes];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  if (GMDelegateImplements(internal_, kGMDelegateSetAttributesOfFileSystem)) {
+    return [[internal_ delegate] setAttributes:attributes ofFileSystemAtPath:path error:error];
+  }
+  *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  return NO;
+}
+
+- (BOOL)supportsAttributesOfItemAtPath {
+  return GMDelegateImplements(internal_, kGMDelegateAttributesOfItem);
+}
+
+- (NSDictionary *)attributesOfItemAtPath:(NSString *)path
+                                userData:userData
+                                   error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p", path, userData];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  // The file size has to include the writes buffered for the file.
+  [self writeBackFilesAtPath:path recursive:NO];
+  IMP attributesOfItem =
+    GMDelegateMethodIMP(internal_, kGMDelegateAttributesOfItem);
+  if (attributesOfItem) {
+    return ((GMAttributesOfItemIMP)attributesOfItem)(
+      [internal_ delegate], @selector(attributesOfItemAtPath:userData:error:),
+      path, userData, error);
+  }
+  return nil;
+}
+
+- (BOOL)supportsItemAttributes {
+  return GMDelegateImplements(internal_, kGMDelegateGetItemAttributes);
+}
+
+- (BOOL)getItemAttributes:(GMItemAttributes *)attributes
+             ofItemAtPath:(NSString *)path
+                 userData:(id)userData
+                    error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p", path, userData];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  // The file size has to include the writes buffered for the file.
+  [self writeBackFilesAtPath:path recursive:NO];
+  IMP getItemAttributes =
+    GMDelegateMethodIMP(internal_, kGMDelegateGetItemAttributes);
+  if (getItemAttributes) {
+    return ((GMGetItemAttributesIMP)getItemAttributes)(
+      [internal_ delegate],
+      @selector(getItemAttributes:ofItemAtPath:userData:error:),
+      attributes, path, userData, error);
+  }
+  return NO;
+}
+
+- (BOOL)supportsAttributesOfItemsAtPaths {
+  return GMDelegateImplements(internal_, kGMDelegateAttributesOfItems);
+}
+
+- (NSDictionary *)attributesOfItemsAtPaths:(NSArray *)paths
+                                     error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, count=%lu", [paths objectAtIndex:0],
+       (unsigned long)[paths count]];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateAttributesOfItems)) {
+    return [delegate attributesOfItemsAtPaths:paths error:error];
+  }
+  *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  return nil;
+}
+
+- (void)prefetchAttributesOfItemsNamed:(NSArray *)names
+                     inDirectoryAtPath:(NSString *)path {
+  GMCache* cache = [internal_ itemAttributesCache];
+  if (!cache || ![self supportsAttributesOfItemsAtPaths]) {
+    return;  // There is nowhere to keep the prefetched attributes.
+  }
+
+  // The delegate's attributes of files with buffered writes do not include
+  // them. Those files are left to be looked up individually, which writes the
+  // buffered writes back first, rather than writing back all files here.
+  NSMutableSet* dirtyPaths = nil;
+  if ([internal_ writeBackFileCount] > 0) {
+    dirtyPaths = [NSMutableSet set];
+    NSArray* handles = [self fileHandlesAtPath:path recursive:YES];
+    for (int i = 0, count = [handles count]; i < count; i++) {
+      GMFileHandle* handle = [handles objectAtIndex:i];
+      if ([[handle writeBack] isDirty]) {
+        [dirtyPaths addObject:[handle path]];
+      }
+    }
+  }
+
+  NSMutableArray* paths = [NSMutableArray arrayWithCapacity:[names count]];
+  for (int i = 0, count = [names count]; i < count; i++) {
+    NSString* itemPath =
+      [path stringByAppendingPathComponent:[names objectAtIndex:i]];
+    if (![dirtyPaths containsObject:itemPath]) {
+      [paths addObject:itemPath];
+    }
+  }
+
+  // The first batch is prefetched right away, since it is likely to be looked
+  // up next. The others are left to the prefetch queue, if there is one.
+  NSOperationQueue* queue = [internal_ prefetchQueue];
+  NSUInteger count = [paths count];
+  for (NSUInteger i = 0; i < count; i += kAttributesPrefetchBatchSize) {
+    NSRange range = NSMakeRange(i, MIN(kAttributesPrefetchBatchSize, count - i));
+    NSArray* batch = [paths subarrayWithRange:range];
+    if (i == 0) {
+      [self prefetchAttributesOfItemsAtPaths:batch];
+    } else if (queue) {
+      NSInvocationOperation* operation =
+        [[NSInvocationOperation alloc] initWithTarget:self
+                                             selector:@selector(prefetchAttributesOfItemsAtPaths:)
+                                               object:batch];
+      [queue addOperation:operation];
+      [operation release];
+    } else {
+      break;
+    }
+  }
+}
+
+- (void)prefetchAttributesOfItemsAtPaths:(NSArray *)batch {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMCache* cache = [internal_ itemAttributesCache];
+
+  NSMutableArray* paths = [NSMutableArray arrayWithCapacity:[batch count]];
+  for (int i = 0, count = [batch count]; i < count; i++) {
+    NSString* itemPath = [batch objectAtIndex:i];
+    if (![cache containsObjectForKey:itemPath]) {
+      [paths addObject:itemPath];
+    }
+  }
+  if ([paths count] > 0) {
+    // Batches prefetched on the prefetch queue race with the operations that
+    // modify the items, so results for items invalidated since the batch
+    // started are dropped again.
+    UInt64 invalidationCount = [internal_ beginPrefetch];
+    @try {
+      NSError* error = nil;
+      NSDictionary* attributes = [self attributesOfItemsAtPaths:paths
+                                                          error:&error];
+      NSArray* fetchedPaths = [attributes allKeys];
+      for (int i = 0, count = [fetchedPaths count]; i < count; i++) {
+        NSString* fetchedPath = [fetchedPaths objectAtIndex:i];
+        NSDictionary* itemAttributes = [attributes objectForKey:fetchedPath];
+        if ([self needsSizeForItemAttributes:itemAttributes]) {
+          // Rather than computing the size of every listed item, leave that to
+          // the items that are actually looked up.
+          continue;
+        }
+        struct stat stbuf;
+        memset(&stbuf, 0, sizeof(struct stat));
+        if ([self fillStatBuffer:&stbuf
+                         forPath:fetchedPath
+              withItemAttributes:itemAttributes
+                           error:&error] &&
+            [internal_ isPathInvalidated:fetchedPath sinceCount:invalidationCount]) {
+          // Checked after caching, so that an invalidation cannot slip in
+          // between the check and the cache.
+          [cache removeObjectForKey:fetchedPath];
+          [[internal_ metadataSnapshot] removeEntriesForPath:fetchedPath
+                                                   recursive:NO];
+        }
+      }
+    }
+    @finally {
+      [internal_ endPrefetch];
+    }
+  }
+  [pool release];
+}
+
+// The default item attributes that the delegate's attributes are added to.
+- (NSMutableDictionary *)baseAttributesOfItemAtPath:(NSString *)path {
+  NSMutableDictionary* attributes = [NSMutableDictionary dictionary];
+  BOOL isReadOnly = [internal_ isReadOnly];
+  [attributes setObject:[NSNumber numberWithLong:(isReadOnly ? 0555 : 0775)]
+                 forKey:NSFilePosixPermissions];
+  [attributes setObject:[NSNumber numberWithLong:1]
+                 forKey:NSFileReferenceCount];    // 1 means "don't know"
+  if ([path isEqualToString:@"/"]) {
+    [attributes setObject:NSFileTypeDirectory forKey:NSFileType];
+  } else {
+    [attributes setObject:NSFileTypeRegular forKey:NSFileType];
+  }
+  return attributes;
+}
+
+// Get attributesOfItemAtPath from the delegate with default values.
+- (NSDictionary *)defaultAttributesOfItemAtPath:(NSString *)path 
+                                       userData:userData
+                                          error:(NSError **)error {
+  // Set up default item attributes.
+  NSMutableDictionary* attributes = [self baseAttributesOfItemAtPath:path];
+  
+  id delegate = [internal_ delegate];
+  BOOL isDirectoryIcon = NO;
+
+  // The delegate can override any of the above defaults by implementing the
+  // attributesOfItemAtPath: selector and returning a custom dictionary.
+  NSDictionary* customAttribs = nil;
+  BOOL supportsAttributesSelector = [self supportsAttributesOfItemAtPath];
+  if (supportsAttributesSelector) {
+    customAttribs = [self attributesOfItemAtPath:path 
+                                        userData:userData
+                                           error:error];
+  }
+  
+  // Maybe this is the root directory?  If so, we'll claim it always exists.
+  if (!customAttribs && [path isEqualToString:@"/"]) {
+    return attributes;  // The root directory always exists.
+  }
+  
+  // Maybe check to see if this is a special file that we should handle. If they
+  // wanted to handle it, then they would have given us back customAttribs.
+  if (!customAttribs && [internal_ shouldCheckForResource]) {
+    // If the maybe-fixed-up path is a directoryIcon, we'll modify the path to
+    // refer to the parent directory and note that we are a directory icon.
+    isDirectoryIcon = [self isDirectoryIconAtPath:path dirPath:&path];
+    
+    // Maybe we'll try again to get custom attribs on the real path.
+    if (supportsAttributesSelector && isDirectoryIcon) {
+      customAttribs = [self attributesOfItemAtPath:path 
+                                          userData:userData
+                                             error:error];
+    }
+  }
+  
+  if (customAttribs) {
+    [attributes addEntriesFromDictionary:customAttribs];
+  } else if (supportsAttributesSelector) {
+    // They explicitly support attributesOfItemAtPath: and returned nil.
+    if (!(*error)) {
+      *error = [GMUserFileSystem errorWithCode:ENOENT];
+    }
+    return nil;
+  }
+  
+  // If this is a directory Icon\r then it is an empty file and we're done.
+  if (isDirectoryIcon) {
+    if ([self hasCustomIconAtPath:path]) {
+      [attributes setObject:NSFileTypeRegular forKey:NSFileType];
+      [attributes setObject:[NSNumber numberWithLongLong:0] forKey:NSFileSize];
+      return attributes;
+    }
+    *error = [GMUserFileSystem errorWithCode:ENOENT];
+    return nil;
+  }
+  
+  if (![self addSizeToAttributes:attributes ofItemAtPath:path error:error]) {
+    return nil;
+  }
+  return attributes;
+}
+
+// If they don't supply a size and it is a file then we try to compute it.
+- (BOOL)addSizeToAttributes:(NSMutableDictionary *)attributes
+               ofItemAtPath:(NSString *)path
+                      error:(NSError **)error {
+  if ([attributes objectForKey:NSFileSize] ||
+      [[attributes objectForKey:NSFileType] isEqualToString:NSFileTypeDirectory]) {
+    return YES;
+  }
+  if (GMDelegateImplements(internal_, kGMDelegateContents)) {
+    NSData* data = [self contentsAtPath:path];
+    if (data == nil) {
+      *error = [GMUserFileSystem errorWithCode:ENOENT];
+      return NO;
+    }
+    [attributes setObject:[NSNumber numberWithLongLong:[data length]]
+                   forKey:NSFileSize];
+  } else if ([self supportsFileContentsBlocks]) {
+    off_t size = [self sizeOfItemAtPath:path error:error];
+    if (size < 0) {
+      return NO;
+    }
+    [attributes setObject:[NSNumber numberWithLongLong:size]
+                   forKey:NSFileSize];
+  }
+  return YES;
+}
+
+// Attributes of the item at path that the delegate returned other than by
+// attributesOfItemAtPath:userData:error:, completed with the same defaults.
+- (NSDictionary *)attributesOfItemAtPath:(NSString *)path
+                    withItemAttributes:(NSDictionary *)itemAttributes
+                                 error:(NSError **)error {
+  NSMutableDictionary* attributes = [self baseAttributesOfItemAtPath:path];
+  [attributes addEntriesFromDictionary:itemAttributes];
+  if (![self addSizeToAttributes:attributes ofItemAtPath:path error:error]) {
+    return nil;
+  }
+  return attributes;
+}
+
+// Returns YES if the item at path exists even if the delegate does not know
+// about it, i.e. if it is the root directory or a directory icon.
+- (BOOL)isImplicitItemAtPath:(NSString *)path {
+  return [path isEqualToString:@"/"] ||
+         ([internal_ shouldCheckForResource] &&
+          [self isDirectoryIconAtPath:path dirPath:NULL]);
+}
+
+// The counterpart of baseAttributesOfItemAtPath: for GMItemAttributes.
+- (void)getBaseItemAttributes:(GMItemAttributes *)attributes
+                 ofItemAtPath:(NSString *)path {
+  memset(attributes, 0, sizeof(GMItemAttributes));
+  attributes->valid =
+    kGMItemAttributeType | kGMItemAttributePermissions | kGMItemAttributeLinkCount;
+  attributes->type = [path isEqualToString:@"/"] ? S_IFDIR : S_IFREG;
+  attributes->permissions = [internal_ isReadOnly] ? 0555 : 0775;
+  attributes->linkCount = 1;  // 1 means "don't know"
+}
+
+// The counterpart of defaultAttributesOfItemAtPath:userData:error: for
+// delegates that implement getItemAttributes:ofItemAtPath:userData:error:.
+- (BOOL)getDefaultItemAttributes:(GMItemAttributes *)attributes
+                    ofItemAtPath:(NSString *)path
+                        userData:(id)userData
+                           error:(NSError **)error {
+  [self getBaseItemAttributes:attributes ofItemAtPath:path];
+  BOOL exists = [self getItemAttributes:attributes
+                           ofItemAtPath:path
+                               userData:userData
+                                  error:error];
+
+  // Maybe this is the root directory?  If so, we'll claim it always exists.
+  if (!exists && [path isEqualToString:@"/"]) {
+    [self getBaseItemAttributes:attributes ofItemAtPath:path];
+    return YES;
+  }
+
+  // Maybe this is a directory icon; if so, try again on the real path.
+  BOOL isDirectoryIcon = NO;
+  if (!exists && [internal_ shouldCheckForResource]) {
+    isDirectoryIcon = [self isDirectoryIconAtPath:path dirPath:&path];
+    if (isDirectoryIcon) {
+      [self getBaseItemAttributes:attributes ofItemAtPath:path];
+      exists = [self getItemAttributes:attributes
+                          ofItemAtPath:path
+                              userData:userData
+                                 error:error];
+    }
+  }
+  if (!exists) {
+    if (!(*error)) {
+      *error = [GMUserFileSystem errorWithCode:ENOENT];
+    }
+    return NO;
+  }
+
+  // If this is a directory Icon\r then it is an empty file and we're done.
+  if (isDirectoryIcon) {
+    if ([self hasCustomIconAtPath:path]) {
+      attributes->valid |= kGMItemAttributeType | kGMItemAttributeSize;
+      attributes->type = S_IFREG;
+      attributes->size = 0;
+      return YES;
+    }
+    *error = [GMUserFileSystem errorWithCode:ENOENT];
+    return NO;
+  }
+
+  // If they don't supply a size and it is a file then we try to compute it.
+  if (!(attributes->valid & kGMItemAttributeSize) &&
+      attributes->type != S_IFDIR) {
+    if (GMDelegateImplements(internal_, kGMDelegateContents)) {
+      NSData* data = [self contentsAtPath:path];
+      if (data == nil) {
+        *error = [GMUserFileSystem errorWithCode:ENOENT];
+        return NO;
+      }
+      attributes->size = [data length];
+      attributes->valid |= kGMItemAttributeSize;
+    } else if ([self supportsFileContentsBlocks]) {
+      off_t size = [self sizeOfItemAtPath:path error:error];
+      if (size < 0) {
+        return NO;
+      }
+      attributes->size = size;
+      attributes->valid |= kGMItemAttributeSize;
+    }
+  }
+  return YES;
+}
+
+- (NSDictionary *)extendedTimesOfItemAtPath:(NSString *)path
+                                   userData:(id)userData
+                                      error:(NSError **)error {
+  if ([self supportsItemAttributes]) {
+    GMItemAttributes attributes;
+    [self getBaseItemAttributes:&attributes ofItemAtPath:path];
+    if (![self getItemAttributes:&attributes
+                    ofItemAtPath:path
+                        userData:userData
+                           error:error]) {
+      return nil;
+    }
+    NSMutableDictionary* times = [NSMutableDictionary dictionary];
+    if (attributes.valid & kGMItemAttributeCreationTime) {
+      [times setObject:dateWithTimespec(&attributes.creationTime)
+                forKey:NSFileCreationDate];
+    }
+    if (attributes.valid & kGMItemAttributeBackupTime) {
+      [times setObject:dateWithTimespec(&attributes.backupTime)
+                forKey:kGMUserFileSystemFileBackupDateKey];
+    }
+    return times;
+  }
+  if (![self supportsAttributesOfItemAtPath]) {
+    *error = [GMUserFileSystem errorWithCode:ENOSYS];
+    return nil;
+  }
+  return [self attributesOfItemAtPath:path 
+                             userData:userData
+                                error:error];
+}
+
+- (BOOL)setAttributes:(NSDictionary *)attributes 
+         ofItemAtPath:(NSString *)path
+             userData:(id)userData
+                error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = 
+      [NSString stringWithFormat:@"%@, userData=%p, attributes=%@", 
+       path, userData, attributes];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  [self writeBackFilesAtPath:path recursive:NO];
+  if ([attributes objectForKey:NSFileSize] != nil) {
+    BOOL handled = NO;  // Did they have a delegate method that handles truncation?    
+    NSNumber* offsetNumber = [attributes objectForKey:NSFileSize];
+    off_t offset = [offsetNumber longLongValue];
+    BOOL ret = [self truncateFileAtPath:path 
+                               userData:userData
+                                 offset:offset 
+                                  error:error 
+                                handled:&handled];
+    if (handled && (!ret || [attributes count] == 1)) {
+      // Either the truncate call failed, or we only had NSFileSize, so we are done.
+      return ret;
+    }
+  }
+  
+  if (GMDelegateImplements(internal_, kGMDelegateSetAttributes)) {
+    return [[internal_ delegate] setAttributes:attributes ofItemAtPath:path userData:userData error:error];
+  }
+  *error = [GMUserFileSystem errorWithCode:ENODEV];
+  return NO;
+}
+
+- (BOOL)supportsSetItemAttributes {
+  return GMDelegateImplements(internal_, kGMDelegateSetItemAttributes);
+}
+
+- (BOOL)setItemAttributes:(const GMItemAttributes *)attributes
+             ofItemAtPath:(NSString *)path
+                 userData:(id)userData
+                    error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, userData=%p, valid=0x%x",
+       path, userData, (unsigned int)attributes->valid];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  [self writeBackFilesAtPath:path recursive:NO];
+  if (attributes->valid & kGMItemAttributeSize) {
+    BOOL handled = NO;  // Did they have a delegate method that handles truncation?
+    BOOL ret = [self truncateFileAtPath:path
+                               userData:userData
+                                 offset:attributes->size
+                                  error:error
+                                handled:&handled];
+    if (handled && (!ret || attributes->valid == kGMItemAttributeSize)) {
+      // Either the truncate call failed, or we only had the size, so we are done.
+      return ret;
+    }
+  }
+
+  return [[internal_ delegate] setItemAttributes:attributes
+                                    ofItemAtPath:path
+                                        userData:userData
+                                           error:error];
+}
+
+#pragma mark Extended Attributes
+
+// Returns YES if the extended attributes of items should be fetched all at once
+// rather than one by one.
+- (BOOL)prefersValuesOfExtendedAttributesForMethod:(GMDelegateMethod)method {
+  if (!GMDelegateImplements(internal_, kGMDelegateValuesOfExtendedAttributes)) {
+    return NO;
+  }
+  // Without a cache, fetching all values to answer for one is a waste.
+  return [internal_ extendedAttributesCache] != nil ||
+         !GMDelegateImplements(internal_, method);
+}
+
+- (NSDictionary *)valuesOfExtendedAttributesOfItemAtPath:(NSString *)path
+                                                   error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }
+
+  NSDictionary* values =
+    [[internal_ delegate] valuesOfExtendedAttributesOfItemAtPath:path error:error];
+  GMCache* cache = [internal_ extendedAttributesCache];
+  if (cache && values) {
+    GMExtendedAttributes* attributes =
+      [[GMExtendedAttributes alloc] initWithNames:[values allKeys]
+                                           values:values
+                                         complete:YES];
+    [cache setObject:attributes forKey:path cost:[attributes cost]];
+    [attributes release];
+  }
+  return values;
+}
+
+- (NSArray *)extendedAttributesOfItemAtPath:path error:(NSError **)error {
+  GMCache* cache = [internal_ extendedAttributesCache];
+  GMExtendedAttributes* cached = [cache objectForKey:path];
+  if ([cached names]) {
+    return [cached names];
+  }
+
+  if ([self prefersValuesOfExtendedAttributesForMethod:kGMDelegateExtendedAttributes]) {
+    NSDictionary* values = [self valuesOfExtendedAttributesOfItemAtPath:path
+                                                                  error:error];
+    return values ? [values allKeys] : nil;
+  }
+
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+  }
+
+  if (GMDelegateImplements(internal_, kGMDelegateExtendedAttributes)) {
+    NSArray* names = [[internal_ delegate] extendedAttributesOfItemAtPath:path error:error];
+    if (cache && names) {
+      GMExtendedAttributes* attributes = cached;
+      if (attributes) {
+        attributes = [attributes extendedAttributesBySettingNames:names];
+      } else {
+        attributes = [[[GMExtendedAttributes alloc] initWithNames:names
+                                                           values:nil
+                                                         complete:NO] autorelease];
+      }
+      [cache setObject:attributes forKey:path cost:[attributes cost]];
+    }
+    return names;
+  }
+  *error = [GMUserFileSystem errorWithCode:ENOTSUP];
+  return nil;
+}
+
+// Returns the part of value at position or later, or nil and ERANGE if position
+// is past its end.
+static NSData* extendedAttributeValueAtPosition(NSData* value, off_t position,
+                                                NSError** error) {
+  if (position == 0) {
+    return value;
+  }
+  size_t length = [value length];
+  if (position > length) {
+    *error = [GMUserFileSystem errorWithCode:ERANGE];
+    return nil;
+  }
+  return [value subdataWithRange:NSMakeRange(position, length - position)];
+}
+
+// Returns the value of the extended attribute as provided by the delegate, using
+// and filling the extended attributes cache. Returns nil with a nil error if the
+// item does not have the attribute.
+- (NSData *)delegateValueOfExtendedAttribute:(NSString *)name
+                                ofItemAtPath:(NSString *)path
+                                    position:(off_t)position
+                                       error:(NSError **)error {
+  GMCache* cache = [internal_ extendedAttributesCache];
+  GMExtendedAttributes* cached = [cache objectForKey:path];
+  id value = [cached valueForName:name];
+  if (!value &&
+      [self prefersValuesOfExtendedAttributesForMethod:kGMDelegateValueOfExtendedAttribute]) {
+    NSDictionary* values = [self valuesOfExtendedAttributesOfItemAtPath:path
+                                                                  error:error];
+    if (!values) {
+      return nil;
+    }
+    value = [values objectForKey:name];
+    if (!value) {
+      value = [NSNull null];
+    }
+  }
+  if (value) {
+    if (value == [NSNull null]) {
+      return nil;
+    }
+    return extendedAttributeValueAtPosition(value, position, error);
+  }
+
+  // Values are always fetched all at once if the delegate cannot fetch one.
+  IMP valueOfExtendedAttribute =
+    GMDelegateMethodIMP(internal_, kGMDelegateValueOfExtendedAttribute);
+  NSData* data = ((GMValueOfExtendedAttributeIMP)valueOfExtendedAttribute)(
+    [internal_ delegate],
+    @selector(valueOfExtendedAttribute:ofItemAtPath:position:error:),
+    name, path, position, error);
+  // Only whole values are cached; parts can be served from them.
+  if (cache && position == 0 &&
+      (data || *error == nil || [*error code] == ENOATTR)) {
+    value = data ? (id)[[data copy] autorelease] : (id)[NSNull null];
+    GMExtendedAttributes* attributes = cached;
+    if (attributes) {
+      attributes = [attributes extendedAttributesBySettingValue:value forName:name];
+    } else {
+      attributes =
+        [[[GMExtendedAttributes alloc] initWithNames:nil
+                                              values:[NSDictionary dictionaryWithObject:value
+                                                                                 forKey:name]
+                                            complete:NO] autorelease];
+    }
+    [cache setObject:attributes forKey:path cost:[attributes cost]];
+  }
+  return data;
+}
+
+- (NSData *)valueOfExtendedAttribute:(NSString *)name 
+                        ofItemAtPath:(NSString *)path
+                            position:(off_t)position
+                               error:(NSError **)error {
+  size_t length = 0;
+  return [self valueOfExtendedAttribute:name
+                           ofItemAtPath:path
+                               position:position
+                                   size:SIZE_MAX
+                                 length:&length
+                                  error:error];
+}
+
+- (NSData *)valueOfExtendedAttribute:(NSString *)name
+                        ofItemAtPath:(NSString *)path
+                            position:(off_t)position
+                                size:(size_t)size
+                              length:(size_t *)length
+                               error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = 
+      [NSString stringWithFormat:@"%@, name=%@, position=%lld", path, name, position];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  NSData* data = nil;
+  BOOL xattrSupported = NO;
+  if (GMDelegateImplements(internal_, kGMDelegateValueOfExtendedAttribute) ||
+      GMDelegateImplements(internal_, kGMDelegateValuesOfExtendedAttributes)) {
+    xattrSupported = YES;
+    data = [self delegateValueOfExtendedAttribute:name
+                                     ofItemAtPath:path
+                                         position:position
+                                            error:error];
+  }
+
+  if (!data && [internal_ shouldCheckForResource]) {
+    if ([name isEqualToString:@"com.apple.FinderInfo"]) {
+      data = [self finderDataAtPath:path];
+      if (data != nil) {
+        data = extendedAttributeValueAtPosition(data, position, error);
+      }
+    } else if ([name isEqualToString:@"com.apple.ResourceFork"]) {
+      [self isDirectoryIconAtPath:path dirPath:&path];  // Maybe update path.
+      GMResourceFork* fork = [self resourceForkAtPath:path];
+      if (fork != nil) {
+        // Only copy the part of the fork that is requested.
+        NSUInteger forkLength = [fork length];
+        if (position > forkLength) {
+          *error = [GMUserFileSystem errorWithCode:ERANGE];
+          return nil;
+        }
+        *length = forkLength - position;
+        NSUInteger count = MIN(size, *length);
+        NSMutableData* window = [NSMutableData dataWithLength:count];
+        [fork getBytes:[window mutableBytes]
+                 range:NSMakeRange(position, count)];
+        return window;
+      }
+    }
+  }
+  if (data == nil && *error == nil) {
+    *error = [GMUserFileSystem errorWithCode:xattrSupported ? ENOATTR : ENOTSUP];
+  }
+  *length = [data length];
+  return data;
+}
+
+- (BOOL)setExtendedAttribute:(NSString *)name 
+                ofItemAtPath:(NSString *)path 
+                       value:(NSData *)value
+                    position:(off_t)position
+                     options:(int)options
+                       error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = 
+      [NSString stringWithFormat:@"%@, name=%@, position=%lld, options=0x%x", 
+       path, name, position, options];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateSetExtendedAttribute)) {
+    BOOL ret = [delegate setExtendedAttribute:name
+                                 ofItemAtPath:path
+                                        value:value
+                                     position:position
+                                      options:options
+                                        error:error];
+    [[internal_ extendedAttributesCache] removeObjectForKey:path];
+    return ret;
+  }
+  *error = [GMUserFileSystem errorWithCode:ENOTSUP];
+  return NO;
+}
+
+- (BOOL)removeExtendedAttribute:(NSString *)name
+                   ofItemAtPath:(NSString *)path
+                          error:(NSError **)error {
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = 
+      [NSString stringWithFormat:@"%@, name=%@", path, name];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }  
+  
+  id delegate = [internal_ delegate];
+  if (GMDelegateImplements(internal_, kGMDelegateRemoveExtendedAttribute)) {
+    BOOL ret = [delegate removeExtendedAttribute:name
+                                    ofItemAtPath:path
+                                           error:error];
+    [[internal_ extendedAttributesCache] removeObjectForKey:path];
+    return ret;
+  }  
+  *error = [GMUserFileSystem errorWithCode:ENOTSUP];
+  return NO;  
+}
+
+#pragma mark FUSE Operations
+
+#define SET_CAPABILITY(conn, flag, enable)                                \
+  do {                                                                    \
+    if (enable) {                                                         \
+      (conn)->want |= (flag);                                             \
+    } else {                                                              \
+      (conn)->want &= ~(flag);                                            \
+    }                                                                     \
+  } while (0)
+
+#define MAYBE_USE_ERROR(var, error)                                       \
+  if ((error) != nil &&                                                   \
+      [[(error) domain] isEqualToString:NSPOSIXErrorDomain]) {            \
+    int code = [(error) code];                                            \
+    if (code != 0) {                                                      \
+      (var) = -code;                                                      \
+    }                                                                     \
+  }
+
+// Returns the path for a path argument of the high-level interface. Paths known
+// to the inode table share its string instead of creating a new one.
+static NSString* fusefm_path(GMUserFileSystem* fs, const char* path) {
+  return [[fs inodeTable] pathWithFileSystemRepresentation:path];
+}
+
+// Returns the inode number of the item at path for the high-level interface if
+// the delegate did not supply one. The node IDs of the inode table count up
+// from 1, like the numbers of many file systems, so the high bit is set to keep
+// them apart from the NSFileSystemFileNumber values of other items.
+static ino_t fusefm_inode_number(GMUserFileSystem* fs, NSString* path) {
+  return (ino_t)([[fs inodeTable] registerPath:path] | (1ULL << 63));
+}
+
+static void* fusefm_init(struct fuse_conn_info* conn) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+
+  GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+  [fs retain];
+  @try {
+    [fs fuseInit];
+  }
+  @catch (id exception) { }
+
+  SET_CAPABILITY(conn, FUSE_CAP_ALLOCATE, [fs enableAllocate]);
+  SET_CAPABILITY(conn, FUSE_CAP_XTIMES, [fs enableExtendedTimes]);
+  SET_CAPABILITY(conn, FUSE_CAP_VOL_RENAME, [fs enableSetVolumeName]);
+  SET_CAPABILITY(conn, FUSE_CAP_CASE_INSENSITIVE, ![fs enableCaseSensitiveNames]);
+  SET_CAPABILITY(conn, FUSE_CAP_EXCHANGE_DATA, [fs enableExchangeData]);
+
+  [pool release];
+  return fs;
+}
+
+static void fusefm_destroy(void* private_data) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+
+  GMUserFileSystem* fs = (GMUserFileSystem *)private_data;
+  @try {
+    [fs fuseDestroy];
+  }
+  @catch (id exception) { }
+  [fs release];
+  [pool release];
+}
+
+static int fusefm_mkdir(const char* path, mode_t mode) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EACCES;
+
+  @try {
+    NSError* error = nil;
+    unsigned long perm = mode & ALLPERMS;
+    NSDictionary* attribs = 
+      [NSDictionary dictionaryWithObject:[NSNumber numberWithLong:perm]
+                                  forKey:NSFilePosixPermissions];
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* directoryPath = fusefm_path(fs, path);
+    if ([fs createDirectoryAtPath:directoryPath
+                       attributes:attribs
+                            error:&error]) {
+      ret = 0;  // Success!
+      [fs invalidateCachesForPath:directoryPath recursive:NO];
+      [fs invalidateCachesForParentOfPath:directoryPath];
+      [fs updateDirectoryContentsCacheForItemAtPath:directoryPath exists:YES];
+    } else {
+      if (error != nil) {
+        ret = -[error code];
+      }
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_create(const char* path, mode_t mode, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EACCES;
+
+  @try {
+    NSError* error = nil;
+    id userData = nil;
+    unsigned long perms = mode & ALLPERMS;
+    NSDictionary* attribs =
+      [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedLong:perms]
+                                  forKey:NSFilePosixPermissions];
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* filePath = fusefm_path(fs, path);
+    if ([fs createFileAtPath:filePath
+                  attributes:attribs
+                       flags:fi->flags
+                    userData:&userData
+                       error:&error]) {
+      ret = 0;
+      [fs invalidateCachesForPath:filePath recursive:NO];
+      [fs invalidateCachesForParentOfPath:filePath];
+      [fs updateDirectoryContentsCacheForItemAtPath:filePath exists:YES];
+      fi->fh = (uintptr_t)[fs newFileHandleForFileAtPath:filePath
+                                                    mode:fi->flags
+                                                userData:userData];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_rmdir(const char* path) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EACCES;
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* directoryPath = fusefm_path(fs, path);
+    if ([fs removeDirectoryAtPath:directoryPath error:&error]) {
+      ret = 0;  // Success!
+      [fs invalidateCachesForPath:directoryPath recursive:YES];
+      [fs invalidateCachesForParentOfPath:directoryPath];
+      [fs updateDirectoryContentsCacheForItemAtPath:directoryPath exists:NO];
+      [[fs inodeTable] removePath:directoryPath];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_unlink(const char* path) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EACCES;
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* itemPath = fusefm_path(fs, path);
+    if ([fs removeItemAtPath:itemPath error:&error]) {
+      ret = 0;  // Success!
+      [fs invalidateCachesForPath:itemPath recursive:NO];
+      [fs invalidateCachesForParentOfPath:itemPath];
+      [fs updateDirectoryContentsCacheForItemAtPath:itemPath exists:NO];
+      [[fs inodeTable] removePath:itemPath];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_rename(const char* path, const char* toPath) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EACCES;
+
+  @try {
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* source = fusefm_path(fs, path);
+    NSString* destination = fusefm_path(fs, toPath);
+    NSError* error = nil;
+    if ([fs moveItemAtPath:source toPath:destination error:&error]) {
+      ret = 0;  // Success!
+      [fs invalidateCachesForPath:source recursive:YES];
+      [fs invalidateCachesForParentOfPath:source];
+      [fs updateDirectoryContentsCacheForItemAtPath:source exists:NO];
+      [fs invalidateCachesForPath:destination recursive:YES];
+      [fs invalidateCachesForParentOfPath:destination];
+      [fs updateDirectoryContentsCacheForItemAtPath:destination exists:YES];
+      [[fs inodeTable] movePath:source toPath:destination];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;  
+}
+
+static int fusefm_link(const char* path1, const char* path2) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EACCES;
+  
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* sourcePath = fusefm_path(fs, path1);
+    NSString* linkPath = fusefm_path(fs, path2);
+    if ([fs linkItemAtPath:sourcePath toPath:linkPath error:&error]) {
+      ret = 0;  // Success!
+      [fs invalidateCachesForPath:sourcePath recursive:NO];  // Link count
+      [fs invalidateCachesForPath:linkPath recursive:NO];
+      [fs invalidateCachesForParentOfPath:linkPath];
+      [fs updateDirectoryContentsCacheForItemAtPath:linkPath exists:YES];
+      // A node left for an item that was at linkPath before does not describe
+      // the link.
+      [[fs inodeTable] removePath:linkPath];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_symlink(const char* path1, const char* path2) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EACCES;
+  
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* linkPath = fusefm_path(fs, path2);
+    if ([fs createSymbolicLinkAtPath:linkPath
+                 withDestinationPath:[NSString stringWithUTF8String:path1]
+                       error:&error]) {
+      ret = 0;  // Success!
+      [fs invalidateCachesForPath:linkPath recursive:NO];
+      [fs invalidateCachesForParentOfPath:linkPath];
+      [fs updateDirectoryContentsCacheForItemAtPath:linkPath exists:YES];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_readlink(const char *path, char *buf, size_t size)
+{
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOENT;
+
+  @try {
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* linkPath = fusefm_path(fs, path);
+    NSError* error = nil;
+    NSString *pathContent = [fs destinationOfSymbolicLinkAtPath:linkPath
+                                                          error:&error];
+    if (pathContent != nil) {
+      ret = 0;
+      [pathContent getFileSystemRepresentation:buf maxLength:size];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_opendir(const char* path, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOENT;
+
+  @try {
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    if ([fs supportsDirectoryCursors]) {
+      id userData = nil;
+      NSError* error = nil;
+      NSString* directoryPath = fusefm_path(fs, path);
+      if ([fs openDirectoryAtPath:directoryPath userData:&userData error:&error]) {
+        ret = 0;
+        fi->fh = (uintptr_t)[[GMDirectoryEnumerator alloc] initWithFileSystem:fs
+                                                                        path:directoryPath
+                                                                    userData:userData];
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
+    } else {
+      ret = 0;  // The whole directory is listed by readdir.
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_releasedir(const char* path, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  @try {
+    GMDirectoryEnumerator* enumerator = (GMDirectoryEnumerator *)(uintptr_t)fi->fh;
+    if (enumerator) {
+      GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+      [fs releaseDirectoryAtPath:[enumerator path] userData:[enumerator userData]];
+      [enumerator release];
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return 0;
+}
+
+static int fusefm_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                          off_t offset, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOENT;
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* directoryPath = fusefm_path(fs, path);
+    GMDirectoryEnumerator* enumerator =
+      fi ? (GMDirectoryEnumerator *)(uintptr_t)fi->fh : nil;
+    if (enumerator) {
+      // Entries are passed with their offsets, so FUSE asks for the remaining
+      // entries in another call once its buffer is full.
+      int count = 0;
+      if ([enumerator seekToOffset:offset error:&error]) {
+        NSString* name = nil;
+        while ((name = [enumerator currentNameWithError:&error])) {
+          if (filler(buf, [name UTF8String], NULL, [enumerator position] + 1)) {
+            break;  // Buffer is full.
+          }
+          [enumerator advance];
+          ++count;
+        }
+      }
+      ret = 0;
+      if (error && count == 0) {
+        ret = -EIO;
+        MAYBE_USE_ERROR(ret, error);
+      }
+    } else if ([fs supportsContentsAndAttributesOfDirectoryAtPath]) {
+      NSDictionary* contents =
+        [fs contentsAndAttributesOfDirectoryAtPath:directoryPath error:&error];
+      if (contents) {
+        ret = 0;
+        filler(buf, ".", NULL, 0);
+        filler(buf, "..", NULL, 0);
+        NSArray* names = [contents allKeys];
+        for (int i = 0, count = [names count]; i < count; i++) {
+          NSString* name = [names objectAtIndex:i];
+          NSString* itemPath = [directoryPath stringByAppendingPathComponent:name];
+          NSError* itemError = nil;
+          struct stat stbuf;
+          memset(&stbuf, 0, sizeof(struct stat));
+          BOOL hasStat = [fs fillStatBuffer:&stbuf
+                    forDirectoryEntryAtPath:itemPath
+                         withItemAttributes:[contents objectForKey:name]
+                                      error:&itemError];
+          if (hasStat && stbuf.st_ino == 0) {
+            stbuf.st_ino = fusefm_inode_number(fs, itemPath);
+          }
+          filler(buf, [name UTF8String], (hasStat ? &stbuf : NULL), 0);
+        }
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
+    } else {
+      NSArray *contents = [fs contentsOfDirectoryAtPath:directoryPath
+                                                  error:&error];
+      if (contents) {
+        ret = 0;
+        [fs prefetchAttributesOfItemsNamed:contents inDirectoryAtPath:directoryPath];
+        filler(buf, ".", NULL, 0);
+        filler(buf, "..", NULL, 0);
+        for (int i = 0, count = [contents count]; i < count; i++) {
+          filler(buf, [[contents objectAtIndex:i] UTF8String], NULL, 0);
+        }
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_open(const char *path, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOENT;  // TODO: Default to 0 (success) since a file-system does
+                      // not necessarily need to implement open?
+
+  @try {
+    id userData = nil;
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* filePath = fusefm_path(fs, path);
+    if ([fs openFileAtPath:filePath
+                      mode:fi->flags
+                  userData:&userData
+                     error:&error]) {
+      ret = 0;
+      fi->fh = (uintptr_t)[fs newFileHandleForFileAtPath:filePath
+                                                    mode:fi->flags
+                                                userData:userData];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_release(const char *path, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  @try {
+    GMFileHandle* handle = fusefm_file_handle(fi);
+    if (handle) {
+      GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+      [fs releaseFileHandle:handle atPath:fusefm_path(fs, path)];
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return 0;
+}
+
+static int fusefm_read(const char *path, char *buf, size_t size, off_t offset,
+                       struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EIO;
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    ret = [fs readFileAtPath:fusefm_path(fs, path)
+                      handle:fusefm_file_handle(fi)
+                      buffer:buf
+                        size:size
+                      offset:offset
+                       error:&error];
+    MAYBE_USE_ERROR(ret, error);
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+// Used instead of fusefm_read() by FUSE. Files that are backed by a file
+// descriptor are read from it directly, which lets FUSE splice the data into
+// the reply where the kernel supports it.
+static int fusefm_read_buf(const char* path, struct fuse_bufvec** bufp,
+                           size_t size, off_t offset, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EIO;
+  struct fuse_bufvec* bufv = NULL;
+  char* mem = NULL;
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* filePath = fusefm_path(fs, path);
+    GMFileHandle* handle = fusefm_file_handle(fi);
+    id userData = [handle userData];
+    bufv = malloc(sizeof(struct fuse_bufvec));
+    if (!bufv) {
+      ret = -ENOMEM;
+    } else {
+      int fd = [fs fileDescriptorForFileAtPath:filePath userData:userData];
+      if (fd >= 0) {
+        *bufv = FUSE_BUFVEC_INIT(size);
+        bufv->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        bufv->buf[0].fd = fd;
+        bufv->buf[0].pos = offset;
+        ret = 0;
+      } else if ((mem = malloc(size))) {
+        ret = [fs readFileAtPath:filePath
+                          handle:handle
+                          buffer:mem
+                            size:size
+                          offset:offset
+                           error:&error];
+        MAYBE_USE_ERROR(ret, error);
+        if (ret >= 0) {
+          *bufv = FUSE_BUFVEC_INIT(ret);
+          bufv->buf[0].mem = mem;
+          mem = NULL;  // Freed by FUSE along with bufv.
+          ret = 0;
+        }
+      } else {
+        ret = -ENOMEM;
+      }
+    }
+  }
+  @catch (id exception) { }
+  free(mem);
+  if (ret == 0) {
+    *bufp = bufv;
+  } else {
+    free(bufv);
+  }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_write(const char* path, const char* buf, size_t size, 
+                        off_t offset, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EIO;
+  
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* filePath = fusefm_path(fs, path);
+    ret = [fs writeFileAtPath:filePath
+                       handle:fusefm_file_handle(fi)
+                       buffer:buf
+                         size:size
+                       offset:offset
+                        error:&error];
+    MAYBE_USE_ERROR(ret, error);
+    if (ret > 0) {
+      [fs invalidateCachesForWriteToFileAtPath:filePath
+                                        handle:fusefm_file_handle(fi)];
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+// Used instead of fusefm_write() by FUSE.
+static int fusefm_write_buf(const char* path, struct fuse_bufvec* buf,
+                            off_t offset, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EIO;
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* filePath = fusefm_path(fs, path);
+    ret = [fs writeFileAtPath:filePath
+                       handle:fusefm_file_handle(fi)
+                 bufferVector:buf
+                       offset:offset
+                        error:&error];
+    MAYBE_USE_ERROR(ret, error);
+    if (ret > 0) {
+      [fs invalidateCachesForWriteToFileAtPath:filePath
+                                        handle:fusefm_file_handle(fi)];
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_flush(const char* path, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EIO;
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    if ([fs flushFileAtPath:fusefm_path(fs, path)
+                     handle:fusefm_file_handle(fi)
+                      error:&error]) {
+      ret = 0;
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_fsync(const char* path, int isdatasync,
+                        struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EIO;
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    if ([fs synchronizeFileAtPath:fusefm_path(fs, path)
+                           handle:fusefm_file_handle(fi)
+                         dataOnly:(isdatasync != 0)
+                            error:&error]) {
+      ret = 0;
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_fallocate(const char* path, int mode, off_t offset, off_t length,
+                            struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOSYS;
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* filePath = fusefm_path(fs, path);
+    if ([fs allocateFileAtPath:filePath
+                      userData:fusefm_user_data(fi)
+                       options:mode
+                        offset:offset
+                        length:length
+                         error:&error]) {
+      ret = 0;
+      [fs invalidateCachesForPath:filePath recursive:NO];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_exchange(const char* p1, const char* p2, unsigned long opts) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOSYS;
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* path1 = fusefm_path(fs, p1);
+    NSString* path2 = fusefm_path(fs, p2);
+    if ([fs exchangeDataOfItemAtPath:path1 withItemAtPath:path2 error:&error]) {
+      ret = 0;
+      [fs invalidateCachesForPath:path1 recursive:NO];
+      [fs invalidateCachesForPath:path2 recursive:NO];
+      // The items have swapped their contents, so neither keeps its number.
+      [[fs inodeTable] removePath:path1];
+      [[fs inodeTable] removePath:path2];
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;  
+}
+
+static int fusefm_statfs_x(const char* path, struct statfs* stbuf) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOENT;
+  @try {
+    memset(stbuf, 0, sizeof(struct statfs));
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    if ([fs fillStatfsBuffer:stbuf
+                     forPath:fusefm_path(fs, path)
+                       error:&error]) {
+      ret = 0;
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_setvolname(const char* name) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOSYS;
+  @try {
+    NSError* error = nil;
+    NSDictionary* attribs = 
+      [NSDictionary dictionaryWithObject:[NSString stringWithUTF8String:name]
+                                  forKey:kGMUserFileSystemVolumeNameKey];
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    if ([fs setAttributes:attribs ofFileSystemAtPath:@"/" error:&error]) {
+      ret = 0;
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_fgetattr(const char *path, struct stat *stbuf, 
+                           struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOENT;
+  @try {
+    memset(stbuf, 0, sizeof(struct stat));
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* itemPath = fusefm_path(fs, path);
+    id userData = fusefm_user_data(fi);
+    if ([fs fillStatBuffer:stbuf 
+                   forPath:itemPath
+                  userData:userData
+                     error:&error]) {
+      ret = 0;
+      if (stbuf->st_ino == 0) {
+        stbuf->st_ino = fusefm_inode_number(fs, itemPath);
+      }
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_getattr(const char *path, struct stat *stbuf) {
+  return fusefm_fgetattr(path, stbuf, nil);
+}
+
+static int fusefm_getxtimes(const char* path, struct timespec* bkuptime, 
+                            struct timespec* crtime) {  
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOENT;
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSDictionary* attribs = 
+      [fs extendedTimesOfItemAtPath:fusefm_path(fs, path)
+                           userData:nil  // TODO: Maybe this should support FH?
+                              error:&error];
+    if (attribs) {
+      ret = 0;
+      NSDate* creationDate = [attribs objectForKey:NSFileCreationDate];
+      if (creationDate) {
+        const double seconds_dp = [creationDate timeIntervalSince1970];
+        const time_t t_sec = (time_t) seconds_dp;
+        const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
+        const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
+        crtime->tv_sec = t_sec;
+        crtime->tv_nsec = t_nsec;          
+      } else {
+        memset(crtime, 0, sizeof(struct timespec));
+      }
+      NSDate* backupDate = [attribs objectForKey:kGMUserFileSystemFileBackupDateKey];
+      if (backupDate) {
+        const double seconds_dp = [backupDate timeIntervalSince1970];
+        const time_t t_sec = (time_t) seconds_dp;
+        const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
+        const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
+        bkuptime->tv_sec = t_sec;
+        bkuptime->tv_nsec = t_nsec;
+      } else {
+        memset(bkuptime, 0, sizeof(struct timespec));
+      }
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static NSDictionary* dictionaryWithAttributes(const struct setattr_x* attrs) {
+  NSMutableDictionary* dict = [NSMutableDictionary dictionary];
+  if (SETATTR_WANTS_MODE(attrs)) {
+    unsigned long perm = attrs->mode & ALLPERMS;
+    [dict setObject:[NSNumber numberWithLong:perm] 
+             forKey:NSFilePosixPermissions];    
+  }
+  if (SETATTR_WANTS_UID(attrs)) {
+    [dict setObject:[NSNumber numberWithLong:attrs->uid] 
+             forKey:NSFileOwnerAccountID];
+  }
+  if (SETATTR_WANTS_GID(attrs)) {
+    [dict setObject:[NSNumber numberWithLong:attrs->gid] 
+             forKey:NSFileGroupOwnerAccountID];
+  }
+  if (SETATTR_WANTS_SIZE(attrs)) {
+    [dict setObject:[NSNumber numberWithLongLong:attrs->size]
+             forKey:NSFileSize];
+  }
+  if (SETATTR_WANTS_ACCTIME(attrs)) {
+    [dict setObject:dateWithTimespec(&(attrs->acctime))
+             forKey:kGMUserFileSystemFileAccessDateKey];
+  }
+  if (SETATTR_WANTS_MODTIME(attrs)) {
+    [dict setObject:dateWithTimespec(&(attrs->modtime))
+             forKey:NSFileModificationDate];
+  }
+  if (SETATTR_WANTS_CRTIME(attrs)) {
+    [dict setObject:dateWithTimespec(&(attrs->crtime))
+             forKey:NSFileCreationDate];
+  }
+  if (SETATTR_WANTS_CHGTIME(attrs)) {
+    [dict setObject:dateWithTimespec(&(attrs->chgtime))
+             forKey:kGMUserFileSystemFileChangeDateKey];
+  }
+  if (SETATTR_WANTS_BKUPTIME(attrs)) {
+    [dict setObject:dateWithTimespec(&(attrs->bkuptime))
+             forKey:kGMUserFileSystemFileBackupDateKey];
+  }
+  if (SETATTR_WANTS_FLAGS(attrs)) {
+    [dict setObject:[NSNumber numberWithLong:attrs->flags]
+             forKey:kGMUserFileSystemFileFlagsKey];
+  }
+  return dict;
+}
+
+static void getItemAttributesWithSetattr(GMItemAttributes* attributes,
+                                         const struct setattr_x* attrs) {
+  memset(attributes, 0, sizeof(GMItemAttributes));
+  if (SETATTR_WANTS_MODE(attrs)) {
+    attributes->valid |= kGMItemAttributePermissions;
+    attributes->permissions = attrs->mode & ALLPERMS;
+  }
+  if (SETATTR_WANTS_UID(attrs)) {
+    attributes->valid |= kGMItemAttributeOwner;
+    attributes->uid = attrs->uid;
+  }
+  if (SETATTR_WANTS_GID(attrs)) {
+    attributes->valid |= kGMItemAttributeGroup;
+    attributes->gid = attrs->gid;
+  }
+  if (SETATTR_WANTS_SIZE(attrs)) {
+    attributes->valid |= kGMItemAttributeSize;
+    attributes->size = attrs->size;
+  }
+  if (SETATTR_WANTS_ACCTIME(attrs)) {
+    attributes->valid |= kGMItemAttributeAccessTime;
+    attributes->accessTime = attrs->acctime;
+  }
+  if (SETATTR_WANTS_MODTIME(attrs)) {
+    attributes->valid |= kGMItemAttributeModificationTime;
+    attributes->modificationTime = attrs->modtime;
+  }
+  if (SETATTR_WANTS_CRTIME(attrs)) {
+    attributes->valid |= kGMItemAttributeCreationTime;
+    attributes->creationTime = attrs->crtime;
+  }
+  if (SETATTR_WANTS_CHGTIME(attrs)) {
+    attributes->valid |= kGMItemAttributeChangeTime;
+    attributes->changeTime = attrs->chgtime;
+  }
+  if (SETATTR_WANTS_BKUPTIME(attrs)) {
+    attributes->valid |= kGMItemAttributeBackupTime;
+    attributes->backupTime = attrs->bkuptime;
+  }
+  if (SETATTR_WANTS_FLAGS(attrs)) {
+    attributes->valid |= kGMItemAttributeFlags;
+    attributes->flags = attrs->flags;
+  }
+}
+
+static int fusefm_fsetattr_x(const char* path, struct setattr_x* attrs,
+                             struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = 0;  // Note: Return success by default.
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSString* itemPath = fusefm_path(fs, path);
+    BOOL success;
+    if ([fs supportsSetItemAttributes]) {
+      GMItemAttributes attributes;
+      getItemAttributesWithSetattr(&attributes, attrs);
+      success = [fs setItemAttributes:&attributes
+                         ofItemAtPath:itemPath
+                             userData:fusefm_user_data(fi)
+                                error:&error];
+    } else {
+      success = [fs setAttributes:dictionaryWithAttributes(attrs)
+                     ofItemAtPath:itemPath
+                         userData:fusefm_user_data(fi)
+                            error:&error];
+    }
+    if (success) {
+      ret = 0;
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+    // Note: Attributes may have been partially applied even on failure.
+    [fs invalidateCachesForPath:itemPath recursive:NO];
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_setattr_x(const char* path, struct setattr_x* attrs) {
+  return fusefm_fsetattr_x(path, attrs, nil);
+}
+
+// Returns names as listxattr(2) does: NUL-terminated UTF-8 strings, one after
+// the other, in a buffer that is allocated once.
+static NSData* fusefm_xattr_list(NSArray* names) {
+  NSUInteger length = 0;
+  for (int i = 0, count = [names count]; i < count; i++) {
+    length += [[names objectAtIndex:i] lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + 1;
+  }
+  NSMutableData* data = [NSMutableData dataWithLength:length];
+  char* bytes = [data mutableBytes];
+  for (int i = 0, count = [names count]; i < count; i++) {
+    NSString* name = [names objectAtIndex:i];
+    NSUInteger nameLength = [name lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    [name getCString:bytes maxLength:nameLength + 1 encoding:NSUTF8StringEncoding];
+    bytes += nameLength + 1;
+  }
+  return data;
+}
+
+static int fusefm_listxattr(const char *path, char *list, size_t size)
+{
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOTSUP;
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    NSArray* attributeNames =
+      [fs extendedAttributesOfItemAtPath:fusefm_path(fs, path)
+                                   error:&error];
+    if (attributeNames != nil) {
+      NSData* data = fusefm_xattr_list(attributeNames);
+      ret = [data length];  // default to returning size of buffer.
+      if (list) {
+        if (size > [data length]) {
+          size = [data length];
+        }
+        [data getBytes:list length:size];
+      }
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_getxattr(const char *path, const char *name, char *value,
+                           size_t size, uint32_t position) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOATTR;
+  
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    size_t length = 0;
+    NSData *data = [fs valueOfExtendedAttribute:[NSString stringWithUTF8String:name]
+                                   ofItemAtPath:fusefm_path(fs, path)
+                                       position:position
+                                           size:(value ? size : 0)
+                                         length:&length
+                                          error:&error];
+    if (data != nil) {
+      ret = length;  // default to returning size of buffer.
+      if (value) {
+        if (size > [data length]) {
+          size = [data length];
+        }
+        [data getBytes:value length:size];
+        ret = size;  // bytes read
+      }
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_setxattr(const char *path, const char *name, const char *value,
+                           size_t size, int flags, uint32_t position) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -EPERM;
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    if ([fs setExtendedAttribute:[NSString stringWithUTF8String:name]
+                    ofItemAtPath:fusefm_path(fs, path)
+                           value:[NSData dataWithBytes:value length:size]
+                        position:position
+                         options:flags
+                           error:&error]) {
+      ret = 0;
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static int fusefm_removexattr(const char *path, const char *name) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  int ret = -ENOATTR;
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    if ([fs removeExtendedAttribute:[NSString stringWithUTF8String:name]
+                    ofItemAtPath:fusefm_path(fs, path)
+                           error:&error]) {
+      ret = 0;
+    } else {
+      MAYBE_USE_ERROR(ret, error);
     }
-    *error = [GMUserFileSystem errorWithCode:ENOENT];
-    return nil;
   }
+  @catch (id exception) { }
+  [pool release];
+  return ret;
+}
+
+static struct fuse_operations fusefm_oper = {
+  .init = fusefm_init,
+  .destroy = fusefm_destroy,
   
-  // If they don't supply a size and it is a file then we try to compute it.
-  if (![attributes objectForKey:NSFileSize] &&
-      ![[attributes objectForKey:NSFileType] isEqualToString:NSFileTypeDirectory] &&
-      [delegate respondsToSelector:@selector(contentsAtPath:)]) {
-    NSData* data = [self contentsAtPath:path];
-    if (data == nil) {
-      *error = [GMUserFileSystem errorWithCode:ENOENT];
-      return nil;
-    }
-    [attributes setObject:[NSNumber numberWithLongLong:[data length]]
-                   forKey:NSFileSize];
-  }
+  // Creating an Item
+  .mkdir = fusefm_mkdir,
+  .create = fusefm_create,
   
-  return attributes;
-}
+  // Removing an Item
+  .rmdir = fusefm_rmdir,
+  .unlink = fusefm_unlink,
+  
+  // Moving an Item
+  .rename = fusefm_rename,
+  
+  // Linking an Item
+  .link = fusefm_link,
+  
+  // Symbolic Links
+  .symlink = fusefm_symlink,
+  .readlink = fusefm_readlink,
+  
+  // Directory Contents
+  .opendir = fusefm_opendir,
+  .readdir = fusefm_readdir,
+  .releasedir = fusefm_releasedir,
+  
+  // File Contents
+  .open	= fusefm_open,
+  .release = fusefm_release,
+  .read	= fusefm_read,
+  .read_buf = fusefm_read_buf,
+  .write = fusefm_write,
+  .write_buf = fusefm_write_buf,
+  .flush = fusefm_flush,
+  .fsync = fusefm_fsync,
+  .fallocate = fusefm_fallocate,
+  .exchange = fusefm_exchange,
+  
+  // Getting and Setting Attributes
+  .statfs_x = fusefm_statfs_x,
+  .setvolname = fusefm_setvolname,
+  .getattr = fusefm_getattr,
+  .fgetattr = fusefm_fgetattr,
+  .getxtimes = fusefm_getxtimes,
+  .setattr_x = fusefm_setattr_x,
+  .fsetattr_x = fusefm_fsetattr_x,
+  
+  // Extended Attributes
+  .listxattr = fusefm_listxattr,
+  .getxattr = fusefm_getxattr,
+  .setxattr = fusefm_setxattr,
+  .removexattr = fusefm_removexattr,
+};
 
-- (NSDictionary *)extendedTimesOfItemAtPath:(NSString *)path
-                                   userData:(id)userData
-                                      error:(NSError **)error {
-  if (![self supportsAttributesOfItemAtPath]) {
-    *error = [GMUserFileSystem errorWithCode:ENOSYS];
-    return nil;
+// Leaves out of oper the operations that only do work for delegates with some
+// capability, so that FUSE does not call into the framework for nothing.
+// Operations the framework answers itself, with ENOTSUP or from FinderInfo,
+// resource forks or userData, stay registered.
+static void fusefm_select_oper(GMUserFileSystemInternal* internal,
+                               struct fuse_operations* oper) {
+  if (!GMDelegateImplements(internal, kGMDelegateContentsOfDirectoryWithCookie)) {
+    // Without cursors, readdir lists the whole directory at once.
+    oper->opendir = NULL;
+    oper->releasedir = NULL;
   }
-  return [self attributesOfItemAtPath:path 
-                             userData:userData
-                                error:error];
 }
 
-- (BOOL)setAttributes:(NSDictionary *)attributes 
-         ofItemAtPath:(NSString *)path
-             userData:(id)userData
-                error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = 
-      [NSString stringWithFormat:@"%@, userData=%p, attributes=%@", 
-       path, userData, attributes];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
-  }
+#pragma mark FUSE Low-Level Operations
 
-  if ([attributes objectForKey:NSFileSize] != nil) {
-    BOOL handled = NO;  // Did they have a delegate method that handles truncation?    
-    NSNumber* offsetNumber = [attributes objectForKey:NSFileSize];
-    off_t offset = [offsetNumber longLongValue];
-    BOOL ret = [self truncateFileAtPath:path 
-                               userData:userData
-                                 offset:offset 
-                                  error:error 
-                                handled:&handled];
-    if (handled && (!ret || [attributes count] == 1)) {
-      // Either the truncate call failed, or we only had NSFileSize, so we are done.
-      return ret;
-    }
-  }
-  
-  if ([[internal_ delegate] respondsToSelector:@selector(setAttributes:ofItemAtPath:userData:error:)]) {
-    return [[internal_ delegate] setAttributes:attributes ofItemAtPath:path userData:userData error:error];
-  }
-  *error = [GMUserFileSystem errorWithCode:ENODEV];
-  return NO;
-}
+// Unlike the high-level operations above, which are handed paths by FUSE, the
+// low-level operations are handed node IDs and resolve them using the inode
+// table. Every request must be answered with exactly one fuse_reply_*() call.
 
-#pragma mark Extended Attributes
+// Prepares the current thread for handling req and returns the file system.
+static GMUserFileSystem* fusefm_ll_begin(fuse_req_t req) {
+  setCurrentRequest(req);
+  return (GMUserFileSystem *)fuse_req_userdata(req);
+}
 
-- (NSArray *)extendedAttributesOfItemAtPath:path error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(path));
+// Replies with the error ret unless ret is 0, i.e. a reply has been sent.
+static void fusefm_ll_end(fuse_req_t req, int ret) {
+  setCurrentRequest(NULL);
+  if (ret != 0) {
+    fuse_reply_err(req, -ret);
   }
+}
 
-  if ([[internal_ delegate] respondsToSelector:@selector(extendedAttributesOfItemAtPath:error:)]) {
-    return [[internal_ delegate] extendedAttributesOfItemAtPath:path error:error];
+static void fusefm_ll_reply_entry(fuse_req_t req, GMUserFileSystem* fs,
+                                  const struct fuse_entry_param* e) {
+  if (fuse_reply_entry(req, e) == -ENOENT) {
+    // The request has been interrupted, so the kernel does not know the node.
+    [fs forgetNodeID:e->ino count:1];
   }
-  *error = [GMUserFileSystem errorWithCode:ENOTSUP];
-  return nil;
 }
 
-- (NSData *)valueOfExtendedAttribute:(NSString *)name 
-                        ofItemAtPath:(NSString *)path
-                            position:(off_t)position
-                               error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = 
-      [NSString stringWithFormat:@"%@, name=%@, position=%lld", path, name, position];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
-  }
+// Appends a directory entry to buffer. Only the file type bits of mode are
+// used; if they are zero, the type of the entry is left unknown.
+static void fusefm_ll_add_direntry(fuse_req_t req, NSMutableData* buffer,
+                                   const char* name, ino_t ino, mode_t mode) {
+  struct stat stbuf;
+  memset(&stbuf, 0, sizeof(struct stat));
+  stbuf.st_ino = ino;
+  stbuf.st_mode = mode & S_IFMT;
+
+  size_t oldSize = [buffer length];
+  size_t entrySize = fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+  [buffer increaseLengthBy:entrySize];
+  fuse_add_direntry(req, (char *)[buffer mutableBytes] + oldSize, entrySize,
+                    name, &stbuf, oldSize + entrySize);
+}
 
-  id delegate = [internal_ delegate];
-  NSData* data = nil;
-  BOOL xattrSupported = NO;
-  if ([delegate respondsToSelector:@selector(valueOfExtendedAttribute:ofItemAtPath:position:error:)]) {
-    xattrSupported = YES;
-    data = [delegate valueOfExtendedAttribute:name 
-                                 ofItemAtPath:path 
-                                     position:position 
-                                        error:error];
+static NSDictionary* dictionaryWithStat(const struct stat* attr, int to_set) {
+  NSMutableDictionary* dict = [NSMutableDictionary dictionary];
+  if (to_set & FUSE_SET_ATTR_MODE) {
+    unsigned long perm = attr->st_mode & ALLPERMS;
+    [dict setObject:[NSNumber numberWithLong:perm]
+             forKey:NSFilePosixPermissions];
   }
-
-  if (!data && [internal_ shouldCheckForResource]) {
-    if ([name isEqualToString:@"com.apple.FinderInfo"]) {
-      NSDictionary* finderAttributes = [self finderAttributesAtPath:path];
-      data = [self finderDataForAttributes:finderAttributes];
-    } else if ([name isEqualToString:@"com.apple.ResourceFork"]) {
-      [self isDirectoryIconAtPath:path dirPath:&path];  // Maybe update path.
-      NSDictionary* attributes = [self resourceAttributesAtPath:path];
-      data = [self resourceDataForAttributes:attributes];
-    }
-    if (data != nil && position > 0) {
-      // We have all the data, but they are only requesting a subrange.
-      size_t length = [data length];
-      if (position > length) {
-        *error = [GMUserFileSystem errorWithCode:ERANGE];
-        return nil;
-      }
-      data = [data subdataWithRange:NSMakeRange(position, length - position)];
-    }
+  if (to_set & FUSE_SET_ATTR_UID) {
+    [dict setObject:[NSNumber numberWithLong:attr->st_uid]
+             forKey:NSFileOwnerAccountID];
   }
-  if (data == nil && *error == nil) {
-    *error = [GMUserFileSystem errorWithCode:xattrSupported ? ENOATTR : ENOTSUP];
+  if (to_set & FUSE_SET_ATTR_GID) {
+    [dict setObject:[NSNumber numberWithLong:attr->st_gid]
+             forKey:NSFileGroupOwnerAccountID];
   }
-  return data;
-}
-
-- (BOOL)setExtendedAttribute:(NSString *)name 
-                ofItemAtPath:(NSString *)path 
-                       value:(NSData *)value
-                    position:(off_t)position
-                     options:(int)options
-                       error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = 
-      [NSString stringWithFormat:@"%@, name=%@, position=%lld, options=0x%x", 
-       path, name, position, options];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  if (to_set & FUSE_SET_ATTR_SIZE) {
+    [dict setObject:[NSNumber numberWithLongLong:attr->st_size]
+             forKey:NSFileSize];
   }
-
-  id delegate = [internal_ delegate];
-  if ([delegate respondsToSelector:@selector(setExtendedAttribute:ofItemAtPath:value:position:options:error:)]) {
-    return [delegate setExtendedAttribute:name 
-                             ofItemAtPath:path 
-                                    value:value
-                                 position:position
-                                  options:options
-                                    error:error]; 
+  if (to_set & FUSE_SET_ATTR_ATIME) {
+    [dict setObject:dateWithTimespec(&(attr->st_atimespec))
+             forKey:kGMUserFileSystemFileAccessDateKey];
   }
-  *error = [GMUserFileSystem errorWithCode:ENOTSUP];
-  return NO;
-}
-
-- (BOOL)removeExtendedAttribute:(NSString *)name
-                   ofItemAtPath:(NSString *)path
-                          error:(NSError **)error {
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = 
-      [NSString stringWithFormat:@"%@, name=%@", path, name];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
-  }  
-  
-  id delegate = [internal_ delegate];
-  if ([delegate respondsToSelector:@selector(removeExtendedAttribute:ofItemAtPath:error:)]) {
-    return [delegate removeExtendedAttribute:name 
-                                ofItemAtPath:path 
-                                       error:error];
-  }  
-  *error = [GMUserFileSystem errorWithCode:ENOTSUP];
-  return NO;  
+  if (to_set & FUSE_SET_ATTR_MTIME) {
+    [dict setObject:dateWithTimespec(&(attr->st_mtimespec))
+             forKey:NSFileModificationDate];
+  }
+#ifdef FUSE_SET_ATTR_ATIME_NOW
+  if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+    [dict setObject:[NSDate date] forKey:kGMUserFileSystemFileAccessDateKey];
+  }
+#endif
+#ifdef FUSE_SET_ATTR_MTIME_NOW
+  if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+    [dict setObject:[NSDate date] forKey:NSFileModificationDate];
+  }
+#endif
+#ifdef FUSE_SET_ATTR_CHGTIME
+  if (to_set & FUSE_SET_ATTR_CHGTIME) {
+    [dict setObject:dateWithTimespec(&(attr->st_ctimespec))
+             forKey:kGMUserFileSystemFileChangeDateKey];
+  }
+#endif
+#if defined(FUSE_SET_ATTR_CRTIME) && defined(_DARWIN_USE_64_BIT_INODE)
+  if (to_set & FUSE_SET_ATTR_CRTIME) {
+    [dict setObject:dateWithTimespec(&(attr->st_birthtimespec))
+             forKey:NSFileCreationDate];
+  }
+#endif
+#ifdef FUSE_SET_ATTR_FLAGS
+  if (to_set & FUSE_SET_ATTR_FLAGS) {
+    [dict setObject:[NSNumber numberWithLong:attr->st_flags]
+             forKey:kGMUserFileSystemFileFlagsKey];
+  }
+#endif
+  return dict;
 }
 
-#pragma mark FUSE Operations
-
-#define SET_CAPABILITY(conn, flag, enable)                                \
-  do {                                                                    \
-    if (enable) {                                                         \
-      (conn)->want |= (flag);                                             \
-    } else {                                                              \
-      (conn)->want &= ~(flag);                                            \
-    }                                                                     \
-  } while (0)
-
-#define MAYBE_USE_ERROR(var, error)                                       \
-  if ((error) != nil &&                                                   \
-      [[(error) domain] isEqualToString:NSPOSIXErrorDomain]) {            \
-    int code = [(error) code];                                            \
-    if (code != 0) {                                                      \
-      (var) = -code;                                                      \
-    }                                                                     \
+static void getItemAttributesWithStat(GMItemAttributes* attributes,
+                                      const struct stat* attr, int to_set) {
+  memset(attributes, 0, sizeof(GMItemAttributes));
+  if (to_set & FUSE_SET_ATTR_MODE) {
+    attributes->valid |= kGMItemAttributePermissions;
+    attributes->permissions = attr->st_mode & ALLPERMS;
+  }
+  if (to_set & FUSE_SET_ATTR_UID) {
+    attributes->valid |= kGMItemAttributeOwner;
+    attributes->uid = attr->st_uid;
+  }
+  if (to_set & FUSE_SET_ATTR_GID) {
+    attributes->valid |= kGMItemAttributeGroup;
+    attributes->gid = attr->st_gid;
+  }
+  if (to_set & FUSE_SET_ATTR_SIZE) {
+    attributes->valid |= kGMItemAttributeSize;
+    attributes->size = attr->st_size;
+  }
+  if (to_set & FUSE_SET_ATTR_ATIME) {
+    attributes->valid |= kGMItemAttributeAccessTime;
+    attributes->accessTime = attr->st_atimespec;
+  }
+  if (to_set & FUSE_SET_ATTR_MTIME) {
+    attributes->valid |= kGMItemAttributeModificationTime;
+    attributes->modificationTime = attr->st_mtimespec;
+  }
+#if defined(FUSE_SET_ATTR_ATIME_NOW) || defined(FUSE_SET_ATTR_MTIME_NOW)
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  struct timespec now = { tv.tv_sec, tv.tv_usec * 1000 };
+#endif
+#ifdef FUSE_SET_ATTR_ATIME_NOW
+  if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+    attributes->valid |= kGMItemAttributeAccessTime;
+    attributes->accessTime = now;
+  }
+#endif
+#ifdef FUSE_SET_ATTR_MTIME_NOW
+  if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+    attributes->valid |= kGMItemAttributeModificationTime;
+    attributes->modificationTime = now;
+  }
+#endif
+#ifdef FUSE_SET_ATTR_CHGTIME
+  if (to_set & FUSE_SET_ATTR_CHGTIME) {
+    attributes->valid |= kGMItemAttributeChangeTime;
+    attributes->changeTime = attr->st_ctimespec;
   }
+#endif
+#if defined(FUSE_SET_ATTR_CRTIME) && defined(_DARWIN_USE_64_BIT_INODE)
+  if (to_set & FUSE_SET_ATTR_CRTIME) {
+    attributes->valid |= kGMItemAttributeCreationTime;
+    attributes->creationTime = attr->st_birthtimespec;
+  }
+#endif
+#ifdef FUSE_SET_ATTR_FLAGS
+  if (to_set & FUSE_SET_ATTR_FLAGS) {
+    attributes->valid |= kGMItemAttributeFlags;
+    attributes->flags = attr->st_flags;
+  }
+#endif
+}
 
-static void* fusefm_init(struct fuse_conn_info* conn) {
+static void fusefm_ll_init(void* userdata, struct fuse_conn_info* conn) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
 
-  GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+  GMUserFileSystem* fs = (GMUserFileSystem *)userdata;
   [fs retain];
   @try {
     [fs fuseInit];
   }
   @catch (id exception) { }
 
-  SET_CAPABILITY(conn, FUSE_CAP_ALLOCATE, [fs enableAllocate]);
-  SET_CAPABILITY(conn, FUSE_CAP_XTIMES, [fs enableExtendedTimes]);
-  SET_CAPABILITY(conn, FUSE_CAP_VOL_RENAME, [fs enableSetVolumeName]);
+  // Preallocation, extended times, volume renaming and exchange data are only
+  // supported by the high-level interface.
+  SET_CAPABILITY(conn, FUSE_CAP_ALLOCATE, NO);
+  SET_CAPABILITY(conn, FUSE_CAP_XTIMES, NO);
+  SET_CAPABILITY(conn, FUSE_CAP_VOL_RENAME, NO);
   SET_CAPABILITY(conn, FUSE_CAP_CASE_INSENSITIVE, ![fs enableCaseSensitiveNames]);
-  SET_CAPABILITY(conn, FUSE_CAP_EXCHANGE_DATA, [fs enableExchangeData]);
+  SET_CAPABILITY(conn, FUSE_CAP_EXCHANGE_DATA, NO);
 
   [pool release];
-  return fs;
 }
 
-static void fusefm_destroy(void* private_data) {
+static void fusefm_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
 
-  GMUserFileSystem* fs = (GMUserFileSystem *)private_data;
   @try {
-    [fs fuseDestroy];
+    NSError* error = nil;
+    struct fuse_entry_param e;
+    if ([fs fillEntry:&e
+              forName:[NSString stringWithUTF8String:name]
+         parentNodeID:parent
+                error:&error]) {
+      fusefm_ll_reply_entry(req, fs, &e);
+      ret = 0;
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
   }
   @catch (id exception) { }
-  [fs release];
+  fusefm_ll_end(req, ret);
   [pool release];
 }
 
-static int fusefm_mkdir(const char* path, mode_t mode) {
+static void fusefm_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -EACCES;
-
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
   @try {
-    NSError* error = nil;
-    unsigned long perm = mode & ALLPERMS;
-    NSDictionary* attribs = 
-      [NSDictionary dictionaryWithObject:[NSNumber numberWithLong:perm]
-                                  forKey:NSFilePosixPermissions];
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs createDirectoryAtPath:[NSString stringWithUTF8String:path] 
-                       attributes:attribs
-                            error:&error]) {
-      ret = 0;  // Success!
-    } else {
-      if (error != nil) {
-        ret = -[error code];
-      }
-    }
+    [fs forgetNodeID:ino count:nlookup];
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, 0);
+  fuse_reply_none(req);
   [pool release];
-  return ret;
 }
 
-static int fusefm_create(const char* path, mode_t mode, struct fuse_file_info* fi) {
+static void fusefm_ll_getattr(fuse_req_t req, fuse_ino_t ino,
+                              struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -EACCES;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
 
   @try {
+    struct stat stbuf;
+    memset(&stbuf, 0, sizeof(struct stat));
     NSError* error = nil;
-    id userData = nil;
-    unsigned long perms = mode & ALLPERMS;
-    NSDictionary* attribs =
-      [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedLong:perms]
-                                  forKey:NSFilePosixPermissions];
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs createFileAtPath:[NSString stringWithUTF8String:path]
-                  attributes:attribs
-                       flags:fi->flags
-                    userData:&userData
-                       error:&error]) {
+    id userData = fusefm_user_data(fi);
+    if ([fs fillStatBuffer:&stbuf forNodeID:ino userData:userData error:&error]) {
+      fuse_reply_attr(req, &stbuf, kLowLevelAttributeTimeout);
       ret = 0;
-      if (userData != nil) {
-        [userData retain];
-        fi->fh = (uintptr_t)userData;
-      }
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_rmdir(const char* path) {
+static void fusefm_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr,
+                              int to_set, struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -EACCES;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
 
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs removeDirectoryAtPath:[NSString stringWithUTF8String:path] 
-                            error:&error]) {
-      ret = 0;  // Success!
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* itemPath = [[fs inodeTable] pathForNodeID:ino];
+    if (itemPath) {
+      ret = -EACCES;
+      NSError* error = nil;
+      id userData = fusefm_user_data(fi);
+      BOOL success;
+      if ([fs supportsSetItemAttributes]) {
+        GMItemAttributes attributes;
+        getItemAttributesWithStat(&attributes, attr, to_set);
+        success = [fs setItemAttributes:&attributes
+                           ofItemAtPath:itemPath
+                               userData:userData
+                                  error:&error];
+      } else {
+        success = [fs setAttributes:dictionaryWithStat(attr, to_set)
+                       ofItemAtPath:itemPath
+                           userData:userData
+                              error:&error];
+      }
+      // Note: Attributes may have been partially applied even on failure.
+      [fs invalidateCachesForPath:itemPath recursive:NO];
+      if (success) {
+        struct stat stbuf;
+        memset(&stbuf, 0, sizeof(struct stat));
+        success = [fs fillStatBuffer:&stbuf
+                           forNodeID:ino
+                            userData:userData
+                               error:&error];
+        if (success) {
+          fuse_reply_attr(req, &stbuf, kLowLevelAttributeTimeout);
+          ret = 0;
+        }
+      }
+      if (!success) {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_unlink(const char* path) {
+static void fusefm_ll_readlink(fuse_req_t req, fuse_ino_t ino) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -EACCES;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs removeItemAtPath:[NSString stringWithUTF8String:path] 
-                       error:&error]) {
-      ret = 0;  // Success!
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* linkPath = [[fs inodeTable] pathForNodeID:ino];
+    if (linkPath) {
+      NSError* error = nil;
+      NSString* pathContent = [fs destinationOfSymbolicLinkAtPath:linkPath
+                                                            error:&error];
+      if (pathContent != nil) {
+        fuse_reply_readlink(req, [pathContent fileSystemRepresentation]);
+        ret = 0;
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_rename(const char* path, const char* toPath) {
+static void fusefm_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name,
+                            mode_t mode) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -EACCES;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
 
   @try {
-    NSString* source = [NSString stringWithUTF8String:path];
-    NSString* destination = [NSString stringWithUTF8String:toPath];
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs moveItemAtPath:source toPath:destination error:&error]) {
-      ret = 0;  // Success!
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* itemName = [NSString stringWithUTF8String:name];
+    NSString* directoryPath = [[fs inodeTable] pathForName:itemName
+                                              parentNodeID:parent];
+    if (directoryPath) {
+      ret = -EACCES;
+      NSError* error = nil;
+      unsigned long perm = mode & ALLPERMS;
+      NSDictionary* attribs =
+        [NSDictionary dictionaryWithObject:[NSNumber numberWithLong:perm]
+                                    forKey:NSFilePosixPermissions];
+      if ([fs createDirectoryAtPath:directoryPath
+                         attributes:attribs
+                              error:&error]) {
+        [fs invalidateCachesForPath:directoryPath recursive:NO];
+        [fs invalidateCachesForParentOfPath:directoryPath];
+        [fs updateDirectoryContentsCacheForItemAtPath:directoryPath exists:YES];
+        struct fuse_entry_param e;
+        if ([fs fillEntry:&e forName:itemName parentNodeID:parent error:&error]) {
+          fusefm_ll_reply_entry(req, fs, &e);
+          ret = 0;
+        } else {
+          MAYBE_USE_ERROR(ret, error);
+        }
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;  
 }
 
-static int fusefm_link(const char* path1, const char* path2) {
+static void fusefm_ll_create(fuse_req_t req, fuse_ino_t parent, const char* name,
+                             mode_t mode, struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -EACCES;
-  
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs linkItemAtPath:[NSString stringWithUTF8String:path1]
-                    toPath:[NSString stringWithUTF8String:path2]
-                     error:&error]) {
-      ret = 0;  // Success!
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* itemName = [NSString stringWithUTF8String:name];
+    NSString* filePath = [[fs inodeTable] pathForName:itemName
+                                         parentNodeID:parent];
+    if (filePath) {
+      ret = -EACCES;
+      NSError* error = nil;
+      id userData = nil;
+      unsigned long perms = mode & ALLPERMS;
+      NSDictionary* attribs =
+        [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedLong:perms]
+                                    forKey:NSFilePosixPermissions];
+      if ([fs createFileAtPath:filePath
+                    attributes:attribs
+                         flags:fi->flags
+                      userData:&userData
+                         error:&error]) {
+        [fs invalidateCachesForPath:filePath recursive:NO];
+        [fs invalidateCachesForParentOfPath:filePath];
+        [fs updateDirectoryContentsCacheForItemAtPath:filePath exists:YES];
+        struct fuse_entry_param e;
+        if ([fs fillEntry:&e forName:itemName parentNodeID:parent error:&error]) {
+          GMFileHandle* handle = [fs newFileHandleForFileAtPath:filePath
+                                                          mode:fi->flags
+                                                      userData:userData];
+          fi->fh = (uintptr_t)handle;
+          if (fuse_reply_create(req, &e, fi) == -ENOENT) {
+            // The request has been interrupted, so nobody will release the file.
+            [fs releaseFileHandle:handle atPath:filePath];
+            [fs forgetNodeID:e.ino count:1];
+          }
+          ret = 0;
+        } else {
+          [fs releaseFileAtPath:filePath userData:userData];
+          MAYBE_USE_ERROR(ret, error);
+        }
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_symlink(const char* path1, const char* path2) {
+static void fusefm_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -EACCES;
-  
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs createSymbolicLinkAtPath:[NSString stringWithUTF8String:path2]
-                 withDestinationPath:[NSString stringWithUTF8String:path1]
-                       error:&error]) {
-      ret = 0;  // Success!
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* itemName = [NSString stringWithUTF8String:name];
+    NSString* directoryPath = [[fs inodeTable] pathForName:itemName
+                                              parentNodeID:parent];
+    if (directoryPath) {
+      ret = -EACCES;
+      NSError* error = nil;
+      if ([fs removeDirectoryAtPath:directoryPath error:&error]) {
+        [fs invalidateCachesForPath:directoryPath recursive:YES];
+        [fs invalidateCachesForParentOfPath:directoryPath];
+        [fs updateDirectoryContentsCacheForItemAtPath:directoryPath exists:NO];
+        [[fs inodeTable] removeName:itemName parentNodeID:parent];
+        fuse_reply_err(req, 0);
+        ret = 0;
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_readlink(const char *path, char *buf, size_t size)
-{
+static void fusefm_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
   int ret = -ENOENT;
 
   @try {
-    NSString* linkPath = [NSString stringWithUTF8String:path];
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    NSString *pathContent = [fs destinationOfSymbolicLinkAtPath:linkPath
-                                                          error:&error];
-    if (pathContent != nil) {
-      ret = 0;
-      [pathContent getFileSystemRepresentation:buf maxLength:size];
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* itemName = [NSString stringWithUTF8String:name];
+    NSString* itemPath = [[fs inodeTable] pathForName:itemName
+                                         parentNodeID:parent];
+    if (itemPath) {
+      ret = -EACCES;
+      NSError* error = nil;
+      if ([fs removeItemAtPath:itemPath error:&error]) {
+        [fs invalidateCachesForPath:itemPath recursive:NO];
+        [fs invalidateCachesForParentOfPath:itemPath];
+        [fs updateDirectoryContentsCacheForItemAtPath:itemPath exists:NO];
+        [[fs inodeTable] removeName:itemName parentNodeID:parent];
+        fuse_reply_err(req, 0);
+        ret = 0;
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                          off_t offset, struct fuse_file_info* fi) {
+static void fusefm_ll_rename(fuse_req_t req, fuse_ino_t parent, const char* name,
+                             fuse_ino_t newparent, const char* newname) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
   int ret = -ENOENT;
 
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    NSArray *contents = 
-    [fs contentsOfDirectoryAtPath:[NSString stringWithUTF8String:path] 
-                            error:&error];
-    if (contents) {
-      ret = 0;
-      filler(buf, ".", NULL, 0);
-      filler(buf, "..", NULL, 0);
-      for (int i = 0, count = [contents count]; i < count; i++) {
-        filler(buf, [[contents objectAtIndex:i] UTF8String], NULL, 0);
+    GMInodeTable* inodeTable = [fs inodeTable];
+    NSString* itemName = [NSString stringWithUTF8String:name];
+    NSString* newItemName = [NSString stringWithUTF8String:newname];
+    NSString* source = [inodeTable pathForName:itemName parentNodeID:parent];
+    NSString* destination = [inodeTable pathForName:newItemName
+                                       parentNodeID:newparent];
+    if (source && destination) {
+      ret = -EACCES;
+      NSError* error = nil;
+      if ([fs moveItemAtPath:source toPath:destination error:&error]) {
+        [fs invalidateCachesForPath:source recursive:YES];
+        [fs invalidateCachesForParentOfPath:source];
+        [fs updateDirectoryContentsCacheForItemAtPath:source exists:NO];
+        [fs invalidateCachesForPath:destination recursive:YES];
+        [fs invalidateCachesForParentOfPath:destination];
+        [fs updateDirectoryContentsCacheForItemAtPath:destination exists:YES];
+        [inodeTable moveName:itemName
+                parentNodeID:parent
+                      toName:newItemName
+                parentNodeID:newparent];
+        fuse_reply_err(req, 0);
+        ret = 0;
+      } else {
+        MAYBE_USE_ERROR(ret, error);
       }
-    } else {
-      MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_open(const char *path, struct fuse_file_info* fi) {
+static void fusefm_ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
+                           const char* newname) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -ENOENT;  // TODO: Default to 0 (success) since a file-system does
-                      // not necessarily need to implement open?
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
 
   @try {
-    id userData = nil;
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs openFileAtPath:[NSString stringWithUTF8String:path]
-                      mode:fi->flags
-                  userData:&userData
-                     error:&error]) {
-      ret = 0;
-      if (userData != nil) {
-        [userData retain];
-        fi->fh = (uintptr_t)userData;
+    NSString* itemName = [NSString stringWithUTF8String:newname];
+    NSString* sourcePath = [[fs inodeTable] pathForNodeID:ino];
+    NSString* linkPath = [[fs inodeTable] pathForName:itemName
+                                         parentNodeID:newparent];
+    if (sourcePath && linkPath) {
+      ret = -EACCES;
+      NSError* error = nil;
+      if ([fs linkItemAtPath:sourcePath toPath:linkPath error:&error]) {
+        [fs invalidateCachesForPath:sourcePath recursive:NO];  // Link count
+        [fs invalidateCachesForPath:linkPath recursive:NO];
+        [fs invalidateCachesForParentOfPath:linkPath];
+        [fs updateDirectoryContentsCacheForItemAtPath:linkPath exists:YES];
+        struct fuse_entry_param e;
+        if ([fs fillEntry:&e forName:itemName parentNodeID:newparent error:&error]) {
+          fusefm_ll_reply_entry(req, fs, &e);
+          ret = 0;
+        } else {
+          MAYBE_USE_ERROR(ret, error);
+        }
+      } else {
+        MAYBE_USE_ERROR(ret, error);
       }
-    } else {
-      MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_release(const char *path, struct fuse_file_info* fi) {
+static void fusefm_ll_symlink(fuse_req_t req, const char* link, fuse_ino_t parent,
+                              const char* name) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    id userData = (id)(uintptr_t)fi->fh;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    [fs releaseFileAtPath:[NSString stringWithUTF8String:path] userData:userData];
-    if (userData) {
-      [userData release]; 
+    NSString* itemName = [NSString stringWithUTF8String:name];
+    NSString* linkPath = [[fs inodeTable] pathForName:itemName
+                                         parentNodeID:parent];
+    if (linkPath) {
+      ret = -EACCES;
+      NSError* error = nil;
+      if ([fs createSymbolicLinkAtPath:linkPath
+                   withDestinationPath:[NSString stringWithUTF8String:link]
+                                 error:&error]) {
+        [fs invalidateCachesForPath:linkPath recursive:NO];
+        [fs invalidateCachesForParentOfPath:linkPath];
+        [fs updateDirectoryContentsCacheForItemAtPath:linkPath exists:YES];
+        struct fuse_entry_param e;
+        if ([fs fillEntry:&e forName:itemName parentNodeID:parent error:&error]) {
+          fusefm_ll_reply_entry(req, fs, &e);
+          ret = 0;
+        } else {
+          MAYBE_USE_ERROR(ret, error);
+        }
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return 0;
 }
 
-static int fusefm_read(const char *path, char *buf, size_t size, off_t offset,
-                       struct fuse_file_info* fi) {
+static void fusefm_ll_opendir(fuse_req_t req, fuse_ino_t ino,
+                              struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -EIO;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
 
   @try {
+    // Unless the delegate enumerates the directory in batches, the listing is
+    // encoded once and then served to readdir in pieces.
+    id handle = nil;
+    NSMutableData* buffer = nil;
     NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    ret = [fs readFileAtPath:[NSString stringWithUTF8String:path]
-                    userData:(id)(uintptr_t)fi->fh
-                      buffer:buf
-                        size:size
-                      offset:offset
-                       error:&error];
-    MAYBE_USE_ERROR(ret, error);
+    NSString* directoryPath = [[fs inodeTable] pathForNodeID:ino];
+    if (directoryPath && [fs supportsDirectoryCursors]) {
+      id userData = nil;
+      if ([fs openDirectoryAtPath:directoryPath userData:&userData error:&error]) {
+        handle = [[GMDirectoryEnumerator alloc] initWithFileSystem:fs
+                                                              path:directoryPath
+                                                          userData:userData];
+      }
+    } else if (directoryPath && [fs supportsContentsAndAttributesOfDirectoryAtPath]) {
+      NSDictionary* contents =
+        [fs contentsAndAttributesOfDirectoryAtPath:directoryPath error:&error];
+      if (contents) {
+        buffer = [[NSMutableData alloc] init];
+        fusefm_ll_add_direntry(req, buffer, ".", ino, S_IFDIR);
+        fusefm_ll_add_direntry(req, buffer, "..", kLowLevelUnknownInode, S_IFDIR);
+        NSArray* names = [contents allKeys];
+        for (int i = 0, count = [names count]; i < count; i++) {
+          NSString* name = [names objectAtIndex:i];
+          NSString* itemPath = [directoryPath stringByAppendingPathComponent:name];
+          NSError* itemError = nil;
+          struct stat stbuf;
+          memset(&stbuf, 0, sizeof(struct stat));
+          if (![fs fillStatBuffer:&stbuf
+          forDirectoryEntryAtPath:itemPath
+               withItemAttributes:[contents objectForKey:name]
+                            error:&itemError]) {
+            memset(&stbuf, 0, sizeof(struct stat));
+          }
+          fusefm_ll_add_direntry(req, buffer, [name UTF8String],
+                                 (stbuf.st_ino ? stbuf.st_ino : kLowLevelUnknownInode),
+                                 stbuf.st_mode);
+        }
+      }
+    } else {
+      NSArray* contents = [fs contentsOfDirectoryWithNodeID:ino error:&error];
+      if (contents) {
+        if (directoryPath) {
+          [fs prefetchAttributesOfItemsNamed:contents inDirectoryAtPath:directoryPath];
+        }
+        buffer = [[NSMutableData alloc] init];
+        fusefm_ll_add_direntry(req, buffer, ".", ino, S_IFDIR);
+        fusefm_ll_add_direntry(req, buffer, "..", kLowLevelUnknownInode, S_IFDIR);
+        for (int i = 0, count = [contents count]; i < count; i++) {
+          fusefm_ll_add_direntry(req, buffer, [[contents objectAtIndex:i] UTF8String],
+                                 kLowLevelUnknownInode, 0);
+        }
+      }
+    }
+    if (buffer) {
+      handle = buffer;
+    }
+    if (handle) {
+      fi->fh = (uintptr_t)handle;
+      if (fuse_reply_open(req, fi) == -ENOENT) {
+        if ([handle isKindOfClass:[GMDirectoryEnumerator class]]) {
+          [fs releaseDirectoryAtPath:[handle path] userData:[handle userData]];
+        }
+        [handle release];
+      }
+      ret = 0;
+    } else {
+      MAYBE_USE_ERROR(ret, error);
+    }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_write(const char* path, const char* buf, size_t size, 
-                        off_t offset, struct fuse_file_info* fi) {
+static void fusefm_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+                              off_t off, struct fuse_file_info* fi) {
+  id handle = (id)(uintptr_t)fi->fh;
+  if (![handle isKindOfClass:[GMDirectoryEnumerator class]]) {
+    NSData* buffer = handle;
+    size_t length = [buffer length];
+    if (off >= 0 && (size_t)off < length) {
+      fuse_reply_buf(req, (const char *)[buffer bytes] + off,
+                     MIN(length - (size_t)off, size));
+    } else {
+      fuse_reply_buf(req, NULL, 0);
+    }
+    return;
+  }
+
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  fusefm_ll_begin(req);
   int ret = -EIO;
-  
+  char* buf = NULL;
+
   @try {
     NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    ret = [fs writeFileAtPath:[NSString stringWithUTF8String:path]
-                     userData:(id)(uintptr_t)fi->fh
-                       buffer:buf
-                         size:size
-                       offset:offset
-                        error:&error];
-    MAYBE_USE_ERROR(ret, error);
+    GMDirectoryEnumerator* enumerator = handle;
+    buf = malloc(size);
+    if (buf) {
+      size_t used = 0;
+      if ([enumerator seekToOffset:off error:&error]) {
+        struct stat stbuf;
+        memset(&stbuf, 0, sizeof(struct stat));
+        stbuf.st_ino = kLowLevelUnknownInode;
+        NSString* name = nil;
+        while ((name = [enumerator currentNameWithError:&error])) {
+          size_t entrySize = fuse_add_direntry(req, buf + used, size - used,
+                                               [name UTF8String], &stbuf,
+                                               [enumerator position] + 1);
+          if (entrySize > size - used) {
+            break;  // Buffer is full.
+          }
+          used += entrySize;
+          [enumerator advance];
+        }
+      }
+      if (error && used == 0) {
+        MAYBE_USE_ERROR(ret, error);
+      } else {
+        fuse_reply_buf(req, buf, used);
+        ret = 0;
+      }
+    } else {
+      ret = -ENOMEM;
+    }
   }
   @catch (id exception) { }
+  free(buf);
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_fsync(const char* path, int isdatasync,
-                        struct fuse_file_info* fi) {
-  // TODO: Support fsync?
-  return 0;
+static void fusefm_ll_releasedir(fuse_req_t req, fuse_ino_t ino,
+                                 struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  @try {
+    id handle = (id)(uintptr_t)fi->fh;
+    if ([handle isKindOfClass:[GMDirectoryEnumerator class]]) {
+      [fs releaseDirectoryAtPath:[handle path] userData:[handle userData]];
+    }
+    [handle release];
+  }
+  @catch (id exception) { }
+  fusefm_ll_end(req, 0);
+  fuse_reply_err(req, 0);
+  [pool release];
 }
 
-static int fusefm_fallocate(const char* path, int mode, off_t offset, off_t length,
-                            struct fuse_file_info* fi) {
+static void fusefm_ll_open(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -ENOSYS;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs allocateFileAtPath:[NSString stringWithUTF8String:path]
-                      userData:(fi ? (id)(uintptr_t)fi->fh : nil)
-                       options:mode
-                        offset:offset
-                        length:length
-                         error:&error]) {
-      ret = 0;
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* filePath = [[fs inodeTable] pathForNodeID:ino];
+    if (filePath) {
+      id userData = nil;
+      NSError* error = nil;
+      if ([fs openFileAtPath:filePath
+                        mode:fi->flags
+                    userData:&userData
+                       error:&error]) {
+        GMFileHandle* handle = [fs newFileHandleForFileAtPath:filePath
+                                                        mode:fi->flags
+                                                    userData:userData];
+        fi->fh = (uintptr_t)handle;
+        if (fuse_reply_open(req, fi) == -ENOENT) {
+          // The request has been interrupted, so nobody will release the file.
+          [fs releaseFileHandle:handle atPath:filePath];
+        }
+        ret = 0;
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_exchange(const char* p1, const char* p2, unsigned long opts) {
+static void fusefm_ll_release(fuse_req_t req, fuse_ino_t ino,
+                              struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -ENOSYS;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs exchangeDataOfItemAtPath:[NSString stringWithUTF8String:p1]
-                      withItemAtPath:[NSString stringWithUTF8String:p2]
-                               error:&error]) {
-      ret = 0;
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    GMFileHandle* handle = fusefm_file_handle(fi);
+    if (handle) {
+      // The file is released even if its node is no longer known, by the path
+      // it was last accessed by.
+      [fs releaseFileHandle:handle atPath:[[fs inodeTable] pathForNodeID:ino]];
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, 0);
+  fuse_reply_err(req, 0);
   [pool release];
-  return ret;  
 }
 
-static int fusefm_statfs_x(const char* path, struct statfs* stbuf) {
+static void fusefm_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+                           off_t off, struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
   int ret = -ENOENT;
+  char* buf = NULL;
+
   @try {
-    memset(stbuf, 0, sizeof(struct statfs));
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs fillStatfsBuffer:stbuf
-                     forPath:[NSString stringWithUTF8String:path]
-                       error:&error]) {
-      ret = 0;
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* filePath = [[fs inodeTable] pathForNodeID:ino];
+    if (filePath) {
+      ret = -EIO;
+      NSError* error = nil;
+      GMFileHandle* handle = fusefm_file_handle(fi);
+      id userData = [handle userData];
+      int fd = [fs fileDescriptorForFileAtPath:filePath userData:userData];
+      if (fd >= 0) {
+        // FUSE replies with an error itself if reading from fd fails.
+        struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(size);
+        bufv.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        bufv.buf[0].fd = fd;
+        bufv.buf[0].pos = off;
+        fuse_reply_data(req, &bufv, FUSE_BUF_SPLICE_MOVE);
+        ret = 0;
+      } else if (![handle readahead] && ![handle writeBack] &&
+                 ![handle contentVersion] &&
+                 [fs supportsReadingDataFromFileWithHandle:handle]) {
+        // The bytes are sent straight from the data object.
+        NSData* data = [fs readDataFromFileAtPath:filePath
+                                           handle:handle
+                                             size:size
+                                           offset:off
+                                            error:&error];
+        if (data) {
+          fuse_reply_buf(req, [data bytes], MIN(size, [data length]));
+          ret = 0;
+        } else {
+          MAYBE_USE_ERROR(ret, error);
+        }
+      } else if ((buf = malloc(size))) {
+        int bytesRead = [fs readFileAtPath:filePath
+                                    handle:handle
+                                    buffer:buf
+                                      size:size
+                                    offset:off
+                                     error:&error];
+        if (bytesRead >= 0) {
+          fuse_reply_buf(req, buf, bytesRead);
+          ret = 0;
+        } else {
+          ret = bytesRead;
+          MAYBE_USE_ERROR(ret, error);
+        }
+      } else {
+        ret = -ENOMEM;
+      }
     }
   }
   @catch (id exception) { }
+  free(buf);
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_setvolname(const char* name) {
+static void fusefm_ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf,
+                            size_t size, off_t off, struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -ENOSYS;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    NSError* error = nil;
-    NSDictionary* attribs = 
-      [NSDictionary dictionaryWithObject:[NSString stringWithUTF8String:name]
-                                  forKey:kGMUserFileSystemVolumeNameKey];
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs setAttributes:attribs ofFileSystemAtPath:@"/" error:&error]) {
-      ret = 0;
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* filePath = [[fs inodeTable] pathForNodeID:ino];
+    if (filePath) {
+      ret = -EIO;
+      NSError* error = nil;
+      int bytesWritten = [fs writeFileAtPath:filePath
+                                      handle:fusefm_file_handle(fi)
+                                      buffer:buf
+                                        size:size
+                                      offset:off
+                                       error:&error];
+      if (bytesWritten >= 0) {
+        if (bytesWritten > 0) {
+          [fs invalidateCachesForWriteToFileAtPath:filePath
+                                            handle:fusefm_file_handle(fi)];
+        }
+        fuse_reply_write(req, bytesWritten);
+        ret = 0;
+      } else {
+        ret = bytesWritten;
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_fgetattr(const char *path, struct stat *stbuf, 
-                           struct fuse_file_info* fi) {
+static void fusefm_ll_write_buf(fuse_req_t req, fuse_ino_t ino,
+                                struct fuse_bufvec* bufv, off_t off,
+                                struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
   int ret = -ENOENT;
+
   @try {
-    memset(stbuf, 0, sizeof(struct stat));
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    id userData = fi ? (id)(uintptr_t)fi->fh : nil;
-    if ([fs fillStatBuffer:stbuf 
-                   forPath:[NSString stringWithUTF8String:path]
-                  userData:userData
-                     error:&error]) {
-      ret = 0;
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* filePath = [[fs inodeTable] pathForNodeID:ino];
+    if (filePath) {
+      ret = -EIO;
+      NSError* error = nil;
+      int bytesWritten = [fs writeFileAtPath:filePath
+                                      handle:fusefm_file_handle(fi)
+                                bufferVector:bufv
+                                      offset:off
+                                       error:&error];
+      if (bytesWritten >= 0) {
+        if (bytesWritten > 0) {
+          [fs invalidateCachesForWriteToFileAtPath:filePath
+                                            handle:fusefm_file_handle(fi)];
+        }
+        fuse_reply_write(req, bytesWritten);
+        ret = 0;
+      } else {
+        ret = bytesWritten;
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
-}
-
-static int fusefm_getattr(const char *path, struct stat *stbuf) {
-  return fusefm_fgetattr(path, stbuf, nil);
 }
 
-static int fusefm_getxtimes(const char* path, struct timespec* bkuptime, 
-                            struct timespec* crtime) {  
+static void fusefm_ll_flush(fuse_req_t req, fuse_ino_t ino,
+                            struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
   int ret = -ENOENT;
 
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    NSDictionary* attribs = 
-      [fs extendedTimesOfItemAtPath:[NSString stringWithUTF8String:path]
-                           userData:nil  // TODO: Maybe this should support FH?
-                              error:&error];
-    if (attribs) {
-      ret = 0;
-      NSDate* creationDate = [attribs objectForKey:NSFileCreationDate];
-      if (creationDate) {
-        const double seconds_dp = [creationDate timeIntervalSince1970];
-        const time_t t_sec = (time_t) seconds_dp;
-        const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
-        const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
-        crtime->tv_sec = t_sec;
-        crtime->tv_nsec = t_nsec;          
-      } else {
-        memset(crtime, 0, sizeof(struct timespec));
-      }
-      NSDate* backupDate = [attribs objectForKey:kGMUserFileSystemFileBackupDateKey];
-      if (backupDate) {
-        const double seconds_dp = [backupDate timeIntervalSince1970];
-        const time_t t_sec = (time_t) seconds_dp;
-        const double nanoseconds_dp = ((seconds_dp - t_sec) * kNanoSecondsPerSecond); 
-        const long t_nsec = (nanoseconds_dp > 0 ) ? nanoseconds_dp : 0;
-        bkuptime->tv_sec = t_sec;
-        bkuptime->tv_nsec = t_nsec;
+    NSString* filePath = [[fs inodeTable] pathForNodeID:ino];
+    if (filePath) {
+      ret = -EIO;
+      NSError* error = nil;
+      if ([fs flushFileAtPath:filePath
+                       handle:fusefm_file_handle(fi)
+                        error:&error]) {
+        fuse_reply_err(req, 0);
+        ret = 0;
       } else {
-        memset(bkuptime, 0, sizeof(struct timespec));
+        MAYBE_USE_ERROR(ret, error);
       }
-    } else {
-      MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static NSDate* dateWithTimespec(const struct timespec* spec) {
-  const NSTimeInterval time_ns = spec->tv_nsec;
-  const NSTimeInterval time_sec = spec->tv_sec + (time_ns / kNanoSecondsPerSecond);
-  return [NSDate dateWithTimeIntervalSince1970:time_sec];
-}
+static void fusefm_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                            struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
 
-static NSDictionary* dictionaryWithAttributes(const struct setattr_x* attrs) {
-  NSMutableDictionary* dict = [NSMutableDictionary dictionary];
-  if (SETATTR_WANTS_MODE(attrs)) {
-    unsigned long perm = attrs->mode & ALLPERMS;
-    [dict setObject:[NSNumber numberWithLong:perm] 
-             forKey:NSFilePosixPermissions];    
-  }
-  if (SETATTR_WANTS_UID(attrs)) {
-    [dict setObject:[NSNumber numberWithLong:attrs->uid] 
-             forKey:NSFileOwnerAccountID];
-  }
-  if (SETATTR_WANTS_GID(attrs)) {
-    [dict setObject:[NSNumber numberWithLong:attrs->gid] 
-             forKey:NSFileGroupOwnerAccountID];
-  }
-  if (SETATTR_WANTS_SIZE(attrs)) {
-    [dict setObject:[NSNumber numberWithLongLong:attrs->size]
-             forKey:NSFileSize];
-  }
-  if (SETATTR_WANTS_ACCTIME(attrs)) {
-    [dict setObject:dateWithTimespec(&(attrs->acctime))
-             forKey:kGMUserFileSystemFileAccessDateKey];
-  }
-  if (SETATTR_WANTS_MODTIME(attrs)) {
-    [dict setObject:dateWithTimespec(&(attrs->modtime))
-             forKey:NSFileModificationDate];
-  }
-  if (SETATTR_WANTS_CRTIME(attrs)) {
-    [dict setObject:dateWithTimespec(&(attrs->crtime))
-             forKey:NSFileCreationDate];
-  }
-  if (SETATTR_WANTS_CHGTIME(attrs)) {
-    [dict setObject:dateWithTimespec(&(attrs->chgtime))
-             forKey:kGMUserFileSystemFileChangeDateKey];
-  }
-  if (SETATTR_WANTS_BKUPTIME(attrs)) {
-    [dict setObject:dateWithTimespec(&(attrs->bkuptime))
-             forKey:kGMUserFileSystemFileBackupDateKey];
-  }
-  if (SETATTR_WANTS_FLAGS(attrs)) {
-    [dict setObject:[NSNumber numberWithLong:attrs->flags]
-             forKey:kGMUserFileSystemFileFlagsKey];
+  @try {
+    NSString* filePath = [[fs inodeTable] pathForNodeID:ino];
+    if (filePath) {
+      ret = -EIO;
+      NSError* error = nil;
+      if ([fs synchronizeFileAtPath:filePath
+                             handle:fusefm_file_handle(fi)
+                           dataOnly:(datasync != 0)
+                              error:&error]) {
+        fuse_reply_err(req, 0);
+        ret = 0;
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
+    }
   }
-  return dict;
+  @catch (id exception) { }
+  fusefm_ll_end(req, ret);
+  [pool release];
 }
 
-static int fusefm_fsetattr_x(const char* path, struct setattr_x* attrs,
-                             struct fuse_file_info* fi) {
+static void fusefm_ll_statfs(fuse_req_t req, fuse_ino_t ino) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = 0;  // Note: Return success by default.
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
 
   @try {
+    struct statfs stbuf;
+    memset(&stbuf, 0, sizeof(struct statfs));
     NSError* error = nil;
-    NSDictionary* attribs = dictionaryWithAttributes(attrs);
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs setAttributes:attribs 
-             ofItemAtPath:[NSString stringWithUTF8String:path]
-                 userData:(fi ? (id)(uintptr_t)fi->fh : nil)
-                    error:&error]) {
+    if ([fs fillStatfsBuffer:&stbuf forPath:@"/" error:&error]) {
+      struct statvfs stvfsbuf;
+      memset(&stvfsbuf, 0, sizeof(struct statvfs));
+      stvfsbuf.f_bsize = stbuf.f_bsize;
+      stvfsbuf.f_frsize = stbuf.f_bsize;
+      stvfsbuf.f_blocks = (fsblkcnt_t)stbuf.f_blocks;
+      stvfsbuf.f_bfree = (fsblkcnt_t)stbuf.f_bfree;
+      stvfsbuf.f_bavail = (fsblkcnt_t)stbuf.f_bavail;
+      stvfsbuf.f_files = (fsfilcnt_t)stbuf.f_files;
+      stvfsbuf.f_ffree = (fsfilcnt_t)stbuf.f_ffree;
+      stvfsbuf.f_favail = (fsfilcnt_t)stbuf.f_ffree;
+      stvfsbuf.f_namemax = NAME_MAX;
+      fuse_reply_statfs(req, &stvfsbuf);
       ret = 0;
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
-}
-
-static int fusefm_setattr_x(const char* path, struct setattr_x* attrs) {
-  return fusefm_fsetattr_x(path, attrs, nil);
 }
 
-static int fusefm_listxattr(const char *path, char *list, size_t size)
-{
+static void fusefm_ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -ENOTSUP;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    NSArray* attributeNames =
-      [fs extendedAttributesOfItemAtPath:[NSString stringWithUTF8String:path]
-                                   error:&error];
-    if (attributeNames != nil) {
-      char zero = 0;
-      NSMutableData* data = [NSMutableData dataWithCapacity:size];  
-      for (int i = 0, count = [attributeNames count]; i < count; i++) {
-        [data appendData:[[attributeNames objectAtIndex:i] dataUsingEncoding:NSUTF8StringEncoding]];
-        [data appendBytes:&zero length:1];
-      }
-      ret = [data length];  // default to returning size of buffer.
-      if (list) {
-        if (size > [data length]) {
-          size = [data length];
+    NSString* itemPath = [[fs inodeTable] pathForNodeID:ino];
+    if (itemPath) {
+      ret = -ENOTSUP;
+      NSError* error = nil;
+      NSArray* attributeNames =
+        [fs extendedAttributesOfItemAtPath:itemPath
+                                     error:&error];
+      if (attributeNames != nil) {
+        NSData* data = fusefm_xattr_list(attributeNames);
+        if (size == 0) {
+          fuse_reply_xattr(req, [data length]);
+          ret = 0;
+        } else if ([data length] <= size) {
+          fuse_reply_buf(req, [data bytes], [data length]);
+          ret = 0;
+        } else {
+          ret = -ERANGE;
         }
-        [data getBytes:list length:size];
+      } else {
+        MAYBE_USE_ERROR(ret, error);
       }
-    } else {
-      MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_getxattr(const char *path, const char *name, char *value,
-                           size_t size, uint32_t position) {
+static void fusefm_ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char* name,
+                               size_t size, uint32_t position) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -ENOATTR;
-  
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    NSData *data = [fs valueOfExtendedAttribute:[NSString stringWithUTF8String:name]
-                                   ofItemAtPath:[NSString stringWithUTF8String:path]
-                                       position:position
-                                          error:&error];
-    if (data != nil) {
-      ret = [data length];  // default to returning size of buffer.
-      if (value) {
-        if (size > [data length]) {
-          size = [data length];
+    NSString* itemPath = [[fs inodeTable] pathForNodeID:ino];
+    if (itemPath) {
+      ret = -ENOATTR;
+      NSError* error = nil;
+      size_t length = 0;
+      NSData* data = [fs valueOfExtendedAttribute:[NSString stringWithUTF8String:name]
+                                     ofItemAtPath:itemPath
+                                         position:position
+                                             size:size
+                                           length:&length
+                                            error:&error];
+      if (data != nil) {
+        if (size == 0) {
+          fuse_reply_xattr(req, length);
+          ret = 0;
+        } else if (length <= size) {
+          fuse_reply_buf(req, [data bytes], length);
+          ret = 0;
+        } else {
+          ret = -ERANGE;
         }
-        [data getBytes:value length:size];
-        ret = size;  // bytes read
+      } else {
+        MAYBE_USE_ERROR(ret, error);
       }
-    } else {
-      MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_setxattr(const char *path, const char *name, const char *value,
-                           size_t size, int flags, uint32_t position) {
+static void fusefm_ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char* name,
+                               const char* value, size_t size, int flags,
+                               uint32_t position) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -EPERM;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs setExtendedAttribute:[NSString stringWithUTF8String:name]
-                    ofItemAtPath:[NSString stringWithUTF8String:path]
-                           value:[NSData dataWithBytes:value length:size]
-                        position:position
-                         options:flags
-                           error:&error]) {
-      ret = 0;
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* itemPath = [[fs inodeTable] pathForNodeID:ino];
+    if (itemPath) {
+      ret = -EPERM;
+      NSError* error = nil;
+      if ([fs setExtendedAttribute:[NSString stringWithUTF8String:name]
+                      ofItemAtPath:itemPath
+                             value:[NSData dataWithBytes:value length:size]
+                          position:position
+                           options:flags
+                             error:&error]) {
+        fuse_reply_err(req, 0);
+        ret = 0;
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
-static int fusefm_removexattr(const char *path, const char *name) {
+static void fusefm_ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char* name) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-  int ret = -ENOATTR;
+  GMUserFileSystem* fs = fusefm_ll_begin(req);
+  int ret = -ENOENT;
+
   @try {
-    NSError* error = nil;
-    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs removeExtendedAttribute:[NSString stringWithUTF8String:name]
-                    ofItemAtPath:[NSString stringWithUTF8String:path]
-                           error:&error]) {
-      ret = 0;
-    } else {
-      MAYBE_USE_ERROR(ret, error);
+    NSString* itemPath = [[fs inodeTable] pathForNodeID:ino];
+    if (itemPath) {
+      ret = -ENOATTR;
+      NSError* error = nil;
+      if ([fs removeExtendedAttribute:[NSString stringWithUTF8String:name]
+                         ofItemAtPath:itemPath
+                                error:&error]) {
+        fuse_reply_err(req, 0);
+        ret = 0;
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
     }
   }
   @catch (id exception) { }
+  fusefm_ll_end(req, ret);
   [pool release];
-  return ret;
 }
 
 #undef MAYBE_USE_ERROR
 
-static struct fuse_operations fusefm_oper = {
-  .init = fusefm_init,
+static struct fuse_lowlevel_ops fusefm_ll_oper = {
+  .init = fusefm_ll_init,
   .destroy = fusefm_destroy,
-  
+
+  // Looking up an Item
+  .lookup = fusefm_ll_lookup,
+  .forget = fusefm_ll_forget,
+
   // Creating an Item
-  .mkdir = fusefm_mkdir,
-  .create = fusefm_create,
-  
+  .mkdir = fusefm_ll_mkdir,
+  .create = fusefm_ll_create,
+
   // Removing an Item
-  .rmdir = fusefm_rmdir,
-  .unlink = fusefm_unlink,
-  
+  .rmdir = fusefm_ll_rmdir,
+  .unlink = fusefm_ll_unlink,
+
   // Moving an Item
-  .rename = fusefm_rename,
-  
+  .rename = fusefm_ll_rename,
+
   // Linking an Item
-  .link = fusefm_link,
-  
+  .link = fusefm_ll_link,
+
   // Symbolic Links
-  .symlink = fusefm_symlink,
-  .readlink = fusefm_readlink,
-  
+  .symlink = fusefm_ll_symlink,
+  .readlink = fusefm_ll_readlink,
+
   // Directory Contents
-  .readdir = fusefm_readdir,
-  
+  .opendir = fusefm_ll_opendir,
+  .readdir = fusefm_ll_readdir,
+  .releasedir = fusefm_ll_releasedir,
+
   // File Contents
-  .open	= fusefm_open,
-  .release = fusefm_release,
-  .read	= fusefm_read,
-  .write = fusefm_write,
-  .fsync = fusefm_fsync,
-  .fallocate = fusefm_fallocate,
-  .exchange = fusefm_exchange,
-  
+  .open = fusefm_ll_open,
+  .release = fusefm_ll_release,
+  .read = fusefm_ll_read,
+  .write = fusefm_ll_write,
+  .write_buf = fusefm_ll_write_buf,
+  .flush = fusefm_ll_flush,
+  .fsync = fusefm_ll_fsync,
+
   // Getting and Setting Attributes
-  .statfs_x = fusefm_statfs_x,
-  .setvolname = fusefm_setvolname,
-  .getattr = fusefm_getattr,
-  .fgetattr = fusefm_fgetattr,
-  .getxtimes = fusefm_getxtimes,
-  .setattr_x = fusefm_setattr_x,
-  .fsetattr_x = fusefm_fsetattr_x,
-  
+  .statfs = fusefm_ll_statfs,
+  .getattr = fusefm_ll_getattr,
+  .setattr = fusefm_ll_setattr,
+
   // Extended Attributes
-  .listxattr = fusefm_listxattr,
-  .getxattr = fusefm_getxattr,
-  .setxattr = fusefm_setxattr,
-  .removexattr = fusefm_removexattr,
+  .listxattr = fusefm_ll_listxattr,
+  .getxattr = fusefm_ll_getxattr,
+  .setxattr = fusefm_ll_setxattr,
+  .removexattr = fusefm_ll_removexattr,
 };
 
 #pragma mark Internal Mount
 
+// The low-level counterpart of fuse_main().
+- (int)lowLevelMainWithArgc:(int)argc argv:(char **)argv {
+  struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+  char* mountpoint = NULL;
+  int multithreaded = 0;
+  int foreground = 0;
+  int ret = 1;
+
+  if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) != -1) {
+    struct fuse_chan* chan = fuse_mount(mountpoint, &args);
+    if (chan) {
+      struct fuse_session* se = fuse_lowlevel_new(&args, &fusefm_ll_oper,
+                                                  sizeof(fusefm_ll_oper), self);
+      if (se) {
+        if (fuse_daemonize(foreground) != -1 &&
+            fuse_set_signal_handlers(se) != -1) {
+          [internal_ setChannel:chan];
+          fuse_session_add_chan(se, chan);
+          if (multithreaded) {
+            ret = fuse_session_loop_mt(se);
+          } else {
+            ret = fuse_session_loop(se);
+          }
+          fuse_remove_signal_handlers(se);
+          fuse_session_remove_chan(chan);
+          [internal_ setChannel:NULL];
+        }
+        fuse_session_destroy(se);
+      }
+      fuse_unmount(mountpoint, chan);
+    }
+    free(mountpoint);
+  }
+  fuse_opt_free_args(&args);
+  return ret;
+}
+
 - (void)postMountError:(NSError *)error {
   assert([internal_ status] == GMUserFileSystem_MOUNTING);
   [internal_ setStatus:GMUserFileSystem_FAILURE];
@@ -2390,6 +7506,9 @@ static struct fuse_operations fusefm_oper = {
       [arguments addObject:[NSString stringWithFormat:@"-o%@",option]];
     }
   }
+  if (![internal_ usesLowLevelInterface]) {
+    [arguments addObject:@"-ouse_ino"];  // Report the inode numbers we assign.
+  }
   [arguments addObject:[internal_ mountPath]];
   [args release];  // We don't need packaged up args any more.
 
@@ -2400,13 +7519,27 @@ static struct fuse_operations fusefm_oper = {
     NSString* argument = [arguments objectAtIndex:i];
     argv[i] = strdup([argument UTF8String]);  // We'll just leak this for now.
   }
-  if ([[internal_ delegate] respondsToSelector:@selector(willMount)]) {
+  if (GMDelegateImplements(internal_, kGMDelegateWillMount)) {
     [[internal_ delegate] willMount];
   }
+  // The high-level interface uses the inode table to intern paths and to
+  // number the items it reports attributes for.
+  BOOL usesLowLevelInterface = [internal_ usesLowLevelInterface];
+  GMInodeTable* inodeTable =
+    [[GMInodeTable alloc] initWithCountLimit:(usesLowLevelInterface ? 0 : kInodeTableCountLimit)];
+  [internal_ setInodeTable:inodeTable];
+  [inodeTable release];
   [pool release];
-  ret = fuse_main(argc, (char **)argv, &fusefm_oper, self);
+  if (usesLowLevelInterface) {
+    ret = [self lowLevelMainWithArgc:argc argv:(char **)argv];
+  } else {
+    struct fuse_operations oper = fusefm_oper;
+    fusefm_select_oper(internal_, &oper);
+    ret = fuse_main(argc, (char **)argv, &oper, self);
+  }
 
   pool = [[NSAutoreleasePool alloc] init];
+  [internal_ setInodeTable:nil];
 
   if ([internal_ status] == GMUserFileSystem_MOUNTING) {
     // If we returned from fuse_main while we still think we are 
@@ -0,0 +1,93 @@
+//
+//  GMWriteBack.h
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+
+#include <pthread.h>
+
+// Buffers the writes to an open file and passes them on in large extents.
+// Adjacent and overlapping writes are merged. The buffered extents are written
+// once they exceed the maximum size or the oldest of them exceeds the maximum
+// age, which is checked on every write, and whenever flushWithError: is called.
+//
+// Errors that occur while writing extents on behalf of a later write are kept
+// and reported by the next call to flushWithError:.
+//
+// The target must implement writeFromBuffer:size:offset:error:. It is not
+// retained.
+//
+// All methods are thread-safe.
+@interface GMWriteBack : NSObject {
+ @private
+  pthread_mutex_t mutex_;
+  id target_;                 // Not retained
+  NSUInteger maxSize_;
+  NSTimeInterval maxAge_;
+  NSMutableArray* extents_;   // Disjoint, not adjacent and ordered by offset.
+  NSUInteger size_;           // The number of bytes buffered.
+  NSTimeInterval dirtyTime_;  // When the oldest buffered extent was written.
+  NSError* error_;            // The first error not reported yet, or nil.
+}
+
+- (id)initWithTarget:(id)target
+             maxSize:(NSUInteger)maxSize
+              maxAge:(NSTimeInterval)maxAge;
+
+// Buffers the data, or writes it right away if it is larger than the maximum
+// size. Returns size or -1 on error.
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error;
+
+// Writes all buffered extents. Returns NO if writing failed now or since the
+// last call.
+- (BOOL)flushWithError:(NSError **)error;
+
+// Writes all buffered extents like flushWithError:, but keeps any error for
+// the next call to flushWithError:. Used when the writes have to reach the
+// target before something else happens, e.g. before the file size is read.
+- (void)writeBufferedExtents;
+
+// Returns YES if there are buffered extents or an error to report.
+- (BOOL)isDirty;
+
+// Returns the number of bytes buffered.
+- (NSUInteger)size;
+
+@end
@@ -0,0 +1,277 @@
+//
+//  GMWriteBack.m
+//  OSXFUSE
+//
+
+//  Copyright (c) 2017 Benjamin Fleischer.
+//  All rights reserved.
+
+//  OSXFUSE.framework is based on MacFUSE.framework. MacFUSE.framework is
+//  covered under the following BSD-style license:
+//
+//  Copyright (c) 2007 Google Inc.
+//  All rights reserved.
+//
+//  Redistribution  and  use  in  source  and  binary  forms,  with  or  without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the  above  copyright  notice,
+//     this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//  3. Neither the name of Google Inc. nor the names of its contributors may  be
+//     used to endorse or promote products derived from  this  software  without
+//     specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS  IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT  LIMITED  TO,  THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A  PARTICULAR  PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT  OWNER  OR  CONTRIBUTORS  BE
+//  LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,   OR
+//  CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT  OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,  OR  PROFITS;  OR  BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY  THEORY  OF  LIABILITY,  WHETHER  IN
+//  CONTRACT, STRICT LIABILITY, OR  TORT  (INCLUDING  NEGLIGENCE  OR  OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED  OF  THE
+//  POSSIBILITY OF SUCH DAMAGE.
+
+#import "GMWriteBack.h"
+
+#include <errno.h>
+
+static NSError* GMWriteBackError(int code) {
+  return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+}
+
+@interface GMWriteBackExtent : NSObject {
+ @public
+  off_t offset_;
+  NSMutableData* data_;  // Retained
+}
+@end
+
+@implementation GMWriteBackExtent
+
+- (void)dealloc {
+  [data_ release];
+  [super dealloc];
+}
+
+@end
+
+@implementation GMWriteBack
+
+- (id)initWithTarget:(id)target
+             maxSize:(NSUInteger)maxSize
+              maxAge:(NSTimeInterval)maxAge {
+  self = [super init];
+  if (self) {
+    pthread_mutex_init(&mutex_, NULL);
+    target_ = target;
+    maxSize_ = maxSize;
+    maxAge_ = maxAge;
+    extents_ = [[NSMutableArray alloc] init];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [extents_ release];
+  [error_ release];
+  pthread_mutex_destroy(&mutex_);
+  [super dealloc];
+}
+
+#pragma mark Internal (mutex_ must be held)
+
+- (void)keepError:(NSError *)error {
+  if (!error_) {
+    error_ = [error retain];
+  }
+}
+
+// Writes all of buffer, unless the target fails.
+- (BOOL)writeBuffer:(const char *)buffer
+               size:(size_t)size
+             offset:(off_t)offset
+              error:(NSError **)error {
+  size_t written = 0;
+  while (written < size) {
+    NSError* writeError = nil;
+    int ret = [target_ writeFromBuffer:buffer + written
+                                  size:size - written
+                                offset:offset + written
+                                 error:&writeError];
+    if (ret <= 0) {
+      *error = writeError ? writeError : GMWriteBackError(EIO);
+      return NO;
+    }
+    written += ret;
+  }
+  return YES;
+}
+
+- (BOOL)writeExtentsWithError:(NSError **)error {
+  BOOL ok = YES;
+  for (int i = 0, count = [extents_ count]; i < count; i++) {
+    GMWriteBackExtent* extent = [extents_ objectAtIndex:i];
+    NSError* writeError = nil;
+    if (![self writeBuffer:[extent->data_ bytes]
+                      size:[extent->data_ length]
+                    offset:extent->offset_
+                     error:&writeError] && ok) {
+      // Keep going; the other extents may still be written successfully.
+      *error = writeError;
+      ok = NO;
+    }
+  }
+  [extents_ removeAllObjects];
+  size_ = 0;
+  return ok;
+}
+
+- (void)addExtentWithBytes:(const char *)buffer
+                      size:(size_t)size
+                    offset:(off_t)offset {
+  off_t end = offset + size;
+  NSUInteger first = NSNotFound;
+  NSUInteger last = NSNotFound;
+  NSUInteger index = 0;
+  for (int count = [extents_ count]; index < count; index++) {
+    GMWriteBackExtent* extent = [extents_ objectAtIndex:index];
+    off_t extentEnd = extent->offset_ + [extent->data_ length];
+    if (extentEnd < offset) {
+      continue;
+    }
+    if (extent->offset_ > end) {
+      break;
+    }
+    if (first == NSNotFound) {
+      first = index;
+    }
+    last = index;
+  }
+
+  if ([extents_ count] == 0) {
+    dirtyTime_ = [NSDate timeIntervalSinceReferenceDate];
+  }
+
+  if (first == NSNotFound) {
+    GMWriteBackExtent* extent = [[GMWriteBackExtent alloc] init];
+    extent->offset_ = offset;
+    extent->data_ = [[NSMutableData alloc] initWithBytes:buffer length:size];
+    [extents_ insertObject:extent atIndex:index];
+    [extent release];
+    size_ += size;
+    return;
+  }
+
+  // Merge the new data and all extents it overlaps or touches into the first
+  // of them. Appending to an extent grows its data in place.
+  GMWriteBackExtent* base = [extents_ objectAtIndex:first];
+  GMWriteBackExtent* lastExtent = [extents_ objectAtIndex:last];
+  off_t start = MIN(offset, base->offset_);
+  off_t mergedEnd = MAX(end, lastExtent->offset_ + (off_t)[lastExtent->data_ length]);
+  NSUInteger mergedSize = 0;
+  for (NSUInteger i = first; i <= last; i++) {
+    GMWriteBackExtent* extent = [extents_ objectAtIndex:i];
+    mergedSize += [extent->data_ length];
+  }
+  if (base->offset_ != start) {
+    NSMutableData* data = [[NSMutableData alloc] initWithLength:mergedEnd - start];
+    [data replaceBytesInRange:NSMakeRange(base->offset_ - start, [base->data_ length])
+                    withBytes:[base->data_ bytes]];
+    [base->data_ release];
+    base->data_ = data;
+    base->offset_ = start;
+  } else {
+    [base->data_ setLength:mergedEnd - start];
+  }
+  for (NSUInteger i = first + 1; i <= last; i++) {
+    GMWriteBackExtent* extent = [extents_ objectAtIndex:i];
+    [base->data_ replaceBytesInRange:NSMakeRange(extent->offset_ - start,
+                                                 [extent->data_ length])
+                           withBytes:[extent->data_ bytes]];
+  }
+  [base->data_ replaceBytesInRange:NSMakeRange(offset - start, size)
+                         withBytes:buffer];
+  if (last > first) {
+    [extents_ removeObjectsInRange:NSMakeRange(first + 1, last - first)];
+  }
+  size_ = size_ - mergedSize + [base->data_ length];
+}
+
+#pragma mark Public
+
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(off_t)offset
+                 error:(NSError **)error {
+  int ret = (int)size;
+  pthread_mutex_lock(&mutex_);
+  if (size > maxSize_) {
+    // Too large to be worth buffering. Write what is buffered first, so the
+    // writes reach the target in order.
+    NSError* flushError = nil;
+    if (![self writeExtentsWithError:&flushError]) {
+      [self keepError:flushError];
+    }
+    if (![self writeBuffer:buffer size:size offset:offset error:error]) {
+      ret = -1;
+    }
+  } else {
+    [self addExtentWithBytes:buffer size:size offset:offset];
+    if (size_ >= maxSize_ ||
+        (maxAge_ > 0 &&
+         [NSDate timeIntervalSinceReferenceDate] - dirtyTime_ >= maxAge_)) {
+      NSError* flushError = nil;
+      if (![self writeExtentsWithError:&flushError]) {
+        [self keepError:flushError];
+      }
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return ret;
+}
+
+- (BOOL)flushWithError:(NSError **)error {
+  pthread_mutex_lock(&mutex_);
+  NSError* flushError = nil;
+  if (![self writeExtentsWithError:&flushError]) {
+    [self keepError:flushError];
+  }
+  BOOL ok = (error_ == nil);
+  if (!ok) {
+    *error = [[error_ retain] autorelease];
+    [error_ release];
+    error_ = nil;
+  }
+  pthread_mutex_unlock(&mutex_);
+  return ok;
+}
+
+- (void)writeBufferedExtents {
+  pthread_mutex_lock(&mutex_);
+  NSError* flushError = nil;
+  if (![self writeExtentsWithError:&flushError]) {
+    [self keepError:flushError];
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+- (BOOL)isDirty {
+  pthread_mutex_lock(&mutex_);
+  BOOL dirty = ([extents_ count] > 0 || error_ != nil);
+  pthread_mutex_unlock(&mutex_);
+  return dirty;
+}
+
+- (NSUInteger)size {
+  pthread_mutex_lock(&mutex_);
+  NSUInteger size = size_;
+  pthread_mutex_unlock(&mutex_);
+  return size;
+}
+
+@end
@@ -37,6 +37,7 @@
 //  POSSIBILITY OF SUCH DAMAGE.
 
 #import <OSXFUSE/GMAvailability.h>
+#import <OSXFUSE/GMDataBackedFileDelegate.h>
 #import <OSXFUSE/GMFinderInfo.h>
 #import <OSXFUSE/GMUserFileSystem.h>
 #import <OSXFUSE/GMResourceFork.h>